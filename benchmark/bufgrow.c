@@ -0,0 +1,132 @@
+/*
+ * Counts the reallocations made by each buffer growth policy while
+ * rendering multi-megabyte documents and running SmartyPants over the
+ * resulting HTML, using a counting allocator.
+ *
+ *   cc -O2 -Isrc -o bufgrow benchmark/bufgrow.c src/[a-z]*.c
+ *   ./bufgrow benchmark/tests/[a-z]*.text
+ *
+ * The given files are concatenated and repeated to build each document.
+ * Fresh allocations are not counted, only the growth of existing buffers.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "markdown.h"
+#include "html.h"
+
+static size_t reallocs;
+
+static void *
+count_malloc(size_t size, void *opaque)
+{
+	return malloc(size);
+}
+
+static void *
+count_realloc(void *ptr, size_t size, void *opaque)
+{
+	if (ptr)
+		reallocs++;
+	return realloc(ptr, size);
+}
+
+static void
+count_free(void *ptr, void *opaque)
+{
+	free(ptr);
+}
+
+static const struct buf_allocator counter = {
+	count_malloc, count_realloc, count_free, NULL
+};
+
+static void
+slurp(struct buf *ob, const char *path)
+{
+	char chunk[4096];
+	size_t n;
+	FILE *in = fopen(path, "rb");
+
+	if (!in) {
+		perror(path);
+		exit(1);
+	}
+
+	while ((n = fread(chunk, 1, sizeof chunk, in)) > 0)
+		bufput(ob, chunk, n);
+
+	fclose(in);
+}
+
+static void
+bench(const char *name, bufgrowth_t policy, const struct buf *doc)
+{
+	struct sd_callbacks callbacks;
+	struct html_renderopt options;
+	struct sd_markdown *markdown;
+	struct buf *ob, *smart;
+	size_t render_reallocs;
+	clock_t start;
+
+	bufsetgrowth(policy);
+	reallocs = 0;
+	start = clock();
+
+	ob = bufnew(64);
+	sdhtml_renderer(&callbacks, &options, 0);
+	markdown = sd_markdown_new(MKDEXT_TABLES | MKDEXT_FENCED_CODE | MKDEXT_AUTOLINK, 16, &callbacks, &options);
+	sd_markdown_render(ob, doc->data, doc->size, markdown);
+	sd_markdown_free(markdown);
+	render_reallocs = reallocs;
+
+	smart = bufnew(64);
+	sdhtml_smartypants(smart, ob->data, ob->size);
+
+	printf("  %-10s %8lu + %8lu reallocs %8.1f ms\n", name,
+		(unsigned long)render_reallocs,
+		(unsigned long)(reallocs - render_reallocs),
+		(double)(clock() - start) * 1000 / CLOCKS_PER_SEC);
+
+	bufrelease(smart);
+	bufrelease(ob);
+}
+
+int
+main(int argc, char **argv)
+{
+	static const size_t sizes[] = { 1, 4, 16, 32 };
+	struct buf *corpus, *doc;
+	size_t i;
+	int j;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s file.text...\n", argv[0]);
+		return 1;
+	}
+
+	bufsetallocator(&counter);
+
+	corpus = bufnew(4096);
+	for (j = 1; j < argc; ++j) {
+		slurp(corpus, argv[j]);
+		bufputc(corpus, '\n');
+	}
+
+	for (i = 0; i < sizeof sizes / sizeof sizes[0]; ++i) {
+		doc = bufnew(4096);
+		while (doc->size < sizes[i] << 20)
+			bufput(doc, corpus->data, corpus->size);
+
+		printf("%luMB document (render + smartypants):\n", (unsigned long)sizes[i]);
+		bench("linear", BUF_GROW_LINEAR, doc);
+		bench("geometric", BUF_GROW_GEOMETRIC, doc);
+		bufrelease(doc);
+	}
+
+	bufrelease(corpus);
+	return 0;
+}
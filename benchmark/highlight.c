@@ -0,0 +1,154 @@
+/*
+ * Times the rendering of code-heavy documents with and without the
+ * built-in highlighter, and the highlighter on its own.
+ *
+ *   cc -O2 -Isrc -o highlight benchmark/highlight.c src/[a-z]*.c
+ *   ./highlight [megabytes] benchmark/tests/gfm_code.text src/html.c src/robotskirt.cc
+ *
+ * Markdown files (.text, .md) are taken as they are; the others become
+ * fenced code blocks in the language of their extension. The files are
+ * concatenated and repeated to build the document.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "markdown.h"
+#include "html.h"
+
+#define ROUNDS 20
+
+static double
+now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+static void
+slurp(struct buf *ob, const char *path)
+{
+	char chunk[4096];
+	size_t n;
+	FILE *in = fopen(path, "rb");
+
+	if (!in) {
+		perror(path);
+		exit(1);
+	}
+
+	while ((n = fread(chunk, 1, sizeof chunk, in)) > 0)
+		bufput(ob, chunk, n);
+
+	fclose(in);
+}
+
+/* add_file • the file as Markdown, or as a code block of its extension */
+static void
+add_file(struct buf *doc, const char *path, size_t *code)
+{
+	const char *ext = strrchr(path, '.');
+	size_t start;
+
+	if (ext && (strcmp(ext, ".text") == 0 || strcmp(ext, ".md") == 0)) {
+		slurp(doc, path);
+		bufputc(doc, '\n');
+		return;
+	}
+
+	bufprintf(doc, "~~~ %s\n", ext ? ext + 1 : "");
+	start = doc->size;
+	slurp(doc, path);
+	*code += doc->size - start;
+	BUFPUTSL(doc, "\n~~~\n\n");
+}
+
+static double
+render(struct buf *ob, const struct buf *doc, struct sdhtml_highlighter *h)
+{
+	struct sd_callbacks callbacks;
+	struct html_renderopt options;
+	struct sd_markdown *markdown;
+	double start;
+	size_t i;
+
+	sdhtml_renderer(&callbacks, &options, 0);
+	sdhtml_set_highlighter(&options, h);
+	markdown = sd_markdown_new(MKDEXT_FENCED_CODE, 16, &callbacks, &options);
+
+	start = now();
+	for (i = 0; i < ROUNDS; ++i) {
+		bufreset(ob);
+		sd_markdown_render(ob, doc->data, doc->size, markdown);
+	}
+	start = (now() - start) / ROUNDS;
+
+	sd_markdown_free(markdown);
+	sdhtml_set_highlighter(&options, NULL);
+	return start;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct buf *doc, *ob, *code;
+	struct sdhtml_highlighter *h;
+	size_t megabytes = 4, code_size = 0, f, i;
+	double plain, lit, alone, start;
+	int j = 1;
+
+	if (j < argc && strspn(argv[j], "0123456789") == strlen(argv[j]))
+		megabytes = strtoul(argv[j++], NULL, 10);
+
+	if (j >= argc) {
+		fprintf(stderr, "usage: %s [megabytes] file...\n", argv[0]);
+		return 1;
+	}
+
+	doc = bufnew(4096);
+	code = bufnew(4096);
+	while (doc->size < megabytes << 20)
+		for (f = j; f < (size_t)argc; ++f)
+			add_file(doc, argv[f], &code_size);
+
+	/* the C of the document on its own, for the lexer alone */
+	for (f = j; f < (size_t)argc; ++f) {
+		const char *ext = strrchr(argv[f], '.');
+		if (ext && (strcmp(ext, ".c") == 0 || strcmp(ext, ".h") == 0))
+			slurp(code, argv[f]);
+	}
+
+	h = sdhtml_highlighter_new();
+	sdhtml_highlighter_add_builtins(h);
+	ob = bufnew(64);
+
+	plain = render(ob, doc, NULL);
+	printf("%luKB document, %luKB of it code\n", (unsigned long)(doc->size >> 10),
+		(unsigned long)(code_size >> 10));
+	printf("  plain render       %8.3f ms  %8.1f MB/s  %luKB out\n", plain,
+		doc->size / plain / 1000.0, (unsigned long)(ob->size >> 10));
+
+	lit = render(ob, doc, h);
+	printf("  highlighted render %8.3f ms  %8.1f MB/s  %luKB out\n", lit,
+		doc->size / lit / 1000.0, (unsigned long)(ob->size >> 10));
+
+	if (code->size) {
+		start = now();
+		for (i = 0; i < ROUNDS; ++i) {
+			bufreset(ob);
+			sdhtml_highlight(ob, (const uint8_t *)"c", 1, code->data, code->size, h);
+		}
+		alone = (now() - start) / ROUNDS;
+		printf("  C lexer, %luKB      %8.3f ms  %8.1f MB/s\n", (unsigned long)(code->size >> 10),
+			alone, code->size / alone / 1000.0);
+	}
+
+	sdhtml_highlighter_release(h);
+	bufrelease(doc);
+	bufrelease(code);
+	bufrelease(ob);
+	return 0;
+}
@@ -0,0 +1,53 @@
+#!/usr/bin/env node
+
+// Microbenchmarks for the Houdini unescapers.
+// Every input is built from the markdown tests, escaped the way
+// that unescaper expects to find it.
+
+var fs = require('fs')
+  , path = require('path')
+  , rs = require('../build/Release/robotskirt')
+  , houdini = rs.houdini
+  , dir = __dirname + '/tests';
+
+var TIMES = 200;
+
+var load = function() {
+  return fs
+    .readdirSync(dir)
+    .filter(function(file) {
+      return path.extname(file) === '.text';
+    })
+    .map(function(file) {
+      return fs.readFileSync(path.join(dir, file), 'utf8');
+    })
+    .join('\n');
+};
+
+var bench = function(name, func, input) {
+  var start = Date.now()
+    , times = TIMES;
+
+  while (times--) func(input);
+
+  console.log('%s completed in %dms.', name, Date.now() - start);
+};
+
+var main = function() {
+  var text = load()
+    , query = text.split('\n').map(function(line, i) {
+        return 'field' + i + '=' + encodeURIComponent(line).replace(/%20/g, '+');
+      }).join('&');
+
+  bench('unescapeURL (query string)', houdini.unescapeURL, query);
+  bench('unescapeURI (encoded text)', houdini.unescapeURI, encodeURI(text));
+  bench('unescapeJS (string literal)', houdini.unescapeJS, houdini.escapeJS(text));
+  bench('unescapeHTML (entities)', houdini.unescapeHTML, houdini.escapeHTML(text));
+  bench('unescapeHTML (plain text)', houdini.unescapeHTML, text);
+};
+
+if (!module.parent) {
+  main();
+} else {
+  module.exports = main;
+}
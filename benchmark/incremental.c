@@ -0,0 +1,184 @@
+/*
+ * Times a full render of a big document against typing into it with
+ * sd_document_edit, checking that both give the same output.
+ *
+ *   cc -O2 -Isrc -o incremental benchmark/incremental.c src/[a-z]*.c
+ *   ./incremental [megabytes] benchmark/tests/[a-z]*.text
+ *
+ * The given files are concatenated and repeated to build the document.
+ * A few edits known to have gone wrong are checked first.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "markdown.h"
+#include "html.h"
+
+#define KEYSTROKES 200
+
+static double
+now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+static void
+slurp(struct buf *ob, const char *path)
+{
+	char chunk[4096];
+	size_t n;
+	FILE *in = fopen(path, "rb");
+
+	if (!in) {
+		perror(path);
+		exit(1);
+	}
+
+	while ((n = fread(chunk, 1, sizeof chunk, in)) > 0)
+		bufput(ob, chunk, n);
+
+	fclose(in);
+}
+
+/* same_output • whether the document renders as `text` does from scratch */
+static int
+same_output(struct sd_document *document, struct sd_markdown *markdown, const struct buf *text)
+{
+	const struct buf *out = sd_document_output(document);
+	struct buf *ob = bufnew(64);
+	int same;
+
+	sd_markdown_render(ob, text->data, text->size, markdown);
+	same = ob->size == out->size && (!ob->size || memcmp(ob->data, out->data, ob->size) == 0);
+	bufrelease(ob);
+	return same;
+}
+
+/* the edits, each replacing `removed` bytes at `offset` of `text` */
+static const struct {
+	const char *text;
+	size_t offset, removed;
+	const char *inserted;
+} regressions[] = {
+	/* the second definition becomes text, the first one applies again */
+	{ "[2]: http://a.com/  \"A\"\n\nPara.\n\n[2]: http://b.com/  \"B\"\nmore\n\nLink [t] [2].\n", 31, 10, "x" },
+	/* an empty document, left empty and then typed into */
+	{ "", 0, 0, "" },
+	{ "", 0, 0, "# Typed\n" },
+};
+
+static void
+check_regressions(struct sd_markdown *markdown, const struct sd_parallel *parallel)
+{
+	struct sd_document *document;
+	struct buf *text = bufnew(64);
+	size_t i, size;
+
+	for (i = 0; i < sizeof(regressions) / sizeof(regressions[0]); ++i) {
+		size = strlen(regressions[i].text);
+		document = sd_document_new(markdown, parallel);
+		if (sd_document_render(document, (const uint8_t *)regressions[i].text, size) < 0 ||
+			sd_document_edit(document, regressions[i].offset, regressions[i].removed,
+				(const uint8_t *)regressions[i].inserted, strlen(regressions[i].inserted)) < 0) {
+			printf("edit %lu: failed!\n", (unsigned long)i);
+			sd_document_free(document);
+			continue;
+		}
+
+		bufreset(text);
+		bufput(text, regressions[i].text, regressions[i].offset);
+		bufputs(text, regressions[i].inserted);
+		bufput(text, regressions[i].text + regressions[i].offset + regressions[i].removed,
+			size - regressions[i].offset - regressions[i].removed);
+
+		if (!same_output(document, markdown, text))
+			printf("edit %lu: output differs!\n", (unsigned long)i);
+		sd_document_free(document);
+	}
+
+	bufrelease(text);
+}
+
+int
+main(int argc, char **argv)
+{
+	static const char typed[] = "Some *typed* words. ";
+	struct sd_callbacks callbacks;
+	struct html_renderopt options;
+	struct sd_parallel parallel;
+	struct sd_markdown *markdown;
+	struct sd_document *document;
+	struct buf *corpus, *doc, *ob;
+	size_t megabytes = 1, offset, i;
+	double start, full, edits;
+	int j = 1;
+
+	if (j < argc && strspn(argv[j], "0123456789") == strlen(argv[j]))
+		megabytes = strtoul(argv[j++], NULL, 10);
+
+	if (j >= argc) {
+		fprintf(stderr, "usage: %s [megabytes] file.text...\n", argv[0]);
+		return 1;
+	}
+
+	corpus = bufnew(4096);
+	for (; j < argc; ++j) {
+		slurp(corpus, argv[j]);
+		bufputc(corpus, '\n');
+	}
+
+	doc = bufnew(4096);
+	while (doc->size < megabytes << 20)
+		bufput(doc, corpus->data, corpus->size);
+
+	sdhtml_renderer(&callbacks, &options, 0);
+	markdown = sd_markdown_new(MKDEXT_TABLES | MKDEXT_FENCED_CODE | MKDEXT_AUTOLINK, 16, &callbacks, &options);
+	sdhtml_parallel(&parallel, &callbacks);
+	check_regressions(markdown, &parallel);
+
+	ob = bufnew(64);
+	start = now();
+	sd_markdown_render(ob, doc->data, doc->size, markdown);
+	full = now() - start;
+
+	document = sd_document_new(markdown, &parallel);
+	sd_document_render(document, doc->data, doc->size);
+
+	/* typing at the start of a paragraph in the middle of the document */
+	offset = doc->size / 2;
+	while (offset < doc->size && !(doc->data[offset - 1] == '\n' && doc->data[offset - 2] == '\n'))
+		offset++;
+
+	start = now();
+	for (i = 0; i < KEYSTROKES; ++i)
+		sd_document_edit(document, offset + i, 0, (const uint8_t *)typed + i % (sizeof typed - 1), 1);
+	edits = (now() - start) / KEYSTROKES;
+
+	printf("%luMB document:\n", (unsigned long)megabytes);
+	printf("  full render  %8.3f ms\n", full);
+	printf("  keystroke    %8.3f ms\n", edits);
+
+	/* the same text, rendered from scratch */
+	bufreset(ob);
+	bufput(ob, doc->data, offset);
+	for (i = 0; i < KEYSTROKES; ++i)
+		bufputc(ob, typed[i % (sizeof typed - 1)]);
+	bufput(ob, doc->data + offset, doc->size - offset);
+	bufreset(doc);
+	bufput(doc, ob->data, ob->size);
+
+	if (!same_output(document, markdown, doc))
+		printf("  (output differs!)\n");
+
+	sd_document_free(document);
+	sd_markdown_free(markdown);
+	bufrelease(ob);
+	bufrelease(doc);
+	bufrelease(corpus);
+	return 0;
+}
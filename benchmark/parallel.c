@@ -0,0 +1,162 @@
+/*
+ * Times serial and parallel renders of a big document, checking that
+ * both give the same output.
+ *
+ *   cc -O2 -Isrc -o parallel benchmark/parallel.c src/[a-z]*.c -lpthread
+ *   ./parallel [megabytes [threads]] benchmark/tests/[a-z]*.text
+ *
+ * The given files are concatenated and repeated to build the document.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "markdown.h"
+#include "html.h"
+
+#define MAX_THREADS 64
+
+struct runner {
+	void (*job)(void *);
+	void **args;
+	size_t count, next;
+	pthread_mutex_t lock;
+};
+
+static void *
+worker(void *opaque)
+{
+	struct runner *runner = opaque;
+	size_t i;
+
+	for (;;) {
+		pthread_mutex_lock(&runner->lock);
+		i = runner->next++;
+		pthread_mutex_unlock(&runner->lock);
+
+		if (i >= runner->count)
+			return NULL;
+
+		runner->job(runner->args[i]);
+	}
+}
+
+static void
+run(void (*job)(void *), void **args, size_t count, void *opaque)
+{
+	struct runner runner;
+	pthread_t threads[MAX_THREADS];
+	size_t n = *(size_t *)opaque, i;
+
+	runner.job = job;
+	runner.args = args;
+	runner.count = count;
+	runner.next = 0;
+	pthread_mutex_init(&runner.lock, NULL);
+
+	if (n > count)
+		n = count;
+
+	for (i = 1; i < n; ++i)
+		pthread_create(&threads[i], NULL, worker, &runner);
+
+	worker(&runner);
+
+	for (i = 1; i < n; ++i)
+		pthread_join(threads[i], NULL);
+
+	pthread_mutex_destroy(&runner.lock);
+}
+
+static double
+now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+static void
+slurp(struct buf *ob, const char *path)
+{
+	char chunk[4096];
+	size_t n;
+	FILE *in = fopen(path, "rb");
+
+	if (!in) {
+		perror(path);
+		exit(1);
+	}
+
+	while ((n = fread(chunk, 1, sizeof chunk, in)) > 0)
+		bufput(ob, chunk, n);
+
+	fclose(in);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct sd_callbacks callbacks;
+	struct html_renderopt options;
+	struct sd_parallel parallel;
+	struct sd_markdown *markdown;
+	struct buf *corpus, *doc, *serial, *ob;
+	size_t megabytes = 64, threads = 4, n;
+	double start;
+	int j = 1;
+
+	if (j < argc && strspn(argv[j], "0123456789") == strlen(argv[j]))
+		megabytes = strtoul(argv[j++], NULL, 10);
+	if (j < argc && strspn(argv[j], "0123456789") == strlen(argv[j]))
+		threads = strtoul(argv[j++], NULL, 10);
+
+	if (j >= argc || threads < 1 || threads > MAX_THREADS) {
+		fprintf(stderr, "usage: %s [megabytes [threads]] file.text...\n", argv[0]);
+		return 1;
+	}
+
+	corpus = bufnew(4096);
+	for (; j < argc; ++j) {
+		slurp(corpus, argv[j]);
+		bufputc(corpus, '\n');
+	}
+
+	doc = bufnew(4096);
+	while (doc->size < megabytes << 20)
+		bufput(doc, corpus->data, corpus->size);
+
+	sdhtml_renderer(&callbacks, &options, HTML_TOC);
+	markdown = sd_markdown_new(MKDEXT_TABLES | MKDEXT_FENCED_CODE | MKDEXT_AUTOLINK, 16, &callbacks, &options);
+
+	sdhtml_parallel(&parallel, &callbacks);
+	parallel.run = run;
+
+	serial = bufnew(64);
+	start = now();
+	sd_markdown_render(serial, doc->data, doc->size, markdown);
+	printf("%luMB document:\n", (unsigned long)megabytes);
+	printf("  serial       %8.1f ms\n", now() - start);
+
+	for (n = 1; n <= threads; n *= 2) {
+		ob = bufnew(64);
+		parallel.run_opaque = &n;
+		options.toc_data.header_count = 0;
+
+		start = now();
+		sd_markdown_render_parallel(ob, doc->data, doc->size, markdown, n * 4, &parallel);
+		printf("  %2lu thread%s   %8.1f ms%s\n", (unsigned long)n, n > 1 ? "s" : " ", now() - start,
+			ob->size == serial->size && !memcmp(ob->data, serial->data, ob->size) ? "" : "  (output differs!)");
+
+		bufrelease(ob);
+	}
+
+	sd_markdown_free(markdown);
+	bufrelease(serial);
+	bufrelease(doc);
+	bufrelease(corpus);
+	return 0;
+}
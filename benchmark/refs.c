@@ -0,0 +1,72 @@
+/*
+ * Times the rendering of a generated document with lots of reference
+ * links: 10k definitions, used 50k times in all.
+ *
+ *   cc -O2 -Isrc -o refs benchmark/refs.c src/[a-z]*.c
+ *   ./refs [definitions [uses]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "markdown.h"
+#include "html.h"
+
+#define ROUNDS 10
+
+int
+main(int argc, char **argv)
+{
+	struct sd_callbacks callbacks;
+	struct html_renderopt options;
+	struct sd_markdown *markdown;
+	struct buf *doc, *ob;
+	unsigned long defs = 10000, uses = 50000, i;
+	clock_t start;
+	int round;
+
+	if (argc > 1)
+		defs = strtoul(argv[1], NULL, 10);
+	if (argc > 2)
+		uses = strtoul(argv[2], NULL, 10);
+	if (!defs)
+		defs = 1;
+
+	srand(1);
+	doc = bufnew(4096);
+
+	for (i = 0; i < defs; ++i)
+		bufprintf(doc, "[Reference %lu]: http://example.com/docs/%lu \"Title %lu\"\n", i, i, i);
+
+	/* uses go in paragraphs of ten, half of them in a different case */
+	for (i = 0; i < uses; ++i) {
+		unsigned long id = (unsigned long)rand() % defs;
+		if (i % 2)
+			bufprintf(doc, "See [the docs][REFERENCE %lu] ", id);
+		else
+			bufprintf(doc, "See [Reference %lu] ", id);
+
+		if (i % 10 == 9)
+			bufputs(doc, "\n\n");
+	}
+
+	ob = bufnew(64);
+	sdhtml_renderer(&callbacks, &options, 0);
+	markdown = sd_markdown_new(0, 16, &callbacks, &options);
+
+	start = clock();
+	for (round = 0; round < ROUNDS; ++round) {
+		ob->size = 0;
+		sd_markdown_render(ob, doc->data, doc->size, markdown);
+	}
+
+	printf("%lu references, %lu uses (%luKB): %.1f ms per render\n",
+		defs, uses, (unsigned long)(doc->size >> 10),
+		(double)(clock() - start) * 1000 / CLOCKS_PER_SEC / ROUNDS);
+
+	sd_markdown_free(markdown);
+	bufrelease(ob);
+	bufrelease(doc);
+	return 0;
+}
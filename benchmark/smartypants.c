@@ -0,0 +1,128 @@
+/*
+ * Times SmartyPants over HTML files, on their own and concatenated into
+ * a big page. Build it twice to compare the vectorized scanning with the
+ * byte-wise one; the checksums show that both give the same output.
+ *
+ *   cc -O2 -Isrc -o smartypants benchmark/smartypants.c src/[a-z]*.c
+ *   cc -O2 -Isrc -DHOUDINI_NO_SIMD -o smartypants-bytes benchmark/smartypants.c src/[a-z]*.c
+ *   ./smartypants [megabytes] benchmark/tests/[a-z]*.html
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "html.h"
+
+#define ROUNDS 20
+
+static double
+now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+static void
+slurp(struct buf *ob, const char *path)
+{
+	char chunk[4096];
+	size_t n;
+	FILE *in = fopen(path, "rb");
+
+	if (!in) {
+		perror(path);
+		exit(1);
+	}
+
+	while ((n = fread(chunk, 1, sizeof chunk, in)) > 0)
+		bufput(ob, chunk, n);
+
+	fclose(in);
+}
+
+static unsigned long
+checksum(const struct buf *b, unsigned long sum)
+{
+	size_t i;
+
+	for (i = 0; i < b->size; ++i)
+		sum = sum * 31 + b->data[i];
+
+	return sum;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct buf **files, *page, *ob;
+	size_t megabytes = 4, count, total = 0, f, i;
+	unsigned long sum = 0;
+	double start, small, big;
+	int j = 1;
+
+	if (j < argc && strspn(argv[j], "0123456789") == strlen(argv[j]))
+		megabytes = strtoul(argv[j++], NULL, 10);
+
+	if (j >= argc) {
+		fprintf(stderr, "usage: %s [megabytes] file.html...\n", argv[0]);
+		return 1;
+	}
+
+	count = argc - j;
+	files = malloc(count * sizeof *files);
+	page = bufnew(4096);
+
+	for (f = 0; f < count; ++f) {
+		files[f] = bufnew(4096);
+		slurp(files[f], argv[j + f]);
+		total += files[f]->size;
+	}
+
+	while (page->size < megabytes << 20)
+		for (f = 0; f < count; ++f)
+			bufput(page, files[f]->data, files[f]->size);
+
+	ob = bufnew(64);
+
+	/* each file on its own, as when converting rendered pages one by one */
+	start = now();
+	for (i = 0; i < ROUNDS; ++i) {
+		for (f = 0; f < count; ++f) {
+			bufreset(ob);
+			sdhtml_smartypants(ob, files[f]->data, files[f]->size);
+			if (i == 0)
+				sum = checksum(ob, sum);
+		}
+	}
+	small = (now() - start) / ROUNDS;
+
+	start = now();
+	for (i = 0; i < ROUNDS; ++i) {
+		bufreset(ob);
+		sdhtml_smartypants(ob, page->data, page->size);
+	}
+	big = (now() - start) / ROUNDS;
+	sum = checksum(ob, sum);
+
+	printf("%s scanning, checksum %08lx\n",
+#ifdef HOUDINI_NO_SIMD
+		"byte-wise",
+#else
+		"vectorized",
+#endif
+		sum & 0xFFFFFFFFul);
+	printf("  %lu files, %luKB    %8.3f ms  %8.1f MB/s\n", (unsigned long)count,
+		(unsigned long)(total >> 10), small, total / small / 1000.0);
+	printf("  %luMB page           %8.3f ms  %8.1f MB/s\n", (unsigned long)megabytes,
+		big, page->size / big / 1000.0);
+
+	for (f = 0; f < count; ++f)
+		bufrelease(files[f]);
+	free(files);
+	bufrelease(page);
+	bufrelease(ob);
+	return 0;
+}
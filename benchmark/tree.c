@@ -0,0 +1,229 @@
+/*
+ * Times a full render of a big document against rendering it from a
+ * saved tree mapped from a file, checking that both give the same output.
+ *
+ *   cc -O2 -Isrc -o tree benchmark/tree.c src/[a-z]*.c
+ *   ./tree [megabytes] benchmark/tests/[a-z]*.text
+ *
+ * The given files are concatenated and repeated to build the document.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#include "markdown.h"
+#include "html.h"
+#include "tree.h"
+
+#define ROUNDS 10
+
+static double
+now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+static void
+slurp(struct buf *ob, const char *path)
+{
+	char chunk[4096];
+	size_t n;
+	FILE *in = fopen(path, "rb");
+
+	if (!in) {
+		perror(path);
+		exit(1);
+	}
+
+	while ((n = fread(chunk, 1, sizeof chunk, in)) > 0)
+		bufput(ob, chunk, n);
+
+	fclose(in);
+}
+
+/* nodes given flags their callbacks are never called with; a header level
+ * of 2^28 would have the TOC open that many levels */
+static const struct {
+	enum sd_node_type type;
+	uint32_t flags;
+} corruptions[] = {
+	{ SD_NODE_HEADER, 0 },
+	{ SD_NODE_HEADER, 7 },
+	{ SD_NODE_HEADER, 1u << 28 },
+	{ SD_NODE_LIST, 1u << 4 },
+	{ SD_NODE_LISTITEM, 1u << 31 },
+	{ SD_NODE_TABLE_CELL, 1u << 3 },
+	{ SD_NODE_AUTOLINK, MKDA_NOT_AUTOLINK },
+	{ SD_NODE_AUTOLINK, 3 },
+	{ SD_NODE_TABLE_ROW, 1 },
+};
+
+/* check_corrupted • saves a small tree with one node corrupted at a time,
+ * which sdtree_load must turn down */
+static void
+check_corrupted(unsigned int extensions)
+{
+	static const char text[] = "# Title\n\n1. item <http://a.com/>\n\n| a | b |\n|---|:-:|\n| c | d |\n";
+	struct sd_callbacks recorder;
+	struct sd_markdown *markdown;
+	struct sd_tree_data data, loaded;
+	struct sd_tree *tree;
+	struct sd_node *nodes;
+	struct buf *saved;
+	size_t i, n;
+
+	tree = sdtree_new();
+	sdtree_recorder(&recorder);
+	markdown = sd_markdown_new(extensions, 16, &recorder, tree);
+	sdtree_parse(tree, (const uint8_t *)text, sizeof text - 1, markdown);
+	sdtree_data(&data, tree);
+
+	nodes = malloc(data.node_count * sizeof(struct sd_node));
+	saved = bufnew(256);
+
+	sdtree_save(saved, &data);
+	if (sdtree_load(&loaded, saved->data, saved->size) < 0)
+		printf("  sound tree turned down!\n");
+
+	for (i = 0; i < sizeof corruptions / sizeof corruptions[0]; ++i) {
+		memcpy(nodes, data.nodes, data.node_count * sizeof(struct sd_node));
+		for (n = 0; n < data.node_count && nodes[n].type != corruptions[i].type; ++n);
+		if (n == data.node_count) {
+			printf("  corruption %lu: no node to corrupt!\n", (unsigned long)i);
+			continue;
+		}
+
+		nodes[n].flags = corruptions[i].flags;
+		loaded = data;
+		loaded.nodes = nodes;
+		bufreset(saved);
+		sdtree_save(saved, &loaded);
+
+		if (sdtree_load(&loaded, saved->data, saved->size) == 0)
+			printf("  corruption %lu: tree loaded!\n", (unsigned long)i);
+	}
+
+	bufrelease(saved);
+	free(nodes);
+	sd_markdown_free(markdown);
+	sdtree_free(tree);
+}
+
+int
+main(int argc, char **argv)
+{
+	static const unsigned int flags[] = { 0, HTML_USE_XHTML | HTML_HARD_WRAP | HTML_TOC };
+	unsigned int extensions = MKDEXT_TABLES | MKDEXT_FENCED_CODE | MKDEXT_AUTOLINK;
+	struct sd_callbacks callbacks, recorder;
+	struct html_renderopt options;
+	struct sd_markdown *markdown;
+	struct sd_tree_data data;
+	struct sd_tree *tree;
+	struct buf *corpus, *doc, *saved, *ob, *out;
+	size_t megabytes = 1, f, i;
+	double start, full, parse, load, emit;
+	void *mapped;
+	FILE *file;
+	int j = 1;
+
+	if (j < argc && strspn(argv[j], "0123456789") == strlen(argv[j]))
+		megabytes = strtoul(argv[j++], NULL, 10);
+
+	if (j >= argc) {
+		fprintf(stderr, "usage: %s [megabytes] file.text...\n", argv[0]);
+		return 1;
+	}
+
+	corpus = bufnew(4096);
+	for (; j < argc; ++j) {
+		slurp(corpus, argv[j]);
+		bufputc(corpus, '\n');
+	}
+
+	doc = bufnew(4096);
+	while (doc->size < megabytes << 20)
+		bufput(doc, corpus->data, corpus->size);
+
+	check_corrupted(extensions);
+
+	/* parsing and saving, once */
+	tree = sdtree_new();
+	sdtree_recorder(&recorder);
+	markdown = sd_markdown_new(extensions, 16, &recorder, tree);
+	saved = bufnew(4096);
+
+	start = now();
+	sdtree_parse(tree, doc->data, doc->size, markdown);
+	sdtree_data(&data, tree);
+	sdtree_save(saved, &data);
+	parse = now() - start;
+	sd_markdown_free(markdown);
+
+	file = tmpfile();
+	if (!file || fwrite(saved->data, 1, saved->size, file) != saved->size || fflush(file)) {
+		perror("tmpfile");
+		return 1;
+	}
+
+	mapped = mmap(NULL, saved->size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+	if (mapped == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+
+	printf("%luMB document, %luMB saved tree (parse + save %.3f ms):\n",
+		(unsigned long)megabytes, (unsigned long)(saved->size >> 20), parse);
+
+	ob = bufnew(64);
+	out = bufnew(64);
+
+	for (f = 0; f < sizeof flags / sizeof flags[0]; ++f) {
+		sdhtml_renderer(&callbacks, &options, flags[f]);
+		markdown = sd_markdown_new(extensions, 16, &callbacks, &options);
+
+		/* the options count headers, so they are reset before each round */
+		start = now();
+		for (i = 0; i < ROUNDS; ++i) {
+			bufreset(ob);
+			sdhtml_renderer(&callbacks, &options, flags[f]);
+			sd_markdown_render(ob, doc->data, doc->size, markdown);
+		}
+		full = (now() - start) / ROUNDS;
+
+		start = now();
+		for (i = 0; i < ROUNDS; ++i)
+			sdtree_load(&data, mapped, saved->size);
+		load = (now() - start) / ROUNDS;
+
+		start = now();
+		for (i = 0; i < ROUNDS; ++i) {
+			bufreset(out);
+			sdhtml_renderer(&callbacks, &options, flags[f]);
+			sdtree_render_data(out, &data, &callbacks, &options);
+		}
+		emit = (now() - start) / ROUNDS;
+
+		printf("  flags 0x%03x  full render %8.3f ms   load %8.3f ms + emit %8.3f ms\n",
+			flags[f], full, load, emit);
+
+		if (ob->size != out->size || memcmp(ob->data, out->data, ob->size))
+			printf("  (output differs!)\n");
+
+		sd_markdown_free(markdown);
+	}
+
+	munmap(mapped, saved->size);
+	fclose(file);
+	sdtree_free(tree);
+	bufrelease(out);
+	bufrelease(ob);
+	bufrelease(saved);
+	bufrelease(doc);
+	bufrelease(corpus);
+	return 0;
+}
@@ -6,6 +6,7 @@
       'type': 'static_library',
       'include_dirs': ['src'],
       'sources': [
+        'src/arena.c',
         'src/autolink.c',
         'src/buffer.c',
         'src/houdini_href_e.c',
@@ -17,9 +18,15 @@
         'src/houdini_uri_u.c',
         'src/houdini_xml_e.c',
         'src/html.c',
+        'src/html_highlight.c',
+        'src/html_links.c',
+        'src/html_sanitize.c',
         'src/html_smartypants.c',
+        'src/html_template.c',
+        'src/html_urls.c',
         'src/markdown.c',
         'src/stack.c',
+        'src/tree.c',
       ]
     },
 
@@ -0,0 +1,261 @@
+#include "arena.h"
+#include <string.h>
+
+/* allocations are aligned like this, and preceded by their size */
+#define ARENA_ALIGN (2 * sizeof(void *))
+#define ARENA_ROUND(x) (((x) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+#define BLOCK_HEADER ARENA_ROUND(sizeof(size_t))
+#define BLOCK_SIZE(ptr) (*(size_t *)((uint8_t *)(ptr) - BLOCK_HEADER))
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size;	/* bytes available after the header */
+	size_t pos;	/* bytes handed out */
+};
+
+#define CHUNK_HEADER ARENA_ROUND(sizeof(struct arena_chunk))
+#define CHUNK_DATA(chunk) ((uint8_t *)(chunk) + CHUNK_HEADER)
+
+static void *
+arena_buf_malloc(size_t size, void *opaque)
+{
+	return arena_alloc(opaque, size);
+}
+
+static void *
+arena_buf_realloc(void *ptr, size_t size, void *opaque)
+{
+	return arena_realloc(opaque, ptr, size);
+}
+
+static void
+arena_buf_free(void *ptr, void *opaque)
+{
+	arena_release(opaque, ptr);
+}
+
+/* new_chunk • starts a chunk big enough for `min_size` bytes; chunks
+ * get at least as big as everything allocated so far, so their count
+ * only grows logarithmically */
+static struct arena_chunk *
+new_chunk(struct arena *arena, size_t min_size)
+{
+	struct arena_chunk *chunk;
+	size_t size = arena->chunk_size;
+
+	if (size < arena->used)
+		size = arena->used;
+
+	if (size < min_size)
+		size = min_size;
+
+	chunk = malloc(CHUNK_HEADER + size);
+	if (chunk == NULL)
+		return NULL;
+
+	chunk->next = arena->chunk;
+	chunk->size = size;
+	chunk->pos = 0;
+
+	arena->chunk = chunk;
+	return chunk;
+}
+
+static inline void
+update_peak(struct arena *arena)
+{
+	if (arena->used > arena->peak)
+		arena->peak = arena->used;
+
+	if (arena->used > arena->high_water)
+		arena->high_water = arena->used;
+}
+
+static void
+free_chunks(struct arena *arena)
+{
+	struct arena_chunk *chunk = arena->chunk, *next;
+
+	while (chunk) {
+		next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+
+	arena->chunk = NULL;
+}
+
+int
+arena_init(struct arena *arena, size_t chunk_size)
+{
+	arena->chunk = NULL;
+	arena->last = NULL;
+	arena->used = 0;
+	arena->peak = 0;
+	arena->high_water = 0;
+	arena->chunk_size = chunk_size ? chunk_size : 4096;
+
+	arena->allocator.malloc = arena_buf_malloc;
+	arena->allocator.realloc = arena_buf_realloc;
+	arena->allocator.free = arena_buf_free;
+	arena->allocator.opaque = arena;
+
+	return new_chunk(arena, 0) ? 0 : -1;
+}
+
+void
+arena_free(struct arena *arena)
+{
+	if (!arena)
+		return;
+
+	free_chunks(arena);
+	arena->last = NULL;
+	arena->used = 0;
+}
+
+void *
+arena_alloc(struct arena *arena, size_t size)
+{
+	struct arena_chunk *chunk = arena->chunk;
+	size_t need = BLOCK_HEADER + ARENA_ROUND(size);
+	uint8_t *block;
+
+	if (need < size)
+		return NULL;
+
+	if (chunk == NULL || chunk->size - chunk->pos < need) {
+		chunk = new_chunk(arena, need);
+		if (chunk == NULL)
+			return NULL;
+	}
+
+	block = CHUNK_DATA(chunk) + chunk->pos;
+	chunk->pos += need;
+
+	arena->used += need;
+	update_peak(arena);
+
+	arena->last = block + BLOCK_HEADER;
+	BLOCK_SIZE(arena->last) = size;
+	return arena->last;
+}
+
+void *
+arena_calloc(struct arena *arena, size_t count, size_t size)
+{
+	void *ptr;
+
+	if (size && count > (size_t)-1 / size)
+		return NULL;
+
+	ptr = arena_alloc(arena, count * size);
+	if (ptr)
+		memset(ptr, 0x0, count * size);
+
+	return ptr;
+}
+
+/* arena_realloc • the latest allocation grows in place while its chunk
+ * has room; anything else is copied, and its old space is wasted until
+ * the next reset */
+void *
+arena_realloc(struct arena *arena, void *ptr, size_t size)
+{
+	size_t old_size;
+	void *neo;
+
+	if (ptr == NULL)
+		return arena_alloc(arena, size);
+
+	old_size = BLOCK_SIZE(ptr);
+
+	if (ptr == arena->last) {
+		struct arena_chunk *chunk = arena->chunk;
+		size_t old_need = ARENA_ROUND(old_size);
+		size_t new_need = ARENA_ROUND(size);
+
+		if (new_need >= size && new_need <= old_need + chunk->size - chunk->pos) {
+			chunk->pos = chunk->pos - old_need + new_need;
+			arena->used = arena->used - old_need + new_need;
+			update_peak(arena);
+
+			BLOCK_SIZE(ptr) = size;
+			return ptr;
+		}
+	}
+
+	if (size <= old_size)
+		return ptr;
+
+	neo = arena_alloc(arena, size);
+	if (neo)
+		memcpy(neo, ptr, old_size);
+
+	return neo;
+}
+
+/* arena_release • only the latest allocation can be taken back;
+ * everything else waits for the next reset */
+void
+arena_release(struct arena *arena, void *ptr)
+{
+	size_t need;
+
+	if (ptr == NULL || ptr != arena->last)
+		return;
+
+	need = BLOCK_HEADER + ARENA_ROUND(BLOCK_SIZE(ptr));
+	arena->chunk->pos -= need;
+	arena->used -= need;
+	arena->last = NULL;
+}
+
+/* arena_reset • gives back every allocation at once; if the last
+ * round needed more than one chunk, they are merged into a single
+ * one as big as that round's peak */
+void
+arena_reset(struct arena *arena)
+{
+	struct arena_chunk *chunk = arena->chunk;
+	size_t peak = arena->peak;
+
+	arena->last = NULL;
+	arena->used = 0;
+	arena->peak = 0;
+
+	if (chunk && chunk->next == NULL && chunk->size >= peak) {
+		chunk->pos = 0;
+		return;
+	}
+
+	free_chunks(arena);
+	new_chunk(arena, peak);
+}
+
+/* arena_trim • gives back every allocation, and all the memory beyond
+ * a single chunk of the initial size */
+void
+arena_trim(struct arena *arena)
+{
+	free_chunks(arena);
+
+	arena->last = NULL;
+	arena->used = 0;
+	arena->peak = 0;
+
+	new_chunk(arena, 0);
+}
+
+/* arena_allocated • bytes taken from the system */
+size_t
+arena_allocated(const struct arena *arena)
+{
+	const struct arena_chunk *chunk;
+	size_t total = 0;
+
+	for (chunk = arena->chunk; chunk; chunk = chunk->next)
+		total += CHUNK_HEADER + chunk->size;
+
+	return total;
+}
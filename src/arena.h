@@ -0,0 +1,42 @@
+#ifndef ARENA_H__
+#define ARENA_H__
+
+#include <stdlib.h>
+
+#include "buffer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct arena_chunk;
+
+/* struct arena: bump allocator whose memory is given back all at once */
+struct arena {
+	struct arena_chunk *chunk;	/* chunk in use, linked to the older ones */
+	void *last;	/* most recent allocation, which can grow in place */
+	size_t used;	/* bytes handed out since the last reset */
+	size_t peak;	/* largest `used` since the last reset */
+	size_t high_water;	/* largest `used` ever reached */
+	size_t chunk_size;	/* minimum size of a new chunk */
+	struct buf_allocator allocator;	/* buffer memory from this arena */
+};
+
+void arena_free(struct arena *);
+int arena_init(struct arena *, size_t);
+
+void *arena_alloc(struct arena *, size_t);
+void *arena_calloc(struct arena *, size_t, size_t);
+void *arena_realloc(struct arena *, void *, size_t);
+void arena_release(struct arena *, void *);
+
+void arena_reset(struct arena *);
+void arena_trim(struct arena *);
+
+size_t arena_allocated(const struct arena *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
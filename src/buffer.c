@@ -15,8 +15,6 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
-#define BUFFER_MAX_ALLOC_SIZE (1024 * 1024 * 16) //16mb
-
 #include "buffer.h"
 
 #include <stdio.h>
@@ -26,10 +24,69 @@
 /* MSVC compat */
 #if defined(_MSC_VER)
 #	define _buf_vsnprintf _vsnprintf
+#	ifndef va_copy
+#		define va_copy(dst, src) ((dst) = (src))
+#	endif
 #else
 #	define _buf_vsnprintf vsnprintf
 #endif
 
+static void *
+std_malloc(size_t size, void *opaque)
+{
+	return malloc(size);
+}
+
+static void *
+std_realloc(void *ptr, size_t size, void *opaque)
+{
+	return realloc(ptr, size);
+}
+
+static void
+std_free(void *ptr, void *opaque)
+{
+	free(ptr);
+}
+
+static const struct buf_allocator std_allocator = {
+	std_malloc, std_realloc, std_free, NULL
+};
+
+static const struct buf_allocator *allocator = &std_allocator;
+static bufgrowth_t growth = BUF_GROW_GEOMETRIC;
+static size_t max_alloc_size = 0;
+
+#define buf_allocator_of(buf) ((buf)->alloc ? (buf)->alloc : allocator)
+#define buf_realloc(buf, ptr, size) \
+	buf_allocator_of(buf)->realloc((ptr), (size), buf_allocator_of(buf)->opaque)
+#define buf_free(buf, ptr) \
+	buf_allocator_of(buf)->free((ptr), buf_allocator_of(buf)->opaque)
+
+void
+bufsetallocator(const struct buf_allocator *alloc)
+{
+	allocator = alloc ? alloc : &std_allocator;
+}
+
+const struct buf_allocator *
+bufallocator(void)
+{
+	return allocator;
+}
+
+void
+bufsetgrowth(bufgrowth_t policy)
+{
+	growth = policy;
+}
+
+void
+bufsetmaxsize(size_t size)
+{
+	max_alloc_size = size;
+}
+
 int
 bufprefix(const struct buf *buf, const char *prefix)
 {
@@ -50,19 +107,27 @@ bufprefix(const struct buf *buf, const char *prefix)
 int
 bufgrow(struct buf *buf, size_t neosz)
 {
-	size_t neoasz;
+	size_t neoasz, step;
 	void *neodata;
-	if (!buf || !buf->unit || neosz > BUFFER_MAX_ALLOC_SIZE)
+	if (!buf || !buf->unit || (max_alloc_size && neosz > max_alloc_size))
 		return BUF_ENOMEM;
 
 	if (buf->asize >= neosz)
 		return BUF_OK;
 
-	neoasz = buf->asize + buf->unit;
-	while (neoasz < neosz)
-		neoasz += buf->unit;
+	step = buf->unit;
+	if (growth == BUF_GROW_GEOMETRIC && buf->asize / 2 > step)
+		step = buf->asize / 2;
+
+	/* at least one step, and whole units past the current size */
+	neoasz = buf->asize + step;
+	if (neoasz < neosz)
+		neoasz = buf->asize + (neosz - buf->asize + buf->unit - 1) / buf->unit * buf->unit;
 
-	neodata = realloc(buf->data, neoasz);
+	if (neoasz < neosz || (max_alloc_size && neoasz > max_alloc_size))
+		neoasz = max_alloc_size > neosz ? max_alloc_size : neosz;
+
+	neodata = buf_realloc(buf, buf->data, neoasz);
 	if (!neodata)
 		return BUF_ENOMEM;
 
@@ -75,14 +140,23 @@ bufgrow(struct buf *buf, size_t neosz)
 /* bufnew: allocation of a new buffer */
 struct buf *
 bufnew(size_t unit)
+{
+	return bufnewalloc(unit, NULL);
+}
+
+/* bufnewalloc: allocation of a new buffer from the given memory functions */
+struct buf *
+bufnewalloc(size_t unit, const struct buf_allocator *alloc)
 {
 	struct buf *ret;
-	ret = malloc(sizeof (struct buf));
+	const struct buf_allocator *from = alloc ? alloc : allocator;
+	ret = from->malloc(sizeof (struct buf), from->opaque);
 
 	if (ret) {
 		ret->data = 0;
 		ret->size = ret->asize = 0;
 		ret->unit = unit;
+		ret->alloc = alloc;
 	}
 	return ret;
 }
@@ -161,8 +235,8 @@ bufrelease(struct buf *buf)
 	if (!buf)
 		return;
 
-	free(buf->data);
-	free(buf);
+	buf_free(buf, buf->data);
+	buf_free(buf, buf);
 }
 
 
@@ -173,7 +247,7 @@ bufreset(struct buf *buf)
 	if (!buf)
 		return;
 
-	free(buf->data);
+	buf_free(buf, buf->data);
 	buf->data = NULL;
 	buf->size = buf->asize = 0;
 }
@@ -199,27 +273,35 @@ void
 vbufprintf(struct buf *buf, const char *fmt, va_list ap)
 {
 	int n;
+	va_list ap_retry;
 
 	if (buf == 0 || (buf->size >= buf->asize && bufgrow(buf, buf->size + 1)) < 0)
 		return;
 
+	/* the first attempt consumes `ap`, keep a copy in case it falls short */
+	va_copy(ap_retry, ap);
 	n = _buf_vsnprintf((char *)buf->data + buf->size, buf->asize - buf->size, fmt, ap);
 
 	if (n < 0) {
 #ifdef _MSC_VER
-		n = _vscprintf(fmt, ap);
+		n = _vscprintf(fmt, ap_retry);
 #else
+		va_end(ap_retry);
 		return;
 #endif
 	}
 
 	if ((size_t)n >= buf->asize - buf->size) {
-		if (bufgrow(buf, buf->size + n + 1) < 0)
+		if (bufgrow(buf, buf->size + n + 1) < 0) {
+			va_end(ap_retry);
 			return;
+		}
 
-		n = _buf_vsnprintf((char *)buf->data + buf->size, buf->asize - buf->size, fmt, ap);
+		n = _buf_vsnprintf((char *)buf->data + buf->size, buf->asize - buf->size, fmt, ap_retry);
 	}
 
+	va_end(ap_retry);
+
 	if (n < 0)
 		return;
 
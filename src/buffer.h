@@ -36,12 +36,28 @@ typedef enum {
 	BUF_ENOMEM = -1,
 } buferror_t;
 
+/* bufgrowth_t: how buffers grow when they run out of room */
+typedef enum {
+	BUF_GROW_LINEAR,	/* add `unit` bytes at a time */
+	BUF_GROW_GEOMETRIC,	/* add half the allocated size, `unit` bytes at least */
+} bufgrowth_t;
+
+/* struct buf_allocator: where buffers get their memory from; the functions
+ * behave like their C library namesakes, but get `opaque` passed along */
+struct buf_allocator {
+	void *(*malloc)(size_t size, void *opaque);
+	void *(*realloc)(void *ptr, size_t size, void *opaque);
+	void (*free)(void *ptr, void *opaque);
+	void *opaque;
+};
+
 /* struct buf: character array buffer */
 struct buf {
 	uint8_t *data;		/* actual character data */
 	size_t size;	/* size of the string */
 	size_t asize;	/* allocated size (0 = volatile buffer) */
 	size_t unit;	/* reallocation unit size (0 = read-only buffer) */
+	const struct buf_allocator *alloc;	/* memory functions (NULL = bufallocator()) */
 };
 
 /* CONST_BUF: global buffer from a string litteral */
@@ -56,12 +72,28 @@ struct buf {
 #define BUFPUTSL(output, literal) \
 	bufput(output, literal, sizeof literal - 1)
 
+/* bufsetallocator: memory functions for all buffers (NULL for the C library's);
+ * set it before any buffer is allocated */
+void bufsetallocator(const struct buf_allocator *);
+
+/* bufallocator: the memory functions in use */
+const struct buf_allocator *bufallocator(void);
+
+/* bufsetgrowth: growth policy for all buffers (BUF_GROW_GEOMETRIC by default) */
+void bufsetgrowth(bufgrowth_t);
+
+/* bufsetmaxsize: largest allocation a buffer may make (0 for no limit, the default) */
+void bufsetmaxsize(size_t);
+
 /* bufgrow: increasing the allocated size to the given value */
 int bufgrow(struct buf *, size_t);
 
 /* bufnew: allocation of a new buffer */
 struct buf *bufnew(size_t) __attribute__ ((malloc));
 
+/* bufnewalloc: allocation of a new buffer from the given memory functions */
+struct buf *bufnewalloc(size_t, const struct buf_allocator *) __attribute__ ((malloc));
+
 /* bufnullterm: NUL-termination of the string array (making a C-string) */
 const char *bufcstr(struct buf *);
 
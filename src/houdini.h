@@ -7,6 +7,11 @@ extern "C" {
 
 #include "buffer.h"
 
+/* value of each hex digit, HOUDINI_NOT_HEX for anything else */
+#define HOUDINI_NOT_HEX 0xFF
+extern const uint8_t houdini_hex_values[256];
+#define _hexval(c) (houdini_hex_values[(uint8_t)(c)])
+
 #ifdef HOUDINI_USE_LOCALE
 #	define _isxdigit(c) isxdigit(c)
 #	define _isdigit(c) isdigit(c)
@@ -14,7 +19,7 @@ extern "C" {
 /*
  * Helper _isdigit methods -- do not trust the current locale
  * */
-#	define _isxdigit(c) (strchr("0123456789ABCDEFabcdef", (c)) != NULL)
+#	define _isxdigit(c) (_hexval(c) != HOUDINI_NOT_HEX)
 #	define _isdigit(c) ((c) >= '0' && (c) <= '9')
 #endif
 
@@ -30,6 +35,42 @@ extern void houdini_unescape_url(struct buf *ob, const uint8_t *src, size_t size
 extern void houdini_escape_js(struct buf *ob, const uint8_t *src, size_t size);
 extern void houdini_unescape_js(struct buf *ob, const uint8_t *src, size_t size);
 
+/* houdini_escaped_size_*: exact size of the escaped output, without writing it */
+extern size_t houdini_escaped_size_html(const uint8_t *src, size_t size, int secure);
+extern size_t houdini_escaped_size_xml(const uint8_t *src, size_t size);
+extern size_t houdini_escaped_size_uri(const uint8_t *src, size_t size);
+extern size_t houdini_escaped_size_url(const uint8_t *src, size_t size);
+extern size_t houdini_escaped_size_href(const uint8_t *src, size_t size);
+extern size_t houdini_escaped_size_js(const uint8_t *src, size_t size);
+
+/* houdini_needs_*: whether the function would change the input at all;
+ * when it wouldn't, callers can keep using the input as it is */
+extern int houdini_needs_escape_html(const uint8_t *src, size_t size, int secure);
+extern int houdini_needs_unescape_html(const uint8_t *src, size_t size);
+extern int houdini_needs_escape_xml(const uint8_t *src, size_t size);
+extern int houdini_needs_escape_uri(const uint8_t *src, size_t size);
+extern int houdini_needs_escape_url(const uint8_t *src, size_t size);
+extern int houdini_needs_escape_href(const uint8_t *src, size_t size);
+extern int houdini_needs_unescape_uri(const uint8_t *src, size_t size);
+extern int houdini_needs_unescape_url(const uint8_t *src, size_t size);
+extern int houdini_needs_escape_js(const uint8_t *src, size_t size);
+extern int houdini_needs_unescape_js(const uint8_t *src, size_t size);
+
+/* houdini_lazy_*: the functions above in the same pass as that check,
+ * writing nothing and returning 0 when the input would come out the same;
+ * callers keep the input then, instead of a copy of it. They return 1 once
+ * the output is written, and -1 if it couldn't be allocated */
+extern int houdini_lazy_escape_html(struct buf *ob, const uint8_t *src, size_t size, int secure);
+extern int houdini_lazy_unescape_html(struct buf *ob, const uint8_t *src, size_t size);
+extern int houdini_lazy_escape_xml(struct buf *ob, const uint8_t *src, size_t size);
+extern int houdini_lazy_escape_uri(struct buf *ob, const uint8_t *src, size_t size);
+extern int houdini_lazy_escape_url(struct buf *ob, const uint8_t *src, size_t size);
+extern int houdini_lazy_escape_href(struct buf *ob, const uint8_t *src, size_t size);
+extern int houdini_lazy_unescape_uri(struct buf *ob, const uint8_t *src, size_t size);
+extern int houdini_lazy_unescape_url(struct buf *ob, const uint8_t *src, size_t size);
+extern int houdini_lazy_escape_js(struct buf *ob, const uint8_t *src, size_t size);
+extern int houdini_lazy_unescape_js(struct buf *ob, const uint8_t *src, size_t size);
+
 #ifdef __cplusplus
 }
 #endif
@@ -3,8 +3,7 @@
 #include <string.h>
 
 #include "houdini.h"
-
-#define ESCAPE_GROW_FACTOR(x) (((x) * 12) / 10)
+#include "houdini_simd.h"
 
 /*
  * The following characters will not be escaped:
@@ -50,40 +49,155 @@ static const char HREF_SAFE[] = {
 	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
 };
 
-void
-houdini_escape_href(struct buf *ob, const uint8_t *src, size_t size)
+#ifdef HOUDINI_SIMD
+/* href_mask • lanes of `v` that are not HREF_SAFE */
+static inline unsigned int
+href_mask(hd_vec v)
+{
+	/* everything outside '!'..'z' is unsafe, and so are these few in between */
+	unsigned int mask = ~hd_mask(hd_range(v, '!', 'z')) & 0xFFFF;
+
+	return mask | hd_mask(hd_or(
+		hd_or(hd_eq(v, '"'), hd_range(v, '&', '\'')),
+		hd_or(hd_or(hd_eq(v, '<'), hd_eq(v, '>')),
+			hd_or(hd_range(v, '[', '^'), hd_eq(v, '`')))));
+}
+#endif
+
+/* href_skip • returns the index of the first byte at or after `i`
+ * that is not HREF_SAFE */
+static inline size_t
+href_skip(const uint8_t *src, size_t i, size_t size)
+{
+#ifdef HOUDINI_SIMD
+	for (; i + HD_VEC_SIZE <= size; i += HD_VEC_SIZE) {
+		unsigned int mask = href_mask(hd_load(src + i));
+		if (mask)
+			return i + hd_ctz(mask);
+	}
+#endif
+	while (i < size && HREF_SAFE[src[i]] != 0)
+		i++;
+
+	return i;
+}
+
+/* escaped_size • size of the escaped output, given that the
+ * first `i` bytes of the input need no escaping */
+static size_t
+escaped_size(const uint8_t *src, size_t i, size_t size)
+{
+	size_t total = size;
+
+#ifdef HOUDINI_SIMD
+	for (; i + HD_VEC_SIZE <= size; i += HD_VEC_SIZE) {
+		hd_vec v = hd_load(src + i);
+		unsigned int mask = href_mask(v);
+
+		if (!mask)
+			continue;
+
+		/* %XX by default, &amp; and &#x27; for the two entities */
+		total += 2 * hd_popcount(mask);
+		total += 2 * hd_popcount(hd_mask(hd_eq(v, '&')));
+		total += 3 * hd_popcount(hd_mask(hd_eq(v, '\'')));
+	}
+#endif
+	for (; i < size; ++i) {
+		if (HREF_SAFE[src[i]] != 0)
+			continue;
+
+		switch (src[i]) {
+		case '&':
+			total += 4;
+			break;
+
+		case '\'':
+			total += 5;
+			break;
+
+		default:
+			total += 2;
+		}
+	}
+
+	return total;
+}
+
+int
+houdini_needs_escape_href(const uint8_t *src, size_t size)
+{
+	return href_skip(src, 0, size) < size;
+}
+
+size_t
+houdini_escaped_size_href(const uint8_t *src, size_t size)
+{
+	return escaped_size(src, 0, size);
+}
+
+int
+houdini_lazy_escape_href(struct buf *ob, const uint8_t *src, size_t size)
 {
 	static const char hex_chars[] = "0123456789ABCDEF";
-	size_t  i = 0, org;
-	char hex_str[3];
+	size_t  i;
+	uint8_t *out;
 
-	bufgrow(ob, ESCAPE_GROW_FACTOR(size));
-	hex_str[0] = '%';
+	/* nothing to escape: leave the input to the caller */
+	i = href_skip(src, 0, size);
+	if (i >= size)
+		return 0;
 
+	/* size the output exactly, then write it in a single pass */
+	if (!ob || bufgrow(ob, ob->size + escaped_size(src, i, size)) < 0)
+		return -1;
+
+	out = ob->data + ob->size;
+	memcpy(out, src, i);
+	out += i;
+
+	/* escaping never shrinks the input: see houdini_escape_html0 */
 	while (i < size) {
-		org = i;
-		while (i < size && HREF_SAFE[src[i]] != 0)
-			i++;
+#ifdef HOUDINI_SIMD
+		if (i + HD_VEC_SIZE <= size) {
+			hd_vec v = hd_load(src + i);
+			unsigned int mask = href_mask(v);
 
-		if (i > org)
-			bufput(ob, src + org, i - org);
+			hd_store(out, v);
 
-		/* escaping */
-		if (i >= size)
-			break;
+			if (!mask) {
+				out += HD_VEC_SIZE;
+				i += HD_VEC_SIZE;
+				continue;
+			}
+
+			out += hd_ctz(mask);
+			i += hd_ctz(mask);
+		} else
+#endif
+		{
+			while (i < size && HREF_SAFE[src[i]] != 0)
+				*out++ = src[i++];
+
+			/* escaping */
+			if (i >= size)
+				break;
+		}
 
 		switch (src[i]) {
 		/* amp appears all the time in URLs, but needs
 		 * HTML-entity escaping to be inside an href */
 		case '&': 
-			BUFPUTSL(ob, "&amp;");
+			memcpy(out, "&amp;", 5);
+			out += 5;
 			break;
 
 		/* the single quote is a valid URL character
 		 * according to the standard; it needs HTML
 		 * entity escaping too */
 		case '\'':
-			BUFPUTSL(ob, "&#x27;");
+			memcpy(out, "&#x27;", 6);
+			out += 6;
 			break;
 		
 		/* the space can be escaped to %20 or a plus
@@ -92,17 +206,28 @@ houdini_escape_href(struct buf *ob, const uint8_t *src, size_t size)
 		 * when building GET strings */
 #if 0
 		case ' ':
-			bufputc(ob, '+');
+			*out++ = '+';
 			break;
 #endif
 
 		/* every other character goes with a %XX escaping */
 		default:
-			hex_str[1] = hex_chars[(src[i] >> 4) & 0xF];
-			hex_str[2] = hex_chars[src[i] & 0xF];
-			bufput(ob, hex_str, 3);
+			out[0] = '%';
+			out[1] = hex_chars[(src[i] >> 4) & 0xF];
+			out[2] = hex_chars[src[i] & 0xF];
+			out += 3;
 		}
 
 		i++;
 	}
+
+	ob->size = out - ob->data;
+	return 1;
+}
+
+void
+houdini_escape_href(struct buf *ob, const uint8_t *src, size_t size)
+{
+	if (!houdini_lazy_escape_href(ob, src, size))
+		bufput(ob, src, size);
 }
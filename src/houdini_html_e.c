@@ -3,8 +3,7 @@
 #include <string.h>
 
 #include "houdini.h"
-
-#define ESCAPE_GROW_FACTOR(x) (((x) * 12) / 10) /* this is very scientific, yes */
+#include "houdini_simd.h"
 
 /**
  * According to the OWASP rules:
@@ -36,44 +35,181 @@ static const char HTML_ESCAPE_TABLE[] = {
 	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
 };
 
-static const char *HTML_ESCAPES[] = {
-        "",
-        "&quot;",
-        "&amp;",
-        "&#39;",
-        "&#47;",
-        "&lt;",
-        "&gt;"
+#define HTML_ESC(str) { str, sizeof str - 1 }
+
+static const struct {
+	const char *str;
+	size_t len;
+} HTML_ESCAPES[] = {
+	HTML_ESC(""),
+	HTML_ESC("&quot;"),
+	HTML_ESC("&amp;"),
+	HTML_ESC("&#39;"),
+	HTML_ESC("&#47;"),
+	HTML_ESC("&lt;"),
+	HTML_ESC("&gt;")
 };
 
-void
-houdini_escape_html0(struct buf *ob, const uint8_t *src, size_t size, int secure)
+#ifdef HOUDINI_SIMD
+/* html_mask • lanes of `v` that appear in HTML_ESCAPE_TABLE */
+static inline unsigned int
+html_mask(hd_vec v)
+{
+	return hd_mask(hd_or(
+		hd_or(hd_eq(v, '"'), hd_range(v, '&', '\'')),
+		hd_or(hd_eq(v, '/'), hd_or(hd_eq(v, '<'), hd_eq(v, '>')))));
+}
+#endif
+
+/* html_skip • returns the index of the first byte at or after `i`
+ * that appears in HTML_ESCAPE_TABLE */
+static inline size_t
+html_skip(const uint8_t *src, size_t i, size_t size)
+{
+#ifdef HOUDINI_SIMD
+	for (; i + HD_VEC_SIZE <= size; i += HD_VEC_SIZE) {
+		unsigned int mask = html_mask(hd_load(src + i));
+		if (mask)
+			return i + hd_ctz(mask);
+	}
+#endif
+	while (i < size && HTML_ESCAPE_TABLE[src[i]] == 0)
+		i++;
+
+	return i;
+}
+
+/* html_clean • like html_skip, but steps over the forward slashes
+ * that are left alone outside of secure mode */
+static inline size_t
+html_clean(const uint8_t *src, size_t i, size_t size, int secure)
+{
+	i = html_skip(src, i, size);
+
+	while (!secure && i < size && src[i] == '/')
+		i = html_skip(src, i + 1, size);
+
+	return i;
+}
+
+/* escaped_size • size of the escaped output, given that the
+ * first `i` bytes of the input need no escaping */
+static size_t
+escaped_size(const uint8_t *src, size_t i, size_t size, int secure)
 {
-	size_t  i = 0, org, esc = 0;
+	size_t total = size;
 
-	bufgrow(ob, ESCAPE_GROW_FACTOR(size));
+#ifdef HOUDINI_SIMD
+	for (; i + HD_VEC_SIZE <= size; i += HD_VEC_SIZE) {
+		hd_vec v = hd_load(src + i);
 
+		if (!html_mask(v))
+			continue;
+
+		total += 5 * hd_popcount(hd_mask(hd_eq(v, '"')));
+		total += 4 * hd_popcount(hd_mask(hd_range(v, '&', '\'')));
+		total += 3 * hd_popcount(hd_mask(hd_or(hd_eq(v, '<'), hd_eq(v, '>'))));
+
+		/* The forward slash is only escaped in secure mode */
+		if (secure)
+			total += 4 * hd_popcount(hd_mask(hd_eq(v, '/')));
+	}
+#endif
+	for (; i < size; ++i) {
+		if (HTML_ESCAPE_TABLE[src[i]] == 0 || (src[i] == '/' && !secure))
+			continue;
+
+		total += HTML_ESCAPES[(int)HTML_ESCAPE_TABLE[src[i]]].len - 1;
+	}
+
+	return total;
+}
+
+int
+houdini_needs_escape_html(const uint8_t *src, size_t size, int secure)
+{
+	return html_clean(src, 0, size, secure) < size;
+}
+
+size_t
+houdini_escaped_size_html(const uint8_t *src, size_t size, int secure)
+{
+	return escaped_size(src, 0, size, secure);
+}
+
+int
+houdini_lazy_escape_html(struct buf *ob, const uint8_t *src, size_t size, int secure)
+{
+	size_t  i, esc, k;
+	uint8_t *out;
+
+	/* nothing to escape: leave the input to the caller */
+	i = html_clean(src, 0, size, secure);
+	if (i >= size)
+		return 0;
+
+	/* size the output exactly, then write it in a single pass */
+	if (!ob || bufgrow(ob, ob->size + escaped_size(src, i, size, secure)) < 0)
+		return -1;
+
+	out = ob->data + ob->size;
+	memcpy(out, src, i);
+	out += i;
+
+	/*
+	 * Escaping never shrinks the input, so while there are 16 bytes
+	 * of input left there are at least 16 bytes of room left in the
+	 * output, and whole blocks can be stored before they are known
+	 * to be clean.
+	 */
 	while (i < size) {
-		org = i;
-		while (i < size && (esc = HTML_ESCAPE_TABLE[src[i]]) == 0)
-			i++;
+#ifdef HOUDINI_SIMD
+		if (i + HD_VEC_SIZE <= size) {
+			hd_vec v = hd_load(src + i);
+			unsigned int mask = html_mask(v);
+
+			hd_store(out, v);
 
-		if (i > org)
-			bufput(ob, src + org, i - org);
+			if (!mask) {
+				out += HD_VEC_SIZE;
+				i += HD_VEC_SIZE;
+				continue;
+			}
 
-		/* escaping */
-		if (i >= size)
-			break;
+			out += hd_ctz(mask);
+			i += hd_ctz(mask);
+		} else
+#endif
+		{
+			while (i < size && HTML_ESCAPE_TABLE[src[i]] == 0)
+				*out++ = src[i++];
+
+			/* escaping */
+			if (i >= size)
+				break;
+		}
 
 		/* The forward slash is only escaped in secure mode */
 		if (src[i] == '/' && !secure) {
-			bufputc(ob, '/');
+			*out++ = '/';
 		} else {
-			bufputs(ob, HTML_ESCAPES[esc]);
+			esc = HTML_ESCAPE_TABLE[src[i]];
+			for (k = 0; k < HTML_ESCAPES[esc].len; ++k)
+				*out++ = HTML_ESCAPES[esc].str[k];
 		}
 
 		i++;
 	}
+
+	ob->size = out - ob->data;
+	return 1;
+}
+
+void
+houdini_escape_html0(struct buf *ob, const uint8_t *src, size_t size, int secure)
+{
+	if (!houdini_lazy_escape_html(ob, src, size, secure))
+		bufput(ob, src, size);
 }
 
 void
@@ -4,6 +4,7 @@
 
 #include "houdini.h"
 #include "html_unescape.h"
+#include "houdini_simd.h"
 
 #define UNESCAPE_GROW_FACTOR(x) (x) /* unescaping shouldn't grow our buffer */
 
@@ -56,7 +57,7 @@ unescape_ent(struct buf *ob, const uint8_t *src, size_t size)
 
 		else if (src[1] == 'x' || src[1] == 'X') {
 			for (i = 2; i < size && _isxdigit(src[i]); ++i)
-				codepoint = (codepoint * 16) + ((src[i] | 32) % 39 - 9);
+				codepoint = (codepoint * 16) + _hexval(src[i]);
 		}
 
 		if (i < size && src[i] == ';') {
@@ -90,17 +91,48 @@ unescape_ent(struct buf *ob, const uint8_t *src, size_t size)
 	return 0;
 }
 
-void
-houdini_unescape_html(struct buf *ob, const uint8_t *src, size_t size)
+/* unescape_skip • returns the index of the first ampersand at or after `i` */
+static inline size_t
+unescape_skip(const uint8_t *src, size_t i, size_t size)
+{
+#ifdef HOUDINI_SIMD
+	for (; i + HD_VEC_SIZE <= size; i += HD_VEC_SIZE) {
+		unsigned int mask = hd_mask(hd_eq(hd_load(src + i), '&'));
+		if (mask)
+			return i + hd_ctz(mask);
+	}
+#endif
+	while (i < size && src[i] != '&')
+		i++;
+
+	return i;
+}
+
+int
+houdini_needs_unescape_html(const uint8_t *src, size_t size)
 {
-	size_t  i = 0, org;
+	return unescape_skip(src, 0, size) < size;
+}
 
-	bufgrow(ob, UNESCAPE_GROW_FACTOR(size));
+int
+houdini_lazy_unescape_html(struct buf *ob, const uint8_t *src, size_t size)
+{
+	size_t  i, org;
+
+	/* nothing to unescape: leave the input to the caller */
+	i = unescape_skip(src, 0, size);
+	if (i >= size)
+		return 0;
+
+	/* entities never decode to more bytes than they take */
+	if (bufgrow(ob, ob->size + UNESCAPE_GROW_FACTOR(size)) < 0)
+		return -1;
+
+	bufput(ob, src, i);
 
 	while (i < size) {
 		org = i;
-		while (i < size && src[i] != '&')
-			i++;
+		i = unescape_skip(src, i, size);
 
 		if (i > org)
 			bufput(ob, src + org, i - org);
@@ -112,5 +144,14 @@ houdini_unescape_html(struct buf *ob, const uint8_t *src, size_t size)
 		i++;
 		i += unescape_ent(ob, src + i, size - i);
 	}
+
+	return 1;
+}
+
+void
+houdini_unescape_html(struct buf *ob, const uint8_t *src, size_t size)
+{
+	if (!houdini_lazy_unescape_html(ob, src, size))
+		bufput(ob, src, size);
 }
 
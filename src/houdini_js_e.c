@@ -3,8 +3,7 @@
 #include <string.h>
 
 #include "houdini.h"
-
-#define ESCAPE_GROW_FACTOR(x) (((x) * 12) / 10)
+#include "houdini_simd.h"
 
 static const char JS_ESCAPE[] = {
 	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 1, 0, 0, 
@@ -25,24 +24,156 @@ static const char JS_ESCAPE[] = {
 	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
 };
 
-void
-houdini_escape_js(struct buf *ob, const uint8_t *src, size_t size)
+#ifdef HOUDINI_SIMD
+/* js_mask • lanes of `v` that appear in JS_ESCAPE */
+static inline unsigned int
+js_mask(hd_vec v)
 {
-	size_t  i = 0, org, ch;
+	return hd_mask(hd_or(
+		hd_or(hd_or(hd_eq(v, '\n'), hd_eq(v, '\r')), hd_eq(v, '"')),
+		hd_or(hd_or(hd_eq(v, '\''), hd_eq(v, '/')), hd_eq(v, '\\'))));
+}
+#endif
 
-	bufgrow(ob, ESCAPE_GROW_FACTOR(size));
+/* js_skip • returns the index of the first byte at or after `i`
+ * that appears in JS_ESCAPE */
+static inline size_t
+js_skip(const uint8_t *src, size_t i, size_t size)
+{
+#ifdef HOUDINI_SIMD
+	for (; i + HD_VEC_SIZE <= size; i += HD_VEC_SIZE) {
+		unsigned int mask = js_mask(hd_load(src + i));
+		if (mask)
+			return i + hd_ctz(mask);
+	}
+#endif
+	while (i < size && JS_ESCAPE[src[i]] == 0)
+		i++;
 
+	return i;
+}
+
+/* js_clean • like js_skip, but steps over the forward slashes
+ * that are not preceded by a lt */
+static inline size_t
+js_clean(const uint8_t *src, size_t i, size_t size)
+{
+	i = js_skip(src, i, size);
+
+	while (i < size && src[i] == '/' && !(i && src[i - 1] == '<'))
+		i = js_skip(src, i + 1, size);
+
+	return i;
+}
+
+/* escaped_growth • extra output bytes for the character at `i`
+ *
+ * A \r\n pair collapses into a single \n escape, so it grows by
+ * nothing: the \n accounts for one byte and the \r gives it back. */
+static inline int
+escaped_growth(const uint8_t *src, size_t i, size_t size)
+{
+	switch (src[i]) {
+	case '/':
+		return (i && src[i - 1] == '<');
+
+	case '\r':
+		return (i + 1 < size && src[i + 1] == '\n') ? -1 : 1;
+
+	default:
+		return JS_ESCAPE[src[i]];
+	}
+}
+
+/* escaped_size • size of the escaped output, given that the
+ * first `i` bytes of the input need no escaping */
+static size_t
+escaped_size(const uint8_t *src, size_t i, size_t size)
+{
+	size_t total = size;
+
+#ifdef HOUDINI_SIMD
+	for (; i + HD_VEC_SIZE <= size; i += HD_VEC_SIZE) {
+		hd_vec v = hd_load(src + i);
+		unsigned int ctx;
+
+		/* these always take a backslash */
+		total += hd_popcount(hd_mask(hd_or(
+			hd_or(hd_eq(v, '\n'), hd_eq(v, '"')),
+			hd_or(hd_eq(v, '\''), hd_eq(v, '\\')))));
+
+		/* these depend on their neighbours */
+		ctx = hd_mask(hd_or(hd_eq(v, '/'), hd_eq(v, '\r')));
+		while (ctx) {
+			total += escaped_growth(src, i + hd_ctz(ctx), size);
+			ctx &= ctx - 1;
+		}
+	}
+#endif
+	for (; i < size; ++i)
+		total += escaped_growth(src, i, size);
+
+	return total;
+}
+
+int
+houdini_needs_escape_js(const uint8_t *src, size_t size)
+{
+	return js_clean(src, 0, size) < size;
+}
+
+size_t
+houdini_escaped_size_js(const uint8_t *src, size_t size)
+{
+	return escaped_size(src, 0, size);
+}
+
+int
+houdini_lazy_escape_js(struct buf *ob, const uint8_t *src, size_t size)
+{
+	size_t  i, ch;
+	uint8_t *out;
+
+	/* nothing to escape: leave the input to the caller */
+	i = js_clean(src, 0, size);
+	if (i >= size)
+		return 0;
+
+	/* size the output exactly, then write it in a single pass */
+	if (!ob || bufgrow(ob, ob->size + escaped_size(src, i, size)) < 0)
+		return -1;
+
+	out = ob->data + ob->size;
+	memcpy(out, src, i);
+	out += i;
+
+	/* escaping never shrinks the input: see houdini_escape_html0 */
 	while (i < size) {
-		org = i;
-		while (i < size && JS_ESCAPE[src[i]] == 0)
-			i++;
+#ifdef HOUDINI_SIMD
+		if (i + HD_VEC_SIZE <= size) {
+			hd_vec v = hd_load(src + i);
+			unsigned int mask = js_mask(v);
 
-		if (i > org)
-			bufput(ob, src + org, i - org);
+			hd_store(out, v);
 
-		/* escaping */
-		if (i >= size)
-			break;
+			if (!mask) {
+				out += HD_VEC_SIZE;
+				i += HD_VEC_SIZE;
+				continue;
+			}
+
+			out += hd_ctz(mask);
+			i += hd_ctz(mask);
+		} else
+#endif
+		{
+			while (i < size && JS_ESCAPE[src[i]] == 0)
+				*out++ = src[i++];
+
+			/* escaping */
+			if (i >= size)
+				break;
+		}
 
 		ch = src[i];
 		
@@ -52,9 +183,9 @@ houdini_escape_js(struct buf *ob, const uint8_t *src, size_t size)
 			 * Escape only if preceded by a lt
 			 */
 			if (i && src[i - 1] == '<')
-				bufputc(ob, '\\');
+				*out++ = '\\';
 
-			bufputc(ob, ch);
+			*out++ = ch;
 			break;
 
 		case '\r':
@@ -73,12 +204,21 @@ houdini_escape_js(struct buf *ob, const uint8_t *src, size_t size)
 			/*
 			 * Normal escaping
 			 */
-			bufputc(ob, '\\');
-			bufputc(ob, ch);
+			*out++ = '\\';
+			*out++ = ch;
 			break;
 		}
 
 		i++;
 	}
+
+	ob->size = out - ob->data;
+	return 1;
 }
 
+void
+houdini_escape_js(struct buf *ob, const uint8_t *src, size_t size)
+{
+	if (!houdini_lazy_escape_js(ob, src, size))
+		bufput(ob, src, size);
+}
@@ -3,30 +3,67 @@
 #include <string.h>
 
 #include "houdini.h"
+#include "houdini_simd.h"
 
 #define UNESCAPE_GROW_FACTOR(x) (x)
 
-void
-houdini_unescape_js(struct buf *ob, const uint8_t *src, size_t size)
+/* unescape_skip • returns the index of the first backslash at or after `i` */
+static inline size_t
+unescape_skip(const uint8_t *src, size_t i, size_t size)
+{
+#ifdef HOUDINI_SIMD
+	for (; i + HD_VEC_SIZE <= size; i += HD_VEC_SIZE) {
+		unsigned int mask = hd_mask(hd_eq(hd_load(src + i), '\\'));
+		if (mask)
+			return i + hd_ctz(mask);
+	}
+#endif
+	while (i < size && src[i] != '\\')
+		i++;
+
+	return i;
+}
+
+int
+houdini_needs_unescape_js(const uint8_t *src, size_t size)
+{
+	return unescape_skip(src, 0, size) < size;
+}
+
+int
+houdini_lazy_unescape_js(struct buf *ob, const uint8_t *src, size_t size)
 {
-	size_t  i = 0, org, ch;
+	size_t  i, org, ch;
+	uint8_t *out;
 
-	bufgrow(ob, UNESCAPE_GROW_FACTOR(size));
+	/* nothing to unescape: leave the input to the caller */
+	i = unescape_skip(src, 0, size);
+	if (i >= size)
+		return 0;
+
+	/* unescaping never grows the input, so write straight into the buffer */
+	if (bufgrow(ob, ob->size + UNESCAPE_GROW_FACTOR(size)) < 0)
+		return -1;
+
+	out = ob->data + ob->size;
+	memcpy(out, src, i);
+	out += i;
 
 	while (i < size) {
 		org = i;
-		while (i < size && src[i] != '\\')
-			i++;
+		i = unescape_skip(src, i, size);
 
-		if (i > org)
-			bufput(ob, src + org, i - org);
+		if (i > org) {
+			memcpy(out, src + org, i - org);
+			out += i - org;
+		}
 
 		/* escaping */
 		if (i == size)
 			break;
 
 		if (++i == size) {
-			bufputc(ob, '\\');
+			*out++ = '\\';
 			break;
 		}
 
@@ -41,14 +78,23 @@ houdini_unescape_js(struct buf *ob, const uint8_t *src, size_t size)
 		case '\'':
 		case '\"':
 		case '/':
-			bufputc(ob, ch);
+			*out++ = ch;
 			i++;
 			break;
 
 		default:
-			bufputc(ob, '\\');
+			*out++ = '\\';
 			break;
 		}
 	}
+
+	ob->size = out - ob->data;
+	return 1;
 }
 
+void
+houdini_unescape_js(struct buf *ob, const uint8_t *src, size_t size)
+{
+	if (!houdini_lazy_unescape_js(ob, src, size))
+		bufput(ob, src, size);
+}
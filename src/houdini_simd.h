@@ -0,0 +1,74 @@
+#ifndef __HOUDINI_SIMD_H__
+#define __HOUDINI_SIMD_H__
+
+/*
+ * Vectorized helpers for the Houdini scanners.
+ *
+ * The [un]escapers spend most of their time skipping over runs of bytes
+ * that need no work at all. When SSE2 is available (always the case on
+ * x86-64) these helpers let a scanner test 16 bytes at a time, and only
+ * fall back to the byte-wise lookup tables for the tail of the input.
+ *
+ * Define HOUDINI_NO_SIMD to force the portable code paths.
+ */
+
+#include <stdint.h>
+
+#if !defined(HOUDINI_NO_SIMD) && \
+	(defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#	define HOUDINI_SIMD 1
+#endif
+
+#ifdef HOUDINI_SIMD
+#include <emmintrin.h>
+
+#define HD_VEC_SIZE 16
+
+typedef __m128i hd_vec;
+
+#define hd_load(p) _mm_loadu_si128((const __m128i *)(p))
+#define hd_store(p, v) _mm_storeu_si128((__m128i *)(p), (v))
+#define hd_or(a, b) _mm_or_si128((a), (b))
+#define hd_eq(v, c) _mm_cmpeq_epi8((v), _mm_set1_epi8((char)(c)))
+
+/* hd_mask: one bit per byte lane with the high bit set; applied to a
+ * comparison result it yields the lanes that matched, and applied to
+ * raw input it yields the non-ASCII bytes */
+#define hd_mask(v) ((unsigned int)_mm_movemask_epi8(v))
+
+/* hd_range: lanes whose unsigned value lies within [lo, hi] */
+static inline hd_vec
+hd_range(hd_vec v, uint8_t lo, uint8_t hi)
+{
+	hd_vec d = _mm_sub_epi8(v, _mm_set1_epi8((char)lo));
+	return _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8((char)(hi - lo))), d);
+}
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+static __inline unsigned int
+hd_ctz(unsigned int mask)
+{
+	unsigned long idx;
+	_BitScanForward(&idx, mask);
+	return (unsigned int)idx;
+}
+
+/* __popcnt needs the POPCNT instruction, which SSE2 doesn't promise;
+ * the masks have 16 bits, summed here in pairs, nibbles and bytes */
+static __inline unsigned int
+hd_popcount(unsigned int mask)
+{
+	mask = mask - ((mask >> 1) & 0x5555);
+	mask = (mask & 0x3333) + ((mask >> 2) & 0x3333);
+	mask = (mask + (mask >> 4)) & 0x0F0F;
+	return (mask + (mask >> 8)) & 0x1F;
+}
+#else
+#	define hd_ctz(mask) ((unsigned int)__builtin_ctz(mask))
+#	define hd_popcount(mask) ((unsigned int)__builtin_popcount(mask))
+#endif
+
+#endif /* HOUDINI_SIMD */
+
+#endif
@@ -3,8 +3,7 @@
 #include <string.h>
 
 #include "houdini.h"
-
-#define ESCAPE_GROW_FACTOR(x) (((x) * 12) / 10)
+#include "houdini_simd.h"
 
 static const char URL_SAFE[] = {
 	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 
@@ -44,51 +43,205 @@ static const char URI_SAFE[] = {
 	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
 };
 
-static void
+#ifdef HOUDINI_SIMD
+/* uri_mask • lanes of `v` that are not safe according to the given table */
+static inline unsigned int
+uri_mask(hd_vec v, int is_url)
+{
+	unsigned int mask;
+
+	if (is_url) {
+		/* only alphanumerics and -._ are safe */
+		mask = ~hd_mask(hd_or(
+			hd_or(hd_range(v, '0', '9'), hd_range(v, 'a', 'z')),
+			hd_or(hd_or(hd_range(v, 'A', 'Z'), hd_range(v, '-', '.')), hd_eq(v, '_'))));
+	} else {
+		/* everything outside '!'..'~' is unsafe, and so are these */
+		mask = ~hd_mask(hd_range(v, '!', '~'));
+		mask |= hd_mask(hd_or(
+			hd_or(hd_or(hd_range(v, '"', '#'), hd_eq(v, '%')),
+				hd_or(hd_eq(v, '<'), hd_eq(v, '>'))),
+			hd_or(hd_or(hd_eq(v, '\\'), hd_eq(v, '^')),
+				hd_or(hd_eq(v, '`'), hd_range(v, '{', '}')))));
+	}
+
+	return mask & 0xFFFF;
+}
+#endif
+
+/* uri_skip • returns the index of the first byte at or after `i`
+ * that is not safe according to the given table */
+static inline size_t
+uri_skip(const uint8_t *src, size_t i, size_t size, int is_url)
+{
+	const char *safe_table = is_url ? URL_SAFE : URI_SAFE;
+
+#ifdef HOUDINI_SIMD
+	for (; i + HD_VEC_SIZE <= size; i += HD_VEC_SIZE) {
+		unsigned int mask = uri_mask(hd_load(src + i), is_url);
+		if (mask)
+			return i + hd_ctz(mask);
+	}
+#endif
+	while (i < size && safe_table[src[i]] != 0)
+		i++;
+
+	return i;
+}
+
+/* escaped_size • size of the escaped output, given that the
+ * first `i` bytes of the input need no escaping */
+static size_t
+escaped_size(const uint8_t *src, size_t i, size_t size, int is_url)
+{
+	const char *safe_table = is_url ? URL_SAFE : URI_SAFE;
+	size_t total = size;
+
+#ifdef HOUDINI_SIMD
+	for (; i + HD_VEC_SIZE <= size; i += HD_VEC_SIZE) {
+		hd_vec v = hd_load(src + i);
+		unsigned int mask = uri_mask(v, is_url);
+
+		if (!mask)
+			continue;
+
+		/* everything becomes %XX, except for spaces in URLs */
+		if (is_url)
+			mask &= ~hd_mask(hd_eq(v, ' '));
+
+		total += 2 * hd_popcount(mask);
+	}
+#endif
+	for (; i < size; ++i) {
+		if (safe_table[src[i]] == 0 && (src[i] != ' ' || !is_url))
+			total += 2;
+	}
+
+	return total;
+}
+
+static int
 escape(struct buf *ob, const uint8_t *src, size_t size, int is_url)
 {
 	static const char hex_chars[] = "0123456789ABCDEF";
 	const char *safe_table = is_url ? URL_SAFE : URI_SAFE;
 
-	size_t  i = 0, org;
-	char hex_str[3];
+	size_t  i;
+	uint8_t *out;
+#ifdef HOUDINI_SIMD
+	unsigned int mask = 0;
+	size_t base = 0, limit = 0;
+#endif
+
+	/* nothing to escape: leave the input to the caller */
+	i = uri_skip(src, 0, size, is_url);
+	if (i >= size)
+		return 0;
+
+	/* size the output exactly, then write it in a single pass */
+	if (!ob || bufgrow(ob, ob->size + escaped_size(src, i, size, is_url)) < 0)
+		return -1;
 
-	bufgrow(ob, ESCAPE_GROW_FACTOR(size));
-	hex_str[0] = '%';
+	out = ob->data + ob->size;
+	memcpy(out, src, i);
+	out += i;
 
+	/* escaping never shrinks the input: see houdini_escape_html0 */
 	while (i < size) {
-		org = i;
-		while (i < size && safe_table[src[i]] != 0)
-			i++;
+#ifdef HOUDINI_SIMD
+		if (i + HD_VEC_SIZE <= size) {
+			unsigned int pending;
+			size_t run;
 
-		if (i > org)
-			bufput(ob, src + org, i - org);
+			if (i >= limit) {
+				mask = uri_mask(hd_load(src + i), is_url);
+				base = i;
+				limit = i + HD_VEC_SIZE;
+			}
 
-		/* escaping */
-		if (i >= size)
-			break;
+			hd_store(out, hd_load(src + i));
+
+			pending = mask >> (i - base);
+			run = pending ? hd_ctz(pending) : limit - i;
+			out += run;
+			i += run;
+
+			if (!pending)
+				continue;
+		} else
+#endif
+		{
+			while (i < size && safe_table[src[i]] != 0)
+				*out++ = src[i++];
+
+			/* escaping */
+			if (i >= size)
+				break;
+		}
 
 		if (src[i] == ' ' && is_url) {
-			bufputc(ob, '+');
+			*out++ = '+';
 		} else {
-			hex_str[1] = hex_chars[(src[i] >> 4) & 0xF];
-			hex_str[2] = hex_chars[src[i] & 0xF];
-			bufput(ob, hex_str, 3);
+			out[0] = '%';
+			out[1] = hex_chars[(src[i] >> 4) & 0xF];
+			out[2] = hex_chars[src[i] & 0xF];
+			out += 3;
 		}
 
 		i++;
 	}
+
+	ob->size = out - ob->data;
+	return 1;
+}
+
+int
+houdini_needs_escape_uri(const uint8_t *src, size_t size)
+{
+	return uri_skip(src, 0, size, 0) < size;
+}
+
+int
+houdini_needs_escape_url(const uint8_t *src, size_t size)
+{
+	return uri_skip(src, 0, size, 1) < size;
+}
+
+size_t
+houdini_escaped_size_uri(const uint8_t *src, size_t size)
+{
+	return escaped_size(src, 0, size, 0);
+}
+
+size_t
+houdini_escaped_size_url(const uint8_t *src, size_t size)
+{
+	return escaped_size(src, 0, size, 1);
+}
+
+int
+houdini_lazy_escape_uri(struct buf *ob, const uint8_t *src, size_t size)
+{
+	return escape(ob, src, size, 0);
+}
+
+int
+houdini_lazy_escape_url(struct buf *ob, const uint8_t *src, size_t size)
+{
+	return escape(ob, src, size, 1);
 }
 
 void
 houdini_escape_uri(struct buf *ob, const uint8_t *src, size_t size)
 {
-	return escape(ob, src, size, 0);
+	if (!escape(ob, src, size, 0))
+		bufput(ob, src, size);
 }
 
 void
 houdini_escape_url(struct buf *ob, const uint8_t *src, size_t size)
 {
-	return escape(ob, src, size, 1);
+	if (!escape(ob, src, size, 1))
+		bufput(ob, src, size);
 }
 
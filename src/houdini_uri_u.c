@@ -3,56 +3,144 @@
 #include <string.h>
 
 #include "houdini.h"
+#include "houdini_simd.h"
 
 #define UNESCAPE_GROW_FACTOR(x) (x)
-#define hex2c(c) ((c | 32) % 39 - 9)
 
-static void
+#define H 0xFF
+const uint8_t houdini_hex_values[256] = {
+	H, H, H, H, H, H, H, H, H, H, H, H, H, H, H, H,
+	H, H, H, H, H, H, H, H, H, H, H, H, H, H, H, H,
+	H, H, H, H, H, H, H, H, H, H, H, H, H, H, H, H,
+	0, 1, 2, 3, 4, 5, 6, 7, 8, 9, H, H, H, H, H, H,
+	H,10,11,12,13,14,15, H, H, H, H, H, H, H, H, H,
+	H, H, H, H, H, H, H, H, H, H, H, H, H, H, H, H,
+	H,10,11,12,13,14,15, H, H, H, H, H, H, H, H, H,
+	H, H, H, H, H, H, H, H, H, H, H, H, H, H, H, H,
+	H, H, H, H, H, H, H, H, H, H, H, H, H, H, H, H,
+	H, H, H, H, H, H, H, H, H, H, H, H, H, H, H, H,
+	H, H, H, H, H, H, H, H, H, H, H, H, H, H, H, H,
+	H, H, H, H, H, H, H, H, H, H, H, H, H, H, H, H,
+	H, H, H, H, H, H, H, H, H, H, H, H, H, H, H, H,
+	H, H, H, H, H, H, H, H, H, H, H, H, H, H, H, H,
+	H, H, H, H, H, H, H, H, H, H, H, H, H, H, H, H,
+	H, H, H, H, H, H, H, H, H, H, H, H, H, H, H, H,
+};
+#undef H
+
+/* unescape_skip • returns the index of the first '%' at or
+ * after `i`, or of the first '+' too when unescaping an URL */
+static inline size_t
+unescape_skip(const uint8_t *src, size_t i, size_t size, int is_url)
+{
+#ifdef HOUDINI_SIMD
+	for (; i + HD_VEC_SIZE <= size; i += HD_VEC_SIZE) {
+		hd_vec v = hd_load(src + i);
+		unsigned int mask = hd_mask(hd_eq(v, '%'));
+
+		if (is_url)
+			mask |= hd_mask(hd_eq(v, '+'));
+
+		if (mask)
+			return i + hd_ctz(mask);
+	}
+#endif
+	while (i < size && src[i] != '%' && (src[i] != '+' || !is_url))
+		i++;
+
+	return i;
+}
+
+static int
 unescape(struct buf *ob, const uint8_t *src, size_t size, int is_url)
 {
-	size_t  i = 0, org;
+	size_t  i, org;
+	uint8_t *out;
 
-	bufgrow(ob, UNESCAPE_GROW_FACTOR(size));
+	/* nothing to unescape: leave the input to the caller */
+	i = unescape_skip(src, 0, size, is_url);
+	if (i >= size)
+		return 0;
+
+	/* unescaping never grows the input, so write straight into the buffer */
+	if (bufgrow(ob, ob->size + UNESCAPE_GROW_FACTOR(size)) < 0)
+		return -1;
+
+	out = ob->data + ob->size;
+	memcpy(out, src, i);
+	out += i;
 
 	while (i < size) {
 		org = i;
-		while (i < size && src[i] != '%')
-			i++;
+		i = unescape_skip(src, i, size, is_url);
 
-		if (i > org)
-			bufput(ob, src + org, i - org);
+		if (i > org) {
+			memcpy(out, src + org, i - org);
+			out += i - org;
+		}
 
 		/* escaping */
 		if (i >= size)
 			break;
 
-		i++;
+		if (src[i++] == '+') {
+			*out++ = ' ';
+			continue;
+		}
 
 		if (i + 1 < size && _isxdigit(src[i]) && _isxdigit(src[i + 1])) {
-			unsigned char new_char = (hex2c(src[i]) << 4) + hex2c(src[i + 1]);
-			bufputc(ob, new_char);
+			unsigned char new_char = (_hexval(src[i]) << 4) + _hexval(src[i + 1]);
+
+			/* URLs turn every plus into a space, even an escaped one */
+			if (new_char == '+' && is_url)
+				new_char = ' ';
+
+			*out++ = new_char;
 			i += 2;
 		} else {
-			bufputc(ob, '%');
+			*out++ = '%';
 		}
 	}
 
-	if (is_url) {
-		char *find = (char *)bufcstr(ob);
-		while ((find = strchr(find, '+')) != NULL)
-			*find = ' ';
-	}
+	ob->size = out - ob->data;
+	return 1;
+}
+
+int
+houdini_needs_unescape_uri(const uint8_t *src, size_t size)
+{
+	return unescape_skip(src, 0, size, 0) < size;
+}
+
+int
+houdini_needs_unescape_url(const uint8_t *src, size_t size)
+{
+	return unescape_skip(src, 0, size, 1) < size;
+}
+
+int
+houdini_lazy_unescape_uri(struct buf *ob, const uint8_t *src, size_t size)
+{
+	return unescape(ob, src, size, 0);
+}
+
+int
+houdini_lazy_unescape_url(struct buf *ob, const uint8_t *src, size_t size)
+{
+	return unescape(ob, src, size, 1);
 }
 
 void
 houdini_unescape_uri(struct buf *ob, const uint8_t *src, size_t size)
 {
-	return unescape(ob, src, size, 0);
+	if (!unescape(ob, src, size, 0))
+		bufput(ob, src, size);
 }
 
 void
 houdini_unescape_url(struct buf *ob, const uint8_t *src, size_t size)
 {
-	return unescape(ob, src, size, 1);
+	if (!unescape(ob, src, size, 1))
+		bufput(ob, src, size);
 }
 
@@ -3,8 +3,7 @@
 #include <string.h>
 
 #include "houdini.h"
-
-#define ESCAPE_GROW_FACTOR(x) (((x) * 12) / 10) /* this is very scientific, yes */
+#include "houdini_simd.h"
 
 /**
  * & --> &amp;
@@ -13,18 +12,23 @@
  * " --> &quot;
  * ' --> &apos;
  */
-static const char *LOOKUP_CODES[] = {
-	"", /* reserved: use literal single character */
-	"", /* unused */
-	"", /* reserved: 2 character UTF-8 */
-	"", /* reserved: 3 character UTF-8 */
-	"", /* reserved: 4 character UTF-8 */
-	"?", /* invalid UTF-8 character */
-	"&quot;",
-	"&amp;",
-	"&apos;",
-	"&lt;",
-	"&gt;"
+#define XML_CODE(str) { str, sizeof str - 1 }
+
+static const struct {
+	const char *str;
+	size_t len;
+} LOOKUP_CODES[] = {
+	XML_CODE(""), /* reserved: use literal single character */
+	XML_CODE(""), /* unused */
+	XML_CODE(""), /* reserved: 2 character UTF-8 */
+	XML_CODE(""), /* reserved: 3 character UTF-8 */
+	XML_CODE(""), /* reserved: 4 character UTF-8 */
+	XML_CODE("?"), /* invalid UTF-8 character */
+	XML_CODE("&quot;"),
+	XML_CODE("&amp;"),
+	XML_CODE("&apos;"),
+	XML_CODE("&lt;"),
+	XML_CODE("&gt;")
 };
 
 static const char CODE_INVALID = 5;
@@ -62,75 +66,181 @@ static const char XML_LOOKUP_TABLE[] = {
 	5, 5, 5, 5, 5, 5, 5, 5,
 };
 
-void
-houdini_escape_xml(struct buf *ob, const uint8_t *src, size_t size)
+/* xml_skip • returns the index of the first byte at or after `i`
+ * that has a lookup code, i.e. needs escaping or UTF-8 validation */
+static inline size_t
+xml_skip(const uint8_t *src, size_t i, size_t size)
 {
-	size_t i = 0;
-	unsigned char code = 0;
+#ifdef HOUDINI_SIMD
+	for (; i + HD_VEC_SIZE <= size; i += HD_VEC_SIZE) {
+		hd_vec v = hd_load(src + i);
+		unsigned int mask;
 
-	bufgrow(ob, ESCAPE_GROW_FACTOR(size));
+		/* non-ASCII bytes always take the slow path */
+		mask = hd_mask(v);
 
-	while (i < size) {
-		size_t start, end;
+		/* control characters, except for tab, LF and CR */
+		mask |= hd_mask(hd_range(v, 0x00, 0x1F)) &
+			~hd_mask(hd_or(hd_range(v, '\t', '\n'), hd_eq(v, '\r')));
 
-		start = end = i;
+		mask |= hd_mask(hd_or(
+			hd_or(hd_eq(v, '"'), hd_range(v, '&', '\'')),
+			hd_or(hd_eq(v, '<'), hd_eq(v, '>'))));
 
-		while (i < size) {
-			unsigned int byte;
+		if (mask)
+			return i + hd_ctz(mask);
+	}
+#endif
+	while (i < size && XML_LOOKUP_TABLE[src[i]] == 0)
+		i++;
 
-			byte = src[i++];
-			code = XML_LOOKUP_TABLE[byte];
+	return i;
+}
 
-			if (!code) {
-				/* single character used literally */
-			} else if (code >= CODE_INVALID) {
-				break; /* insert lookup code string */
-			} else if (code > size - end) {
-				code = CODE_INVALID; /* truncated UTF-8 character */
-				break;
-			} else {
-				unsigned int chr = byte & (0xff >> code);
+/* xml_scan • finds the end of the literal run starting at `i`, which
+ * includes any valid UTF-8 sequences. When the run ends before `size`,
+ * `*code` is set to the lookup code to emit and `*next` to the index
+ * where scanning resumes */
+static size_t
+xml_scan(const uint8_t *src, size_t i, size_t size, unsigned char *code_out, size_t *next)
+{
+	size_t end = i;
+	unsigned char code = 0;
 
-				while (--code) {
-					byte = src[i++];
-					if ((byte & 0xc0) != 0x80) {
-						code = CODE_INVALID;
-						break;
-					}
-					chr = (chr << 6) + (byte & 0x3f);
-				}
+	while (i < size) {
+		unsigned int byte;
+
+		i = end = xml_skip(src, i, size);
+		if (i >= size)
+			break;
+
+		byte = src[i++];
+		code = XML_LOOKUP_TABLE[byte];
 
-				switch (i - end) {
-					case 2:
-						if (chr < 0x80)
-							code = CODE_INVALID;
-						break;
-					case 3:
-						if (chr < 0x800 ||
-						    (chr > 0xd7ff && chr < 0xe000) ||
-							chr > 0xfffd)
-							code = CODE_INVALID;
-						break;
-					case 4:
-						if (chr < 0x10000 || chr > 0x10ffff)
-							code = CODE_INVALID;
-						break;
-					default:
-						break;
+		if (code >= CODE_INVALID) {
+			break; /* insert lookup code string */
+		} else if (code > size - end) {
+			code = CODE_INVALID; /* truncated UTF-8 character */
+			break;
+		} else {
+			unsigned int chr = byte & (0xff >> code);
+
+			while (--code) {
+				byte = src[i++];
+				if ((byte & 0xc0) != 0x80) {
+					code = CODE_INVALID;
+					break;
 				}
-				if (code == CODE_INVALID)
+				chr = (chr << 6) + (byte & 0x3f);
+			}
+
+			switch (i - end) {
+				case 2:
+					if (chr < 0x80)
+						code = CODE_INVALID;
+					break;
+				case 3:
+					if (chr < 0x800 ||
+					    (chr > 0xd7ff && chr < 0xe000) ||
+						chr > 0xfffd)
+						code = CODE_INVALID;
+					break;
+				case 4:
+					if (chr < 0x10000 || chr > 0x10ffff)
+						code = CODE_INVALID;
+					break;
+				default:
 					break;
 			}
-			end = i;
+			if (code == CODE_INVALID)
+				break;
 		}
+		end = i;
+	}
+
+	*code_out = code;
+	*next = i;
+	return end;
+}
 
-		if (end > start)
-			bufput(ob, src + start, end - start);
+static size_t
+escaped_size(const uint8_t *src, size_t i, size_t size)
+{
+	size_t start, end, total = i;
+	unsigned char code;
+
+	while (i < size) {
+		start = i;
+		end = xml_scan(src, start, size, &code, &i);
+		total += end - start;
+		if (end >= size)
+			break;
+		total += LOOKUP_CODES[code].len;
+	}
+
+	return total;
+}
+
+int
+houdini_needs_escape_xml(const uint8_t *src, size_t size)
+{
+	unsigned char code;
+	size_t next;
+
+	return xml_scan(src, 0, size, &code, &next) < size;
+}
+
+size_t
+houdini_escaped_size_xml(const uint8_t *src, size_t size)
+{
+	return escaped_size(src, 0, size);
+}
+
+int
+houdini_lazy_escape_xml(struct buf *ob, const uint8_t *src, size_t size)
+{
+	size_t i, start, end;
+	unsigned char code = 0;
+	uint8_t *out;
+
+	/* nothing to escape: leave the input to the caller */
+	start = xml_scan(src, 0, size, &code, &i);
+	if (start >= size)
+		return 0;
+
+	/* size the output exactly, then write it in a single pass */
+	if (!ob || bufgrow(ob, ob->size + escaped_size(src, start, size)) < 0)
+		return -1;
+
+	out = ob->data + ob->size;
+	memcpy(out, src, start);
+	out += start;
+	i = start;
+
+	while (i < size) {
+		start = i;
+		end = xml_scan(src, start, size, &code, &i);
+
+		if (end > start) {
+			memcpy(out, src + start, end - start);
+			out += end - start;
+		}
 
 		/* escaping */
 		if (end >= size)
 			break;
 
-		bufputs(ob, LOOKUP_CODES[code]);
+		memcpy(out, LOOKUP_CODES[code].str, LOOKUP_CODES[code].len);
+		out += LOOKUP_CODES[code].len;
 	}
+
+	ob->size = out - ob->data;
+	return 1;
+}
+
+void
+houdini_escape_xml(struct buf *ob, const uint8_t *src, size_t size)
+{
+	if (!houdini_lazy_escape_xml(ob, src, size))
+		bufput(ob, src, size);
 }
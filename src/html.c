@@ -47,14 +47,14 @@ sdhtml_is_tag(const uint8_t *tag_data, size_t tag_size, const char *tagname)
 		if (*tagname == 0)
 			break;
 
-		if (tag_data[i] != *tagname)
+		if (tolower(tag_data[i]) != *tagname)
 			return HTML_TAG_NONE;
 	}
 
 	if (i == tag_size)
 		return HTML_TAG_NONE;
 
-	if (isspace(tag_data[i]) || tag_data[i] == '>')
+	if (isspace(tag_data[i]) || tag_data[i] == '>' || tag_data[i] == '/')
 		return closed ? HTML_TAG_CLOSE : HTML_TAG_OPEN;
 
 	return HTML_TAG_NONE;
@@ -70,6 +70,28 @@ static inline void escape_href(struct buf *ob, const uint8_t *source, size_t len
 	houdini_escape_href(ob, source, length);
 }
 
+/* smartypants_block • applies SmartyPants to the top-level blocks
+ * rendered since it last did; every block ending in a newline, this
+ * gives what a pass over the whole output would */
+static void
+smartypants_block(struct buf *ob, struct html_renderopt *options)
+{
+	size_t from = options->smartypants.done;
+	struct buf *text = options->smartypants.work;
+	uint8_t previous;
+
+	if (ob != options->smartypants.ob || ob->size <= from)
+		return;
+
+	text->size = 0;
+	bufput(text, ob->data + from, ob->size - from);
+	previous = from > options->smartypants.start ? ob->data[from - 1] : 0;
+
+	ob->size = from;
+	sdhtml_smartypants_part(ob, &options->smartypants.state, previous, text->data, text->size);
+	options->smartypants.done = ob->size;
+}
+
 /********************
  * GENERIC RENDERER *
  ********************/
@@ -77,23 +99,30 @@ static int
 rndr_autolink(struct buf *ob, const struct buf *link, enum mkd_autolink type, void *opaque)
 {
 	struct html_renderopt *options = opaque;
+	const struct buf *href = link;
+	struct buf *work = NULL;
 
 	if (!link || !link->size)
 		return 0;
 
+	if (type != MKDA_EMAIL)
+		href = sdhtml_rewritten_link(&work, link, options);
+
 	if ((options->flags & HTML_SAFELINK) != 0 &&
-		!sd_autolink_issafe(link->data, link->size) &&
-		type != MKDA_EMAIL)
+		!sd_autolink_issafe(href->data, href->size) &&
+		type != MKDA_EMAIL) {
+		bufrelease(work);
 		return 0;
+	}
 
 	BUFPUTSL(ob, "<a href=\"");
 	if (type == MKDA_EMAIL)
 		BUFPUTSL(ob, "mailto:");
-	escape_href(ob, link->data, link->size);
+	escape_href(ob, href->data, href->size);
 
 	if (options->link_attributes) {
 		bufputc(ob, '\"');
-		options->link_attributes(ob, link, opaque);
+		options->link_attributes(ob, href, opaque);
 		bufputc(ob, '>');
 	} else {
 		BUFPUTSL(ob, "\">");
@@ -111,6 +140,7 @@ rndr_autolink(struct buf *ob, const struct buf *link, enum mkd_autolink type, vo
 	}
 
 	BUFPUTSL(ob, "</a>");
+	bufrelease(work);
 
 	return 1;
 }
@@ -118,6 +148,8 @@ rndr_autolink(struct buf *ob, const struct buf *link, enum mkd_autolink type, vo
 static void
 rndr_blockcode(struct buf *ob, const struct buf *text, const struct buf *lang, void *opaque)
 {
+	struct html_renderopt *options = opaque;
+
 	if (ob->size) bufputc(ob, '\n');
 
 	if (lang && lang->size) {
@@ -145,10 +177,12 @@ rndr_blockcode(struct buf *ob, const struct buf *text, const struct buf *lang, v
 	} else
 		BUFPUTSL(ob, "<pre><code>");
 
-	if (text)
+	if (text && (!options->highlighter || !lang ||
+		!sdhtml_highlight(ob, lang->data, lang->size, text->data, text->size, options->highlighter)))
 		escape_html(ob, text->data, text->size);
 
 	BUFPUTSL(ob, "</code></pre>\n");
+	smartypants_block(ob, opaque);
 }
 
 static void
@@ -158,6 +192,7 @@ rndr_blockquote(struct buf *ob, const struct buf *text, void *opaque)
 	BUFPUTSL(ob, "<blockquote>\n");
 	if (text) bufput(ob, text->data, text->size);
 	BUFPUTSL(ob, "</blockquote>\n");
+	smartypants_block(ob, opaque);
 }
 
 static int
@@ -212,6 +247,256 @@ rndr_linebreak(struct buf *ob, void *opaque)
 	return 1;
 }
 
+/* put_untagged • HTML without its tags */
+static void
+put_untagged(struct buf *ob, const uint8_t *data, size_t size)
+{
+	size_t i = 0, org;
+
+	while (i < size) {
+		org = i;
+		while (i < size && data[i] != '<')
+			i++;
+
+		bufput(ob, data + org, i - org);
+
+		while (i < size && data[i] != '>')
+			i++;
+		i++;
+	}
+}
+
+/* slugify • the slug of a rendered header, GitHub-style: its text
+ * without tags nor entities, ASCII letters lowercased, spaces made
+ * hyphens and the rest of ASCII punctuation left out */
+static void
+slugify(struct buf *ob, const uint8_t *data, size_t size)
+{
+	size_t i = 0, end;
+	uint8_t c;
+
+	while (i < size) {
+		c = data[i];
+
+		if (c == '<') {
+			while (i < size && data[i] != '>')
+				i++;
+			i++;
+		} else if (c == '&') {
+			for (end = i + 1; end < size && end < i + 10 && (isalnum(data[end]) || data[end] == '#'); end++);
+			i = end < size && data[end] == ';' ? end + 1 : i + 1;
+		} else {
+			if (c >= 0x80 || isalnum(c) || c == '-' || c == '_')
+				bufputc(ob, tolower(c));
+			else if (isspace(c))
+				bufputc(ob, '-');
+			i++;
+		}
+	}
+}
+
+static uint32_t
+slug_hash(const uint8_t *data, size_t size)
+{
+	uint32_t hash = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < size; ++i)
+		hash = (hash ^ data[i]) * 16777619u;
+
+	return hash;
+}
+
+/* slug_slot • the slot of an id in the set: the one holding it, or the
+ * empty one it would go to */
+static uint32_t *
+slug_slot(struct html_renderopt *options, const uint8_t *id, size_t size)
+{
+	size_t mask = options->slugs.asize - 1, i = slug_hash(id, size) & mask;
+	const struct buf *names = options->slugs.names;
+	size_t at;
+
+	while (options->slugs.table[i]) {
+		at = options->slugs.table[i] - 1;
+		if (names->size - at > size && names->data[at + size] == 0 && memcmp(names->data + at, id, size) == 0)
+			break;
+		i = (i + 1) & mask;
+	}
+
+	return &options->slugs.table[i];
+}
+
+/* slug_reserve • room for one more id in the set, -1 if out of memory */
+static int
+slug_reserve(struct html_renderopt *options)
+{
+	uint32_t *old = options->slugs.table;
+	size_t old_asize = options->slugs.asize, i;
+	const uint8_t *name;
+
+	if (!options->slugs.names && (options->slugs.names = bufnew(256)) == NULL)
+		return -1;
+
+	if ((options->slugs.count + 1) * 2 <= old_asize)
+		return 0;
+
+	options->slugs.asize = old_asize ? old_asize * 2 : 64;
+	if ((options->slugs.table = calloc(options->slugs.asize, sizeof(uint32_t))) == NULL) {
+		options->slugs.table = old;
+		options->slugs.asize = old_asize;
+		return -1;
+	}
+
+	for (i = 0; i < old_asize; ++i) {
+		if (old[i]) {
+			name = options->slugs.names->data + old[i] - 1;
+			*slug_slot(options, name, strlen((const char *)name)) = old[i];
+		}
+	}
+
+	free(old);
+	return 0;
+}
+
+/* header_slug • writes the id of a header from its rendered text: its
+ * slug, followed by -1, -2... when the render already gave it */
+static void
+header_slug(struct buf *ob, const struct buf *text, struct html_renderopt *options)
+{
+	size_t org = ob->size, base;
+	unsigned long n = 0;
+	uint32_t *slot;
+
+	if (text)
+		slugify(ob, text->data, text->size);
+
+	if (ob->size == org)
+		BUFPUTSL(ob, "section");
+
+	if (slug_reserve(options) < 0)
+		return;
+
+	base = ob->size;
+	while (*(slot = slug_slot(options, ob->data + org, ob->size - org))) {
+		ob->size = base;
+		bufprintf(ob, "-%lu", ++n);
+	}
+
+	*slot = (uint32_t)options->slugs.names->size + 1;
+	bufput(options->slugs.names, ob->data + org, ob->size - org);
+	bufputc(options->slugs.names, 0);
+	options->slugs.count++;
+}
+
+/* slugs_release • forgets the ids given in a render */
+static void
+slugs_release(struct html_renderopt *options)
+{
+	bufrelease(options->slugs.names);
+	free(options->slugs.table);
+	memset(&options->slugs, 0x0, sizeof(options->slugs));
+}
+
+/* put_anchor • the id of the header an entry of the table of contents
+ * links to: its slug if given, or its number */
+static void
+put_anchor(struct buf *ob, int id, const struct buf *slug)
+{
+	BUFPUTSL(ob, "<a href=\"#");
+	if (slug)
+		bufput(ob, slug->data, slug->size);
+	else
+		bufprintf(ob, "toc_%d", id);
+	BUFPUTSL(ob, "\">");
+}
+
+/* toc_open • opens and closes lists down to the entry of a header
+ * of the given level, 0 if the table of contents leaves it out */
+static int
+toc_open(struct buf *ob, int level, struct html_renderopt *options)
+{
+	/* set the level offset if this is the first header
+	 * we're parsing for the document */
+	if (options->toc_data.current_level == 0 && !options->toc_data.fixed_offset) {
+		options->toc_data.level_offset = level - 1;
+	}
+	level -= options->toc_data.level_offset;
+
+	if ((options->toc_data.fixed_offset && level < 1) ||
+		(options->toc_data.nesting_level && level > options->toc_data.nesting_level))
+		return 0;
+
+	if (level > options->toc_data.current_level) {
+		while (level > options->toc_data.current_level) {
+			BUFPUTSL(ob, "<ul>\n<li>\n");
+			options->toc_data.current_level++;
+		}
+	} else if (level < options->toc_data.current_level) {
+		BUFPUTSL(ob, "</li>\n");
+		while (level < options->toc_data.current_level) {
+			BUFPUTSL(ob, "</ul>\n</li>\n");
+			options->toc_data.current_level--;
+		}
+		BUFPUTSL(ob,"<li>\n");
+	} else {
+		BUFPUTSL(ob,"</li>\n<li>\n");
+	}
+
+	return 1;
+}
+
+/* toc_entry • the entry of a header the HTML renderer has already
+ * rendered, in the table of contents it writes on the side: the
+ * rendered text goes in without its tags */
+static void
+toc_entry(const struct buf *text, int level, int id, const struct buf *slug, struct html_renderopt *options)
+{
+	struct buf *ob = options->toc;
+
+	if (!toc_open(ob, level, options))
+		return;
+
+	put_anchor(ob, id, slug);
+	if (text)
+		put_untagged(ob, text->data, text->size);
+	BUFPUTSL(ob, "</a>\n");
+}
+
+/* the header callbacks of a part of a parallel render can't know how
+ * many headers came before them: they leave a "\0<index>\0" marker in
+ * the output instead and record the call, which gets replayed against
+ * the main state when the part is joined */
+enum header_kind {
+	HEADER_ID,	/* the number in a header id */
+	HEADER_TOC,	/* a whole entry of the table of contents */
+};
+
+struct header_call {
+	enum header_kind kind;
+	int level;
+	int has_text;
+	size_t size;
+};
+
+static void
+defer_header(struct buf *ob, const struct buf *text, int level, enum header_kind kind, struct html_renderopt *options)
+{
+	struct header_call call;
+
+	call.kind = kind;
+	call.level = level;
+	call.has_text = text != NULL;
+	call.size = text ? text->size : 0;
+
+	bufput(options->headers, &call, sizeof(call));
+	if (text)
+		bufput(options->headers, text->data, text->size);
+
+	bufputc(ob, 0);
+	bufprintf(ob, "%d", options->toc_data.header_count++);
+	bufputc(ob, 0);
+}
+
 static void
 rndr_header(struct buf *ob, const struct buf *text, int level, void *opaque)
 {
@@ -220,22 +505,54 @@ rndr_header(struct buf *ob, const struct buf *text, int level, void *opaque)
 	if (ob->size)
 		bufputc(ob, '\n');
 
-	if (options->flags & HTML_TOC)
-		bufprintf(ob, "<h%d id=\"toc_%d\">", level, options->toc_data.header_count++);
-	else
+	if ((options->flags & HTML_HEADER_IDS) && options->headers) {
+		bufprintf(ob, "<h%d id=\"", level);
+		defer_header(ob, text, level, HEADER_ID, options);
+		BUFPUTSL(ob, "\">");
+	} else if (options->flags & HTML_HEADER_IDS) {
+		int id = options->toc_data.header_count++;
+		struct buf slug;
+
+		bufprintf(ob, "<h%d id=\"", level);
+		memset(&slug, 0x0, sizeof(slug));
+		slug.size = ob->size;
+		header_slug(ob, text, options);
+		slug.data = ob->data + slug.size;
+		slug.size = ob->size - slug.size;
+
+		if (options->toc)
+			toc_entry(text, level, id, &slug, options);
+		BUFPUTSL(ob, "\">");
+	} else if ((options->flags & HTML_TOC || options->toc) && options->headers) {
+		bufprintf(ob, "<h%d id=\"toc_", level);
+		defer_header(ob, options->toc ? text : NULL, level, HEADER_ID, options);
+		BUFPUTSL(ob, "\">");
+	} else if (options->flags & HTML_TOC || options->toc) {
+		int id = options->toc_data.header_count++;
+
+		bufprintf(ob, "<h%d id=\"toc_%d\">", level, id);
+		if (options->toc)
+			toc_entry(text, level, id, NULL, options);
+	} else
 		bufprintf(ob, "<h%d>", level);
 
 	if (text) bufput(ob, text->data, text->size);
 	bufprintf(ob, "</h%d>\n", level);
+	smartypants_block(ob, options);
 }
 
 static int
 rndr_link(struct buf *ob, const struct buf *link, const struct buf *title, const struct buf *content, void *opaque)
 {
 	struct html_renderopt *options = opaque;
+	struct buf *work = NULL;
+
+	link = sdhtml_rewritten_link(&work, link, options);
 
-	if (link != NULL && (options->flags & HTML_SAFELINK) != 0 && !sd_autolink_issafe(link->data, link->size))
+	if (link != NULL && (options->flags & HTML_SAFELINK) != 0 && !sd_autolink_issafe(link->data, link->size)) {
+		bufrelease(work);
 		return 0;
+	}
 
 	BUFPUTSL(ob, "<a href=\"");
 
@@ -257,6 +574,7 @@ rndr_link(struct buf *ob, const struct buf *link, const struct buf *title, const
 
 	if (content && content->size) bufput(ob, content->data, content->size);
 	BUFPUTSL(ob, "</a>");
+	bufrelease(work);
 	return 1;
 }
 
@@ -267,6 +585,7 @@ rndr_list(struct buf *ob, const struct buf *text, int flags, void *opaque)
 	bufput(ob, flags & MKD_LIST_ORDERED ? "<ol>\n" : "<ul>\n", 5);
 	if (text) bufput(ob, text->data, text->size);
 	bufput(ob, flags & MKD_LIST_ORDERED ? "</ol>\n" : "</ul>\n", 6);
+	smartypants_block(ob, opaque);
 }
 
 static void
@@ -324,11 +643,13 @@ rndr_paragraph(struct buf *ob, const struct buf *text, void *opaque)
 		bufput(ob, &text->data[i], text->size - i);
 	}
 	BUFPUTSL(ob, "</p>\n");
+	smartypants_block(ob, options);
 }
 
 static void
 rndr_raw_block(struct buf *ob, const struct buf *text, void *opaque)
 {
+	struct html_renderopt *options = opaque;
 	size_t org, sz;
 	if (!text) return;
 	sz = text->size;
@@ -337,8 +658,12 @@ rndr_raw_block(struct buf *ob, const struct buf *text, void *opaque)
 	while (org < sz && text->data[org] == '\n') org++;
 	if (org >= sz) return;
 	if (ob->size) bufputc(ob, '\n');
-	bufput(ob, text->data + org, sz - org);
+	if (options->sanitizer)
+		sdhtml_sanitize(ob, text->data + org, sz - org, options->sanitizer);
+	else
+		bufput(ob, text->data + org, sz - org);
 	bufputc(ob, '\n');
+	smartypants_block(ob, options);
 }
 
 static int
@@ -357,16 +682,21 @@ rndr_hrule(struct buf *ob, void *opaque)
 	struct html_renderopt *options = opaque;
 	if (ob->size) bufputc(ob, '\n');
 	bufputs(ob, USE_XHTML(options) ? "<hr/>\n" : "<hr>\n");
+	smartypants_block(ob, options);
 }
 
 static int
 rndr_image(struct buf *ob, const struct buf *link, const struct buf *title, const struct buf *alt, void *opaque)
 {
 	struct html_renderopt *options = opaque;
+	struct buf *work = NULL;
 	if (!link || !link->size) return 0;
 
+	link = sdhtml_rewritten_link(&work, link, options);
+
 	BUFPUTSL(ob, "<img src=\"");
 	escape_href(ob, link->data, link->size);
+	bufrelease(work);
 	BUFPUTSL(ob, "\" alt=\"");
 
 	if (alt && alt->size)
@@ -407,7 +737,10 @@ rndr_raw_html(struct buf *ob, const struct buf *text, void *opaque)
 		sdhtml_is_tag(text->data, text->size, "img"))
 		return 1;
 
-	bufput(ob, text->data, text->size);
+	if (options->sanitizer)
+		sdhtml_sanitize(ob, text->data, text->size, options->sanitizer);
+	else
+		bufput(ob, text->data, text->size);
 	return 1;
 }
 
@@ -422,6 +755,7 @@ rndr_table(struct buf *ob, const struct buf *header, const struct buf *body, voi
 	if (body)
 		bufput(ob, body->data, body->size);
 	BUFPUTSL(ob, "</tbody></table>\n");
+	smartypants_block(ob, opaque);
 }
 
 static void
@@ -486,32 +820,47 @@ rndr_normal_text(struct buf *ob, const struct buf *text, void *opaque)
 		escape_html(ob, text->data, text->size);
 }
 
+/* toc_slug_header • an entry of the table of contents linking to the
+ * slug the HTML renderer gives the header; every header takes its slug,
+ * listed or not, for the suffixes to be the same */
+static void
+toc_slug_header(struct buf *ob, const struct buf *text, int level, struct html_renderopt *options)
+{
+	struct buf *slug = bufnew(64);
+	int id = options->toc_data.header_count++;
+
+	if (!slug)
+		return;
+
+	header_slug(slug, text, options);
+	if (toc_open(ob, level, options)) {
+		put_anchor(ob, id, slug);
+		if (text)
+			put_untagged(ob, text->data, text->size);
+		BUFPUTSL(ob, "</a>\n");
+	}
+
+	bufrelease(slug);
+}
+
 static void
 toc_header(struct buf *ob, const struct buf *text, int level, void *opaque)
 {
 	struct html_renderopt *options = opaque;
 
-	/* set the level offset if this is the first header
-	 * we're parsing for the document */
-	if (options->toc_data.current_level == 0) {
-		options->toc_data.level_offset = level - 1;
+	if (options->headers) {
+		defer_header(ob, text, level, HEADER_TOC, options);
+		return;
 	}
-	level -= options->toc_data.level_offset;
 
-	if (level > options->toc_data.current_level) {
-		while (level > options->toc_data.current_level) {
-			BUFPUTSL(ob, "<ul>\n<li>\n");
-			options->toc_data.current_level++;
-		}
-	} else if (level < options->toc_data.current_level) {
-		BUFPUTSL(ob, "</li>\n");
-		while (level < options->toc_data.current_level) {
-			BUFPUTSL(ob, "</ul>\n</li>\n");
-			options->toc_data.current_level--;
-		}
-		BUFPUTSL(ob,"<li>\n");
-	} else {
-		BUFPUTSL(ob,"</li>\n<li>\n");
+	if (options->flags & HTML_HEADER_IDS) {
+		toc_slug_header(ob, text, level, options);
+		return;
+	}
+
+	if (!toc_open(ob, level, options)) {
+		options->toc_data.header_count++;
+		return;
 	}
 
 	bufprintf(ob, "<a href=\"#toc_%d\">", options->toc_data.header_count++);
@@ -520,6 +869,34 @@ toc_header(struct buf *ob, const struct buf *text, int level, void *opaque)
 	BUFPUTSL(ob, "</a>\n");
 }
 
+/* toc_raw_html • with HTML_HEADER_IDS, the tags in headers are dealt
+ * with as the HTML renderer does, for their slugs to be the same */
+static int
+toc_raw_html(struct buf *ob, const struct buf *text, void *opaque)
+{
+	struct html_renderopt *options = opaque;
+
+	if (!(options->flags & HTML_HEADER_IDS))
+		return 0;
+
+	return rndr_raw_html(ob, text, opaque);
+}
+
+/* toc_normal_text • the same for their text, escaped */
+static void
+toc_normal_text(struct buf *ob, const struct buf *text, void *opaque)
+{
+	struct html_renderopt *options = opaque;
+
+	if (!text)
+		return;
+
+	if (options->flags & HTML_HEADER_IDS)
+		escape_html(ob, text->data, text->size);
+	else
+		bufput(ob, text->data, text->size);
+}
+
 static int
 toc_link(struct buf *ob, const struct buf *link, const struct buf *title, const struct buf *content, void *opaque)
 {
@@ -537,6 +914,214 @@ toc_finalize(struct buf *ob, void *opaque)
 		BUFPUTSL(ob, "</li>\n</ul>\n");
 		options->toc_data.current_level--;
 	}
+
+	slugs_release(options);
+}
+
+static void
+rndr_doc_header(struct buf *ob, void *opaque)
+{
+	struct html_renderopt *options = opaque;
+
+	if (options->flags & HTML_SMARTYPANTS) {
+		memset(&options->smartypants, 0x0, sizeof(options->smartypants));
+		options->smartypants.work = bufnew(64);
+		options->smartypants.ob = options->smartypants.work ? ob : NULL;
+		options->smartypants.start = options->smartypants.done = ob->size;
+	}
+}
+
+static void
+rndr_doc_footer(struct buf *ob, void *opaque)
+{
+	struct html_renderopt *options = opaque;
+
+	if (options->toc)
+		toc_finalize(options->toc, options);
+
+	smartypants_block(ob, options);
+	bufrelease(options->smartypants.work);
+	options->smartypants.work = NULL;
+	options->smartypants.ob = NULL;
+	slugs_release(options);
+}
+
+/* replay_header • makes the call recorded at `calls->data[at]` with
+ * the main state, returning the offset of the next one */
+static size_t
+replay_header(struct buf *ob, const struct buf *calls, size_t at, struct html_renderopt *options)
+{
+	struct header_call call;
+	struct buf text;
+
+	memcpy(&call, calls->data + at, sizeof(call));
+	at += sizeof(call);
+
+	memset(&text, 0x0, sizeof(text));
+	text.data = calls->data + at;
+	text.size = call.size;
+
+	if (call.kind == HEADER_ID && (options->flags & HTML_HEADER_IDS)) {
+		int id = options->toc_data.header_count++;
+		struct buf slug;
+
+		memset(&slug, 0x0, sizeof(slug));
+		slug.size = ob->size;
+		header_slug(ob, call.has_text ? &text : NULL, options);
+		slug.data = ob->data + slug.size;
+		slug.size = ob->size - slug.size;
+
+		if (options->toc)
+			toc_entry(call.has_text ? &text : NULL, call.level, id, &slug, options);
+	} else if (call.kind == HEADER_ID) {
+		int id = options->toc_data.header_count++;
+
+		bufprintf(ob, "%d", id);
+		if (options->toc)
+			toc_entry(call.has_text ? &text : NULL, call.level, id, NULL, options);
+	} else
+		toc_header(ob, call.has_text ? &text : NULL, call.level, options);
+
+	return at + call.size;
+}
+
+static void *
+html_fork(void *opaque)
+{
+	struct html_renderopt *part = malloc(sizeof(struct html_renderopt));
+
+	memcpy(part, opaque, sizeof(struct html_renderopt));
+	part->toc_data.header_count = 0;
+	part->smartypants.ob = NULL;
+	part->smartypants.work = NULL;
+	memset(&part->slugs, 0x0, sizeof(part->slugs));
+	part->headers = bufnew(64);
+
+	return part;
+}
+
+static void
+html_join(struct buf *ob, const struct buf *part, void *part_opaque, void *opaque)
+{
+	struct html_renderopt *options = opaque;
+	const struct buf *calls = ((struct html_renderopt *)part_opaque)->headers;
+	struct buf *entry;
+	size_t i = 0, org, at = 0;
+	const uint8_t *mark;
+	int index, next = 0;
+
+	/* no headers, no markers */
+	if (!calls->size) {
+		bufput(ob, part->data, part->size);
+		smartypants_block(ob, options);
+		return;
+	}
+
+	entry = bufnew(64);
+
+	while (i < part->size) {
+		org = i;
+		mark = memchr(part->data + i, 0, part->size - i);
+		i = mark ? (size_t)(mark - part->data) : part->size;
+
+		bufput(ob, part->data + org, i - org);
+		if (i >= part->size)
+			break;
+
+		/* "\0<index>\0": replaying every call up to that one */
+		index = atoi((const char *)part->data + i + 1);
+		i++;
+		while (part->data[i] != 0)
+			i++;
+		i++;
+
+		while (next <= index) {
+			entry->size = 0;
+			at = replay_header(entry, calls, at, options);
+			next++;
+		}
+
+		bufput(ob, entry->data, entry->size);
+	}
+
+	/* headers whose output went nowhere still count */
+	while (at < calls->size)
+		at = replay_header(entry, calls, at, options);
+
+	bufrelease(entry);
+	smartypants_block(ob, options);
+}
+
+static void
+html_restart(void *opaque)
+{
+	struct html_renderopt *options = opaque;
+
+	options->toc_data.header_count = 0;
+	options->toc_data.current_level = 0;
+	if (!options->toc_data.fixed_offset)
+		options->toc_data.level_offset = 0;
+	slugs_release(options);
+}
+
+static void
+html_release(void *part_opaque)
+{
+	struct html_renderopt *part = part_opaque;
+
+	bufrelease(part->headers);
+	free(part);
+}
+
+void
+sdhtml_parallel(struct sd_parallel *parallel, const struct sd_callbacks *callbacks)
+{
+	memset(parallel, 0x0, sizeof(struct sd_parallel));
+	parallel->fork = html_fork;
+	parallel->join = html_join;
+	parallel->release = html_release;
+	parallel->restart = html_restart;
+
+	/* the table of contents doesn't care what's before a header */
+	parallel->uses_output = callbacks->header != toc_header;
+}
+
+void
+sdhtml_tagged_block(struct buf *ob, struct sd_document *doc, size_t index)
+{
+	const struct buf *out = sd_document_output(doc);
+	const unsigned int *ids;
+	size_t offset, size;
+
+	if (index >= sd_document_ids(doc, &ids))
+		return;
+
+	sd_document_block(doc, index, &offset, &size);
+	bufprintf(ob, "<div data-block=\"%08x\">\n", ids[index]);
+	bufput(ob, out->data + offset, size);
+	BUFPUTSL(ob, "</div>\n");
+}
+
+void
+sdhtml_tagged(struct buf *ob, struct sd_document *doc)
+{
+	const struct buf *out = sd_document_output(doc);
+	size_t count = sd_document_blocks(doc), end = 0, offset, size, i;
+
+	if (count) {
+		sd_document_block(doc, count - 1, &offset, &size);
+		end = offset + size;
+		sd_document_block(doc, 0, &offset, &size);
+	} else {
+		offset = end = out->size;
+	}
+
+	bufgrow(ob, ob->size + out->size + count * 32);
+	bufput(ob, out->data, offset);
+	for (i = 0; i < count; ++i)
+		sdhtml_tagged_block(ob, doc, i);
+	if (end < out->size)
+		bufput(ob, out->data + end, out->size - end);
 }
 
 void
@@ -562,13 +1147,13 @@ sdhtml_toc_renderer(struct sd_callbacks *callbacks, struct html_renderopt *optio
 		NULL,
 		NULL,
 		toc_link,
-		NULL,
+		toc_raw_html,
 		rndr_triple_emphasis,
 		rndr_strikethrough,
 		rndr_superscript,
 
 		NULL,
-		NULL,
+		toc_normal_text,
 
 		NULL,
 		toc_finalize,
@@ -611,8 +1196,8 @@ sdhtml_renderer(struct sd_callbacks *callbacks, struct html_renderopt *options,
 		NULL,
 		rndr_normal_text,
 
-		NULL,
-		NULL,
+		rndr_doc_header,
+		rndr_doc_footer,
 	};
 
 	/* Prepare the options pointer */
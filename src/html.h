@@ -25,17 +25,74 @@
 extern "C" {
 #endif
 
+/* sd_smartypants • where SmartyPants stands after a part of a text */
+struct sd_smartypants {
+	int in_squote;
+	int in_dquote;
+	int skip;	/* 1 + index of the tag whose content is being left alone */
+};
+
+struct sdhtml_templates;
+struct sdhtml_link_rules;
+struct sdhtml_url_rewrites;
+struct sdhtml_base_url;
+struct sdhtml_sanitizer;
+struct sdhtml_highlighter;
+
 struct html_renderopt {
 	struct {
 		int header_count;
 		int current_level;
 		int level_offset;
+		int fixed_offset;	/* keep level_offset instead of taking it from the first header */
+		int nesting_level;	/* deepest level listed, after the offset; 0 for all */
 	} toc_data;
 
 	unsigned int flags;
 
 	/* extra callbacks */
 	void (*link_attributes)(struct buf *ob, const struct buf *url, void *self);
+
+	/* what sdhtml_link_attributes goes by */
+	struct sdhtml_link_rules *link_rules;
+
+	/* what the URLs of links and images are rewritten by before being
+	 * escaped: a shared prefix table, and a base URL of the options' own */
+	struct sdhtml_url_rewrites *url_rewrites;
+	struct sdhtml_base_url *base_url;
+
+	/* when set, what raw HTML keeps of its tags and attributes */
+	struct sdhtml_sanitizer *sanitizer;
+
+	/* when set, the lexers code blocks are highlighted with by language */
+	struct sdhtml_highlighter *highlighter;
+
+	/* output templates replacing the markup of some elements */
+	const struct sdhtml_templates *templates;
+
+	/* when set, the HTML renderer also writes there the table of
+	 * contents of the headers it renders, giving them ids */
+	struct buf *toc;
+
+	/* with HTML_SMARTYPANTS, the output of the render, SmartyPants
+	 * being applied to each top-level block as it's rendered */
+	struct {
+		struct buf *ob, *work;
+		size_t start, done;
+		struct sd_smartypants state;
+	} smartypants;
+
+	/* with HTML_HEADER_IDS, the ids given to headers so far in the
+	 * render, to keep them unique: a hash set of offsets in `names` */
+	struct {
+		struct buf *names;	/* each id followed by a 0 */
+		uint32_t *table;	/* 1 + offset of an id, 0 for an empty slot */
+		size_t asize, count;
+	} slugs;
+
+	/* header calls left for sdhtml_parallel to replay, in the
+	 * state of one part of a parallel render */
+	struct buf *headers;
 };
 
 typedef enum {
@@ -49,8 +106,32 @@ typedef enum {
 	HTML_HARD_WRAP = (1 << 7),
 	HTML_USE_XHTML = (1 << 8),
 	HTML_ESCAPE = (1 << 9),
+	HTML_SMARTYPANTS = (1 << 10),
+	HTML_HEADER_IDS = (1 << 11),
 } html_render_mode;
 
+/* what a language is made of, beyond its words and strings */
+typedef enum {
+	SDHTML_LEX_PREPROCESSOR = (1 << 0),	/* '#' starting a line opens a directive */
+	SDHTML_LEX_VARIABLES = (1 << 1),	/* $name, ${name} and $? are variables */
+	SDHTML_LEX_KEYS = (1 << 2),	/* a string followed by ':' is a key */
+	SDHTML_LEX_TRIPLE_QUOTES = (1 << 3),	/* three quotes open a string spanning lines */
+	SDHTML_LEX_SPACED_COMMENTS = (1 << 4),	/* line comments only start after a blank */
+	SDHTML_LEX_DIFF = (1 << 5),	/* lines taken by their first bytes, nothing else */
+} sdhtml_lexer_flags;
+
+/* sdhtml_lexer • the tables a language is highlighted by; the strings
+ * are copied when it's added to a highlighter */
+struct sdhtml_lexer {
+	const char *keywords;	/* space-separated words, in "kw" spans */
+	const char *literals;	/* likewise, in "lit" spans (true, null...) */
+	const char *line_comment;	/* what starts a comment to the end of the line */
+	const char *block_comment[2];	/* what opens and closes a comment */
+	const char *quotes;	/* the bytes opening a string, closed by the same */
+	const char *word_chars;	/* the bytes of words besides letters, digits and '_' */
+	unsigned int flags;
+};
+
 typedef enum {
 	HTML_TAG_NONE = 0,
 	HTML_TAG_OPEN,
@@ -66,9 +147,197 @@ sdhtml_renderer(struct sd_callbacks *callbacks, struct html_renderopt *options_p
 extern void
 sdhtml_toc_renderer(struct sd_callbacks *callbacks, struct html_renderopt *options_ptr);
 
+/* sdhtml_parallel • fills in the renderer side of `parallel` for the
+ * given callbacks; the caller still has to provide `run` */
+extern void
+sdhtml_parallel(struct sd_parallel *parallel, const struct sd_callbacks *callbacks);
+
+/* sdhtml_tagged • the output of a document, with every top-level block
+ * in a <div data-block="id"> for sd_block_diff operations to work on */
+extern void
+sdhtml_tagged(struct buf *ob, struct sd_document *doc);
+
+/* sdhtml_tagged_block • a single block of that output */
+extern void
+sdhtml_tagged_block(struct buf *ob, struct sd_document *doc, size_t index);
+
 extern void
 sdhtml_smartypants(struct buf *ob, const uint8_t *text, size_t size);
 
+/* sdhtml_smartypants_part • sdhtml_smartypants for a text given in
+ * parts, each starting where the last left `state` (zeroed at first);
+ * `previous_char` is the last byte of the part before, 0 for none */
+extern void
+sdhtml_smartypants_part(struct buf *ob, struct sd_smartypants *state, uint8_t previous_char, const uint8_t *text, size_t size);
+
+/* sdhtml_needs_smartypants • whether the text has any byte SmartyPants
+ * acts on; when it hasn't, the output is the text itself */
+extern int
+sdhtml_needs_smartypants(const uint8_t *text, size_t size);
+
+/* sdhtml_lazy_smartypants • sdhtml_smartypants in the same pass as that
+ * check: 0 and nothing written if the text has no byte to act on, 1 once
+ * the output is written, -1 if it couldn't be allocated */
+extern int
+sdhtml_lazy_smartypants(struct buf *ob, const uint8_t *text, size_t size);
+
+/* sdhtml_templates_new • an empty set of output templates */
+extern struct sdhtml_templates *
+sdhtml_templates_new(void);
+
+/* sdhtml_templates_set • compiles the template of an element, named
+ * after its callback ("link", "table_cell"...). {field} placeholders
+ * take the values of the call, escaped as fits the field unless it's
+ * given as {field|raw}, {field|html} or {field|href}; {#field}...{/field}
+ * is left out when the field is empty, and {{ is a brace. -1 and a
+ * message in `error` if the template is wrong */
+extern int
+sdhtml_templates_set(struct sdhtml_templates *templates, const char *element, const uint8_t *src, size_t size, const char **error);
+
+/* sdhtml_templates_renderer • replaces the callbacks of an HTML renderer
+ * by the templates given for their elements. The templates are shared,
+ * not copied, and can't change while they're in use */
+extern void
+sdhtml_templates_renderer(struct sd_callbacks *callbacks, struct html_renderopt *options, const struct sdhtml_templates *templates);
+
+extern void
+sdhtml_templates_free(struct sdhtml_templates *templates);
+
+/* sdhtml_link_rules_new • an empty set of rules giving links attributes
+ * by their host and scheme */
+extern struct sdhtml_link_rules *
+sdhtml_link_rules_new(void);
+
+/* sdhtml_link_rules_add • gives `attributes` to the links with the given
+ * scheme (NULL for any) to the given host or any host within it ("a.com"
+ * takes "b.a.com" too; NULL for all the links). The rule of the narrowest
+ * host that has one for the scheme of a link applies; among those of a
+ * host, the first added. -1 if out of memory */
+extern int
+sdhtml_link_rules_add(struct sdhtml_link_rules *rules, const char *scheme, const char *host, const char *attributes);
+
+/* sdhtml_link_attributes • the link_attributes callback writing the
+ * attributes the options' link rules give */
+extern void
+sdhtml_link_attributes(struct buf *ob, const struct buf *url, void *opaque);
+
+/* sdhtml_set_link_rules • makes the options use the rules, which they
+ * keep (NULL drops them); the rules can't change from then on */
+extern void
+sdhtml_set_link_rules(struct html_renderopt *options, struct sdhtml_link_rules *rules);
+
+/* sdhtml_link_rules_release • drops a reference to the rules */
+extern void
+sdhtml_link_rules_release(struct sdhtml_link_rules *rules);
+
+/* sdhtml_url_rewrites_new • an empty table of URL prefix rewrites */
+extern struct sdhtml_url_rewrites *
+sdhtml_url_rewrites_new(void);
+
+/* sdhtml_url_rewrites_add • makes the URLs starting with `from` start
+ * with `to` instead; the first prefix added that a URL has is the one
+ * replaced. -1 if out of memory */
+extern int
+sdhtml_url_rewrites_add(struct sdhtml_url_rewrites *rw, const char *from, const char *to);
+
+/* sdhtml_rewrite_url • writes to `ob` what `url` becomes under the
+ * options' prefix rewrites and base URL, which applies to the relative
+ * URLs left but the fragments alone. 0 and nothing written if it stays
+ * the same; with a NULL `ob`, only tells whether it changes */
+extern int
+sdhtml_rewrite_url(struct buf *ob, const uint8_t *url, size_t size, const struct html_renderopt *options);
+
+/* sdhtml_rewritten_link • the link rewritten for the options: `link`
+ * itself, or a buffer left in `work` for the caller to release */
+extern const struct buf *
+sdhtml_rewritten_link(struct buf **work, const struct buf *link, const struct html_renderopt *options);
+
+/* sdhtml_set_url_rewrites • makes the options use the table, which they
+ * keep (NULL drops it); the table can't change from then on */
+extern void
+sdhtml_set_url_rewrites(struct html_renderopt *options, struct sdhtml_url_rewrites *rw);
+
+/* sdhtml_url_rewrites_release • drops a reference to the table */
+extern void
+sdhtml_url_rewrites_release(struct sdhtml_url_rewrites *rw);
+
+/* sdhtml_set_base_url • resolves the relative URLs against `url` from
+ * now on (NULL to stop, which frees it). -1 if out of memory */
+extern int
+sdhtml_set_base_url(struct html_renderopt *options, const uint8_t *url, size_t size);
+
+/* sdhtml_sanitizer_new • a sanitizer letting no tag through */
+extern struct sdhtml_sanitizer *
+sdhtml_sanitizer_new(void);
+
+/* sdhtml_sanitizer_allow_tag • lets the tag through, without attributes
+ * but those allowed. -1 if out of memory */
+extern int
+sdhtml_sanitizer_allow_tag(struct sdhtml_sanitizer *san, const char *tag);
+
+/* sdhtml_sanitizer_allow_attribute • lets the attribute through on the
+ * given tag (NULL for every tag allowed); those holding a URL (href, src...)
+ * only when it's relative or of an allowed scheme. -1 if out of memory */
+extern int
+sdhtml_sanitizer_allow_attribute(struct sdhtml_sanitizer *san, const char *tag, const char *attribute);
+
+/* sdhtml_sanitizer_allow_scheme • allows the URLs of the scheme ("https") */
+extern int
+sdhtml_sanitizer_allow_scheme(struct sdhtml_sanitizer *san, const char *scheme);
+
+/* sdhtml_sanitizer_compile • builds the lookups of the rules, needed
+ * before sanitizing. -1 if out of memory */
+extern int
+sdhtml_sanitizer_compile(struct sdhtml_sanitizer *san);
+
+/* sdhtml_sanitize • writes the HTML with only the tags and attributes
+ * allowed; comments go, as do the content of script and style elements
+ * and the tags themselves unless allowed, and a '<' starting no tag is
+ * escaped */
+extern void
+sdhtml_sanitize(struct buf *ob, const uint8_t *data, size_t size, const struct sdhtml_sanitizer *san);
+
+/* sdhtml_set_sanitizer • makes the options sanitize raw HTML with the
+ * compiled sanitizer, which they keep (NULL drops it); it can't change
+ * from then on */
+extern void
+sdhtml_set_sanitizer(struct html_renderopt *options, struct sdhtml_sanitizer *san);
+
+/* sdhtml_sanitizer_release • drops a reference to the sanitizer */
+extern void
+sdhtml_sanitizer_release(struct sdhtml_sanitizer *san);
+
+/* sdhtml_highlighter_new • a highlighter knowing no language */
+extern struct sdhtml_highlighter *
+sdhtml_highlighter_new(void);
+
+/* sdhtml_highlighter_add • highlights the code of the languages with the
+ * space-separated names (matched regardless of case) with `lexer`; a name
+ * added again takes the new lexer. -1 if out of memory */
+extern int
+sdhtml_highlighter_add(struct sdhtml_highlighter *h, const char *names, const struct sdhtml_lexer *lexer);
+
+/* sdhtml_highlighter_add_builtins • adds the lexers for C and C++,
+ * JavaScript, JSON, shell, Python and diffs. -1 if out of memory */
+extern int
+sdhtml_highlighter_add_builtins(struct sdhtml_highlighter *h);
+
+/* sdhtml_highlight • writes the code escaped, its tokens in <span>s of
+ * their class ("kw", "str", "com"...), if the highlighter has a lexer for
+ * the first word of `lang`; 0 and nothing written if it hasn't */
+extern int
+sdhtml_highlight(struct buf *ob, const uint8_t *lang, size_t lang_size, const uint8_t *text, size_t size, const struct sdhtml_highlighter *h);
+
+/* sdhtml_set_highlighter • makes the options highlight code blocks with
+ * the highlighter, which they keep (NULL drops it); it can't change from
+ * then on */
+extern void
+sdhtml_set_highlighter(struct html_renderopt *options, struct sdhtml_highlighter *h);
+
+/* sdhtml_highlighter_release • drops a reference to the highlighter */
+extern void
+sdhtml_highlighter_release(struct sdhtml_highlighter *h);
+
 #ifdef __cplusplus
 }
 #endif
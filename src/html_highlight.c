@@ -0,0 +1,667 @@
+/*
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "buffer.h"
+#include "html.h"
+#include "houdini.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+/* what a byte is to a lexer */
+enum {
+	CH_START = (1 << 0),	/* may start a token */
+	CH_WORD = (1 << 1),	/* part of words */
+	CH_DIGIT = (1 << 2),	/* starts a number */
+	CH_QUOTE = (1 << 3),	/* opens a string */
+};
+
+/* the classes of the spans, in the order of `span_classes` */
+enum {
+	HL_NONE = 0,
+	HL_KEYWORD,
+	HL_LITERAL,
+	HL_STRING,
+	HL_COMMENT,
+	HL_NUMBER,
+	HL_PREPROC,
+	HL_VARIABLE,
+	HL_KEY,
+	HL_INSERTED,
+	HL_DELETED,
+	HL_HUNK,
+	HL_META,
+};
+
+static const char *span_classes[] = {
+	"", "kw", "lit", "str", "com", "num", "pp", "var", "key", "ins", "del", "hunk", "meta",
+};
+
+/* a keyword, its bytes in the strings; size 0 for an empty slot */
+struct hl_word {
+	uint32_t at;
+	uint8_t size, cls;
+};
+
+/* a lexer compiled from a sdhtml_lexer; the strings it takes from the
+ * highlighter are given by offset and size */
+struct hl_lexer {
+	uint8_t chars[256];
+	struct hl_word *words;	/* open addressing, a power of two of slots */
+	uint32_t mask;
+	uint32_t line_comment, line_comment_size;
+	uint32_t block_open, block_open_size;
+	uint32_t block_close, block_close_size;
+	unsigned int flags;
+};
+
+/* a name of a language, lowercase */
+struct hl_name {
+	uint32_t at, size;
+	uint32_t lexer;
+};
+
+/* sdhtml_highlighter • the lexers of the languages code blocks are
+ * highlighted in, by the names of the languages */
+struct sdhtml_highlighter {
+	struct hl_lexer *lexers;
+	size_t lexer_count, lexer_asize;
+	struct hl_name *names;
+	size_t name_count, name_asize;
+	struct buf *strings;
+	int ref_count;
+};
+
+static const struct sdhtml_lexer builtin_c = {
+	"auto break case char const continue default do double else enum extern float for goto "
+	"if inline int long register restrict return short signed sizeof static struct switch "
+	"typedef union unsigned void volatile while bool class namespace template typename public "
+	"private protected virtual new delete this operator try catch throw using friend explicit "
+	"mutable constexpr override final",
+	"true false NULL nullptr",
+	"//", { "/*", "*/" }, "\"'", NULL,
+	SDHTML_LEX_PREPROCESSOR,
+};
+
+static const struct sdhtml_lexer builtin_js = {
+	"break case catch class const continue debugger default delete do else export extends "
+	"finally for function if import in instanceof let new return super switch this throw "
+	"try typeof var void while with yield async await",
+	"true false null undefined NaN Infinity",
+	"//", { "/*", "*/" }, "\"'`", "$",
+	0,
+};
+
+static const struct sdhtml_lexer builtin_json = {
+	NULL,
+	"true false null",
+	NULL, { NULL, NULL }, "\"", NULL,
+	SDHTML_LEX_KEYS,
+};
+
+static const struct sdhtml_lexer builtin_shell = {
+	"if then else elif fi case esac for while until do done in function select time "
+	"return exit local export readonly declare unset shift break continue source alias "
+	"echo cd eval exec set trap test",
+	"true false",
+	"#", { NULL, NULL }, "\"'`", "-",
+	SDHTML_LEX_VARIABLES | SDHTML_LEX_SPACED_COMMENTS,
+};
+
+static const struct sdhtml_lexer builtin_python = {
+	"and as assert async await break class continue def del elif else except finally for "
+	"from global if import in is lambda nonlocal not or pass raise return try while with yield",
+	"True False None",
+	"#", { NULL, NULL }, "\"'", NULL,
+	SDHTML_LEX_TRIPLE_QUOTES,
+};
+
+static const struct sdhtml_lexer builtin_diff = {
+	NULL, NULL, NULL, { NULL, NULL }, NULL, NULL,
+	SDHTML_LEX_DIFF,
+};
+
+static const struct {
+	const char *names;
+	const struct sdhtml_lexer *lexer;
+} builtins[] = {
+	{ "c h cpp c++ cc cxx hpp", &builtin_c },
+	{ "js javascript jsx mjs node", &builtin_js },
+	{ "json", &builtin_json },
+	{ "sh bash shell zsh console", &builtin_shell },
+	{ "py python python3", &builtin_python },
+	{ "diff patch", &builtin_diff },
+};
+
+static int
+grow(void **items, size_t *asize, size_t count, size_t item_size)
+{
+	void *neo;
+	size_t neo_asize;
+
+	if (count < *asize)
+		return 0;
+
+	neo_asize = *asize ? *asize * 2 : 8;
+	if ((neo = realloc(*items, neo_asize * item_size)) == NULL)
+		return -1;
+
+	*items = neo;
+	*asize = neo_asize;
+	return 0;
+}
+
+static uint32_t
+word_hash(const uint8_t *word, size_t size)
+{
+	uint32_t hash = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < size; ++i)
+		hash = (hash ^ word[i]) * 16777619u;
+
+	return hash;
+}
+
+/* word_count • the words of a space-separated list */
+static size_t
+word_count(const char *list)
+{
+	size_t count = 0;
+
+	while (list && *list) {
+		list += strspn(list, " ");
+		if (*list)
+			count++;
+		list += strcspn(list, " ");
+	}
+
+	return count;
+}
+
+/* add_words • puts the words of the list in the table of the lexer;
+ * a word given twice keeps its first class */
+static void
+add_words(struct sdhtml_highlighter *h, struct hl_lexer *lx, const char *list, int cls)
+{
+	size_t size;
+	uint32_t slot;
+
+	while (list && *list) {
+		list += strspn(list, " ");
+		size = strcspn(list, " ");
+
+		if (size && size < 256) {
+			slot = word_hash((const uint8_t *)list, size) & lx->mask;
+			while (lx->words[slot].size && (lx->words[slot].size != size ||
+				memcmp(h->strings->data + lx->words[slot].at, list, size) != 0))
+				slot = (slot + 1) & lx->mask;
+
+			if (!lx->words[slot].size) {
+				lx->words[slot].at = (uint32_t)h->strings->size;
+				lx->words[slot].size = (uint8_t)size;
+				lx->words[slot].cls = (uint8_t)cls;
+				bufput(h->strings, list, size);
+			}
+		}
+
+		list += size;
+	}
+}
+
+static int
+find_word(const struct sdhtml_highlighter *h, const struct hl_lexer *lx, const uint8_t *word, size_t size)
+{
+	uint32_t slot;
+
+	if (!lx->words || size >= 256)
+		return HL_NONE;
+
+	slot = word_hash(word, size) & lx->mask;
+	while (lx->words[slot].size) {
+		if (lx->words[slot].size == size && memcmp(h->strings->data + lx->words[slot].at, word, size) == 0)
+			return lx->words[slot].cls;
+		slot = (slot + 1) & lx->mask;
+	}
+
+	return HL_NONE;
+}
+
+/* add_string • keeps a string of the lexer, its offset and size */
+static void
+add_string(struct sdhtml_highlighter *h, const char *str, uint32_t *at, uint32_t *size)
+{
+	*at = (uint32_t)h->strings->size;
+	*size = str ? (uint32_t)strlen(str) : 0;
+	if (str)
+		bufput(h->strings, str, *size);
+}
+
+static int
+has_prefix(const uint8_t *data, size_t size, const uint8_t *prefix, size_t prefix_size)
+{
+	return prefix_size && prefix_size <= size && memcmp(data, prefix, prefix_size) == 0;
+}
+
+static size_t
+line_end(const uint8_t *data, size_t i, size_t size)
+{
+	const uint8_t *nl = memchr(data + i, '\n', size - i);
+	return nl ? (size_t)(nl - data) : size;
+}
+
+/* at_line_start • whether only blanks come before `i` on its line */
+static int
+at_line_start(const uint8_t *data, size_t i)
+{
+	while (i > 0 && (data[i - 1] == ' ' || data[i - 1] == '\t'))
+		i--;
+
+	return i == 0 || data[i - 1] == '\n';
+}
+
+static size_t
+scan_string(const struct hl_lexer *lx, const uint8_t *data, size_t i, size_t size)
+{
+	uint8_t q = data[i];
+
+	/* """...""" runs to the next three quotes, over lines */
+	if ((lx->flags & SDHTML_LEX_TRIPLE_QUOTES) && i + 2 < size && data[i + 1] == q && data[i + 2] == q) {
+		for (i += 3; i < size; ++i) {
+			if (data[i] == '\\')
+				i++;
+			else if (i + 2 < size && data[i] == q && data[i + 1] == q && data[i + 2] == q)
+				return i + 3;
+		}
+		return size;
+	}
+
+	/* other strings end with the line, but those in backquotes */
+	for (i++; i < size; ++i) {
+		if (data[i] == '\\')
+			i++;
+		else if (data[i] == q)
+			return i + 1;
+		else if (data[i] == '\n' && q != '`')
+			return i;
+	}
+
+	return size;
+}
+
+static size_t
+scan_number(const uint8_t *data, size_t i, size_t size)
+{
+	int hex = i + 1 < size && data[i] == '0' && (data[i + 1] == 'x' || data[i + 1] == 'X');
+
+	for (i++; i < size; ++i) {
+		if ((data[i] == '+' || data[i] == '-') && !hex && (data[i - 1] == 'e' || data[i - 1] == 'E'))
+			continue;
+		if (!isalnum(data[i]) && data[i] != '.' && data[i] != '_')
+			break;
+	}
+
+	return i;
+}
+
+/* scan_variable • the end of $name, ${...} or $? and the like, `i` if
+ * the dollar starts none */
+static size_t
+scan_variable(const uint8_t *data, size_t i, size_t size)
+{
+	size_t j = i + 1;
+
+	if (j >= size)
+		return i;
+
+	if (data[j] == '{') {
+		while (j < size && data[j] != '}' && data[j] != '\n')
+			j++;
+		return j < size && data[j] == '}' ? j + 1 : i;
+	}
+
+	if (isalpha(data[j]) || data[j] == '_') {
+		while (j < size && (isalnum(data[j]) || data[j] == '_'))
+			j++;
+		return j;
+	}
+
+	return strchr("0123456789?#@*!$-", data[j]) ? j + 1 : i;
+}
+
+/* token • the class and end of the token starting at `i`; no class for
+ * a word that's no keyword, or a byte that starts nothing after all */
+static int
+token(const struct sdhtml_highlighter *h, const struct hl_lexer *lx, const uint8_t *data, size_t i, size_t size, size_t *end)
+{
+	const uint8_t *str = h->strings->data;
+	uint8_t c = data[i];
+	size_t j;
+
+	if (has_prefix(data + i, size - i, str + lx->block_open, lx->block_open_size)) {
+		for (j = i + lx->block_open_size; j < size; ++j) {
+			if (has_prefix(data + j, size - j, str + lx->block_close, lx->block_close_size))
+				break;
+		}
+		*end = j < size ? j + lx->block_close_size : size;
+		return HL_COMMENT;
+	}
+
+	if (has_prefix(data + i, size - i, str + lx->line_comment, lx->line_comment_size) &&
+		(!(lx->flags & SDHTML_LEX_SPACED_COMMENTS) || i == 0 || isspace(data[i - 1]))) {
+		*end = line_end(data, i, size);
+		return HL_COMMENT;
+	}
+
+	/* a directive goes on over escaped line breaks */
+	if (c == '#' && (lx->flags & SDHTML_LEX_PREPROCESSOR) && at_line_start(data, i)) {
+		for (j = i; j < size && data[j] != '\n'; ++j) {
+			if (data[j] == '\\' && j + 1 < size)
+				j++;
+		}
+		*end = j;
+		return HL_PREPROC;
+	}
+
+	if (lx->chars[c] & CH_QUOTE) {
+		*end = scan_string(lx, data, i, size);
+		if (lx->flags & SDHTML_LEX_KEYS) {
+			for (j = *end; j < size && (data[j] == ' ' || data[j] == '\t'); ++j);
+			if (j < size && data[j] == ':')
+				return HL_KEY;
+		}
+		return HL_STRING;
+	}
+
+	if (c == '$' && (lx->flags & SDHTML_LEX_VARIABLES)) {
+		*end = scan_variable(data, i, size);
+		if (*end > i)
+			return HL_VARIABLE;
+	}
+
+	if (lx->chars[c] & CH_DIGIT) {
+		*end = scan_number(data, i, size);
+		return HL_NUMBER;
+	}
+
+	if (lx->chars[c] & CH_WORD) {
+		for (j = i + 1; j < size && (lx->chars[data[j]] & CH_WORD); ++j);
+		*end = j;
+		return find_word(h, lx, data + i, j - i);
+	}
+
+	*end = i + 1;
+	return HL_NONE;
+}
+
+static void
+put_span(struct buf *ob, int cls, const uint8_t *data, size_t size)
+{
+	BUFPUTSL(ob, "<span class=\"");
+	bufputs(ob, span_classes[cls]);
+	BUFPUTSL(ob, "\">");
+	houdini_escape_html0(ob, data, size, 0);
+	BUFPUTSL(ob, "</span>");
+}
+
+static void
+lex_code(struct buf *ob, const struct sdhtml_highlighter *h, const struct hl_lexer *lx, const uint8_t *data, size_t size)
+{
+	size_t i = 0, mark = 0, end;
+	int cls;
+
+	while (i < size) {
+		/* what no token starts with goes as it is */
+		while (i < size && !(lx->chars[data[i]] & CH_START))
+			i++;
+
+		if (i >= size)
+			break;
+
+		if ((cls = token(h, lx, data, i, size, &end)) == HL_NONE) {
+			i = end;
+			continue;
+		}
+
+		if (i > mark)
+			houdini_escape_html0(ob, data + mark, i - mark, 0);
+
+		put_span(ob, cls, data + i, end - i);
+		i = mark = end;
+	}
+
+	if (mark < size)
+		houdini_escape_html0(ob, data + mark, size - mark, 0);
+}
+
+/* lex_diff • classes the lines of a diff by how they start */
+static void
+lex_diff(struct buf *ob, const uint8_t *data, size_t size)
+{
+	size_t i = 0, end;
+	int cls;
+
+	while (i < size) {
+		end = line_end(data, i, size);
+
+		if (has_prefix(data + i, end - i, (const uint8_t *)"+++", 3) ||
+			has_prefix(data + i, end - i, (const uint8_t *)"---", 3) ||
+			has_prefix(data + i, end - i, (const uint8_t *)"diff ", 5) ||
+			has_prefix(data + i, end - i, (const uint8_t *)"index ", 6))
+			cls = HL_META;
+		else if (has_prefix(data + i, end - i, (const uint8_t *)"@@", 2))
+			cls = HL_HUNK;
+		else if (data[i] == '+' && end > i)
+			cls = HL_INSERTED;
+		else if (data[i] == '-' && end > i)
+			cls = HL_DELETED;
+		else
+			cls = HL_NONE;
+
+		if (cls)
+			put_span(ob, cls, data + i, end - i);
+		else
+			houdini_escape_html0(ob, data + i, end - i, 0);
+
+		if (end < size)
+			bufputc(ob, '\n');
+		i = end + 1;
+	}
+}
+
+/* find_lexer • the lexer of the first word of `lang` (a leading '.' left
+ * out), the one added last for a name given more than once */
+static const struct hl_lexer *
+find_lexer(const struct sdhtml_highlighter *h, const uint8_t *lang, size_t size)
+{
+	size_t i = 0, end, n, k;
+
+	while (i < size && isspace(lang[i]))
+		i++;
+	if (i < size && lang[i] == '.')
+		i++;
+	for (end = i; end < size && !isspace(lang[end]); end++);
+
+	for (n = h->name_count; n > 0; --n) {
+		const struct hl_name *name = &h->names[n - 1];
+
+		if (name->size != end - i)
+			continue;
+
+		for (k = 0; k < name->size; ++k) {
+			if (h->strings->data[name->at + k] != tolower(lang[i + k]))
+				break;
+		}
+
+		if (k == name->size)
+			return &h->lexers[name->lexer];
+	}
+
+	return NULL;
+}
+
+struct sdhtml_highlighter *
+sdhtml_highlighter_new(void)
+{
+	struct sdhtml_highlighter *h = calloc(1, sizeof(struct sdhtml_highlighter));
+
+	if (!h)
+		return NULL;
+
+	if ((h->strings = bufnew(1024)) == NULL) {
+		free(h);
+		return NULL;
+	}
+
+	h->ref_count = 1;
+	return h;
+}
+
+int
+sdhtml_highlighter_add(struct sdhtml_highlighter *h, const char *names, const struct sdhtml_lexer *lexer)
+{
+	struct hl_lexer *lx;
+	size_t count, slots, i, size;
+	const char *c;
+
+	if (grow((void **)&h->lexers, &h->lexer_asize, h->lexer_count, sizeof(struct hl_lexer)) < 0)
+		return -1;
+
+	lx = &h->lexers[h->lexer_count];
+	memset(lx, 0x0, sizeof(struct hl_lexer));
+	lx->flags = lexer->flags;
+
+	/* keep the table at most half full */
+	count = word_count(lexer->keywords) + word_count(lexer->literals);
+	if (count) {
+		for (slots = 16; slots < count * 2; slots *= 2);
+		if ((lx->words = calloc(slots, sizeof(struct hl_word))) == NULL)
+			return -1;
+
+		lx->mask = (uint32_t)(slots - 1);
+		add_words(h, lx, lexer->keywords, HL_KEYWORD);
+		add_words(h, lx, lexer->literals, HL_LITERAL);
+	}
+
+	add_string(h, lexer->line_comment, &lx->line_comment, &lx->line_comment_size);
+	add_string(h, lexer->block_comment[0], &lx->block_open, &lx->block_open_size);
+	add_string(h, lexer->block_comment[1], &lx->block_close, &lx->block_close_size);
+	if (!lx->block_close_size)
+		lx->block_open_size = 0;
+
+	for (i = 0; i < 256; ++i) {
+		if (isalpha(i) || i == '_')
+			lx->chars[i] |= CH_START | CH_WORD;
+		if (isdigit(i))
+			lx->chars[i] |= CH_START | CH_WORD | CH_DIGIT;
+	}
+
+	for (c = lexer->word_chars; c && *c; ++c)
+		lx->chars[(uint8_t)*c] |= CH_START | CH_WORD;
+
+	for (c = lexer->quotes; c && *c; ++c)
+		lx->chars[(uint8_t)*c] |= CH_START | CH_QUOTE;
+
+	if (lx->line_comment_size)
+		lx->chars[(uint8_t)lexer->line_comment[0]] |= CH_START;
+	if (lx->block_open_size)
+		lx->chars[(uint8_t)lexer->block_comment[0][0]] |= CH_START;
+	if (lx->flags & SDHTML_LEX_PREPROCESSOR)
+		lx->chars['#'] |= CH_START;
+	if (lx->flags & SDHTML_LEX_VARIABLES)
+		lx->chars['$'] |= CH_START;
+
+	/* the names, lowercase */
+	while (*names) {
+		names += strspn(names, " ");
+		if ((size = strcspn(names, " ")) == 0)
+			break;
+
+		if (grow((void **)&h->names, &h->name_asize, h->name_count, sizeof(struct hl_name)) < 0) {
+			free(lx->words);
+			return -1;
+		}
+
+		h->names[h->name_count].at = (uint32_t)h->strings->size;
+		h->names[h->name_count].size = (uint32_t)size;
+		h->names[h->name_count].lexer = (uint32_t)h->lexer_count;
+		h->name_count++;
+
+		for (i = 0; i < size; ++i)
+			bufputc(h->strings, tolower(names[i]));
+		names += size;
+	}
+
+	h->lexer_count++;
+	return 0;
+}
+
+int
+sdhtml_highlighter_add_builtins(struct sdhtml_highlighter *h)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(builtins) / sizeof(builtins[0]); ++i) {
+		if (sdhtml_highlighter_add(h, builtins[i].names, builtins[i].lexer) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+int
+sdhtml_highlight(struct buf *ob, const uint8_t *lang, size_t lang_size, const uint8_t *text, size_t size, const struct sdhtml_highlighter *h)
+{
+	const struct hl_lexer *lx;
+
+	if (!h || !lang || (lx = find_lexer(h, lang, lang_size)) == NULL)
+		return 0;
+
+	if (lx->flags & SDHTML_LEX_DIFF)
+		lex_diff(ob, text, size);
+	else
+		lex_code(ob, h, lx, text, size);
+
+	return 1;
+}
+
+void
+sdhtml_set_highlighter(struct html_renderopt *options, struct sdhtml_highlighter *h)
+{
+	struct sdhtml_highlighter *old = options->highlighter;
+
+	if (h)
+		h->ref_count++;
+
+	options->highlighter = h;
+	sdhtml_highlighter_release(old);
+}
+
+void
+sdhtml_highlighter_release(struct sdhtml_highlighter *h)
+{
+	size_t i;
+
+	if (!h || --h->ref_count > 0)
+		return;
+
+	for (i = 0; i < h->lexer_count; ++i)
+		free(h->lexers[i].words);
+
+	free(h->lexers);
+	free(h->names);
+	bufrelease(h->strings);
+	free(h);
+}
@@ -0,0 +1,316 @@
+/*
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "buffer.h"
+#include "html.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+/* most labels of a host looked at */
+#define MAX_LABELS 128
+
+/* a trie of the hosts, read from their end: a node is one byte, and its
+ * children hang from it in a list. Rule indices are offset by one, so
+ * that 0 is none */
+struct host_node {
+	uint32_t child, next;
+	uint32_t rule;
+	uint8_t c;
+};
+
+struct link_rule {
+	uint32_t scheme, scheme_size;	/* no scheme for any */
+	uint32_t attrs, attrs_size;
+	uint32_t next;	/* next rule of the same host */
+};
+
+/* sdhtml_link_rules • the attributes to give links, by host and scheme */
+struct sdhtml_link_rules {
+	struct host_node *nodes;
+	size_t node_count, node_asize;
+	struct link_rule *rules;
+	size_t rule_count, rule_asize;
+	struct buf *strings;
+	int ref_count;
+};
+
+static int
+grow(void **items, size_t *asize, size_t count, size_t item_size)
+{
+	void *neo;
+	size_t neo_asize;
+
+	if (count < *asize)
+		return 0;
+
+	neo_asize = *asize ? *asize * 2 : 16;
+	if ((neo = realloc(*items, neo_asize * item_size)) == NULL)
+		return -1;
+
+	*items = neo;
+	*asize = neo_asize;
+	return 0;
+}
+
+/* host_find • the child of `node` for the byte `c`, 0 if none */
+static uint32_t
+host_find(const struct sdhtml_link_rules *rules, uint32_t node, uint8_t c)
+{
+	uint32_t i;
+
+	for (i = rules->nodes[node].child; i; i = rules->nodes[i].next) {
+		if (rules->nodes[i].c == c)
+			return i;
+	}
+
+	return 0;
+}
+
+/* host_child • the child of `node` for the byte `c`, made if needed */
+static uint32_t
+host_child(struct sdhtml_link_rules *rules, uint32_t node, uint8_t c)
+{
+	uint32_t i = host_find(rules, node, c);
+	struct host_node *child;
+
+	if (i)
+		return i;
+
+	if (grow((void **)&rules->nodes, &rules->node_asize, rules->node_count, sizeof(struct host_node)) < 0)
+		return 0;
+
+	i = (uint32_t)rules->node_count++;
+	child = &rules->nodes[i];
+	child->c = c;
+	child->rule = 0;
+	child->child = 0;
+	child->next = rules->nodes[node].child;
+	rules->nodes[node].child = i;
+	return i;
+}
+
+/* host_of • the host part of a URL, if it has one */
+static int
+host_of(const uint8_t *url, size_t size, const uint8_t **scheme, size_t *scheme_size, size_t *beg, size_t *end)
+{
+	size_t i = 0, j;
+
+	*scheme = NULL;
+	*scheme_size = 0;
+
+	if (i < size && isalpha(url[i])) {
+		while (i < size && (isalnum(url[i]) || url[i] == '+' || url[i] == '-' || url[i] == '.'))
+			i++;
+
+		if (i < size && url[i] == ':') {
+			*scheme = url;
+			*scheme_size = i;
+			i++;
+		} else
+			i = 0;
+	}
+
+	if (i + 2 > size || url[i] != '/' || url[i + 1] != '/')
+		return 0;
+
+	i += 2;
+	for (j = i; j < size && url[j] != '/' && url[j] != '?' && url[j] != '#'; j++) {
+		if (url[j] == '@')
+			i = j + 1;
+	}
+
+	*beg = i;
+	if (i < j && url[i] == '[') {
+		while (i < j && url[i] != ']')
+			i++;
+		*end = i < j ? i + 1 : j;
+	} else {
+		while (i < j && url[i] != ':')
+			i++;
+		*end = i;
+	}
+
+	while (*end > *beg && url[*end - 1] == '.')
+		(*end)--;
+
+	return *end > *beg;
+}
+
+static int
+same_scheme(const struct sdhtml_link_rules *rules, const struct link_rule *rule, const uint8_t *scheme, size_t size)
+{
+	size_t i;
+
+	if (!rule->scheme_size)
+		return 1;
+
+	if (rule->scheme_size != size)
+		return 0;
+
+	for (i = 0; i < size; ++i) {
+		if (rules->strings->data[rule->scheme + i] != tolower(scheme[i]))
+			return 0;
+	}
+
+	return 1;
+}
+
+/* first_rule • the first rule of the list starting at `rule` that takes
+ * links with the given scheme */
+static const struct link_rule *
+first_rule(const struct sdhtml_link_rules *rules, uint32_t rule, const uint8_t *scheme, size_t scheme_size)
+{
+	for (; rule; rule = rules->rules[rule - 1].next) {
+		if (same_scheme(rules, &rules->rules[rule - 1], scheme, scheme_size))
+			return &rules->rules[rule - 1];
+	}
+
+	return NULL;
+}
+
+struct sdhtml_link_rules *
+sdhtml_link_rules_new(void)
+{
+	struct sdhtml_link_rules *rules = calloc(1, sizeof(struct sdhtml_link_rules));
+
+	if (!rules)
+		return NULL;
+
+	rules->strings = bufnew(256);
+	rules->nodes = malloc(16 * sizeof(struct host_node));
+	if (!rules->strings || !rules->nodes) {
+		bufrelease(rules->strings);
+		free(rules->nodes);
+		free(rules);
+		return NULL;
+	}
+
+	/* the root, for the rules without a host */
+	memset(rules->nodes, 0x0, sizeof(struct host_node));
+	rules->node_asize = 16;
+	rules->node_count = 1;
+	rules->ref_count = 1;
+	return rules;
+}
+
+int
+sdhtml_link_rules_add(struct sdhtml_link_rules *rules, const char *scheme, const char *host, const char *attributes)
+{
+	struct link_rule *rule;
+	uint32_t node = 0, *last;
+	size_t i, size;
+
+	if (host) {
+		size = strlen(host);
+		while (size && host[size - 1] == '.')
+			size--;
+		while (size && host[0] == '.') {
+			host++;
+			size--;
+		}
+
+		for (i = size; i > 0; --i) {
+			if ((node = host_child(rules, node, (uint8_t)tolower(host[i - 1]))) == 0)
+				return -1;
+		}
+	}
+
+	if (grow((void **)&rules->rules, &rules->rule_asize, rules->rule_count, sizeof(struct link_rule)) < 0)
+		return -1;
+
+	rule = &rules->rules[rules->rule_count];
+	rule->next = 0;
+
+	rule->scheme = (uint32_t)rules->strings->size;
+	rule->scheme_size = scheme ? (uint32_t)strlen(scheme) : 0;
+	for (i = 0; i < rule->scheme_size; ++i)
+		bufputc(rules->strings, tolower(scheme[i]));
+
+	rule->attrs = (uint32_t)rules->strings->size;
+	rule->attrs_size = (uint32_t)strlen(attributes);
+	bufput(rules->strings, attributes, rule->attrs_size);
+
+	/* the rules of a host are tried in the order they were given */
+	for (last = &rules->nodes[node].rule; *last; last = &rules->rules[*last - 1].next);
+	*last = (uint32_t)++rules->rule_count;
+	return 0;
+}
+
+void
+sdhtml_link_attributes(struct buf *ob, const struct buf *url, void *opaque)
+{
+	const struct sdhtml_link_rules *rules = ((struct html_renderopt *)opaque)->link_rules;
+	const struct link_rule *rule = NULL;
+	const uint8_t *scheme = NULL, *host;
+	size_t scheme_size = 0, beg, end, k;
+	uint32_t found[MAX_LABELS], node = 0;
+	size_t count = 0;
+
+	if (!rules)
+		return;
+
+	/* the hosts the URL is in, from the widest to the narrowest */
+	if (url && host_of(url->data, url->size, &scheme, &scheme_size, &beg, &end)) {
+		host = url->data;
+
+		for (k = end; k > beg; --k) {
+			if ((node = host_find(rules, node, (uint8_t)tolower(host[k - 1]))) == 0)
+				break;
+
+			if (rules->nodes[node].rule && (k - 1 == beg || host[k - 2] == '.') && count < MAX_LABELS)
+				found[count++] = node;
+		}
+	}
+
+	/* the narrowest host with a rule for the scheme wins */
+	while (count && !rule) {
+		count--;
+		rule = first_rule(rules, rules->nodes[found[count]].rule, scheme, scheme_size);
+	}
+
+	if (!rule)
+		rule = first_rule(rules, rules->nodes[0].rule, scheme, scheme_size);
+
+	if (rule && rule->attrs_size) {
+		bufputc(ob, ' ');
+		bufput(ob, rules->strings->data + rule->attrs, rule->attrs_size);
+	}
+}
+
+void
+sdhtml_set_link_rules(struct html_renderopt *options, struct sdhtml_link_rules *rules)
+{
+	struct sdhtml_link_rules *old = options->link_rules;
+
+	if (rules)
+		rules->ref_count++;
+
+	options->link_rules = rules;
+	options->link_attributes = rules ? sdhtml_link_attributes : NULL;
+	sdhtml_link_rules_release(old);
+}
+
+void
+sdhtml_link_rules_release(struct sdhtml_link_rules *rules)
+{
+	if (!rules || --rules->ref_count > 0)
+		return;
+
+	free(rules->nodes);
+	free(rules->rules);
+	bufrelease(rules->strings);
+	free(rules);
+}
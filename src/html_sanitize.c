@@ -0,0 +1,574 @@
+/*
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "buffer.h"
+#include "html.h"
+#include "houdini.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+/* seeds tried for a table size before doubling it */
+#define MAX_SEEDS 4096
+
+/* a name in a set: tags, attributes (of one tag, or of all with tag 0)
+ * or schemes, lowercase and followed by a 0 in the strings */
+struct san_key {
+	uint32_t name, size;
+	uint32_t tag;	/* 1 + index of the tag of an attribute */
+	int flags;
+};
+
+enum {
+	KEY_ALLOWED = (1 << 0),	/* a tag let through, not just named */
+	KEY_URL = (1 << 1),	/* an attribute whose value is a URL */
+};
+
+/* key_set • names looked up through a perfect hash: every key has a
+ * slot of its own, so that a lookup is one hash and one comparison */
+struct key_set {
+	struct san_key *keys;
+	size_t count, asize;
+	uint32_t *slots;	/* 1 + index of a key, 0 for none */
+	uint32_t mask, seed;
+};
+
+/* sdhtml_sanitizer • the tags, attributes and URL schemes let through */
+struct sdhtml_sanitizer {
+	struct key_set tags, attrs, schemes;
+	struct buf *strings;
+	int compiled;
+	int ref_count;
+};
+
+/* the attributes holding a URL, whose scheme has to be allowed */
+static const char *url_attributes[] = {
+	"href", "src", "cite", "action", "formaction", "poster", "background", "longdesc", "xlink:href",
+};
+
+/* the tags whose content is dropped along with them */
+static const char *skip_content[] = { "script", "style" };
+
+static uint32_t
+key_hash(const uint8_t *name, size_t size, uint32_t tag, uint32_t seed)
+{
+	uint32_t hash = 2166136261u ^ seed ^ (tag * 0x9E3779B1u);
+	size_t i;
+
+	for (i = 0; i < size; ++i)
+		hash = (hash ^ (uint8_t)tolower(name[i])) * 16777619u;
+
+	return hash ^ (hash >> 15);
+}
+
+static int
+key_add(struct key_set *set, struct buf *strings, const char *name, uint32_t tag)
+{
+	struct san_key *key;
+	size_t i, size = strlen(name);
+
+	if (set->count >= set->asize) {
+		size_t neo_asize = set->asize ? set->asize * 2 : 16;
+		void *neo = realloc(set->keys, neo_asize * sizeof(struct san_key));
+
+		if (!neo)
+			return -1;
+
+		set->keys = neo;
+		set->asize = neo_asize;
+	}
+
+	key = &set->keys[set->count++];
+	key->name = (uint32_t)strings->size;
+	key->size = (uint32_t)size;
+	key->tag = tag;
+	key->flags = 0;
+
+	for (i = 0; i < size; ++i)
+		bufputc(strings, tolower(name[i]));
+	bufputc(strings, 0);
+
+	return 0;
+}
+
+static int
+key_equals(const struct san_key *key, const uint8_t *strings, const uint8_t *name, size_t size, uint32_t tag)
+{
+	size_t i;
+
+	if (key->size != size || key->tag != tag)
+		return 0;
+
+	for (i = 0; i < size; ++i) {
+		if (strings[key->name + i] != tolower(name[i]))
+			return 0;
+	}
+
+	return 1;
+}
+
+/* key_find • the index of a key, -1 if it isn't in the set */
+static long
+key_find(const struct key_set *set, const uint8_t *strings, const uint8_t *name, size_t size, uint32_t tag)
+{
+	uint32_t slot;
+
+	if (!set->slots)
+		return -1;
+
+	slot = set->slots[key_hash(name, size, tag, set->seed) & set->mask];
+	if (slot && key_equals(&set->keys[slot - 1], strings, name, size, tag))
+		return (long)slot - 1;
+
+	return -1;
+}
+
+/* key_compile • finds a seed giving each key a slot of its own; keys
+ * given twice keep the first */
+static int
+key_compile(struct key_set *set, const uint8_t *strings)
+{
+	size_t table_size = 8, i;
+	uint32_t seed, *slots, h;
+
+	while (table_size < set->count * 2)
+		table_size *= 2;
+
+	for (;;) {
+		if ((slots = calloc(table_size, sizeof(uint32_t))) == NULL)
+			return -1;
+
+		for (seed = 0; seed < MAX_SEEDS; ++seed) {
+			for (i = 0; i < set->count; ++i) {
+				const struct san_key *key = &set->keys[i];
+
+				h = key_hash(strings + key->name, key->size, key->tag, seed) & (uint32_t)(table_size - 1);
+				if (slots[h] && !key_equals(&set->keys[slots[h] - 1], strings, strings + key->name, key->size, key->tag))
+					break;
+				if (!slots[h])
+					slots[h] = (uint32_t)i + 1;
+			}
+
+			if (i == set->count)
+				break;
+
+			memset(slots, 0x0, table_size * sizeof(uint32_t));
+		}
+
+		if (seed < MAX_SEEDS) {
+			free(set->slots);
+			set->slots = slots;
+			set->mask = (uint32_t)(table_size - 1);
+			set->seed = seed;
+			return 0;
+		}
+
+		free(slots);
+		table_size *= 2;
+	}
+}
+
+static int
+in_list(const char **list, size_t count, const uint8_t *name, size_t size)
+{
+	size_t i, j;
+
+	for (i = 0; i < count; ++i) {
+		for (j = 0; j < size && list[i][j] && list[i][j] == tolower(name[j]); ++j);
+		if (j == size && list[i][j] == 0)
+			return 1;
+	}
+
+	return 0;
+}
+
+struct sdhtml_sanitizer *
+sdhtml_sanitizer_new(void)
+{
+	struct sdhtml_sanitizer *san = calloc(1, sizeof(struct sdhtml_sanitizer));
+
+	if (!san)
+		return NULL;
+
+	if ((san->strings = bufnew(256)) == NULL) {
+		free(san);
+		return NULL;
+	}
+
+	san->ref_count = 1;
+	return san;
+}
+
+/* tag_index • the index of a tag in the set while it's being built,
+ * added if needed */
+static long
+tag_index(struct sdhtml_sanitizer *san, const char *tag)
+{
+	size_t i, size = strlen(tag);
+
+	for (i = 0; i < san->tags.count; ++i) {
+		if (key_equals(&san->tags.keys[i], san->strings->data, (const uint8_t *)tag, size, 0))
+			return (long)i;
+	}
+
+	if (key_add(&san->tags, san->strings, tag, 0) < 0)
+		return -1;
+
+	return (long)san->tags.count - 1;
+}
+
+int
+sdhtml_sanitizer_allow_tag(struct sdhtml_sanitizer *san, const char *tag)
+{
+	long index = tag_index(san, tag);
+
+	if (index < 0)
+		return -1;
+
+	san->tags.keys[index].flags |= KEY_ALLOWED;
+	san->compiled = 0;
+	return 0;
+}
+
+int
+sdhtml_sanitizer_allow_attribute(struct sdhtml_sanitizer *san, const char *tag, const char *attribute)
+{
+	struct san_key *key;
+	long index = -1;
+
+	/* the tag may not be allowed yet, or at all */
+	if (tag && (index = tag_index(san, tag)) < 0)
+		return -1;
+
+	if (key_add(&san->attrs, san->strings, attribute, (uint32_t)(index + 1)) < 0)
+		return -1;
+
+	key = &san->attrs.keys[san->attrs.count - 1];
+	if (in_list(url_attributes, sizeof(url_attributes) / sizeof(url_attributes[0]), san->strings->data + key->name, key->size))
+		key->flags |= KEY_URL;
+
+	san->compiled = 0;
+	return 0;
+}
+
+int
+sdhtml_sanitizer_allow_scheme(struct sdhtml_sanitizer *san, const char *scheme)
+{
+	san->compiled = 0;
+	return key_add(&san->schemes, san->strings, scheme, 0);
+}
+
+int
+sdhtml_sanitizer_compile(struct sdhtml_sanitizer *san)
+{
+	const uint8_t *strings = san->strings->data;
+
+	if (san->compiled)
+		return 0;
+
+	if (key_compile(&san->tags, strings) < 0 ||
+		key_compile(&san->attrs, strings) < 0 ||
+		key_compile(&san->schemes, strings) < 0)
+		return -1;
+
+	san->compiled = 1;
+	return 0;
+}
+
+/* tag_name • the length of the name of a tag starting at `data` */
+static size_t
+tag_name(const uint8_t *data, size_t size)
+{
+	size_t i = 0;
+
+	if (!size || !isalpha(data[0]))
+		return 0;
+
+	while (i < size && (isalnum(data[i]) || data[i] == '-' || data[i] == ':'))
+		i++;
+
+	return i;
+}
+
+/* url_allowed • whether the URL, once its entities are decoded and the
+ * bytes browsers ignore left out, is relative or has an allowed scheme */
+static int
+url_allowed(const struct sdhtml_sanitizer *san, const uint8_t *value, size_t size)
+{
+	struct buf *url;
+	size_t i, j = 0;
+	int allowed = 1;
+
+	if (!memchr(value, ':', size) && !memchr(value, '&', size))
+		return 1;
+
+	if ((url = bufnew(64)) == NULL)
+		return 0;
+
+	houdini_unescape_html(url, value, size);
+	if (!url->size)
+		bufput(url, value, size);
+
+	for (i = 0; i < url->size; ++i) {
+		if (url->data[i] > ' ' && url->data[i] != 0x7f)
+			url->data[j++] = url->data[i];
+	}
+	url->size = j;
+
+	for (i = 0; i < url->size && url->data[i] != ':' && url->data[i] != '/' && url->data[i] != '?' && url->data[i] != '#'; ++i) {
+		/* an entity left undecoded could hide a colon */
+		if (url->data[i] == '&')
+			allowed = 0;
+	}
+
+	if (allowed && i < url->size && url->data[i] == ':')
+		allowed = key_find(&san->schemes, san->strings->data, url->data, i, 0) >= 0;
+
+	bufrelease(url);
+	return allowed;
+}
+
+/* attr_allowed • whether a tag keeps an attribute */
+static int
+attr_allowed(const struct sdhtml_sanitizer *san, long tag, const uint8_t *name, size_t name_size,
+	const uint8_t *value, size_t value_size)
+{
+	const uint8_t *strings = san->strings->data;
+	long attr = key_find(&san->attrs, strings, name, name_size, (uint32_t)(tag + 1));
+
+	if (attr < 0 && (attr = key_find(&san->attrs, strings, name, name_size, 0)) < 0)
+		return 0;
+
+	return !(san->attrs.keys[attr].flags & KEY_URL) || url_allowed(san, value, value_size);
+}
+
+/* put_tag • writes a tag the sanitizer allows with only the attributes
+ * it allows, their values quoted anew */
+static void
+put_tag(struct buf *ob, const struct sdhtml_sanitizer *san, long tag, int closing,
+	const uint8_t *data, size_t i, size_t end)
+{
+	const struct san_key *key = &san->tags.keys[tag];
+	size_t name, name_size, value, value_size, k;
+	int has_value, self_closing = 0;
+	uint8_t quote;
+
+	bufputc(ob, '<');
+	if (closing)
+		bufputc(ob, '/');
+	bufput(ob, san->strings->data + key->name, key->size);
+
+	while (i < end) {
+		if (isspace(data[i]) || data[i] == '/') {
+			self_closing = data[i] == '/';
+			i++;
+			continue;
+		}
+
+		self_closing = 0;
+		name = i;
+		while (i < end && !isspace(data[i]) && data[i] != '/' && data[i] != '=')
+			i++;
+		name_size = i - name;
+
+		while (i < end && isspace(data[i]))
+			i++;
+
+		has_value = 0;
+		value = value_size = 0;
+		if (i < end && data[i] == '=') {
+			i++;
+			while (i < end && isspace(data[i]))
+				i++;
+
+			has_value = 1;
+			if (i < end && (data[i] == '"' || data[i] == '\'')) {
+				quote = data[i++];
+				value = i;
+				while (i < end && data[i] != quote)
+					i++;
+				value_size = i - value;
+				i++;
+			} else {
+				value = i;
+				while (i < end && !isspace(data[i]))
+					i++;
+				value_size = i - value;
+			}
+		}
+
+		if (closing || !name_size || !attr_allowed(san, tag, data + name, name_size, data + value, value_size))
+			continue;
+
+		bufputc(ob, ' ');
+		for (k = 0; k < name_size; ++k)
+			bufputc(ob, tolower(data[name + k]));
+
+		if (has_value) {
+			BUFPUTSL(ob, "=\"");
+			for (k = value; k < value + value_size; ++k) {
+				if (data[k] == '"')
+					BUFPUTSL(ob, "&quot;");
+				else
+					bufputc(ob, data[k]);
+			}
+			bufputc(ob, '"');
+		}
+	}
+
+	if (self_closing && !closing)
+		BUFPUTSL(ob, " /");
+	bufputc(ob, '>');
+}
+
+/* tag_end • the offset of the '>' closing the tag, quotes aside; 0 if
+ * there's none */
+static size_t
+tag_end(const uint8_t *data, size_t i, size_t size)
+{
+	uint8_t quote = 0;
+
+	for (; i < size; ++i) {
+		if (quote) {
+			if (data[i] == quote)
+				quote = 0;
+		} else if (data[i] == '"' || data[i] == '\'') {
+			if (i > 0 && (data[i - 1] == '=' || isspace(data[i - 1])))
+				quote = data[i];
+		} else if (data[i] == '>')
+			return i;
+	}
+
+	return 0;
+}
+
+/* skip_until_close • the offset past the closing tag of `name`, the
+ * size of the text if it's never closed */
+static size_t
+skip_until_close(const uint8_t *data, size_t i, size_t size, const char *name)
+{
+	const uint8_t *lt;
+
+	while (i < size && (lt = memchr(data + i, '<', size - i)) != NULL) {
+		i = lt - data;
+		if (sdhtml_is_tag(data + i, size - i, name) == HTML_TAG_CLOSE) {
+			const uint8_t *gt = memchr(data + i, '>', size - i);
+			return gt ? (size_t)(gt - data) + 1 : size;
+		}
+		i++;
+	}
+
+	return size;
+}
+
+void
+sdhtml_sanitize(struct buf *ob, const uint8_t *data, size_t size, const struct sdhtml_sanitizer *san)
+{
+	const uint8_t *strings = san->strings->data;
+	const uint8_t *lt;
+	size_t i = 0, org, name, name_size, end;
+	int closing, kind;
+	long tag;
+
+	while (i < size) {
+		org = i;
+		lt = memchr(data + i, '<', size - i);
+		i = lt ? (size_t)(lt - data) : size;
+		bufput(ob, data + org, i - org);
+
+		if (i >= size)
+			break;
+
+		/* comments, doctypes and processing instructions go */
+		if (i + 1 < size && (data[i + 1] == '!' || data[i + 1] == '?')) {
+			if (i + 3 < size && data[i + 2] == '-' && data[i + 3] == '-') {
+				for (end = i + 4; end + 2 < size && !(data[end] == '-' && data[end + 1] == '-' && data[end + 2] == '>'); end++);
+				i = end + 2 < size ? end + 3 : size;
+			} else {
+				lt = memchr(data + i, '>', size - i);
+				i = lt ? (size_t)(lt - data) + 1 : size;
+			}
+			continue;
+		}
+
+		closing = i + 1 < size && data[i + 1] == '/';
+		name = i + 1 + closing;
+		name_size = tag_name(data + name, size - name);
+		end = name_size ? tag_end(data, name + name_size, size) : 0;
+
+		/* not a tag: a '<' of the text */
+		if (!end) {
+			BUFPUTSL(ob, "&lt;");
+			i++;
+			continue;
+		}
+
+		tag = key_find(&san->tags, strings, data + name, name_size, 0);
+		if (tag >= 0 && !(san->tags.keys[tag].flags & KEY_ALLOWED))
+			tag = -1;
+
+		/* the name is that of the tag, as sdhtml_is_tag reads it */
+		if (tag >= 0) {
+			kind = sdhtml_is_tag(data + i, end + 1 - i, (const char *)strings + san->tags.keys[tag].name);
+			if (kind == HTML_TAG_NONE || (kind == HTML_TAG_CLOSE) != closing)
+				tag = -1;
+		}
+
+		if (tag >= 0)
+			put_tag(ob, san, tag, closing, data, name + name_size, end);
+		else if (!closing && in_list(skip_content, sizeof(skip_content) / sizeof(skip_content[0]), data + name, name_size)) {
+			/* the name of the tag, as written, is in the list */
+			char tagname[8];
+			size_t k;
+
+			for (k = 0; k < name_size; ++k)
+				tagname[k] = tolower(data[name + k]);
+			tagname[k] = 0;
+
+			i = skip_until_close(data, end + 1, size, tagname);
+			continue;
+		}
+
+		i = end + 1;
+	}
+}
+
+void
+sdhtml_set_sanitizer(struct html_renderopt *options, struct sdhtml_sanitizer *san)
+{
+	struct sdhtml_sanitizer *old = options->sanitizer;
+
+	if (san)
+		san->ref_count++;
+
+	options->sanitizer = san;
+	sdhtml_sanitizer_release(old);
+}
+
+void
+sdhtml_sanitizer_release(struct sdhtml_sanitizer *san)
+{
+	if (!san || --san->ref_count > 0)
+		return;
+
+	free(san->tags.keys);
+	free(san->tags.slots);
+	free(san->attrs.keys);
+	free(san->attrs.slots);
+	free(san->schemes.keys);
+	free(san->schemes.slots);
+	bufrelease(san->strings);
+	free(san);
+}
@@ -16,6 +16,7 @@
 
 #include "buffer.h"
 #include "html.h"
+#include "houdini_simd.h"
 
 #include <string.h>
 #include <stdlib.h>
@@ -26,24 +27,19 @@
 #define snprintf	_snprintf		
 #endif
 
-struct smartypants_data {
-	int in_squote;
-	int in_dquote;
-};
-
-static size_t smartypants_cb__ltag(struct buf *ob, struct smartypants_data *smrt, uint8_t previous_char, const uint8_t *text, size_t size);
-static size_t smartypants_cb__dquote(struct buf *ob, struct smartypants_data *smrt, uint8_t previous_char, const uint8_t *text, size_t size);
-static size_t smartypants_cb__amp(struct buf *ob, struct smartypants_data *smrt, uint8_t previous_char, const uint8_t *text, size_t size);
-static size_t smartypants_cb__period(struct buf *ob, struct smartypants_data *smrt, uint8_t previous_char, const uint8_t *text, size_t size);
-static size_t smartypants_cb__number(struct buf *ob, struct smartypants_data *smrt, uint8_t previous_char, const uint8_t *text, size_t size);
-static size_t smartypants_cb__dash(struct buf *ob, struct smartypants_data *smrt, uint8_t previous_char, const uint8_t *text, size_t size);
-static size_t smartypants_cb__parens(struct buf *ob, struct smartypants_data *smrt, uint8_t previous_char, const uint8_t *text, size_t size);
-static size_t smartypants_cb__squote(struct buf *ob, struct smartypants_data *smrt, uint8_t previous_char, const uint8_t *text, size_t size);
-static size_t smartypants_cb__backtick(struct buf *ob, struct smartypants_data *smrt, uint8_t previous_char, const uint8_t *text, size_t size);
-static size_t smartypants_cb__escape(struct buf *ob, struct smartypants_data *smrt, uint8_t previous_char, const uint8_t *text, size_t size);
+static size_t smartypants_cb__ltag(struct buf *ob, struct sd_smartypants *smrt, uint8_t previous_char, const uint8_t *text, size_t size);
+static size_t smartypants_cb__dquote(struct buf *ob, struct sd_smartypants *smrt, uint8_t previous_char, const uint8_t *text, size_t size);
+static size_t smartypants_cb__amp(struct buf *ob, struct sd_smartypants *smrt, uint8_t previous_char, const uint8_t *text, size_t size);
+static size_t smartypants_cb__period(struct buf *ob, struct sd_smartypants *smrt, uint8_t previous_char, const uint8_t *text, size_t size);
+static size_t smartypants_cb__number(struct buf *ob, struct sd_smartypants *smrt, uint8_t previous_char, const uint8_t *text, size_t size);
+static size_t smartypants_cb__dash(struct buf *ob, struct sd_smartypants *smrt, uint8_t previous_char, const uint8_t *text, size_t size);
+static size_t smartypants_cb__parens(struct buf *ob, struct sd_smartypants *smrt, uint8_t previous_char, const uint8_t *text, size_t size);
+static size_t smartypants_cb__squote(struct buf *ob, struct sd_smartypants *smrt, uint8_t previous_char, const uint8_t *text, size_t size);
+static size_t smartypants_cb__backtick(struct buf *ob, struct sd_smartypants *smrt, uint8_t previous_char, const uint8_t *text, size_t size);
+static size_t smartypants_cb__escape(struct buf *ob, struct sd_smartypants *smrt, uint8_t previous_char, const uint8_t *text, size_t size);
 
 static size_t (*smartypants_cb_ptrs[])
-	(struct buf *, struct smartypants_data *, uint8_t, const uint8_t *, size_t) =
+	(struct buf *, struct sd_smartypants *, uint8_t, const uint8_t *, size_t) =
 {
 	NULL,					/* 0 */
 	smartypants_cb__dash,	/* 1 */
@@ -77,6 +73,36 @@ static const uint8_t smartypants_cb_chars[] = {
 	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
 };
 
+#ifdef HOUDINI_SIMD
+/* smartypants_mask • lanes of `v` that smartypants_cb_chars acts on */
+static inline unsigned int
+smartypants_mask(hd_vec v)
+{
+	return hd_mask(hd_or(
+		hd_or(hd_eq(v, '"'), hd_or(hd_range(v, '&', '('), hd_range(v, '-', '.'))),
+		hd_or(hd_or(hd_eq(v, '1'), hd_eq(v, '3')),
+			hd_or(hd_eq(v, '<'), hd_or(hd_eq(v, '\\'), hd_eq(v, '`'))))));
+}
+#endif
+
+/* smartypants_span • index of the first byte at or after `i` that
+ * smartypants_cb_chars acts on, or `size` */
+static inline size_t
+smartypants_span(const uint8_t *text, size_t i, size_t size)
+{
+#ifdef HOUDINI_SIMD
+	for (; i + HD_VEC_SIZE <= size; i += HD_VEC_SIZE) {
+		unsigned int mask = smartypants_mask(hd_load(text + i));
+		if (mask)
+			return i + hd_ctz(mask);
+	}
+#endif
+	while (i < size && smartypants_cb_chars[text[i]] == 0)
+		i++;
+
+	return i;
+}
+
 static inline int
 word_boundary(uint8_t c)
 {
@@ -101,7 +127,7 @@ smartypants_quotes(struct buf *ob, uint8_t previous_char, uint8_t next_char, uin
 }
 
 static size_t
-smartypants_cb__squote(struct buf *ob, struct smartypants_data *smrt, uint8_t previous_char, const uint8_t *text, size_t size)
+smartypants_cb__squote(struct buf *ob, struct sd_smartypants *smrt, uint8_t previous_char, const uint8_t *text, size_t size)
 {
 	if (size >= 2) {
 		uint8_t t1 = tolower(text[1]);
@@ -138,7 +164,7 @@ smartypants_cb__squote(struct buf *ob, struct smartypants_data *smrt, uint8_t pr
 }
 
 static size_t
-smartypants_cb__parens(struct buf *ob, struct smartypants_data *smrt, uint8_t previous_char, const uint8_t *text, size_t size)
+smartypants_cb__parens(struct buf *ob, struct sd_smartypants *smrt, uint8_t previous_char, const uint8_t *text, size_t size)
 {
 	if (size >= 3) {
 		uint8_t t1 = tolower(text[1]);
@@ -165,7 +191,7 @@ smartypants_cb__parens(struct buf *ob, struct smartypants_data *smrt, uint8_t pr
 }
 
 static size_t
-smartypants_cb__dash(struct buf *ob, struct smartypants_data *smrt, uint8_t previous_char, const uint8_t *text, size_t size)
+smartypants_cb__dash(struct buf *ob, struct sd_smartypants *smrt, uint8_t previous_char, const uint8_t *text, size_t size)
 {
 	if (size >= 3 && text[1] == '-' && text[2] == '-') {
 		BUFPUTSL(ob, "&mdash;");
@@ -182,7 +208,7 @@ smartypants_cb__dash(struct buf *ob, struct smartypants_data *smrt, uint8_t prev
 }
 
 static size_t
-smartypants_cb__amp(struct buf *ob, struct smartypants_data *smrt, uint8_t previous_char, const uint8_t *text, size_t size)
+smartypants_cb__amp(struct buf *ob, struct sd_smartypants *smrt, uint8_t previous_char, const uint8_t *text, size_t size)
 {
 	if (size >= 6 && memcmp(text, "&quot;", 6) == 0) {
 		if (smartypants_quotes(ob, previous_char, size >= 7 ? text[6] : 0, 'd', &smrt->in_dquote))
@@ -197,7 +223,7 @@ smartypants_cb__amp(struct buf *ob, struct smartypants_data *smrt, uint8_t previ
 }
 
 static size_t
-smartypants_cb__period(struct buf *ob, struct smartypants_data *smrt, uint8_t previous_char, const uint8_t *text, size_t size)
+smartypants_cb__period(struct buf *ob, struct sd_smartypants *smrt, uint8_t previous_char, const uint8_t *text, size_t size)
 {
 	if (size >= 3 && text[1] == '.' && text[2] == '.') {
 		BUFPUTSL(ob, "&hellip;");
@@ -214,7 +240,7 @@ smartypants_cb__period(struct buf *ob, struct smartypants_data *smrt, uint8_t pr
 }
 
 static size_t
-smartypants_cb__backtick(struct buf *ob, struct smartypants_data *smrt, uint8_t previous_char, const uint8_t *text, size_t size)
+smartypants_cb__backtick(struct buf *ob, struct sd_smartypants *smrt, uint8_t previous_char, const uint8_t *text, size_t size)
 {
 	if (size >= 2 && text[1] == '`') {
 		if (smartypants_quotes(ob, previous_char, size >= 3 ? text[2] : 0, 'd', &smrt->in_dquote))
@@ -225,7 +251,7 @@ smartypants_cb__backtick(struct buf *ob, struct smartypants_data *smrt, uint8_t
 }
 
 static size_t
-smartypants_cb__number(struct buf *ob, struct smartypants_data *smrt, uint8_t previous_char, const uint8_t *text, size_t size)
+smartypants_cb__number(struct buf *ob, struct sd_smartypants *smrt, uint8_t previous_char, const uint8_t *text, size_t size)
 {
 	if (word_boundary(previous_char) && size >= 3) {
 		if (text[0] == '1' && text[1] == '/' && text[2] == '2') {
@@ -257,7 +283,7 @@ smartypants_cb__number(struct buf *ob, struct smartypants_data *smrt, uint8_t pr
 }
 
 static size_t
-smartypants_cb__dquote(struct buf *ob, struct smartypants_data *smrt, uint8_t previous_char, const uint8_t *text, size_t size)
+smartypants_cb__dquote(struct buf *ob, struct sd_smartypants *smrt, uint8_t previous_char, const uint8_t *text, size_t size)
 {
 	if (!smartypants_quotes(ob, previous_char, size > 0 ? text[1] : 0, 'd', &smrt->in_dquote))
 		BUFPUTSL(ob, "&quot;");
@@ -265,48 +291,63 @@ smartypants_cb__dquote(struct buf *ob, struct smartypants_data *smrt, uint8_t pr
 	return 0;
 }
 
+static const char *skip_tags[] = {
+  "pre", "code", "var", "samp", "kbd", "math", "script", "style"
+};
+static const size_t skip_tags_count = 8;
+
+/* smartypants_skip • index of the '>' closing the skipped tag from `i`
+ * on, or `size` if the text ends first, still skipping */
 static size_t
-smartypants_cb__ltag(struct buf *ob, struct smartypants_data *smrt, uint8_t previous_char, const uint8_t *text, size_t size)
+smartypants_skip(struct sd_smartypants *smrt, const uint8_t *text, size_t i, size_t size)
 {
-	static const char *skip_tags[] = {
-	  "pre", "code", "var", "samp", "kbd", "math", "script", "style"
-	};
-	static const size_t skip_tags_count = 8;
+	for (;;) {
+		const uint8_t *lt = memchr(text + i, '<', size - i);
 
-	size_t tag, i = 0;
+		if (!lt)
+			return size;
 
-	while (i < size && text[i] != '>')
-		i++;
+		i = lt - text;
 
-	for (tag = 0; tag < skip_tags_count; ++tag) {
-		if (sdhtml_is_tag(text, size, skip_tags[tag]) == HTML_TAG_OPEN)
+		if (sdhtml_is_tag(text + i, size - i, skip_tags[smrt->skip - 1]) == HTML_TAG_CLOSE)
 			break;
+
+		i++;
 	}
 
-	if (tag < skip_tags_count) {
-		for (;;) {
-			while (i < size && text[i] != '<')
-				i++;
+	while (i < size && text[i] != '>')
+		i++;
 
-			if (i == size)
-				break;
+	if (i < size)
+		smrt->skip = 0;
 
-			if (sdhtml_is_tag(text + i, size - i, skip_tags[tag]) == HTML_TAG_CLOSE)
-				break;
+	return i;
+}
 
-			i++;
-		}
+static size_t
+smartypants_cb__ltag(struct buf *ob, struct sd_smartypants *smrt, uint8_t previous_char, const uint8_t *text, size_t size)
+{
+	const uint8_t *gt = memchr(text, '>', size);
+	size_t tag, i = gt ? (size_t)(gt - text) : size;
 
-		while (i < size && text[i] != '>')
-			i++;
+	/* only the names starting like the tag's are worth a closer look */
+	for (tag = 0; tag < skip_tags_count; ++tag) {
+		if (size > 1 && skip_tags[tag][0] == text[1] &&
+			sdhtml_is_tag(text, size, skip_tags[tag]) == HTML_TAG_OPEN)
+			break;
 	}
 
-	bufput(ob, text, i + 1);
+	if (tag < skip_tags_count) {
+		smrt->skip = (int)tag + 1;
+		i = smartypants_skip(smrt, text, i, size);
+	}
+
+	bufput(ob, text, i < size ? i + 1 : size);
 	return i;
 }
 
 static size_t
-smartypants_cb__escape(struct buf *ob, struct smartypants_data *smrt, uint8_t previous_char, const uint8_t *text, size_t size)
+smartypants_cb__escape(struct buf *ob, struct sd_smartypants *smrt, uint8_t previous_char, const uint8_t *text, size_t size)
 {
 	if (size < 2)
 		return 0;
@@ -358,32 +399,69 @@ static struct {
 #endif
 
 void
-sdhtml_smartypants(struct buf *ob, const uint8_t *text, size_t size)
+sdhtml_smartypants_part(struct buf *ob, struct sd_smartypants *smrt, uint8_t previous_char, const uint8_t *text, size_t size)
 {
-	size_t i;
-	struct smartypants_data smrt = {0, 0};
+	size_t i = 0;
 
 	if (!text)
 		return;
 
-	bufgrow(ob, size);
+	bufgrow(ob, ob->size + size);
 
-	for (i = 0; i < size; ++i) {
-		size_t org;
-		uint8_t action = 0;
+	/* still within a tag whose content is left alone */
+	if (smrt->skip) {
+		i = smartypants_skip(smrt, text, 0, size);
+		bufput(ob, text, i < size ? i + 1 : size);
+		i++;
+	}
 
-		org = i;
-		while (i < size && (action = smartypants_cb_chars[text[i]]) == 0)
-			i++;
+	for (; i < size; ++i) {
+		size_t org = i;
+
+		i = smartypants_span(text, i, size);
 
 		if (i > org)
 			bufput(ob, text + org, i - org);
 
 		if (i < size) {
-			i += smartypants_cb_ptrs[(int)action]
-				(ob, &smrt, i ? text[i - 1] : 0, text + i, size - i);
+			i += smartypants_cb_ptrs[smartypants_cb_chars[text[i]]]
+				(ob, smrt, i ? text[i - 1] : previous_char, text + i, size - i);
 		}
 	}
 }
 
+int
+sdhtml_needs_smartypants(const uint8_t *text, size_t size)
+{
+	return smartypants_span(text, 0, size) < size;
+}
+
+int
+sdhtml_lazy_smartypants(struct buf *ob, const uint8_t *text, size_t size)
+{
+	struct sd_smartypants smrt;
+	size_t i = smartypants_span(text, 0, size);
+
+	/* nothing to act on: leave the text to the caller */
+	if (i >= size)
+		return 0;
+
+	memset(&smrt, 0x0, sizeof(smrt));
+	if (bufgrow(ob, ob->size + size) < 0)
+		return -1;
+
+	bufput(ob, text, i);
+	sdhtml_smartypants_part(ob, &smrt, i ? text[i - 1] : 0, text + i, size - i);
+	return 1;
+}
+
+void
+sdhtml_smartypants(struct buf *ob, const uint8_t *text, size_t size)
+{
+	struct sd_smartypants smrt;
+
+	memset(&smrt, 0x0, sizeof(smrt));
+	sdhtml_smartypants_part(ob, &smrt, 0, text, size);
+}
+
 
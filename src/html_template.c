@@ -0,0 +1,771 @@
+/*
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "markdown.h"
+#include "html.h"
+#include "autolink.h"
+#include "houdini.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <ctype.h>
+
+/* deepest nesting of {#field} sections */
+#define TPL_MAX_SECTIONS 16
+
+enum tpl_element {
+	TPL_BLOCKCODE,
+	TPL_BLOCKQUOTE,
+	TPL_HEADER,
+	TPL_HRULE,
+	TPL_LIST,
+	TPL_LISTITEM,
+	TPL_PARAGRAPH,
+	TPL_TABLE,
+	TPL_TABLE_ROW,
+	TPL_TABLE_CELL,
+	TPL_AUTOLINK,
+	TPL_CODESPAN,
+	TPL_DOUBLE_EMPHASIS,
+	TPL_EMPHASIS,
+	TPL_IMAGE,
+	TPL_LINEBREAK,
+	TPL_LINK,
+	TPL_TRIPLE_EMPHASIS,
+	TPL_STRIKETHROUGH,
+	TPL_SUPERSCRIPT,
+	TPL_ELEMENT_COUNT
+};
+
+enum tpl_field {
+	TPL_TEXT,
+	TPL_LANG,
+	TPL_HREF,
+	TPL_TITLE,
+	TPL_ALT,
+	TPL_LEVEL,
+	TPL_TAG,
+	TPL_ALIGN,
+	TPL_HEADER_ROWS,
+	TPL_BODY_ROWS,
+	TPL_ATTRS,
+	TPL_FIELD_COUNT
+};
+
+enum tpl_escape {
+	TPL_RAW,
+	TPL_HTML,
+	TPL_HREF_ESCAPE,
+	TPL_DEFAULT
+};
+
+enum tpl_opcode {
+	TPL_OP_LITERAL,	/* `start`, `size`: range in the literals */
+	TPL_OP_FIELD,
+	TPL_OP_SECTION	/* skips the `size` ops after it if the field is empty */
+};
+
+struct tpl_op {
+	uint8_t code;
+	uint8_t field;
+	uint8_t escape;
+	uint32_t start, size;
+};
+
+/* sdhtml_templates • the compiled templates of all the elements, as
+ * ranges in a single list of instructions */
+struct sdhtml_templates {
+	struct tpl_op *ops;
+	size_t op_count, op_asize;
+	struct buf *literals;
+	struct {
+		size_t first, count;
+		int set;
+	} element[TPL_ELEMENT_COUNT];
+};
+
+/* tpl_value • what a field stands for in one call; `lines` asks for a
+ * line break at every newline but a trailing one */
+struct tpl_value {
+	const char *prefix;
+	const uint8_t *data;
+	size_t size;
+	int lines;
+};
+
+#define FIELD(f) (1u << (f))
+
+static const struct {
+	const char *name;
+	unsigned int fields;
+	int source_text;	/* {text} is source text, HTML-escaped by default */
+} elements[TPL_ELEMENT_COUNT] = {
+	{ "blockcode", FIELD(TPL_TEXT) | FIELD(TPL_LANG), 1 },
+	{ "blockquote", FIELD(TPL_TEXT), 0 },
+	{ "header", FIELD(TPL_TEXT) | FIELD(TPL_LEVEL), 0 },
+	{ "hrule", 0, 0 },
+	{ "list", FIELD(TPL_TEXT) | FIELD(TPL_TAG), 0 },
+	{ "listitem", FIELD(TPL_TEXT), 0 },
+	{ "paragraph", FIELD(TPL_TEXT), 0 },
+	{ "table", FIELD(TPL_HEADER_ROWS) | FIELD(TPL_BODY_ROWS), 0 },
+	{ "table_row", FIELD(TPL_TEXT), 0 },
+	{ "table_cell", FIELD(TPL_TEXT) | FIELD(TPL_TAG) | FIELD(TPL_ALIGN), 0 },
+	{ "autolink", FIELD(TPL_TEXT) | FIELD(TPL_HREF) | FIELD(TPL_ATTRS), 1 },
+	{ "codespan", FIELD(TPL_TEXT), 1 },
+	{ "double_emphasis", FIELD(TPL_TEXT), 0 },
+	{ "emphasis", FIELD(TPL_TEXT), 0 },
+	{ "image", FIELD(TPL_HREF) | FIELD(TPL_TITLE) | FIELD(TPL_ALT), 0 },
+	{ "linebreak", 0, 0 },
+	{ "link", FIELD(TPL_TEXT) | FIELD(TPL_HREF) | FIELD(TPL_TITLE) | FIELD(TPL_ATTRS), 0 },
+	{ "triple_emphasis", FIELD(TPL_TEXT), 0 },
+	{ "strikethrough", FIELD(TPL_TEXT), 0 },
+	{ "superscript", FIELD(TPL_TEXT), 0 },
+};
+
+static const char *field_names[TPL_FIELD_COUNT] = {
+	"text", "lang", "href", "title", "alt", "level", "tag", "align", "header", "body", "attrs"
+};
+
+static const char *escape_names[TPL_DEFAULT] = { "raw", "html", "href" };
+
+/********************
+ * COMPILATION
+ ********************/
+
+static int
+lookup(const char **names, size_t count, const uint8_t *name, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < count; ++i) {
+		if (strlen(names[i]) == size && memcmp(names[i], name, size) == 0)
+			return (int)i;
+	}
+
+	return -1;
+}
+
+static struct tpl_op *
+add_op(struct sdhtml_templates *tpl, enum tpl_opcode code)
+{
+	struct tpl_op *op;
+
+	if (tpl->op_count == tpl->op_asize) {
+		size_t asize = tpl->op_asize ? tpl->op_asize * 2 : 32;
+		struct tpl_op *ops = realloc(tpl->ops, asize * sizeof(struct tpl_op));
+
+		if (!ops)
+			return NULL;
+
+		tpl->ops = ops;
+		tpl->op_asize = asize;
+	}
+
+	op = &tpl->ops[tpl->op_count++];
+	memset(op, 0x0, sizeof(struct tpl_op));
+	op->code = code;
+	return op;
+}
+
+/* add_literal • appends literal text, merging it with the op before
+ * when that one is a literal too, from `from` on */
+static int
+add_literal(struct sdhtml_templates *tpl, size_t from, const uint8_t *text, size_t size)
+{
+	struct tpl_op *op = tpl->op_count > from ? &tpl->ops[tpl->op_count - 1] : NULL;
+
+	if (!size)
+		return 0;
+
+	if (!op || op->code != TPL_OP_LITERAL || op->start + op->size != tpl->literals->size) {
+		if ((op = add_op(tpl, TPL_OP_LITERAL)) == NULL)
+			return -1;
+		op->start = (uint32_t)tpl->literals->size;
+	}
+
+	bufput(tpl->literals, text, size);
+	op->size += (uint32_t)size;
+	return 0;
+}
+
+/* compile • appends the ops of a template for `element`: text, with
+ * {field} or {field|escape} placeholders, {#field}...{/field} sections
+ * left out when the field is empty, and {{ for a brace */
+static int
+compile(struct sdhtml_templates *tpl, enum tpl_element element, const uint8_t *src, size_t size, const char **error)
+{
+	size_t sections[TPL_MAX_SECTIONS], depth = 0;
+	size_t first = tpl->op_count, merge = first, i = 0, org, end;
+	struct tpl_op *op;
+
+	while (i < size) {
+		const uint8_t *name;
+		size_t name_size, bar;
+		int field, escape = TPL_DEFAULT;
+		uint8_t kind = 0;
+
+		org = i;
+		while (i < size && src[i] != '{')
+			i++;
+
+		if (add_literal(tpl, merge, src + org, i - org) < 0)
+			goto nomem;
+
+		if (i >= size)
+			break;
+
+		if (i + 1 < size && src[i + 1] == '{') {
+			if (add_literal(tpl, merge, src + i, 1) < 0)
+				goto nomem;
+			i += 2;
+			continue;
+		}
+
+		for (end = i + 1; end < size && src[end] != '}'; end++);
+
+		if (end >= size) {
+			*error = "unclosed placeholder";
+			return -1;
+		}
+
+		name = src + i + 1;
+		name_size = end - i - 1;
+		i = end + 1;
+
+		if (name_size && (name[0] == '#' || name[0] == '/')) {
+			kind = name[0];
+			name++;
+			name_size--;
+		}
+
+		for (bar = 0; bar < name_size && name[bar] != '|'; bar++);
+
+		if (bar < name_size) {
+			if (kind) {
+				*error = "sections take no escaping";
+				return -1;
+			}
+
+			escape = lookup(escape_names, TPL_DEFAULT, name + bar + 1, name_size - bar - 1);
+			if (escape < 0) {
+				*error = "unknown escaping, use raw, html or href";
+				return -1;
+			}
+
+			name_size = bar;
+		}
+
+		field = lookup(field_names, TPL_FIELD_COUNT, name, name_size);
+		if (field < 0 || !(elements[element].fields & FIELD(field))) {
+			*error = "unknown placeholder for this element";
+			return -1;
+		}
+
+		if (field == TPL_ATTRS && (kind || escape != TPL_DEFAULT)) {
+			*error = "{attrs} is written as it is, outside of sections";
+			return -1;
+		}
+
+		if (kind == '/') {
+			if (!depth || tpl->ops[sections[depth - 1]].field != field) {
+				*error = "section closed without being opened";
+				return -1;
+			}
+
+			depth--;
+			op = &tpl->ops[sections[depth]];
+			op->size = (uint32_t)(tpl->op_count - sections[depth] - 1);
+			merge = tpl->op_count;	/* what follows is outside of it */
+			continue;
+		}
+
+		if (kind == '#' && depth == TPL_MAX_SECTIONS) {
+			*error = "sections nested too deep";
+			return -1;
+		}
+
+		if ((op = add_op(tpl, kind ? TPL_OP_SECTION : TPL_OP_FIELD)) == NULL)
+			goto nomem;
+
+		op->field = (uint8_t)field;
+
+		if (escape == TPL_DEFAULT) {
+			if (field == TPL_HREF)
+				escape = TPL_HREF_ESCAPE;
+			else if (field == TPL_LANG || field == TPL_TITLE || field == TPL_ALT ||
+				(field == TPL_TEXT && elements[element].source_text))
+				escape = TPL_HTML;
+			else
+				escape = TPL_RAW;
+		}
+		op->escape = (uint8_t)escape;
+
+		if (kind)
+			sections[depth++] = tpl->op_count - 1;
+	}
+
+	if (depth) {
+		*error = "section left open";
+		return -1;
+	}
+
+	tpl->element[element].first = first;
+	tpl->element[element].count = tpl->op_count - first;
+	tpl->element[element].set = 1;
+	return 0;
+
+nomem:
+	*error = "out of memory";
+	return -1;
+}
+
+/********************
+ * EXECUTION
+ ********************/
+
+static void run(struct buf *ob, const struct sdhtml_templates *tpl, enum tpl_element element,
+	const struct tpl_value *values, const struct buf *link, struct html_renderopt *options);
+
+static void
+put_escaped(struct buf *ob, const uint8_t *data, size_t size, int escape)
+{
+	switch (escape) {
+	case TPL_HTML:
+		houdini_escape_html0(ob, data, size, 0);
+		break;
+
+	case TPL_HREF_ESCAPE:
+		houdini_escape_href(ob, data, size);
+		break;
+
+	default:
+		bufput(ob, data, size);
+	}
+}
+
+/* put_lines • a paragraph with HTML_HARD_WRAP, as rndr_paragraph
+ * writes it, with the linebreak template if there is one */
+static void
+put_lines(struct buf *ob, const struct tpl_value *value, int escape, struct html_renderopt *options)
+{
+	const struct sdhtml_templates *tpl = options->templates;
+	size_t i = 0, org;
+
+	while (i < value->size) {
+		org = i;
+		while (i < value->size && value->data[i] != '\n')
+			i++;
+
+		if (i > org)
+			put_escaped(ob, value->data + org, i - org, escape);
+
+		if (i >= value->size - 1)
+			break;
+
+		if (tpl->element[TPL_LINEBREAK].set)
+			run(ob, tpl, TPL_LINEBREAK, NULL, NULL, options);
+		else
+			bufputs(ob, options->flags & HTML_USE_XHTML ? "<br/>\n" : "<br>\n");
+		i++;
+	}
+}
+
+static void
+run(struct buf *ob, const struct sdhtml_templates *tpl, enum tpl_element element,
+	const struct tpl_value *values, const struct buf *link, struct html_renderopt *options)
+{
+	const struct tpl_op *op = tpl->ops + tpl->element[element].first;
+	const struct tpl_op *end = op + tpl->element[element].count;
+	const struct tpl_value *value;
+
+	for (; op < end; ++op) {
+		switch (op->code) {
+		case TPL_OP_LITERAL:
+			bufput(ob, tpl->literals->data + op->start, op->size);
+			break;
+
+		case TPL_OP_SECTION:
+			value = &values[op->field];
+			if (!value->size && !value->prefix)
+				op += op->size;
+			break;
+
+		case TPL_OP_FIELD:
+			if (op->field == TPL_ATTRS) {
+				if (options->link_attributes)
+					options->link_attributes(ob, link, options);
+				break;
+			}
+
+			value = &values[op->field];
+			if (value->prefix)
+				bufputs(ob, value->prefix);
+
+			if (value->lines)
+				put_lines(ob, value, op->escape, options);
+			else if (value->size)
+				put_escaped(ob, value->data, value->size, op->escape);
+			break;
+		}
+	}
+}
+
+static inline void
+set_value(struct tpl_value *value, const struct buf *b)
+{
+	value->prefix = NULL;
+	value->data = b ? b->data : NULL;
+	value->size = b ? b->size : 0;
+	value->lines = 0;
+}
+
+static inline void
+set_string(struct tpl_value *value, const char *str)
+{
+	value->prefix = NULL;
+	value->data = (const uint8_t *)str;
+	value->size = strlen(str);
+	value->lines = 0;
+}
+
+/* the block elements are separated by a newline, as the HTML renderer does */
+#define BLOCK_START(ob) if (ob->size) bufputc(ob, '\n')
+
+#define TEMPLATE(element) \
+	struct html_renderopt *options = opaque; \
+	const struct sdhtml_templates *tpl = options->templates; \
+	const enum tpl_element tpl_element = element; \
+	struct tpl_value v[TPL_FIELD_COUNT]
+
+#define RUN(link) run(ob, tpl, tpl_element, v, link, options)
+
+/********************
+ * CALLBACKS
+ ********************/
+
+static void
+tpl_blockcode(struct buf *ob, const struct buf *text, const struct buf *lang, void *opaque)
+{
+	TEMPLATE(TPL_BLOCKCODE);
+	BLOCK_START(ob);
+	set_value(&v[TPL_TEXT], text);
+	set_value(&v[TPL_LANG], lang);
+	RUN(NULL);
+}
+
+static void
+tpl_blockquote(struct buf *ob, const struct buf *text, void *opaque)
+{
+	TEMPLATE(TPL_BLOCKQUOTE);
+	BLOCK_START(ob);
+	set_value(&v[TPL_TEXT], text);
+	RUN(NULL);
+}
+
+static void
+tpl_header(struct buf *ob, const struct buf *text, int level, void *opaque)
+{
+	char number[16];
+	TEMPLATE(TPL_HEADER);
+	BLOCK_START(ob);
+	snprintf(number, sizeof(number), "%d", level);
+	set_value(&v[TPL_TEXT], text);
+	set_string(&v[TPL_LEVEL], number);
+	RUN(NULL);
+}
+
+static void
+tpl_hrule(struct buf *ob, void *opaque)
+{
+	struct html_renderopt *options = opaque;
+	BLOCK_START(ob);
+	run(ob, options->templates, TPL_HRULE, NULL, NULL, options);
+}
+
+static void
+tpl_list(struct buf *ob, const struct buf *text, int flags, void *opaque)
+{
+	TEMPLATE(TPL_LIST);
+	BLOCK_START(ob);
+	set_value(&v[TPL_TEXT], text);
+	set_string(&v[TPL_TAG], flags & MKD_LIST_ORDERED ? "ol" : "ul");
+	RUN(NULL);
+}
+
+static void
+tpl_listitem(struct buf *ob, const struct buf *text, int flags, void *opaque)
+{
+	TEMPLATE(TPL_LISTITEM);
+	set_value(&v[TPL_TEXT], text);
+	while (v[TPL_TEXT].size && v[TPL_TEXT].data[v[TPL_TEXT].size - 1] == '\n')
+		v[TPL_TEXT].size--;
+	RUN(NULL);
+}
+
+static void
+tpl_paragraph(struct buf *ob, const struct buf *text, void *opaque)
+{
+	size_t i = 0;
+	TEMPLATE(TPL_PARAGRAPH);
+	BLOCK_START(ob);
+
+	if (!text)
+		return;
+
+	while (i < text->size && isspace(text->data[i]))
+		i++;
+
+	if (i == text->size)
+		return;
+
+	v[TPL_TEXT].prefix = NULL;
+	v[TPL_TEXT].data = text->data + i;
+	v[TPL_TEXT].size = text->size - i;
+	v[TPL_TEXT].lines = (options->flags & HTML_HARD_WRAP) != 0;
+	RUN(NULL);
+}
+
+static void
+tpl_table(struct buf *ob, const struct buf *header, const struct buf *body, void *opaque)
+{
+	TEMPLATE(TPL_TABLE);
+	BLOCK_START(ob);
+	set_value(&v[TPL_HEADER_ROWS], header);
+	set_value(&v[TPL_BODY_ROWS], body);
+	RUN(NULL);
+}
+
+static void
+tpl_table_row(struct buf *ob, const struct buf *text, void *opaque)
+{
+	TEMPLATE(TPL_TABLE_ROW);
+	set_value(&v[TPL_TEXT], text);
+	RUN(NULL);
+}
+
+static void
+tpl_table_cell(struct buf *ob, const struct buf *text, int flags, void *opaque)
+{
+	static const char *align[] = { "", "left", "right", "center" };
+	TEMPLATE(TPL_TABLE_CELL);
+	set_value(&v[TPL_TEXT], text);
+	set_string(&v[TPL_TAG], flags & MKD_TABLE_HEADER ? "th" : "td");
+	set_string(&v[TPL_ALIGN], align[flags & MKD_TABLE_ALIGNMASK]);
+	RUN(NULL);
+}
+
+static int
+tpl_autolink(struct buf *ob, const struct buf *link, enum mkd_autolink type, void *opaque)
+{
+	TEMPLATE(TPL_AUTOLINK);
+	const struct buf *href = link;
+	struct buf *work = NULL;
+
+	if (!link || !link->size)
+		return 0;
+
+	if (type != MKDA_EMAIL)
+		href = sdhtml_rewritten_link(&work, link, options);
+
+	if ((options->flags & HTML_SAFELINK) != 0 &&
+		!sd_autolink_issafe(href->data, href->size) &&
+		type != MKDA_EMAIL) {
+		bufrelease(work);
+		return 0;
+	}
+
+	set_value(&v[TPL_HREF], href);
+	if (type == MKDA_EMAIL)
+		v[TPL_HREF].prefix = "mailto:";
+
+	set_value(&v[TPL_TEXT], link);
+	if (bufprefix(link, "mailto:") == 0) {
+		v[TPL_TEXT].data += 7;
+		v[TPL_TEXT].size -= 7;
+	}
+
+	RUN(href);
+	bufrelease(work);
+	return 1;
+}
+
+static int
+tpl_codespan(struct buf *ob, const struct buf *text, void *opaque)
+{
+	TEMPLATE(TPL_CODESPAN);
+	set_value(&v[TPL_TEXT], text);
+	RUN(NULL);
+	return 1;
+}
+
+/* the emphases print their markup verbatim when they're empty, as
+ * the HTML renderer does */
+#define TPL_SPAN(name, element) \
+	static int \
+	tpl_##name(struct buf *ob, const struct buf *text, void *opaque) \
+	{ \
+		TEMPLATE(element); \
+		if (!text || !text->size) \
+			return 0; \
+		set_value(&v[TPL_TEXT], text); \
+		RUN(NULL); \
+		return 1; \
+	}
+
+TPL_SPAN(double_emphasis, TPL_DOUBLE_EMPHASIS)
+TPL_SPAN(emphasis, TPL_EMPHASIS)
+TPL_SPAN(triple_emphasis, TPL_TRIPLE_EMPHASIS)
+TPL_SPAN(strikethrough, TPL_STRIKETHROUGH)
+TPL_SPAN(superscript, TPL_SUPERSCRIPT)
+
+static int
+tpl_image(struct buf *ob, const struct buf *link, const struct buf *title, const struct buf *alt, void *opaque)
+{
+	TEMPLATE(TPL_IMAGE);
+	struct buf *work = NULL;
+
+	if (!link || !link->size)
+		return 0;
+
+	link = sdhtml_rewritten_link(&work, link, options);
+
+	set_value(&v[TPL_HREF], link);
+	set_value(&v[TPL_TITLE], title);
+	set_value(&v[TPL_ALT], alt);
+	RUN(NULL);
+	bufrelease(work);
+	return 1;
+}
+
+static int
+tpl_linebreak(struct buf *ob, void *opaque)
+{
+	struct html_renderopt *options = opaque;
+	run(ob, options->templates, TPL_LINEBREAK, NULL, NULL, options);
+	return 1;
+}
+
+static int
+tpl_link(struct buf *ob, const struct buf *link, const struct buf *title, const struct buf *content, void *opaque)
+{
+	TEMPLATE(TPL_LINK);
+	struct buf *work = NULL;
+
+	link = sdhtml_rewritten_link(&work, link, options);
+
+	if (link != NULL && (options->flags & HTML_SAFELINK) != 0 && !sd_autolink_issafe(link->data, link->size)) {
+		bufrelease(work);
+		return 0;
+	}
+
+	set_value(&v[TPL_HREF], link);
+	set_value(&v[TPL_TITLE], title);
+	set_value(&v[TPL_TEXT], content);
+	RUN(link);
+	bufrelease(work);
+	return 1;
+}
+
+/********************
+ * PUBLIC API
+ ********************/
+
+struct sdhtml_templates *
+sdhtml_templates_new(void)
+{
+	struct sdhtml_templates *tpl = calloc(1, sizeof(struct sdhtml_templates));
+
+	if (!tpl)
+		return NULL;
+
+	if ((tpl->literals = bufnew(256)) == NULL) {
+		free(tpl);
+		return NULL;
+	}
+
+	return tpl;
+}
+
+int
+sdhtml_templates_set(struct sdhtml_templates *tpl, const char *element, const uint8_t *src, size_t size, const char **error)
+{
+	size_t first = tpl->op_count, literals = tpl->literals->size;
+	int i;
+
+	for (i = 0; i < TPL_ELEMENT_COUNT; ++i) {
+		if (strcmp(elements[i].name, element) == 0)
+			break;
+	}
+
+	if (i == TPL_ELEMENT_COUNT) {
+		*error = "no template can be given for this element";
+		return -1;
+	}
+
+	if (compile(tpl, (enum tpl_element)i, src, size, error) < 0) {
+		tpl->op_count = first;
+		tpl->literals->size = literals;
+		return -1;
+	}
+
+	return 0;
+}
+
+void
+sdhtml_templates_renderer(struct sd_callbacks *callbacks, struct html_renderopt *options, const struct sdhtml_templates *tpl)
+{
+	options->templates = tpl;
+
+#define INSTALL(el, callback) \
+	if (tpl->element[el].set && callbacks->callback) \
+		callbacks->callback = tpl_##callback
+
+	INSTALL(TPL_BLOCKCODE, blockcode);
+	INSTALL(TPL_BLOCKQUOTE, blockquote);
+	INSTALL(TPL_HRULE, hrule);
+	INSTALL(TPL_LIST, list);
+	INSTALL(TPL_LISTITEM, listitem);
+	INSTALL(TPL_PARAGRAPH, paragraph);
+	INSTALL(TPL_TABLE, table);
+	INSTALL(TPL_TABLE_ROW, table_row);
+	INSTALL(TPL_TABLE_CELL, table_cell);
+	INSTALL(TPL_AUTOLINK, autolink);
+	INSTALL(TPL_CODESPAN, codespan);
+	INSTALL(TPL_DOUBLE_EMPHASIS, double_emphasis);
+	INSTALL(TPL_EMPHASIS, emphasis);
+	INSTALL(TPL_IMAGE, image);
+	INSTALL(TPL_LINEBREAK, linebreak);
+	INSTALL(TPL_LINK, link);
+	INSTALL(TPL_TRIPLE_EMPHASIS, triple_emphasis);
+	INSTALL(TPL_STRIKETHROUGH, strikethrough);
+	INSTALL(TPL_SUPERSCRIPT, superscript);
+
+	/* the table of contents needs the ids the HTML renderer gives */
+	if (!(options->flags & (HTML_TOC | HTML_HEADER_IDS)) && !options->toc)
+		INSTALL(TPL_HEADER, header);
+
+#undef INSTALL
+}
+
+void
+sdhtml_templates_free(struct sdhtml_templates *tpl)
+{
+	if (!tpl)
+		return;
+
+	free(tpl->ops);
+	bufrelease(tpl->literals);
+	free(tpl);
+}
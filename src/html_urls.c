@@ -0,0 +1,277 @@
+/*
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "buffer.h"
+#include "html.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+struct url_prefix {
+	uint32_t from, from_size;
+	uint32_t to, to_size;
+};
+
+/* sdhtml_url_rewrites • the prefixes to replace in URLs, in order */
+struct sdhtml_url_rewrites {
+	struct url_prefix *prefixes;
+	size_t count, asize;
+	uint8_t first[256];	/* whether some prefix starts with the byte */
+	struct buf *strings;
+	int ref_count;
+};
+
+/* sdhtml_base_url • the URL relative ones are resolved against, with
+ * the lengths of its scheme (and colon), origin and directory */
+struct sdhtml_base_url {
+	uint8_t *data;
+	size_t size;
+	size_t scheme, origin, dir;
+};
+
+/* scheme_size • the length of the scheme a URL starts with, 0 if none */
+static size_t
+scheme_size(const uint8_t *url, size_t size)
+{
+	size_t i = 0;
+
+	if (!size || !isalpha(url[0]))
+		return 0;
+
+	while (i < size && (isalnum(url[i]) || url[i] == '+' || url[i] == '-' || url[i] == '.'))
+		i++;
+
+	return i < size && url[i] == ':' ? i : 0;
+}
+
+/* base_part • how much of the base goes before `url` to resolve it,
+ * 0 if it's to be left as it is; the leading "./" and "../" segments
+ * of a relative path are taken off the base, `skip` telling their size */
+static size_t
+base_part(const struct sdhtml_base_url *base, const uint8_t *url, size_t size, size_t *skip)
+{
+	size_t dir, i = 0;
+
+	*skip = 0;
+	if (!base || !size || url[0] == '#' || scheme_size(url, size))
+		return 0;
+
+	if (url[0] == '/')
+		return size > 1 && url[1] == '/' ? base->scheme : base->origin;
+
+	if (url[0] == '?')
+		return base->size;
+
+	dir = base->dir;
+	while (i < size && url[i] == '.') {
+		if (i + 1 < size && url[i + 1] == '/')
+			i += 2;
+		else if (i + 2 < size && url[i + 1] == '.' && url[i + 2] == '/') {
+			i += 3;
+			/* up to the slash before the last one, not past the origin */
+			if (dir > base->origin + 1) {
+				dir--;
+				while (dir > base->origin + 1 && base->data[dir - 1] != '/')
+					dir--;
+			}
+		} else
+			break;
+	}
+
+	*skip = i;
+	return dir;
+}
+
+struct sdhtml_url_rewrites *
+sdhtml_url_rewrites_new(void)
+{
+	struct sdhtml_url_rewrites *rw = calloc(1, sizeof(struct sdhtml_url_rewrites));
+
+	if (!rw)
+		return NULL;
+
+	if ((rw->strings = bufnew(256)) == NULL) {
+		free(rw);
+		return NULL;
+	}
+
+	rw->ref_count = 1;
+	return rw;
+}
+
+int
+sdhtml_url_rewrites_add(struct sdhtml_url_rewrites *rw, const char *from, const char *to)
+{
+	struct url_prefix *prefix;
+
+	if (rw->count >= rw->asize) {
+		size_t neo_asize = rw->asize ? rw->asize * 2 : 8;
+		void *neo = realloc(rw->prefixes, neo_asize * sizeof(struct url_prefix));
+
+		if (!neo)
+			return -1;
+
+		rw->prefixes = neo;
+		rw->asize = neo_asize;
+	}
+
+	prefix = &rw->prefixes[rw->count++];
+	prefix->from = (uint32_t)rw->strings->size;
+	prefix->from_size = (uint32_t)strlen(from);
+	bufput(rw->strings, from, prefix->from_size);
+
+	prefix->to = (uint32_t)rw->strings->size;
+	prefix->to_size = (uint32_t)strlen(to);
+	bufput(rw->strings, to, prefix->to_size);
+
+	/* an empty prefix is in every URL */
+	if (prefix->from_size)
+		rw->first[(uint8_t)from[0]] = 1;
+	else
+		memset(rw->first, 1, sizeof(rw->first));
+
+	return 0;
+}
+
+int
+sdhtml_rewrite_url(struct buf *ob, const uint8_t *url, size_t size, const struct html_renderopt *options)
+{
+	const struct sdhtml_url_rewrites *rw = options->url_rewrites;
+	const struct sdhtml_base_url *base = options->base_url;
+	const struct url_prefix *prefix = NULL;
+	size_t i, org, part, skip;
+
+	if (rw && size && rw->first[url[0]]) {
+		for (i = 0; i < rw->count; ++i) {
+			const struct url_prefix *p = &rw->prefixes[i];
+
+			if (p->from_size <= size && memcmp(url, rw->strings->data + p->from, p->from_size) == 0) {
+				prefix = p;
+				break;
+			}
+		}
+	}
+
+	if (!prefix) {
+		if ((part = base_part(base, url, size, &skip)) == 0)
+			return 0;
+
+		if (ob) {
+			bufput(ob, base->data, part);
+			bufput(ob, url + skip, size - skip);
+		}
+		return 1;
+	}
+
+	if (!ob)
+		return 1;
+
+	org = ob->size;
+	bufput(ob, rw->strings->data + prefix->to, prefix->to_size);
+	bufput(ob, url + prefix->from_size, size - prefix->from_size);
+
+	/* what the prefix became may still have to be resolved */
+	part = base_part(base, ob->data + org, ob->size - org, &skip);
+	if (part && bufgrow(ob, ob->size + part) == BUF_OK) {
+		memmove(ob->data + org + part, ob->data + org + skip, ob->size - org - skip);
+		memcpy(ob->data + org, base->data, part);
+		ob->size += part - skip;
+	}
+
+	return 1;
+}
+
+const struct buf *
+sdhtml_rewritten_link(struct buf **work, const struct buf *link, const struct html_renderopt *options)
+{
+	*work = NULL;
+
+	if (!link || !link->size || (!options->url_rewrites && !options->base_url))
+		return link;
+
+	if (!sdhtml_rewrite_url(NULL, link->data, link->size, options))
+		return link;
+
+	if ((*work = bufnew(64)) == NULL)
+		return link;
+
+	sdhtml_rewrite_url(*work, link->data, link->size, options);
+	return *work;
+}
+
+void
+sdhtml_set_url_rewrites(struct html_renderopt *options, struct sdhtml_url_rewrites *rw)
+{
+	struct sdhtml_url_rewrites *old = options->url_rewrites;
+
+	if (rw)
+		rw->ref_count++;
+
+	options->url_rewrites = rw;
+	sdhtml_url_rewrites_release(old);
+}
+
+void
+sdhtml_url_rewrites_release(struct sdhtml_url_rewrites *rw)
+{
+	if (!rw || --rw->ref_count > 0)
+		return;
+
+	free(rw->prefixes);
+	bufrelease(rw->strings);
+	free(rw);
+}
+
+int
+sdhtml_set_base_url(struct html_renderopt *options, const uint8_t *url, size_t size)
+{
+	struct sdhtml_base_url *base = NULL;
+	size_t i, path;
+
+	if (url) {
+		/* room for the slash of an empty path */
+		if ((base = malloc(sizeof(struct sdhtml_base_url) + size + 1)) == NULL)
+			return -1;
+
+		base->data = (uint8_t *)(base + 1);
+		base->scheme = scheme_size(url, size);
+		if (base->scheme)
+			base->scheme++;
+
+		i = base->scheme;
+		if (i + 2 <= size && url[i] == '/' && url[i + 1] == '/') {
+			i += 2;
+			while (i < size && url[i] != '/' && url[i] != '?' && url[i] != '#')
+				i++;
+		}
+		base->origin = i;
+
+		/* the query and fragment of the base are no part of its path */
+		for (path = i; path < size && url[path] != '?' && url[path] != '#'; path++);
+
+		memcpy(base->data, url, path);
+		base->size = path;
+		if (path == base->origin && base->origin > base->scheme)
+			base->data[base->size++] = '/';
+
+		base->dir = base->size;
+		while (base->dir > base->origin && base->data[base->dir - 1] != '/')
+			base->dir--;
+	}
+
+	free(options->base_url);
+	options->base_url = base;
+	return 0;
+}
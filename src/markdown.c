@@ -19,6 +19,7 @@
 
 #include "markdown.h"
 #include "stack.h"
+#include "arena.h"
 
 #include <assert.h>
 #include <string.h>
@@ -29,7 +30,21 @@
 #define strncasecmp	_strnicmp
 #endif
 
-#define REF_TABLE_SIZE 8
+#define REF_TABLE_MIN 16
+
+/* output/input size ratio, in sixteenths */
+#define OUTPUT_RATIO_ONE 16
+#define OUTPUT_RATIO_INITIAL 24
+#define OUTPUT_RATIO_MAX (64 * OUTPUT_RATIO_ONE)
+
+/* first pass steps redone before an edit, since a reference
+ * definition may look at the line after it */
+#define PREPASS_BACKTRACK 3
+
+/* smallest piece of text worth rendering on its own thread */
+#ifndef PARALLEL_MIN_PART
+#define PARALLEL_MIN_PART (256 * 1024)
+#endif
 
 #define BUFFER_BLOCK 0
 #define BUFFER_SPAN 1
@@ -52,7 +67,15 @@ struct link_ref {
 	struct buf *link;
 	struct buf *title;
 
-	struct link_ref *next;
+	size_t key_size;
+	uint8_t key[1];	/* case-folded name, `key_size` bytes long */
+};
+
+/* ref_table: open-addressing hash table of link_refs */
+struct ref_table {
+	struct link_ref **slots;
+	size_t size;	/* number of references */
+	size_t asize;	/* number of slots, a power of two */
 };
 
 /* char_trigger: function pointer to render active chars */
@@ -110,18 +133,70 @@ struct sd_markdown {
 	struct sd_callbacks	cb;
 	void *opaque;
 
-	struct link_ref *refs[REF_TABLE_SIZE];
+	struct ref_table refs;
 	uint8_t active_char[256];
 	struct stack work_bufs[2];
 	unsigned int ext_flags;
 	size_t max_nesting;
 	int in_link_body;
+
+	/* per-render allocations come from here when set */
+	struct arena *arena;
+
+	/* how much output the last renders made per byte of input */
+	size_t out_ratio;
+
+	/* memory kept between renders (0 = no limit) */
+	size_t retain_limit;
+	int rendering;
+
+	/* shared references, looked up after the document's own */
+	struct sd_refdict *refdict;
+	struct sd_refdict *render_refdict;	/* the one the current render uses */
+
+	/* incremental rendering: hashes of the references looked up, and
+	 * whether a top-level block looked at the whole rest of the text */
+	struct buf *ref_log;
+	int read_to_end;
+};
+
+/* refdict • immutable reference definitions, shared between parsers */
+struct sd_refdict {
+	struct arena arena;
+	struct ref_table refs;
+	unsigned int ref_count;
 };
 
 /***************************
  * HELPER FUNCTIONS *
  ***************************/
 
+/* mem_allocator • memory functions for buffers living in `arena`,
+ * or in the heap when it is NULL */
+static inline const struct buf_allocator *
+mem_allocator(struct arena *arena)
+{
+	return arena ? &arena->allocator : NULL;
+}
+
+static inline void *
+mem_calloc(struct arena *arena, size_t count, size_t size)
+{
+	if (arena)
+		return arena_calloc(arena, count, size);
+
+	return calloc(count, size);
+}
+
+static inline void
+mem_free(struct arena *arena, void *ptr)
+{
+	if (arena)
+		arena_release(arena, ptr);
+	else
+		free(ptr);
+}
+
 static inline struct buf *
 rndr_newbuf(struct sd_markdown *rndr, int type)
 {
@@ -134,7 +209,7 @@ rndr_newbuf(struct sd_markdown *rndr, int type)
 		work = pool->item[pool->size++];
 		work->size = 0;
 	} else {
-		work = bufnew(buf_size[type]);
+		work = bufnewalloc(buf_size[type], mem_allocator(rndr->arena));
 		stack_push(pool, work);
 	}
 
@@ -147,6 +222,15 @@ rndr_popbuf(struct sd_markdown *rndr, int type)
 	rndr->work_bufs[type].size--;
 }
 
+/* note_read_to_end • a block that looked for its end up to the end of
+ * its data; at the top level, that's the rest of the document */
+static inline void
+note_read_to_end(struct sd_markdown *rndr)
+{
+	if (rndr->work_bufs[BUFFER_BLOCK].size == 0 && rndr->work_bufs[BUFFER_SPAN].size == 0)
+		rndr->read_to_end = 1;
+}
+
 static void
 unscape_text(struct buf *ob, struct buf *src)
 {
@@ -179,58 +263,141 @@ hash_link_ref(const uint8_t *link_ref, size_t length)
 	return hash;
 }
 
+/* match_link_ref • whether `ref` is named `name`, regardless of case */
+static inline int
+match_link_ref(const struct link_ref *ref, unsigned int hash, const uint8_t *name, size_t length)
+{
+	size_t i;
+
+	if (ref->id != hash || ref->key_size != length)
+		return 0;
+
+	for (i = 0; i < length; ++i)
+		if (ref->key[i] != tolower(name[i]))
+			return 0;
+
+	return 1;
+}
+
+/* ref_slot • slot holding the reference named `name`, or the empty
+ * slot where it would go */
+static struct link_ref **
+ref_slot(const struct ref_table *table, unsigned int hash, const uint8_t *name, size_t length)
+{
+	size_t mask = table->asize - 1;
+	size_t i = hash & mask;
+
+	while (table->slots[i] != NULL && !match_link_ref(table->slots[i], hash, name, length))
+		i = (i + 1) & mask;
+
+	return &table->slots[i];
+}
+
+static void
+free_link_ref(struct arena *arena, struct link_ref *ref)
+{
+	if (arena)
+		return;
+
+	bufrelease(ref->link);
+	bufrelease(ref->title);
+	free(ref);
+}
+
+/* grow_ref_table • doubles the slots, keeping the load under one half */
+static int
+grow_ref_table(struct arena *arena, struct ref_table *table)
+{
+	struct ref_table neo;
+	size_t i;
+
+	neo.asize = table->asize ? table->asize * 2 : REF_TABLE_MIN;
+	neo.size = table->size;
+	neo.slots = mem_calloc(arena, neo.asize, sizeof(struct link_ref *));
+	if (!neo.slots)
+		return -1;
+
+	for (i = 0; i < table->asize; ++i) {
+		struct link_ref *ref = table->slots[i];
+		if (ref)
+			*ref_slot(&neo, ref->id, ref->key, ref->key_size) = ref;
+	}
+
+	mem_free(arena, table->slots);
+	*table = neo;
+	return 0;
+}
+
+/* add_link_ref • new reference named `name`; it replaces any earlier
+ * reference with the same name */
 static struct link_ref *
 add_link_ref(
-	struct link_ref **references,
+	struct arena *arena,
+	struct ref_table *table,
 	const uint8_t *name, size_t name_size)
 {
-	struct link_ref *ref = calloc(1, sizeof(struct link_ref));
+	struct link_ref *ref, **slot;
+	size_t i;
+
+	if ((table->size + 1) * 2 > table->asize && grow_ref_table(arena, table) < 0)
+		return NULL;
 
+	ref = mem_calloc(arena, 1, sizeof(struct link_ref) + name_size);
 	if (!ref)
 		return NULL;
 
 	ref->id = hash_link_ref(name, name_size);
-	ref->next = references[ref->id % REF_TABLE_SIZE];
+	ref->key_size = name_size;
+	for (i = 0; i < name_size; ++i)
+		ref->key[i] = tolower(name[i]);
+
+	slot = ref_slot(table, ref->id, name, name_size);
+	if (*slot)
+		free_link_ref(arena, *slot);
+	else
+		table->size++;
 
-	references[ref->id % REF_TABLE_SIZE] = ref;
+	*slot = ref;
 	return ref;
 }
 
 static struct link_ref *
-find_link_ref(struct link_ref **references, uint8_t *name, size_t length)
+find_link_ref(const struct ref_table *table, uint8_t *name, size_t length)
 {
-	unsigned int hash = hash_link_ref(name, length);
-	struct link_ref *ref = NULL;
+	if (!table->size)
+		return NULL;
 
-	ref = references[hash % REF_TABLE_SIZE];
+	return *ref_slot(table, hash_link_ref(name, length), name, length);
+}
 
-	while (ref != NULL) {
-		if (ref->id == hash)
-			return ref;
+/* lookup_link_ref • the document's references first, then the dictionary */
+static struct link_ref *
+lookup_link_ref(struct sd_markdown *rndr, uint8_t *name, size_t length)
+{
+	struct link_ref *ref = find_link_ref(&rndr->refs, name, length);
 
-		ref = ref->next;
+	if (rndr->ref_log) {
+		unsigned int id = hash_link_ref(name, length);
+		bufput(rndr->ref_log, &id, sizeof(id));
 	}
 
-	return NULL;
+	if (!ref && rndr->render_refdict)
+		ref = find_link_ref(&rndr->render_refdict->refs, name, length);
+
+	return ref;
 }
 
 static void
-free_link_refs(struct link_ref **references)
+free_link_refs(struct arena *arena, struct ref_table *table)
 {
 	size_t i;
 
-	for (i = 0; i < REF_TABLE_SIZE; ++i) {
-		struct link_ref *r = references[i];
-		struct link_ref *next;
+	for (i = 0; i < table->asize; ++i)
+		if (table->slots[i])
+			free_link_ref(arena, table->slots[i]);
 
-		while (r) {
-			next = r->next;
-			bufrelease(r->link);
-			bufrelease(r->title);
-			free(r);
-			r = next;
-		}
-	}
+	mem_free(arena, table->slots);
+	memset(table, 0x0, sizeof(struct ref_table));
 }
 
 /*
@@ -991,7 +1158,7 @@ char_link(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t offset
 			id.size = link_e - link_b;
 		}
 
-		lr = find_link_ref(rndr->refs, id.data, id.size);
+		lr = lookup_link_ref(rndr, id.data, id.size);
 		if (!lr)
 			goto cleanup;
 
@@ -1026,7 +1193,7 @@ char_link(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t offset
 		}
 
 		/* finding the link_ref */
-		lr = find_link_ref(rndr->refs, id.data, id.size);
+		lr = lookup_link_ref(rndr, id.data, id.size);
 		if (!lr)
 			goto cleanup;
 
@@ -1387,11 +1554,11 @@ static void parse_block(struct buf *ob, struct sd_markdown *rndr,
 static size_t
 parse_blockquote(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t size)
 {
-	size_t beg, end = 0, pre, work_size = 0;
-	uint8_t *work_data = 0;
-	struct buf *out = 0;
+	size_t beg, end = 0, pre;
+	struct buf *out = 0, *work = 0;
 
 	out = rndr_newbuf(rndr, BUFFER_BLOCK);
+	work = rndr_newbuf(rndr, BUFFER_BLOCK);
 	beg = 0;
 	while (beg < size) {
 		for (end = beg + 1; end < size && data[end - 1] != '\n'; end++);
@@ -1407,21 +1574,18 @@ parse_blockquote(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t
 				!is_empty(data + end, size - end))))
 			break;
 
-		if (beg < end) { /* copy into the in-place working buffer */
-			/* bufput(work, data + beg, end - beg); */
-			if (!work_data)
-				work_data = data + beg;
-			else if (data + beg != work_data + work_size)
-				memmove(work_data + work_size, data + beg, end - beg);
-			work_size += end - beg;
-		}
+		/* the text stays untouched, so that parts of it can be parsed
+		 * again (or at the same time) from somewhere else */
+		if (beg < end)
+			bufput(work, data + beg, end - beg);
 		beg = end;
 	}
 
-	parse_block(out, rndr, work_data, work_size);
+	parse_block(out, rndr, work->data, work->size);
 	if (rndr->cb.blockquote)
 		rndr->cb.blockquote(ob, out, rndr->opaque);
 	rndr_popbuf(rndr, BUFFER_BLOCK);
+	rndr_popbuf(rndr, BUFFER_BLOCK);
 	return end;
 }
 
@@ -1955,6 +2119,7 @@ parse_htmlblock(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t
 		}
 
 		/* no special case recognised */
+		note_read_to_end(rndr);
 		return 0;
 	}
 
@@ -1964,8 +2129,12 @@ parse_htmlblock(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t
 
 	/* if not found, trying a second pass looking for indented match */
 	/* but not if tag is "ins" or "del" (following original Markdown.pl) */
-	if (!tag_end && strcmp(curtag, "ins") != 0 && strcmp(curtag, "del") != 0) {
-		tag_end = htmlblock_end(curtag, rndr, data, size, 0);
+	if (!tag_end) {
+		/* either way, the first pass went through to the end */
+		note_read_to_end(rndr);
+
+		if (strcmp(curtag, "ins") != 0 && strcmp(curtag, "del") != 0)
+			tag_end = htmlblock_end(curtag, rndr, data, size, 0);
 	}
 
 	if (!tag_end)
@@ -2068,7 +2237,7 @@ parse_table_header(
 		pipes--;
 
 	*columns = pipes + 1;
-	*column_data = calloc(*columns, sizeof(int));
+	*column_data = mem_calloc(rndr->arena, *columns, sizeof(int));
 
 	/* Parse the header underline */
 	i++;
@@ -2177,25 +2346,25 @@ parse_table(
 			rndr->cb.table(ob, header_work, body_work, rndr->opaque);
 	}
 
-	free(col_data);
+	mem_free(rndr->arena, col_data);
 	rndr_popbuf(rndr, BUFFER_SPAN);
 	rndr_popbuf(rndr, BUFFER_BLOCK);
 	return i;
 }
 
-/* parse_block • parsing of one block, returning next uint8_t to parse */
-static void
-parse_block(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t size)
+/* parse_blocks • parsing of the blocks starting before `stop`,
+ * returning where the last one ends */
+static size_t
+parse_blocks(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t size, size_t beg, size_t stop)
 {
-	size_t beg, end, i;
+	size_t end, i;
 	uint8_t *txt_data;
-	beg = 0;
 
 	if (rndr->work_bufs[BUFFER_SPAN].size +
 		rndr->work_bufs[BUFFER_BLOCK].size > rndr->max_nesting)
-		return;
+		return beg;
 
-	while (beg < size) {
+	while (beg < stop) {
 		txt_data = data + beg;
 		end = size - beg;
 
@@ -2242,6 +2411,15 @@ parse_block(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t size
 		else
 			beg += parse_paragraph(ob, rndr, txt_data, end);
 	}
+
+	return beg;
+}
+
+/* parse_block • parsing of a sequence of blocks */
+static void
+parse_block(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t size)
+{
+	parse_blocks(ob, rndr, data, size, 0, size);
 }
 
 
@@ -2252,7 +2430,7 @@ parse_block(struct buf *ob, struct sd_markdown *rndr, uint8_t *data, size_t size
 
 /* is_ref • returns whether a line is a reference or not */
 static int
-is_ref(const uint8_t *data, size_t beg, size_t end, size_t *last, struct link_ref **refs)
+is_ref(const uint8_t *data, size_t beg, size_t end, size_t *last, struct arena *arena, struct ref_table *refs)
 {
 /*	int n; */
 	size_t i = 0;
@@ -2348,15 +2526,15 @@ is_ref(const uint8_t *data, size_t beg, size_t end, size_t *last, struct link_re
 	if (refs) {
 		struct link_ref *ref;
 
-		ref = add_link_ref(refs, data + id_offset, id_end - id_offset);
+		ref = add_link_ref(arena, refs, data + id_offset, id_end - id_offset);
 		if (!ref)
 			return 0;
 
-		ref->link = bufnew(link_end - link_offset);
+		ref->link = bufnewalloc(link_end - link_offset, mem_allocator(arena));
 		bufput(ref->link, data + link_offset, link_end - link_offset);
 
 		if (title_end > title_offset) {
-			ref->title = bufnew(title_end - title_offset);
+			ref->title = bufnewalloc(title_end - title_offset, mem_allocator(arena));
 			bufput(ref->title, data + title_offset, title_end - title_offset);
 		}
 	}
@@ -2364,6 +2542,95 @@ is_ref(const uint8_t *data, size_t beg, size_t end, size_t *last, struct link_re
 	return 1;
 }
 
+/* update_out_ratio • folds the ratio of one render into a moving
+ * average, rounding up so the estimate rather errs on the large side */
+static void
+update_out_ratio(struct sd_markdown *md, size_t out_size, size_t in_size)
+{
+	size_t ratio = OUTPUT_RATIO_MAX;
+
+	if (out_size / in_size < OUTPUT_RATIO_MAX / OUTPUT_RATIO_ONE)
+		ratio = (out_size * OUTPUT_RATIO_ONE + in_size - 1) / in_size;
+
+	md->out_ratio = (md->out_ratio * 3 + ratio + 3) / 4;
+}
+
+/* forget_work_bufs • empties the work buffer pools without freeing them */
+static void
+forget_work_bufs(struct sd_markdown *md)
+{
+	int type;
+
+	for (type = 0; type < 2; ++type) {
+		struct stack *pool = &md->work_bufs[type];
+		memset(pool->item, 0x0, pool->asize * sizeof(void *));
+		pool->size = 0;
+	}
+}
+
+/* release_work_bufs • frees the pooled work buffers not in use */
+static void
+release_work_bufs(struct sd_markdown *md)
+{
+	int type;
+	size_t i;
+
+	for (type = 0; type < 2; ++type) {
+		struct stack *pool = &md->work_bufs[type];
+
+		for (i = pool->size; i < pool->asize; ++i) {
+			bufrelease(pool->item[i]);
+			pool->item[i] = NULL;
+		}
+	}
+}
+
+/* work_bufs_size • bytes held by the pooled work buffers */
+static size_t
+work_bufs_size(const struct sd_markdown *md)
+{
+	const struct buf *work;
+	size_t total = 0, i;
+	int type;
+
+	for (type = 0; type < 2; ++type)
+		for (i = 0; i < md->work_bufs[type].asize; ++i)
+			if ((work = md->work_bufs[type].item[i]) != NULL)
+				total += sizeof(struct buf) + work->asize;
+
+	return total;
+}
+
+/* limit_work_bufs • frees the biggest pooled work buffers not in use,
+ * until the pools hold no more than `limit` bytes */
+static void
+limit_work_bufs(struct sd_markdown *md, size_t limit)
+{
+	size_t total = work_bufs_size(md), i;
+	int type;
+
+	while (total > limit) {
+		struct buf **biggest = NULL;
+
+		for (type = 0; type < 2; ++type) {
+			struct stack *pool = &md->work_bufs[type];
+
+			for (i = pool->size; i < pool->asize; ++i) {
+				struct buf **work = (struct buf **)&pool->item[i];
+				if (*work && (!biggest || (*work)->asize > (*biggest)->asize))
+					biggest = work;
+			}
+		}
+
+		if (!biggest)
+			break;
+
+		total -= sizeof(struct buf) + (*biggest)->asize;
+		bufrelease(*biggest);
+		*biggest = NULL;
+	}
+}
+
 static void expand_tabs(struct buf *ob, const uint8_t *line, size_t size)
 {
 	size_t  i = 0, tab = 0;
@@ -2389,88 +2656,71 @@ static void expand_tabs(struct buf *ob, const uint8_t *line, size_t size)
 	}
 }
 
-/**********************
- * EXPORTED FUNCTIONS *
- **********************/
-
-struct sd_markdown *
-sd_markdown_new(
-	unsigned int extensions,
-	size_t max_nesting,
-	const struct sd_callbacks *callbacks,
-	void *opaque)
+/* prepass_step • one step of the first pass, from the start of a line:
+ * a reference definition goes into `refs`, anything else is copied
+ * into `text`; returns where the next step starts */
+static size_t
+prepass_step(struct buf *text, const uint8_t *document, size_t beg, size_t doc_size,
+	struct arena *arena, struct ref_table *refs, int *ref)
 {
-	struct sd_markdown *md = NULL;
-
-	assert(max_nesting > 0 && callbacks);
-
-	md = malloc(sizeof(struct sd_markdown));
-	if (!md)
-		return NULL;
-
-	memcpy(&md->cb, callbacks, sizeof(struct sd_callbacks));
-
-	stack_init(&md->work_bufs[BUFFER_BLOCK], 4);
-	stack_init(&md->work_bufs[BUFFER_SPAN], 8);
+	size_t end;
 
-	memset(md->active_char, 0x0, 256);
-
-	if (md->cb.emphasis || md->cb.double_emphasis || md->cb.triple_emphasis) {
-		md->active_char['*'] = MD_CHAR_EMPHASIS;
-		md->active_char['_'] = MD_CHAR_EMPHASIS;
-		if (extensions & MKDEXT_STRIKETHROUGH)
-			md->active_char['~'] = MD_CHAR_EMPHASIS;
+	if (is_ref(document, beg, doc_size, &end, arena, refs)) {
+		if (ref)
+			*ref = 1;
+		return end;
 	}
 
-	if (md->cb.codespan)
-		md->active_char['`'] = MD_CHAR_CODESPAN;
-
-	if (md->cb.linebreak)
-		md->active_char['\n'] = MD_CHAR_LINEBREAK;
+	if (ref)
+		*ref = 0;
 
-	if (md->cb.image || md->cb.link)
-		md->active_char['['] = MD_CHAR_LINK;
+	/* skipping to the next line */
+	end = beg;
+	while (end < doc_size && document[end] != '\n' && document[end] != '\r')
+		end++;
 
-	md->active_char['<'] = MD_CHAR_LANGLE;
-	md->active_char['\\'] = MD_CHAR_ESCAPE;
-	md->active_char['&'] = MD_CHAR_ENTITITY;
+	/* adding the line body if present */
+	if (end > beg)
+		expand_tabs(text, document + beg, end - beg);
 
-	if (extensions & MKDEXT_AUTOLINK) {
-		md->active_char[':'] = MD_CHAR_AUTOLINK_URL;
-		md->active_char['@'] = MD_CHAR_AUTOLINK_EMAIL;
-		md->active_char['w'] = MD_CHAR_AUTOLINK_WWW;
+	while (end < doc_size && (document[end] == '\n' || document[end] == '\r')) {
+		/* add one \n per newline */
+		if (document[end] == '\n' || (end + 1 < doc_size && document[end + 1] != '\n'))
+			bufputc(text, '\n');
+		end++;
 	}
 
-	if (extensions & MKDEXT_SUPERSCRIPT)
-		md->active_char['^'] = MD_CHAR_SUPERSCRIPT;
-
-	/* Extension data */
-	md->ext_flags = extensions;
-	md->opaque = opaque;
-	md->max_nesting = max_nesting;
-	md->in_link_body = 0;
-
-	return md;
+	return end;
 }
 
-void
-sd_markdown_render(struct buf *ob, const uint8_t *document, size_t doc_size, struct sd_markdown *md)
+/* begin_render • first pass over the document, collecting the references
+ * and copying everything else; returns the text left to render, after
+ * the document header */
+static struct buf *
+begin_render(struct buf *ob, const uint8_t *document, size_t doc_size, struct sd_markdown *md)
 {
-#define MARKDOWN_GROW(x) ((x) + ((x) >> 1))
 	static const char UTF8_BOM[] = {0xEF, 0xBB, 0xBF};
 
 	struct buf *text;
-	size_t beg, end;
+	size_t beg;
 
-	text = bufnew(64);
+	text = bufnewalloc(64, mem_allocator(md->arena));
 	if (!text)
-		return;
+		return NULL;
 
 	/* Preallocate enough space for our buffer to avoid expanding while copying */
 	bufgrow(text, doc_size);
 
+	md->rendering = 1;
+
 	/* reset the references table */
-	memset(&md->refs, 0x0, REF_TABLE_SIZE * sizeof(void *));
+	memset(&md->refs, 0x0, sizeof(struct ref_table));
+
+	/* the dictionary stays the same for the whole render, even if
+	 * a callback attaches a new one */
+	md->render_refdict = md->refdict;
+	if (md->render_refdict)
+		md->render_refdict->ref_count++;
 
 	/* first pass: looking for references, copying everything else */
 	beg = 0;
@@ -2481,68 +2731,1262 @@ sd_markdown_render(struct buf *ob, const uint8_t *document, size_t doc_size, str
 		beg += 3;
 
 	while (beg < doc_size) /* iterating over lines */
-		if (is_ref(document, beg, doc_size, &end, md->refs))
-			beg = end;
-		else { /* skipping to the next line */
-			end = beg;
-			while (end < doc_size && document[end] != '\n' && document[end] != '\r')
-				end++;
-
-			/* adding the line body if present */
-			if (end > beg)
-				expand_tabs(text, document + beg, end - beg);
-
-			while (end < doc_size && (document[end] == '\n' || document[end] == '\r')) {
-				/* add one \n per newline */
-				if (document[end] == '\n' || (end + 1 < doc_size && document[end + 1] != '\n'))
-					bufputc(text, '\n');
-				end++;
-			}
-
-			beg = end;
-		}
+		beg = prepass_step(text, document, beg, doc_size, md->arena, &md->refs, NULL);
 
 	/* pre-grow the output buffer to minimize allocations */
-	bufgrow(ob, MARKDOWN_GROW(text->size));
+	bufgrow(ob, ob->size + text->size / OUTPUT_RATIO_ONE * md->out_ratio +
+		text->size % OUTPUT_RATIO_ONE * md->out_ratio / OUTPUT_RATIO_ONE);
 
 	/* second pass: actual rendering */
 	if (md->cb.doc_header)
 		md->cb.doc_header(ob, md->opaque);
 
-	if (text->size) {
-		/* adding a final newline if not already present */
-		if (text->data[text->size - 1] != '\n' &&  text->data[text->size - 1] != '\r')
-			bufputc(text, '\n');
+	/* adding a final newline if not already present */
+	if (text->size && text->data[text->size - 1] != '\n' &&  text->data[text->size - 1] != '\r')
+		bufputc(text, '\n');
 
-		parse_block(ob, md, text->data, text->size);
-	}
+	return text;
+}
 
+/* end_render • document footer and clean-up after the second pass */
+static void
+end_render(struct buf *ob, size_t out_start, struct buf *text, struct sd_markdown *md)
+{
 	if (md->cb.doc_footer)
 		md->cb.doc_footer(ob, md->opaque);
 
-	/* clean-up */
-	bufrelease(text);
-	free_link_refs(md->refs);
-
 	assert(md->work_bufs[BUFFER_SPAN].size == 0);
 	assert(md->work_bufs[BUFFER_BLOCK].size == 0);
+
+	/* the next output is expected to look like the last ones */
+	if (text->size)
+		update_out_ratio(md, ob->size - out_start, text->size);
+
+	/* clean-up */
+	sd_refdict_release(md->render_refdict);
+	md->render_refdict = NULL;
+
+	if (md->arena) {
+		/* everything goes at once, work buffers included */
+		forget_work_bufs(md);
+		arena_reset(md->arena);
+
+		if (md->retain_limit && arena_allocated(md->arena) > md->retain_limit)
+			arena_trim(md->arena);
+	} else {
+		bufrelease(text);
+		free_link_refs(NULL, &md->refs);
+
+		if (md->retain_limit)
+			limit_work_bufs(md, md->retain_limit);
+	}
+
+	md->rendering = 0;
 }
 
-void
-sd_markdown_free(struct sd_markdown *md)
+/***********************
+ * PARALLEL RENDERING *
+ ***********************/
+
+/* render_part • one piece of a parallel render: the blocks starting in
+ * [beg, end) of the text, rendered by a copy of the parser */
+struct render_part {
+	struct sd_markdown md;
+	const struct sd_parallel *parallel;
+	struct buf *text;
+	struct buf *ob;
+	size_t beg, end;
+	size_t reached;	/* where its last block ends */
+	int seeded;	/* whether `ob` starts with a stand-in for earlier output */
+};
+
+/* is_split_point • whether a top-level block most likely starts at `beg`:
+ * right after an empty line, with nothing that could continue a list,
+ * a quote, a code block or some HTML */
+static int
+is_split_point(const uint8_t *data, size_t beg)
 {
-	size_t i;
+	switch (data[beg]) {
+	case ' ': case '\n': case '>': case '<': case '`': case '~':
+	case '*': case '+': case '-': case '=': case '|':
+	case '0': case '1': case '2': case '3': case '4':
+	case '5': case '6': case '7': case '8': case '9':
+		return 0;
+	}
+
+	return data[beg - 1] == '\n' && data[beg - 2] == '\n';
+}
+
+/* find_split • first split point at or after `beg`, or `size` */
+static size_t
+find_split(const uint8_t *data, size_t beg, size_t size)
+{
+	const uint8_t *nl;
+	size_t i = beg < 2 ? 2 : beg;
 
-	for (i = 0; i < (size_t)md->work_bufs[BUFFER_SPAN].asize; ++i)
-		bufrelease(md->work_bufs[BUFFER_SPAN].item[i]);
+	while (i < size) {
+		nl = memchr(data + i - 1, '\n', size - i + 1);
+		if (!nl)
+			break;
 
-	for (i = 0; i < (size_t)md->work_bufs[BUFFER_BLOCK].asize; ++i)
-		bufrelease(md->work_bufs[BUFFER_BLOCK].item[i]);
+		i = nl - data + 1;
+		if (i < size && is_split_point(data, i))
+			return i;
+		i++;
+	}
 
-	stack_free(&md->work_bufs[BUFFER_SPAN]);
-	stack_free(&md->work_bufs[BUFFER_BLOCK]);
+	return size;
+}
 
-	free(md);
+static void
+render_part(void *opaque)
+{
+	struct render_part *part = opaque;
+	struct sd_markdown *md = &part->md;
+
+	part->ob = bufnew(64);
+	bufgrow(part->ob, (part->end - part->beg) / OUTPUT_RATIO_ONE * md->out_ratio + 1);
+
+	/* block callbacks only ever check whether something came before */
+	if (part->seeded)
+		bufputc(part->ob, '\n');
+
+	part->reached = parse_blocks(part->ob, md, part->text->data, part->text->size, part->beg, part->end);
+}
+
+/* fork_part • a copy of the parser for one part, sharing its (read-only)
+ * references but with work buffers and renderer state of its own */
+static void
+fork_part(struct render_part *part, struct sd_markdown *md)
+{
+	memcpy(&part->md, md, sizeof(struct sd_markdown));
+	part->md.opaque = part->parallel->fork(md->opaque);
+	part->md.arena = NULL;
+	part->md.refdict = NULL;
+	part->md.in_link_body = 0;
+	stack_init(&part->md.work_bufs[BUFFER_BLOCK], 4);
+	stack_init(&part->md.work_bufs[BUFFER_SPAN], 8);
+}
+
+/* drop_part • frees the output and renderer state of a part */
+static void
+drop_part(struct render_part *part)
+{
+	bufrelease(part->ob);
+	part->ob = NULL;
+	part->parallel->release(part->md.opaque);
+	part->md.opaque = NULL;
+}
+
+static void
+free_part(struct render_part *part)
+{
+	if (part->md.opaque)
+		drop_part(part);
+
+	release_work_bufs(&part->md);
+	stack_free(&part->md.work_bufs[BUFFER_BLOCK]);
+	stack_free(&part->md.work_bufs[BUFFER_SPAN]);
+}
+
+/* render_parts • cuts the text where top-level blocks seem to start,
+ * renders the parts at the same time and joins them in order. A part
+ * that didn't start where the one before it ended (the cut fell inside
+ * a block) or guessed wrong about the output before it is rendered
+ * again from the right spot, so the result matches a serial render */
+static void
+render_parts(struct buf *ob, struct sd_markdown *md, struct buf *text,
+	size_t count, const struct sd_parallel *parallel)
+{
+	struct render_part *parts;
+	void **args;
+	size_t i, n, beg, pos;
+
+	parts = calloc(count, sizeof(struct render_part));
+	args = calloc(count, sizeof(void *));
+	if (!parts || !args) {
+		free(parts);
+		free(args);
+		parse_block(ob, md, text->data, text->size);
+		return;
+	}
+
+	for (n = 0, beg = 0; n < count && beg < text->size; ++n) {
+		struct render_part *part = &parts[n];
+
+		part->parallel = parallel;
+		part->text = text;
+		part->beg = beg;
+		part->end = text->size * (n + 1) / count;
+		part->end = find_split(text->data, part->end > beg ? part->end : beg + 1, text->size);
+		if (n + 1 == count)
+			part->end = text->size;
+		part->seeded = parallel->uses_output && (n > 0 || ob->size > 0);
+
+		fork_part(part, md);
+		args[n] = part;
+		beg = part->end;
+	}
+
+	parallel->run(render_part, args, n, parallel->run_opaque);
+
+	for (i = 0, pos = 0; i < n; ++i) {
+		struct render_part *part = &parts[i];
+		struct buf out;
+		int seeded = parallel->uses_output && ob->size > 0;
+
+		if (pos >= part->end) {
+			/* an earlier block ran over this whole part */
+			free_part(part);
+			continue;
+		}
+
+		if (part->beg != pos || part->seeded != seeded) {
+			drop_part(part);
+			part->md.opaque = parallel->fork(md->opaque);
+			part->beg = pos;
+			part->seeded = seeded;
+			render_part(part);
+		}
+
+		out = *part->ob;
+		out.data += part->seeded;
+		out.size -= part->seeded;
+		parallel->join(ob, &out, part->md.opaque, md->opaque);
+
+		pos = part->reached;
+		free_part(part);
+	}
+
+	free(args);
+	free(parts);
+}
+
+/*************************
+ * INCREMENTAL RENDERING *
+ *************************/
+
+/* doc_step • one step of the first pass, where it starts in the
+ * source and in the text */
+struct doc_step {
+	size_t src, text;
+	int ref;	/* the step was a reference definition */
+};
+
+/* doc_block • a top-level block, with the empty lines before it */
+struct doc_block {
+	size_t beg, end;	/* in the text */
+	size_t reach;	/* how far its parse looked */
+	struct buf *out;	/* output in the form of a part of a parallel render */
+	void *state;	/* renderer state of that part */
+	struct buf *lookups;	/* hashes of the references it looked up */
+	int seeded;	/* whether `out` starts with a stand-in for earlier output */
+	int fresh;	/* rendered in the current edit */
+	int moved;	/* next to blocks that went away in the current edit */
+	size_t out_off, out_size;	/* where it ended up in the last output */
+	unsigned int hash;	/* of that output */
+};
+
+struct sd_document {
+	struct sd_markdown *md;
+	struct sd_markdown parser;	/* the settings of `md`, with work buffers of its own */
+	struct sd_parallel parallel;
+
+	struct buf *src;
+	struct buf *text;	/* the first pass over `src` */
+	int text_nl;	/* a final newline was added to the text */
+	struct doc_step *steps;
+	size_t step_count, step_asize;
+
+	struct ref_table refs;
+	struct sd_refdict *refdict;	/* the dictionary the blocks were rendered with */
+	struct buf *changed_refs;	/* hashes of the references the current edit changed */
+
+	struct doc_block *blocks;
+	size_t block_count, block_asize;
+
+	struct buf *out;
+	size_t head_size;	/* output before the first block */
+	struct buf *lookups;
+	size_t *changed;
+	size_t changed_count, changed_asize;
+	unsigned int *ids;	/* block ids, made on demand */
+	size_t ids_asize;
+	int ids_valid;
+};
+
+/* doc_reserve • grows an array to hold at least `count` items, returning
+ * it (possibly moved) or NULL if that failed. The array is allocated the
+ * first time even for no items, so that NULL always means a failure */
+static void *
+doc_reserve(void *items, size_t *asize, size_t count, size_t item_size)
+{
+	size_t neo = *asize ? *asize : 16;
+
+	if (count <= *asize && items)
+		return items;
+
+	while (neo < count)
+		neo *= 2;
+
+	items = realloc(items, neo * item_size);
+	if (items)
+		*asize = neo;
+
+	return items;
+}
+
+/* doc_sync_parser • picks up the current settings of the parser,
+ * keeping the work buffers */
+static void
+doc_sync_parser(struct sd_document *doc)
+{
+	struct stack work_bufs[2];
+
+	memcpy(work_bufs, doc->parser.work_bufs, sizeof(work_bufs));
+	memcpy(&doc->parser, doc->md, sizeof(struct sd_markdown));
+	memcpy(doc->parser.work_bufs, work_bufs, sizeof(work_bufs));
+
+	doc->parser.arena = NULL;
+	doc->parser.refdict = NULL;
+	doc->parser.render_refdict = doc->refdict;
+	doc->parser.refs = doc->refs;
+	doc->parser.in_link_body = 0;
+	doc->parser.ref_log = doc->lookups;
+}
+
+static void
+doc_drop_block(struct sd_document *doc, struct doc_block *block)
+{
+	if (block->state)
+		doc->parallel.release(block->state);
+
+	bufrelease(block->out);
+	bufrelease(block->lookups);
+	block->state = NULL;
+	block->out = NULL;
+	block->lookups = NULL;
+}
+
+/* doc_render_block • parses and renders the block starting at `block->beg` */
+static void
+doc_render_block(struct sd_document *doc, struct doc_block *block)
+{
+	struct sd_markdown *md = &doc->parser;
+	uint8_t *data = doc->text->data;
+	size_t size = doc->text->size, beg = block->beg, end, i, lines;
+
+	/* the empty lines before it render to nothing */
+	while (beg < size && (i = is_empty(data + beg, size - beg)) != 0)
+		beg += i;
+
+	block->state = doc->parallel.fork(doc->md->opaque);
+	block->out = bufnew(64);
+	if (block->seeded)
+		bufputc(block->out, '\n');
+
+	md->opaque = block->state;
+	md->read_to_end = 0;
+	doc->lookups->size = 0;
+
+	end = beg < size ? parse_blocks(block->out, md, data, size, beg, beg + 1) : size;
+	block->end = end;
+	block->fresh = 1;
+
+	/* whether it ends where it does depends on a line or two after it */
+	for (lines = 0; lines < 2 && end < size; ++lines) {
+		const uint8_t *nl = memchr(data + end, '\n', size - end);
+		end = nl ? (size_t)(nl - data) + 1 : size;
+	}
+	block->reach = md->read_to_end ? size : end;
+
+	if (doc->lookups->size) {
+		block->lookups = bufnew(64);
+		bufput(block->lookups, doc->lookups->data, doc->lookups->size);
+	}
+}
+
+/* doc_rerender_block • renders a block again, in the same place */
+static void
+doc_rerender_block(struct sd_document *doc, struct doc_block *block)
+{
+	doc_drop_block(doc, block);
+	doc_render_block(doc, block);
+}
+
+/* same_buf • whether two (possibly missing) buffers hold the same bytes */
+static int
+same_buf(const struct buf *a, const struct buf *b)
+{
+	if (!a || !b)
+		return a == b;
+
+	return a->size == b->size && (!a->size || memcmp(a->data, b->data, a->size) == 0);
+}
+
+/* doc_diff_refs • adds to `changed` the references defined differently
+ * (or only) in one of the tables */
+static void
+doc_diff_refs(struct buf *changed, const struct ref_table *from, const struct ref_table *to)
+{
+	struct link_ref *ref, *other;
+	size_t i;
+
+	for (i = 0; i < from->asize; ++i) {
+		if ((ref = from->slots[i]) == NULL)
+			continue;
+
+		other = to->size ? *ref_slot(to, ref->id, ref->key, ref->key_size) : NULL;
+		if (!other || !same_buf(ref->link, other->link) || !same_buf(ref->title, other->title))
+			bufput(changed, &ref->id, sizeof(ref->id));
+	}
+}
+
+/* doc_update_refs • collects the references again, noting which changed */
+static void
+doc_update_refs(struct sd_document *doc)
+{
+	struct ref_table refs;
+	size_t i, end;
+
+	memset(&refs, 0x0, sizeof(struct ref_table));
+	for (i = 0; i < doc->step_count; ++i)
+		if (doc->steps[i].ref)
+			is_ref(doc->src->data, doc->steps[i].src, doc->src->size, &end, NULL, &refs);
+
+	doc_diff_refs(doc->changed_refs, &doc->refs, &refs);
+	doc_diff_refs(doc->changed_refs, &refs, &doc->refs);
+
+	free_link_refs(NULL, &doc->refs);
+	doc->refs = refs;
+}
+
+/* doc_block_stale • whether the block looked up a reference that changed */
+static int
+doc_block_stale(const struct sd_document *doc, const struct doc_block *block, int all_refs)
+{
+	const struct buf *changed = doc->changed_refs;
+	unsigned int id, other;
+	size_t i, j;
+
+	if (!block->lookups)
+		return 0;
+
+	if (all_refs)
+		return 1;
+
+	for (i = 0; i < block->lookups->size; i += sizeof(id)) {
+		memcpy(&id, block->lookups->data + i, sizeof(id));
+		for (j = 0; j < changed->size; j += sizeof(other)) {
+			memcpy(&other, changed->data + j, sizeof(other));
+			if (id == other)
+				return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* doc_edit_text • applies an edit to the source and redoes the first
+ * pass around it, until it gets back in step with the last one. The
+ * text between `*e0` and `*e1_old` became the text up to `*e1_new`;
+ * returns whether the edit touched any reference definition, or -1 */
+static int
+doc_edit_text(struct sd_document *doc, size_t offset, size_t removed,
+	const uint8_t *inserted, size_t inserted_size,
+	size_t *e0, size_t *e1_old, size_t *e1_new)
+{
+	static const char UTF8_BOM[] = {0xEF, 0xBB, 0xBF};
+
+	struct buf *src = doc->src, *text = doc->text, *mid;
+	struct doc_step *steps, *fresh = NULL;
+	struct ref_table scratch;
+	size_t fresh_count = 0, fresh_asize = 0;
+	size_t count, r, j, beg, restart, old_end, old_size, cp, cs, i;
+	int ref, synced = 0, refs_touched = 0, old_nl = doc->text_nl;
+
+	if (offset > src->size || removed > src->size - offset)
+		return -1;
+
+	/* the source, allocated even when empty */
+	if (bufgrow(src, src->size - removed + inserted_size + 1) < 0)
+		return -1;
+
+	memmove(src->data + offset + inserted_size, src->data + offset + removed, src->size - offset - removed);
+	if (inserted_size)
+		memcpy(src->data + offset, inserted, inserted_size);
+	src->size = src->size - removed + inserted_size;
+
+	/* starting a few steps before the one holding the edit */
+	for (count = 0, i = doc->step_count; count < i; ) {
+		size_t m = count + (i - count) / 2;
+		if (doc->steps[m].src <= offset)
+			count = m + 1;
+		else
+			i = m;
+	}
+
+	r = count > PREPASS_BACKTRACK ? count - PREPASS_BACKTRACK : 0;
+	beg = r ? doc->steps[r].src : 0;
+	restart = r ? doc->steps[r].text : 0;
+
+	if (beg == 0 && src->size >= 3 && memcmp(src->data, UTF8_BOM, 3) == 0)
+		beg = 3;
+
+	/* the first pass, until a step starts where one did before the edit */
+	mid = bufnew(64);
+	memset(&scratch, 0x0, sizeof(struct ref_table));
+	j = r;
+
+	while (beg < src->size) {
+		if (beg >= offset + inserted_size) {
+			size_t old = beg - inserted_size + removed;
+			while (j < doc->step_count && doc->steps[j].src < old)
+				j++;
+			if (j < doc->step_count && doc->steps[j].src == old) {
+				synced = 1;
+				break;
+			}
+		}
+
+		steps = doc_reserve(fresh, &fresh_asize, fresh_count + 1, sizeof(struct doc_step));
+		if (!steps)
+			break;
+		fresh = steps;
+
+		fresh[fresh_count].src = beg;
+		fresh[fresh_count].text = restart + mid->size;
+		beg = prepass_step(mid, src->data, beg, src->size, NULL, &scratch, &ref);
+		fresh[fresh_count++].ref = ref;
+		refs_touched |= ref;
+	}
+
+	free_link_refs(NULL, &scratch);
+
+	if (!synced)
+		j = doc->step_count;
+
+	for (i = r; i < j; ++i)
+		refs_touched |= doc->steps[i].ref;
+
+	/* the text */
+	text->size -= doc->text_nl;
+	old_size = text->size + doc->text_nl;
+	old_end = synced ? doc->steps[j].text : text->size;
+
+	for (cp = 0; cp < mid->size && restart + cp < old_end &&
+		mid->data[cp] == text->data[restart + cp]; ++cp);
+
+	for (cs = 0; cs < mid->size - cp && restart + cp + cs < old_end &&
+		mid->data[mid->size - cs - 1] == text->data[old_end - cs - 1]; ++cs);
+
+	*e0 = restart + cp;
+	*e1_old = old_end - cs;
+	*e1_new = restart + mid->size - cs;
+
+	if (bufgrow(text, text->size - (old_end - restart) + mid->size + 1) < 0) {
+		free(fresh);
+		bufrelease(mid);
+		return -1;
+	}
+
+	memmove(text->data + restart + mid->size, text->data + old_end, text->size - old_end);
+	if (mid->size)
+		memcpy(text->data + restart, mid->data, mid->size);
+	text->size = text->size - (old_end - restart) + mid->size;
+
+	/* adding a final newline if not already present */
+	doc->text_nl = text->size && text->data[text->size - 1] != '\n' && text->data[text->size - 1] != '\r';
+	if (doc->text_nl)
+		bufputc(text, '\n');
+
+	if (!synced || doc->text_nl != old_nl) {
+		*e1_old = old_size;
+		*e1_new = text->size;
+	}
+
+	/* the steps */
+	steps = doc_reserve(doc->steps, &doc->step_asize,
+		doc->step_count - (j - r) + fresh_count, sizeof(struct doc_step));
+
+	if (steps) {
+		doc->steps = steps;
+		memmove(steps + r + fresh_count, steps + j, (doc->step_count - j) * sizeof(struct doc_step));
+		if (fresh_count)
+			memcpy(steps + r, fresh, fresh_count * sizeof(struct doc_step));
+
+		for (i = r + fresh_count; i < doc->step_count - (j - r) + fresh_count; ++i) {
+			steps[i].src = steps[i].src - removed + inserted_size;
+			steps[i].text = steps[i].text - old_end + restart + mid->size;
+		}
+
+		doc->step_count = doc->step_count - (j - r) + fresh_count;
+	}
+
+	free(fresh);
+	bufrelease(mid);
+
+	return steps ? refs_touched : -1;
+}
+
+/* doc_reparse • renders again the blocks whose parse may depend on the
+ * text that changed, until a block ends where one started before */
+static int
+doc_reparse(struct sd_document *doc, size_t e0, size_t e1_old, size_t e1_new, size_t old_size)
+{
+	struct doc_block *blocks = doc->blocks, *fresh = NULL, *grown;
+	size_t fresh_count = 0, fresh_asize = 0;
+	size_t n = doc->block_count, i, j, pos, shift = doc->text->size - old_size;
+	int synced = 0;
+
+	for (i = 0; i < n && blocks[i].reach < e0; ++i);
+
+	/* blocks that only looked past the edit, and still end where they
+	 * did, are rendered again on their own (an unclosed HTML block near
+	 * the top would have us render everything in between otherwise) */
+	while (i < n && blocks[i].end <= e0) {
+		struct doc_block block;
+
+		memset(&block, 0x0, sizeof(struct doc_block));
+		block.beg = blocks[i].beg;
+		block.seeded = blocks[i].seeded;
+		doc_render_block(doc, &block);
+
+		if (block.end != blocks[i].end) {
+			doc_drop_block(doc, &block);
+			break;
+		}
+
+		/* its old output is still there to compare with */
+		block.out_off = blocks[i].out_off;
+		block.out_size = blocks[i].out_size;
+		block.fresh = 0;
+
+		doc_drop_block(doc, &blocks[i]);
+		blocks[i] = block;
+
+		for (++i; i < n && blocks[i].reach < e0; ++i);
+	}
+
+	pos = i < n ? blocks[i].beg : (n ? blocks[n - 1].end : 0);
+	j = i;
+
+	while (pos < doc->text->size) {
+		struct doc_block *block;
+
+		if (pos >= e1_new) {
+			size_t old = pos - shift;
+			while (j < n && blocks[j].beg < old)
+				j++;
+			if (j < n && blocks[j].beg == old) {
+				synced = 1;
+				break;
+			}
+		}
+
+		grown = doc_reserve(fresh, &fresh_asize, fresh_count + 1, sizeof(struct doc_block));
+		if (!grown)
+			break;
+		fresh = grown;
+
+		block = &fresh[fresh_count++];
+		memset(block, 0x0, sizeof(struct doc_block));
+		block->beg = pos;
+		block->seeded = doc->parallel.uses_output && (i + fresh_count > 1 || doc->head_size > 0);
+		doc_render_block(doc, block);
+		pos = block->end;
+	}
+
+	if (!synced)
+		j = n;
+
+	grown = doc_reserve(doc->blocks, &doc->block_asize, n - (j - i) + fresh_count, sizeof(struct doc_block));
+	if (!grown || (pos < doc->text->size && !synced)) {
+		for (; fresh_count > 0; --fresh_count)
+			doc_drop_block(doc, &fresh[fresh_count - 1]);
+		free(fresh);
+		return -1;
+	}
+
+	blocks = doc->blocks = grown;
+	for (pos = i; pos < j; ++pos)
+		doc_drop_block(doc, &blocks[pos]);
+
+	memmove(blocks + i + fresh_count, blocks + j, (n - j) * sizeof(struct doc_block));
+	if (fresh_count)
+		memcpy(blocks + i, fresh, fresh_count * sizeof(struct doc_block));
+
+	doc->block_count = n - (j - i) + fresh_count;
+	for (pos = i + fresh_count; pos < doc->block_count; ++pos) {
+		blocks[pos].beg += shift;
+		blocks[pos].end += shift;
+		blocks[pos].reach += shift;
+	}
+
+	/* the block after the ones removed tells where they were */
+	if (j - i > fresh_count && doc->block_count > 0)
+		blocks[i + fresh_count < doc->block_count ? i + fresh_count : doc->block_count - 1].moved = 1;
+
+	free(fresh);
+	return 0;
+}
+
+/* hash_block • FNV-1a hash of the output of a block, never 0 */
+static unsigned int
+hash_block(const uint8_t *data, size_t size)
+{
+	unsigned int hash = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < size; ++i)
+		hash = (hash ^ data[i]) * 16777619u;
+
+	return hash ? hash : 1;
+}
+
+/* doc_assemble • joins the output of every block, noting the blocks
+ * whose final output changed */
+static void
+doc_assemble(struct sd_document *doc)
+{
+	struct sd_markdown *md = doc->md;
+	struct buf *ob = bufnew(64), *old = doc->out;
+	size_t i, off;
+
+	bufgrow(ob, old->asize);
+	doc->changed_count = 0;
+
+	/* the ids given as the parts are joined start over */
+	if (doc->parallel.restart)
+		doc->parallel.restart(md->opaque);
+
+	if (md->cb.doc_header)
+		md->cb.doc_header(ob, md->opaque);
+	doc->head_size = ob->size;
+
+	for (i = 0; i < doc->block_count; ++i) {
+		struct doc_block *block = &doc->blocks[i];
+		int seeded = doc->parallel.uses_output && ob->size > 0;
+		struct buf out;
+
+		/* guessed wrong about the output before it */
+		if (block->seeded != seeded) {
+			block->seeded = seeded;
+			doc_rerender_block(doc, block);
+		}
+
+		out = *block->out;
+		out.data += block->seeded;
+		out.size -= block->seeded;
+
+		off = ob->size;
+		doc->parallel.join(ob, &out, block->state, md->opaque);
+
+		if (block->fresh || block->moved || ob->size - off != block->out_size ||
+			memcmp(ob->data + off, old->data + block->out_off, block->out_size) != 0) {
+			size_t *changed = doc_reserve(doc->changed, &doc->changed_asize,
+				doc->changed_count + 1, sizeof(size_t));
+			if (changed) {
+				doc->changed = changed;
+				changed[doc->changed_count++] = i;
+			}
+
+			block->hash = hash_block(ob->data + off, ob->size - off);
+		}
+
+		block->out_off = off;
+		block->out_size = ob->size - off;
+		block->fresh = 0;
+		block->moved = 0;
+	}
+
+	if (md->cb.doc_footer)
+		md->cb.doc_footer(ob, md->opaque);
+
+	bufrelease(old);
+	doc->out = ob;
+	doc->ids_valid = 0;
+}
+
+/**********************
+ * EXPORTED FUNCTIONS *
+ **********************/
+
+struct sd_markdown *
+sd_markdown_new(
+	unsigned int extensions,
+	size_t max_nesting,
+	const struct sd_callbacks *callbacks,
+	void *opaque)
+{
+	struct sd_markdown *md = NULL;
+
+	assert(max_nesting > 0 && callbacks);
+
+	md = malloc(sizeof(struct sd_markdown));
+	if (!md)
+		return NULL;
+
+	memcpy(&md->cb, callbacks, sizeof(struct sd_callbacks));
+
+	stack_init(&md->work_bufs[BUFFER_BLOCK], 4);
+	stack_init(&md->work_bufs[BUFFER_SPAN], 8);
+
+	memset(md->active_char, 0x0, 256);
+
+	if (md->cb.emphasis || md->cb.double_emphasis || md->cb.triple_emphasis) {
+		md->active_char['*'] = MD_CHAR_EMPHASIS;
+		md->active_char['_'] = MD_CHAR_EMPHASIS;
+		if (extensions & MKDEXT_STRIKETHROUGH)
+			md->active_char['~'] = MD_CHAR_EMPHASIS;
+	}
+
+	if (md->cb.codespan)
+		md->active_char['`'] = MD_CHAR_CODESPAN;
+
+	if (md->cb.linebreak)
+		md->active_char['\n'] = MD_CHAR_LINEBREAK;
+
+	if (md->cb.image || md->cb.link)
+		md->active_char['['] = MD_CHAR_LINK;
+
+	md->active_char['<'] = MD_CHAR_LANGLE;
+	md->active_char['\\'] = MD_CHAR_ESCAPE;
+	md->active_char['&'] = MD_CHAR_ENTITITY;
+
+	if (extensions & MKDEXT_AUTOLINK) {
+		md->active_char[':'] = MD_CHAR_AUTOLINK_URL;
+		md->active_char['@'] = MD_CHAR_AUTOLINK_EMAIL;
+		md->active_char['w'] = MD_CHAR_AUTOLINK_WWW;
+	}
+
+	if (extensions & MKDEXT_SUPERSCRIPT)
+		md->active_char['^'] = MD_CHAR_SUPERSCRIPT;
+
+	/* Extension data */
+	md->ext_flags = extensions;
+	md->opaque = opaque;
+	md->max_nesting = max_nesting;
+	md->in_link_body = 0;
+	md->arena = NULL;
+	md->refdict = NULL;
+	md->render_refdict = NULL;
+	md->out_ratio = OUTPUT_RATIO_INITIAL;
+	md->retain_limit = 0;
+	md->rendering = 0;
+	md->ref_log = NULL;
+	md->read_to_end = 0;
+
+	return md;
+}
+
+void
+sd_markdown_render(struct buf *ob, const uint8_t *document, size_t doc_size, struct sd_markdown *md)
+{
+	struct buf *text;
+	size_t out_start = ob->size;
+
+	text = begin_render(ob, document, doc_size, md);
+	if (!text)
+		return;
+
+	if (text->size)
+		parse_block(ob, md, text->data, text->size);
+
+	end_render(ob, out_start, text, md);
+}
+
+void
+sd_markdown_render_parallel(struct buf *ob, const uint8_t *document, size_t doc_size,
+	struct sd_markdown *md, size_t parts, const struct sd_parallel *parallel)
+{
+	struct buf *text;
+	size_t out_start = ob->size;
+
+	text = begin_render(ob, document, doc_size, md);
+	if (!text)
+		return;
+
+	if (parts > text->size / PARALLEL_MIN_PART)
+		parts = text->size / PARALLEL_MIN_PART;
+
+	if (parts > 1 && !memchr(text->data, 0, text->size))
+		render_parts(ob, md, text, parts, parallel);
+	else if (text->size)
+		parse_block(ob, md, text->data, text->size);
+
+	end_render(ob, out_start, text, md);
+}
+
+void
+sd_markdown_set_retain_limit(struct sd_markdown *md, size_t limit)
+{
+	md->retain_limit = limit;
+}
+
+size_t
+sd_markdown_retained(const struct sd_markdown *md)
+{
+	size_t total = sizeof(struct sd_markdown) + work_bufs_size(md);
+
+	total += (md->work_bufs[BUFFER_BLOCK].asize + md->work_bufs[BUFFER_SPAN].asize) * sizeof(void *);
+
+	if (md->arena)
+		total += arena_allocated(md->arena);
+
+	return total;
+}
+
+void
+sd_markdown_trim(struct sd_markdown *md)
+{
+	release_work_bufs(md);
+
+	if (md->arena && !md->rendering)
+		arena_trim(md->arena);
+}
+
+int
+sd_markdown_use_arena(struct sd_markdown *md, size_t chunk_size)
+{
+	struct arena *arena = NULL;
+
+	if (md->rendering)
+		return -1;
+
+	if (chunk_size) {
+		arena = malloc(sizeof(struct arena));
+		if (!arena)
+			return -1;
+
+		if (arena_init(arena, chunk_size) < 0) {
+			free(arena);
+			return -1;
+		}
+	}
+
+	/* pooled work buffers belong to the old allocator */
+	release_work_bufs(md);
+
+	if (md->arena) {
+		arena_free(md->arena);
+		free(md->arena);
+	}
+
+	md->arena = arena;
+	return 0;
+}
+
+size_t
+sd_markdown_arena_high_water(const struct sd_markdown *md)
+{
+	return md->arena ? md->arena->high_water : 0;
+}
+
+void
+sd_markdown_set_refdict(struct sd_markdown *md, struct sd_refdict *dict)
+{
+	struct sd_refdict *old = md->refdict;
+
+	if (dict)
+		dict->ref_count++;
+
+	md->refdict = dict;
+	sd_refdict_release(old);
+}
+
+struct sd_refdict *
+sd_refdict_new(const uint8_t *data, size_t size)
+{
+	struct sd_refdict *dict;
+	size_t beg = 0, end;
+
+	dict = malloc(sizeof(struct sd_refdict));
+	if (!dict)
+		return NULL;
+
+	/* the definitions take about as much room as their source */
+	if (arena_init(&dict->arena, size) < 0) {
+		free(dict);
+		return NULL;
+	}
+
+	memset(&dict->refs, 0x0, sizeof(struct ref_table));
+	dict->ref_count = 1;
+
+	/* only the definitions matter, skip every other line */
+	while (beg < size)
+		if (is_ref(data, beg, size, &end, &dict->arena, &dict->refs))
+			beg = end;
+		else {
+			end = beg;
+			while (end < size && data[end] != '\n' && data[end] != '\r')
+				end++;
+
+			while (end < size && (data[end] == '\n' || data[end] == '\r'))
+				end++;
+
+			beg = end;
+		}
+
+	return dict;
+}
+
+size_t
+sd_refdict_size(const struct sd_refdict *dict)
+{
+	return dict->refs.size;
+}
+
+void
+sd_refdict_release(struct sd_refdict *dict)
+{
+	if (!dict || --dict->ref_count > 0)
+		return;
+
+	arena_free(&dict->arena);
+	free(dict);
+}
+
+void
+sd_markdown_free(struct sd_markdown *md)
+{
+	release_work_bufs(md);
+
+	stack_free(&md->work_bufs[BUFFER_SPAN]);
+	stack_free(&md->work_bufs[BUFFER_BLOCK]);
+
+	if (md->arena) {
+		arena_free(md->arena);
+		free(md->arena);
+	}
+
+	sd_refdict_release(md->refdict);
+	free(md);
+}
+
+struct sd_document *
+sd_document_new(struct sd_markdown *md, const struct sd_parallel *parallel)
+{
+	struct sd_document *doc = calloc(1, sizeof(struct sd_document));
+
+	if (!doc)
+		return NULL;
+
+	doc->md = md;
+	doc->parallel = *parallel;
+	doc->src = bufnew(1024);
+	doc->text = bufnew(1024);
+	doc->out = bufnew(1024);
+	doc->lookups = bufnew(64);
+	doc->changed_refs = bufnew(64);
+
+	stack_init(&doc->parser.work_bufs[BUFFER_BLOCK], 4);
+	stack_init(&doc->parser.work_bufs[BUFFER_SPAN], 8);
+
+	return doc;
+}
+
+int
+sd_document_render(struct sd_document *doc, const uint8_t *document, size_t doc_size)
+{
+	return sd_document_edit(doc, 0, doc->src->size, document, doc_size);
+}
+
+int
+sd_document_edit(struct sd_document *doc, size_t offset, size_t removed,
+	const uint8_t *inserted, size_t inserted_size)
+{
+	size_t e0, e1_old, e1_new, old_size = doc->text->size, i;
+	int refs_touched, all_refs = 0;
+
+	refs_touched = doc_edit_text(doc, offset, removed, inserted, inserted_size, &e0, &e1_old, &e1_new);
+	if (refs_touched < 0)
+		return -1;
+
+	/* the dictionary stays the same between edits, unless the
+	 * parser gets a new one */
+	if (doc->refdict != doc->md->refdict) {
+		sd_refdict_release(doc->refdict);
+		doc->refdict = doc->md->refdict;
+		if (doc->refdict)
+			doc->refdict->ref_count++;
+		all_refs = 1;
+	}
+
+	doc->changed_refs->size = 0;
+	if (refs_touched)
+		doc_update_refs(doc);
+
+	doc_sync_parser(doc);
+
+	if ((e0 != e1_old || e0 != e1_new) && doc_reparse(doc, e0, e1_old, e1_new, old_size) < 0)
+		return -1;
+
+	/* blocks using a reference that changed */
+	if (all_refs || doc->changed_refs->size)
+		for (i = 0; i < doc->block_count; ++i)
+			if (!doc->blocks[i].fresh && doc_block_stale(doc, &doc->blocks[i], all_refs))
+				doc_rerender_block(doc, &doc->blocks[i]);
+
+	doc_assemble(doc);
+	return 0;
+}
+
+const struct buf *
+sd_document_output(const struct sd_document *doc)
+{
+	return doc->out;
+}
+
+const struct buf *
+sd_document_source(const struct sd_document *doc)
+{
+	return doc->src;
+}
+
+size_t
+sd_document_changed(const struct sd_document *doc, const size_t **indices)
+{
+	*indices = doc->changed;
+	return doc->changed_count;
+}
+
+size_t
+sd_document_blocks(const struct sd_document *doc)
+{
+	return doc->block_count;
+}
+
+void
+sd_document_block(const struct sd_document *doc, size_t index, size_t *offset, size_t *size)
+{
+	*offset = doc->blocks[index].out_off;
+	*size = doc->blocks[index].out_size;
+}
+
+size_t
+sd_document_ids(struct sd_document *doc, const unsigned int **ids)
+{
+	unsigned int *grown, *seen, id;
+	size_t mask = 15, i, k;
+
+	*ids = doc->ids;
+	if (doc->ids_valid || !doc->block_count)
+		return doc->block_count;
+
+	grown = doc_reserve(doc->ids, &doc->ids_asize, doc->block_count, sizeof(unsigned int));
+	if (!grown)
+		return 0;
+	*ids = doc->ids = grown;
+
+	/* identical blocks get the ids following their hash, in order */
+	while (mask < doc->block_count * 2)
+		mask = mask * 2 + 1;
+
+	seen = calloc(mask + 1, sizeof(unsigned int));
+	if (!seen)
+		return 0;
+
+	for (i = 0; i < doc->block_count; ++i) {
+		id = doc->blocks[i].hash;
+
+		for (;;) {
+			for (k = id & mask; seen[k] && seen[k] != id; k = (k + 1) & mask);
+			if (!seen[k])
+				break;
+			id = hash_block((const uint8_t *)&id, sizeof(id));
+		}
+
+		seen[k] = id;
+		grown[i] = id;
+	}
+
+	free(seen);
+	doc->ids_valid = 1;
+	return doc->block_count;
+}
+
+size_t
+sd_block_diff(struct sd_block_op *ops, const unsigned int *from, size_t from_count,
+	const unsigned int *to, size_t to_count)
+{
+	size_t head = 0, tail = 0, count = 0, i;
+
+	while (head < from_count && head < to_count && from[head] == to[head])
+		head++;
+
+	while (tail < from_count - head && tail < to_count - head &&
+		from[from_count - tail - 1] == to[to_count - tail - 1])
+		tail++;
+
+	from_count -= tail;
+	to_count -= tail;
+
+	/* what's left in between is replaced in place, then grown or shrunk */
+	for (i = head; i < from_count || i < to_count; ++i) {
+		if (i < from_count && i < to_count)
+			ops[count].type = SD_BLOCK_REPLACE;
+		else if (i < to_count)
+			ops[count].type = SD_BLOCK_INSERT;
+		else
+			ops[count].type = SD_BLOCK_DELETE;
+
+		ops[count].from = i;
+		ops[count].to = i;
+		count++;
+	}
+
+	return count;
+}
+
+size_t
+sd_document_retained(const struct sd_document *doc)
+{
+	size_t total = sizeof(struct sd_document), i;
+
+	total += doc->src->asize + doc->text->asize + doc->out->asize;
+	total += doc->step_asize * sizeof(struct doc_step);
+	total += doc->block_asize * sizeof(struct doc_block);
+	total += work_bufs_size(&doc->parser);
+
+	for (i = 0; i < doc->block_count; ++i) {
+		total += doc->blocks[i].out->asize;
+		if (doc->blocks[i].lookups)
+			total += doc->blocks[i].lookups->asize;
+	}
+
+	return total;
+}
+
+void
+sd_document_free(struct sd_document *doc)
+{
+	size_t i;
+
+	if (!doc)
+		return;
+
+	for (i = 0; i < doc->block_count; ++i)
+		doc_drop_block(doc, &doc->blocks[i]);
+
+	release_work_bufs(&doc->parser);
+	stack_free(&doc->parser.work_bufs[BUFFER_BLOCK]);
+	stack_free(&doc->parser.work_bufs[BUFFER_SPAN]);
+
+	free_link_refs(NULL, &doc->refs);
+	sd_refdict_release(doc->refdict);
+
+	bufrelease(doc->src);
+	bufrelease(doc->text);
+	bufrelease(doc->out);
+	bufrelease(doc->lookups);
+	bufrelease(doc->changed_refs);
+	free(doc->steps);
+	free(doc->blocks);
+	free(doc->changed);
+	free(doc->ids);
+	free(doc);
 }
 
 void
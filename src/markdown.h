@@ -100,6 +100,45 @@ struct sd_callbacks {
 };
 
 struct sd_markdown;
+struct sd_refdict;
+struct sd_document;
+
+/* sd_parallel • how a renderer and its caller render the parts of one
+ * document at the same time */
+struct sd_parallel {
+	/* renderer state for one part, made from the main one */
+	void *(*fork)(void *opaque);
+
+	/* appends the output of a part to `ob`, folding its state into the main one */
+	void (*join)(struct buf *ob, const struct buf *part, void *part_opaque, void *opaque);
+
+	/* frees the state of a part */
+	void (*release)(void *part_opaque);
+
+	/* readies the main state for the parts of a whole render to be joined
+	 * again, as sd_document does after every edit (optional) */
+	void (*restart)(void *opaque);
+
+	/* calls `job(args[i])` for every `i < count`, on any threads,
+	 * returning once all of them are done */
+	void (*run)(void (*job)(void *), void **args, size_t count, void *run_opaque);
+	void *run_opaque;
+
+	/* whether the block callbacks look at what's already in `ob` */
+	int uses_output;
+};
+
+/* sd_block_op • one step from the blocks of a render to another's */
+enum sd_block_op_type {
+	SD_BLOCK_INSERT,
+	SD_BLOCK_REPLACE,
+	SD_BLOCK_DELETE
+};
+
+struct sd_block_op {
+	enum sd_block_op_type type;
+	size_t from, to;	/* block indices in each render */
+};
 
 /*********
  * FLAGS *
@@ -123,9 +162,123 @@ sd_markdown_new(
 extern void
 sd_markdown_render(struct buf *ob, const uint8_t *document, size_t doc_size, struct sd_markdown *md);
 
+/* sd_markdown_render_parallel • renders the document as up to `parts`
+ * pieces at the same time, with output identical to sd_markdown_render;
+ * documents with NUL bytes are rendered in one piece, so renderers
+ * may use them to mark spots in the output of a part */
+extern void
+sd_markdown_render_parallel(struct buf *ob, const uint8_t *document, size_t doc_size,
+	struct sd_markdown *md, size_t parts, const struct sd_parallel *parallel);
+
+/* sd_markdown_use_arena • takes every per-render allocation from chunks
+ * of at least `chunk_size` bytes, all given back at the end of the render
+ * (0 goes back to the regular allocator) */
+extern int
+sd_markdown_use_arena(struct sd_markdown *md, size_t chunk_size);
+
+/* sd_markdown_arena_high_water • most arena memory any render has used,
+ * a good `chunk_size` for parsers rendering similar documents */
+extern size_t
+sd_markdown_arena_high_water(const struct sd_markdown *md);
+
+/* sd_markdown_set_retain_limit • after each render, frees the biggest work
+ * buffers until the parser keeps no more than `limit` bytes (0 = no limit) */
+extern void
+sd_markdown_set_retain_limit(struct sd_markdown *md, size_t limit);
+
+/* sd_markdown_retained • bytes the parser keeps between renders,
+ * including itself */
+extern size_t
+sd_markdown_retained(const struct sd_markdown *md);
+
+/* sd_markdown_trim • frees every work buffer not in use */
+extern void
+sd_markdown_trim(struct sd_markdown *md);
+
+/* sd_markdown_set_refdict • shares a reference dictionary with the parser
+ * (NULL detaches it); references defined in the document take precedence */
+extern void
+sd_markdown_set_refdict(struct sd_markdown *md, struct sd_refdict *dict);
+
 extern void
 sd_markdown_free(struct sd_markdown *md);
 
+/* sd_refdict_new • parses the `[id]: url "title"` definitions in `data`
+ * into an immutable dictionary; other lines are ignored */
+extern struct sd_refdict *
+sd_refdict_new(const uint8_t *data, size_t size);
+
+/* sd_refdict_size • number of references in the dictionary */
+extern size_t
+sd_refdict_size(const struct sd_refdict *dict);
+
+/* sd_refdict_release • drops a reference to the dictionary, which goes
+ * away once no parser uses it anymore */
+extern void
+sd_refdict_release(struct sd_refdict *dict);
+
+/* sd_document_new • keeps the top-level blocks of a document rendered
+ * by `md` between renders, so that an edit only renders the blocks it
+ * touches again; the renderer has to support parallel rendering (the
+ * `run` hook isn't used) */
+extern struct sd_document *
+sd_document_new(struct sd_markdown *md, const struct sd_parallel *parallel);
+
+/* sd_document_render • replaces the whole document */
+extern int
+sd_document_render(struct sd_document *doc, const uint8_t *document, size_t doc_size);
+
+/* sd_document_edit • replaces `removed` bytes at `offset` with `inserted`;
+ * -1 if the range is out of the document. The renderer state that the
+ * joins build up, such as header ids, starts over through the `restart`
+ * hook, which a renderer without one has to be reset for by the caller */
+extern int
+sd_document_edit(struct sd_document *doc, size_t offset, size_t removed,
+	const uint8_t *inserted, size_t inserted_size);
+
+/* sd_document_output • output of the document, as sd_markdown_render
+ * would have made it */
+extern const struct buf *
+sd_document_output(const struct sd_document *doc);
+
+/* sd_document_source • the document as it stands after the edits */
+extern const struct buf *
+sd_document_source(const struct sd_document *doc);
+
+/* sd_document_changed • indices of the blocks whose output changed
+ * in the last render or edit, and of the block following any that
+ * went away */
+extern size_t
+sd_document_changed(const struct sd_document *doc, const size_t **indices);
+
+/* sd_document_blocks • number of top-level blocks in the document */
+extern size_t
+sd_document_blocks(const struct sd_document *doc);
+
+/* sd_document_block • where the block at `index` is in the output */
+extern void
+sd_document_block(const struct sd_document *doc, size_t index, size_t *offset, size_t *size);
+
+/* sd_document_ids • an id for every block, from a hash of its output:
+ * a block keeps its id as long as it renders the same, wherever it
+ * moves; identical blocks get different ids */
+extern size_t
+sd_document_ids(struct sd_document *doc, const unsigned int **ids);
+
+/* sd_block_diff • the operations turning the blocks of a render, by
+ * their ids `from`, into the blocks `to` of another; `ops` needs room
+ * for `from_count + to_count` of them */
+extern size_t
+sd_block_diff(struct sd_block_op *ops, const unsigned int *from, size_t from_count,
+	const unsigned int *to, size_t to_count);
+
+/* sd_document_retained • bytes the document keeps, including itself */
+extern size_t
+sd_document_retained(const struct sd_document *doc);
+
+extern void
+sd_document_free(struct sd_document *doc);
+
 extern void
 sd_version(int *major, int *minor, int *revision);
 
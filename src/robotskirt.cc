@@ -3,12 +3,15 @@
 #include <node_buffer.h>
 
 #include <string>
+#include <vector>
 #include <cstring>
+#include <cstdlib>
 
 extern "C" {
   #include "markdown.h"
   #include "html.h"
   #include "houdini.h"
+  #include "tree.h"
 }
 
 using namespace std;
@@ -24,6 +27,9 @@ namespace robotskirt {
 // Constants taken from the official Sundown executable 
 #define OUTPUT_UNIT 64
 #define DEFAULT_MAX_NESTING 16
+#define DEFAULT_ARENA_CHUNK 4096
+#define DEFAULT_RETAIN_LIMIT (1 << 20)  //memory kept between renders
+#define PARTS_PER_THREAD 4  //parallel renders: smaller parts balance better
 
 ////////////////////////////////////////////////////////////////////////////////
 // UTILITIES to ease wrapping and interfacing with V8
@@ -74,6 +80,22 @@ unsigned int CheckUFlags(Handle<Value> hdl) {
   return Uint(hdl);
 }
 
+//Tells V8 how much native memory an object holds
+class ExternalMemory {
+public:
+  ExternalMemory() : reported_(0) {}
+  ~ExternalMemory() {
+    reportMemory(0);
+  }
+  void reportMemory(size_t bytes) {
+    V8::AdjustAmountOfExternalAllocatedMemory(static_cast<intptr_t>(bytes) -
+                                              static_cast<intptr_t>(reported_));
+    reported_ = bytes;
+  }
+private:
+  size_t reported_;
+};
+
 //A reference counter
 class RendFuncData {
 public:
@@ -91,13 +113,24 @@ private:
   unsigned char refs;
   unsigned char unrefs;
 };
-class HtmlRendFuncData : public RendFuncData {
+class HtmlRendFuncData : public RendFuncData, public ExternalMemory {
 public:
-  HtmlRendFuncData() : opt(new html_renderopt) {}
-  ~HtmlRendFuncData() {delete opt;}
+  HtmlRendFuncData(sdhtml_templates* templates = NULL) : opt(new html_renderopt), templates(templates) {
+    reportMemory(sizeof(*this) + sizeof(*opt));
+  }
+  ~HtmlRendFuncData() {
+    sdhtml_set_link_rules(opt, NULL);
+    sdhtml_set_url_rewrites(opt, NULL);
+    sdhtml_set_base_url(opt, NULL, 0);
+    sdhtml_set_sanitizer(opt, NULL);
+    sdhtml_set_highlighter(opt, NULL);
+    delete opt;
+    sdhtml_templates_free(templates);
+  }
   void* ptr() {return opt;};
 private:
   html_renderopt* const opt;
+  sdhtml_templates* const templates;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -156,6 +189,25 @@ inline Handle<Value> toString(const buf* buf) {
     if (!buf) return Null();
     return String::New(reinterpret_cast<const char*>(buf->data), buf->size);
 }
+// Hands the contents of a buf over to a new Buffer, without copying them
+void freeBufData(char* data, void* hint) {
+    const buf_allocator* allocator = bufallocator();
+    allocator->free(data, allocator->opaque);
+}
+Local<Object> moveToBuffer(buf* buf) {
+    HandleScope scope;
+    Local<Object> ret;
+    Buffer* slow;
+    if (buf->size) {
+        slow = Buffer::New(reinterpret_cast<char*>(buf->data), buf->size, freeBufData, NULL);
+        buf->data = NULL;
+        buf->size = buf->asize = 0;
+    } else {
+        slow = Buffer::New(0);
+    }
+    MAKE_FAST_BUFFER(slow->handle_, ret);
+    return scope.Close(ret);
+}
 inline void makeBuf(buf*& target, String::Utf8Value*& txt, Local<Value> value) {
   if (value->IsUndefined() || value->IsNull()) return;
   txt = new String::Utf8Value(value);
@@ -163,12 +215,13 @@ inline void makeBuf(buf*& target, String::Utf8Value*& txt, Local<Value> value) {
   target->data = (uint8_t*)(**txt);
   target->size = target->asize = txt->length();
   target->unit = 0;
+  target->alloc = NULL;
 }
 
 // FUNCTION DATA (this gets injected into CPP functions converted to JS)
 class FunctionData;
 typedef v8::Handle<v8::Value> (*PassInvocationCallback)(robotskirt::FunctionData*, const v8::Arguments&);
-class FunctionData: public ObjectWrap {
+class FunctionData: public ObjectWrap, public ExternalMemory {
 public:
     V8_CL_WRAPPER("robotskirt::FunctionData")
     static Handle<Value> NewInstance(const v8::Arguments& args) {
@@ -182,6 +235,7 @@ public:
     FunctionData(void* function, CppSignature signature, RendFuncData* opaque, PassInvocationCallback wrapper):
             function_(function), signature_(signature), opaque_(opaque), wrapper_(wrapper) {
         opaque->ref();
+        reportMemory(sizeof(*this));
     }
     ~FunctionData() {
         opaque_->unref();
@@ -578,10 +632,12 @@ public:
     RENDFUNC_DATA(doc_footer)
 };
 
-class RendererWrap: public ObjectWrap {
+class RendererWrap: public ObjectWrap, public ExternalMemory {
 public:
     V8_CL_WRAPPER("robotskirt::RendererWrap")
-    RendererWrap() {}
+    RendererWrap() {
+        reportMemory(sizeof(*this));
+    }
     virtual ~RendererWrap() {}
     V8_CL_CTOR(RendererWrap) {
         inst = new RendererWrap();
@@ -706,6 +762,408 @@ RENDFUNC_DEF(doc_footer, BUF1, void)
 
 
 
+////////////////////////////////////////////////////////////////////////////////
+// LINK ATTRIBUTE RULES
+////////////////////////////////////////////////////////////////////////////////
+
+// Attributes to give links by host and scheme, like
+// [{hosts: ['example.com'], schemes: ['http', 'https'], attributes: {rel: 'nofollow'}}].
+// A rule without hosts or schemes takes any; the host of a link is matched
+// against the narrowest host having a rule for its scheme. Like References,
+// they can't be modified and are shared by the renderers they're given to.
+class LinkRules: public ObjectWrap {
+public:
+    V8_CL_WRAPPER("robotskirt::LinkRules")
+    LinkRules(sdhtml_link_rules* rules): rules_(rules) {}
+    ~LinkRules() {
+        sdhtml_link_rules_release(rules_);
+    }
+    V8_CL_CTOR(LinkRules) {
+        CheckArguments(1, args);
+        if (!args[0]->IsArray()) V8_THROW(TypeErr("You must give an array of rules!"));
+        Local<Array> list = Local<Array>::Cast(args[0]);
+
+        sdhtml_link_rules* rules = sdhtml_link_rules_new();
+        if (!rules) V8_THROW(Err("Could not allocate the link rules"));
+
+        for (uint32_t i=0; i<list->Length(); i++) {
+            if (!list->Get(i)->IsObject() || !add(rules, Obj(list->Get(i)))) {
+                sdhtml_link_rules_release(rules);
+                V8_THROW(TypeErr("A rule is an object with the attributes to give, and optional hosts and schemes"));
+            }
+        }
+        inst = new LinkRules(rules);
+    } V8_CL_CTOR_END()
+
+    NODE_DEF_TYPE("LinkRules") {
+        StoreTemplate("robotskirt::LinkRules", prot);
+    } NODE_DEF_TYPE_END()
+
+    sdhtml_link_rules* rules() const {return rules_;}
+
+    //The rules given to an HTML renderer: LinkRules or null
+    static sdhtml_link_rules* Check(Local<Value> value) {
+        if (value->IsUndefined() || value->IsNull()) return NULL;
+        if (!value->IsObject() || !GetTemplate("robotskirt::LinkRules")->HasInstance(Obj(value)))
+            V8_THROW(TypeErr("You must provide LinkRules or null!"));
+        return Unwrap<LinkRules>(Obj(value))->rules();
+    }
+protected:
+    sdhtml_link_rules* const rules_;
+private:
+    //A string or an array of them; empty for none
+    static std::vector<std::string> strings(Local<Value> value) {
+        std::vector<std::string> ret;
+        if (value->IsUndefined() || value->IsNull()) return ret;
+        if (value->IsArray()) {
+            Handle<Array> array = Handle<Array>::Cast(value);
+            for (uint32_t i=0; i<array->Length(); i++)
+                ret.push_back(*String::Utf8Value(array->Get(i)));
+        } else {
+            ret.push_back(*String::Utf8Value(value));
+        }
+        return ret;
+    }
+    //The attributes as written in the tag: given as they are, or from an
+    //object whose values get escaped
+    static bool attributes(Local<Value> value, std::string& ret) {
+        if (value->IsString()) {
+            ret = *String::Utf8Value(value);
+            return true;
+        }
+        if (!value->IsObject()) return false;
+
+        Local<Object> obj = Obj(value);
+        Local<Array> names = obj->GetOwnPropertyNames();
+        BufWrap out (bufnew(64));
+        for (uint32_t i=0; i<names->Length(); i++) {
+            String::Utf8Value name (names->Get(i));
+            for (int c=0; c<name.length(); c++) {
+                unsigned char ch = (*name)[c];
+                if (!isalnum(ch) && ch != '-' && ch != '_' && ch != ':') return false;
+            }
+            String::Utf8Value attr (obj->Get(names->Get(i)));
+            if (i) bufputc(*out, ' ');
+            bufput(*out, *name, name.length());
+            BUFPUTSL(*out, "=\"");
+            houdini_escape_html0(*out, reinterpret_cast<const uint8_t*>(*attr), attr.length(), 1);
+            bufputc(*out, '"');
+        }
+        ret.assign(reinterpret_cast<const char*>((*out)->data), (*out)->size);
+        return true;
+    }
+    static bool add(sdhtml_link_rules* rules, Local<Object> rule) {
+        std::string attrs;
+        if (!attributes(rule->Get(Symbol("attributes")), attrs)) return false;
+        std::vector<std::string> hosts = strings(rule->Get(Symbol("hosts")));
+        std::vector<std::string> schemes = strings(rule->Get(Symbol("schemes")));
+
+        for (size_t h=0; h<hosts.size() || (h==0 && hosts.empty()); h++) {
+            for (size_t s=0; s<schemes.size() || (s==0 && schemes.empty()); s++) {
+                if (sdhtml_link_rules_add(rules,
+                        schemes.empty() ? NULL : schemes[s].c_str(),
+                        hosts.empty() ? NULL : hosts[h].c_str(),
+                        attrs.c_str()) < 0)
+                    V8_THROW(Err("Could not allocate the link rules"));
+            }
+        }
+        return true;
+    }
+};
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// URL REWRITES
+////////////////////////////////////////////////////////////////////////////////
+
+// Prefixes to replace in the URLs of links and images, like
+// [['/images/', 'https://cdn.example.com/images/'], ['http://', 'https://']].
+// The first one a URL starts with is replaced. Like LinkRules, they can't
+// be modified and are shared by the renderers they're given to.
+class UrlRewrites: public ObjectWrap {
+public:
+    V8_CL_WRAPPER("robotskirt::UrlRewrites")
+    UrlRewrites(sdhtml_url_rewrites* rw): rw_(rw) {}
+    ~UrlRewrites() {
+        sdhtml_url_rewrites_release(rw_);
+    }
+    V8_CL_CTOR(UrlRewrites) {
+        CheckArguments(1, args);
+        if (!args[0]->IsArray()) V8_THROW(TypeErr("You must give an array of [prefix, replacement] pairs!"));
+        Local<Array> list = Local<Array>::Cast(args[0]);
+
+        sdhtml_url_rewrites* rw = sdhtml_url_rewrites_new();
+        if (!rw) V8_THROW(Err("Could not allocate the URL rewrites"));
+
+        for (uint32_t i=0; i<list->Length(); i++) {
+            Local<Value> pair = list->Get(i);
+            if (!pair->IsArray() || Local<Array>::Cast(pair)->Length() != 2) {
+                sdhtml_url_rewrites_release(rw);
+                V8_THROW(TypeErr("A rewrite is a [prefix, replacement] pair"));
+            }
+            String::Utf8Value from (Obj(pair)->Get(0));
+            String::Utf8Value to (Obj(pair)->Get(1));
+            if (sdhtml_url_rewrites_add(rw, *from, *to) < 0) {
+                sdhtml_url_rewrites_release(rw);
+                V8_THROW(Err("Could not allocate the URL rewrites"));
+            }
+        }
+        inst = new UrlRewrites(rw);
+    } V8_CL_CTOR_END()
+
+    NODE_DEF_TYPE("UrlRewrites") {
+        StoreTemplate("robotskirt::UrlRewrites", prot);
+    } NODE_DEF_TYPE_END()
+
+    sdhtml_url_rewrites* rewrites() const {return rw_;}
+
+    //The rewrites given to an HTML renderer: UrlRewrites or null
+    static sdhtml_url_rewrites* Check(Local<Value> value) {
+        if (value->IsUndefined() || value->IsNull()) return NULL;
+        if (!value->IsObject() || !GetTemplate("robotskirt::UrlRewrites")->HasInstance(Obj(value)))
+            V8_THROW(TypeErr("You must provide UrlRewrites or null!"));
+        return Unwrap<UrlRewrites>(Obj(value))->rewrites();
+    }
+
+    //Resolve the relative URLs against the given one (null to stop)
+    static void SetBase(html_renderopt* options, Local<Value> value) {
+        int ret;
+        if (value->IsUndefined() || value->IsNull()) {
+            ret = sdhtml_set_base_url(options, NULL, 0);
+        } else {
+            String::Utf8Value url (value);
+            ret = sdhtml_set_base_url(options, reinterpret_cast<const uint8_t*>(*url), url.length());
+        }
+        if (ret < 0) V8_THROW(Err("Could not allocate the base URL"));
+    }
+protected:
+    sdhtml_url_rewrites* const rw_;
+};
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// HTML SANITIZER
+////////////////////////////////////////////////////////////////////////////////
+
+// What raw HTML keeps, like {tags: ['a', 'b'], attributes: {a: ['href'], '*':
+// ['class']}, schemes: ['http', 'https']}: every other tag, attribute and URL
+// scheme goes. The rules are compiled once; like LinkRules, they can't be
+// modified and are shared by the renderers they're given to.
+class Sanitizer: public ObjectWrap {
+public:
+    V8_CL_WRAPPER("robotskirt::Sanitizer")
+    Sanitizer(sdhtml_sanitizer* san): san_(san) {}
+    ~Sanitizer() {
+        sdhtml_sanitizer_release(san_);
+    }
+    V8_CL_CTOR(Sanitizer) {
+        CheckArguments(1, args);
+        if (!args[0]->IsObject()) V8_THROW(TypeErr("You must give the tags, attributes and schemes to allow!"));
+        Local<Object> rules = Obj(args[0]);
+
+        sdhtml_sanitizer* san = sdhtml_sanitizer_new();
+        if (!san) V8_THROW(Err("Could not allocate the sanitizer"));
+
+        bool ok = true;
+        std::vector<std::string> tags = strings(rules->Get(Symbol("tags")));
+        for (size_t i=0; ok && i<tags.size(); i++)
+            ok = sdhtml_sanitizer_allow_tag(san, tags[i].c_str()) == 0;
+
+        std::vector<std::string> schemes = strings(rules->Get(Symbol("schemes")));
+        for (size_t i=0; ok && i<schemes.size(); i++)
+            ok = sdhtml_sanitizer_allow_scheme(san, schemes[i].c_str()) == 0;
+
+        Local<Value> attributes = rules->Get(Symbol("attributes"));
+        if (ok && attributes->IsObject()) {
+            Local<Object> obj = Obj(attributes);
+            Local<Array> names = obj->GetOwnPropertyNames();
+            for (uint32_t i=0; ok && i<names->Length(); i++) {
+                std::string tag = *String::Utf8Value(names->Get(i));
+                std::vector<std::string> attrs = strings(obj->Get(names->Get(i)));
+                for (size_t a=0; ok && a<attrs.size(); a++)
+                    ok = sdhtml_sanitizer_allow_attribute(san, tag == "*" ? NULL : tag.c_str(), attrs[a].c_str()) == 0;
+            }
+        }
+
+        if (!ok || sdhtml_sanitizer_compile(san) < 0) {
+            sdhtml_sanitizer_release(san);
+            V8_THROW(Err("Could not allocate the sanitizer"));
+        }
+        inst = new Sanitizer(san);
+    } V8_CL_CTOR_END()
+
+    //Sanitize some HTML with the rules
+    V8_CL_CALLBACK(Sanitizer, Sanitize) {
+        CheckArguments(1, args);
+        String::Utf8Value html (args[0]);
+        BufWrap out (bufnew(OUTPUT_UNIT));
+        sdhtml_sanitize(*out, reinterpret_cast<const uint8_t*>(*html), html.length(), inst->san_);
+        return scope.Close(toString(*out));
+    } V8_CALLBACK_END()
+
+    NODE_DEF_TYPE("Sanitizer") {
+        V8_DEF_METHOD(Sanitize, "sanitize");
+        StoreTemplate("robotskirt::Sanitizer", prot);
+    } NODE_DEF_TYPE_END()
+
+    sdhtml_sanitizer* sanitizer() const {return san_;}
+
+    //The sanitizer given to an HTML renderer: Sanitizer or null
+    static sdhtml_sanitizer* Check(Local<Value> value) {
+        if (value->IsUndefined() || value->IsNull()) return NULL;
+        if (!value->IsObject() || !GetTemplate("robotskirt::Sanitizer")->HasInstance(Obj(value)))
+            V8_THROW(TypeErr("You must provide a Sanitizer or null!"));
+        return Unwrap<Sanitizer>(Obj(value))->sanitizer();
+    }
+protected:
+    sdhtml_sanitizer* const san_;
+private:
+    //A string or an array of them; empty for none
+    static std::vector<std::string> strings(Local<Value> value) {
+        std::vector<std::string> ret;
+        if (value->IsUndefined() || value->IsNull()) return ret;
+        if (value->IsArray()) {
+            Handle<Array> array = Handle<Array>::Cast(value);
+            for (uint32_t i=0; i<array->Length(); i++)
+                ret.push_back(*String::Utf8Value(array->Get(i)));
+        } else {
+            ret.push_back(*String::Utf8Value(value));
+        }
+        return ret;
+    }
+};
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// CODE HIGHLIGHTER
+////////////////////////////////////////////////////////////////////////////////
+
+// The lexers fenced code blocks are highlighted with, picked by the first word
+// of their language: the built-in ones (C/C++, JS, JSON, shell, Python, diff)
+// and those given like {'sql psql': {keywords: ['select', 'from'], literals:
+// ['null'], lineComment: '--', blockComment: ['/*', '*/'], quotes: "'"}},
+// which take over built-in names. Like LinkRules, it can't be modified and is
+// shared by the renderers it's given to.
+class Highlighter: public ObjectWrap {
+public:
+    V8_CL_WRAPPER("robotskirt::Highlighter")
+    Highlighter(sdhtml_highlighter* h): h_(h) {}
+    ~Highlighter() {
+        sdhtml_highlighter_release(h_);
+    }
+    V8_CL_CTOR(Highlighter) {
+        Local<Object> lexers;
+        if (args.Length() >= 1 && !(args[0]->IsUndefined() || args[0]->IsNull())) {
+            if (!args[0]->IsObject()) V8_THROW(TypeErr("You must give the lexers by language names!"));
+            lexers = Obj(args[0]);
+        }
+
+        sdhtml_highlighter* h = sdhtml_highlighter_new();
+        if (!h || sdhtml_highlighter_add_builtins(h) < 0) {
+            sdhtml_highlighter_release(h);
+            V8_THROW(Err("Could not allocate the highlighter"));
+        }
+
+        if (!lexers.IsEmpty()) {
+            Local<Array> names = lexers->GetOwnPropertyNames();
+            for (uint32_t i=0; i<names->Length(); i++) {
+                Local<Value> spec = lexers->Get(names->Get(i));
+                if (!spec->IsObject()) {
+                    sdhtml_highlighter_release(h);
+                    V8_THROW(TypeErr("You must describe each lexer with an object!"));
+                }
+                if (!add(h, *String::Utf8Value(names->Get(i)), Obj(spec))) {
+                    sdhtml_highlighter_release(h);
+                    V8_THROW(Err("Could not allocate the highlighter"));
+                }
+            }
+        }
+        inst = new Highlighter(h);
+    } V8_CL_CTOR_END()
+
+    //Highlight some code in the given language, null if there's no lexer for it
+    V8_CL_CALLBACK(Highlighter, Highlight) {
+        CheckArguments(2, args);
+        String::Utf8Value lang (args[0]);
+        String::Utf8Value code (args[1]);
+        BufWrap out (bufnew(OUTPUT_UNIT));
+        if (!sdhtml_highlight(*out, reinterpret_cast<const uint8_t*>(*lang), lang.length(),
+                reinterpret_cast<const uint8_t*>(*code), code.length(), inst->h_))
+            return scope.Close(Null());
+        return scope.Close(toString(*out));
+    } V8_CALLBACK_END()
+
+    NODE_DEF_TYPE("Highlighter") {
+        V8_DEF_METHOD(Highlight, "highlight");
+        StoreTemplate("robotskirt::Highlighter", prot);
+    } NODE_DEF_TYPE_END()
+
+    sdhtml_highlighter* highlighter() const {return h_;}
+
+    //The highlighter given to an HTML renderer: Highlighter or null
+    static sdhtml_highlighter* Check(Local<Value> value) {
+        if (value->IsUndefined() || value->IsNull()) return NULL;
+        if (!value->IsObject() || !GetTemplate("robotskirt::Highlighter")->HasInstance(Obj(value)))
+            V8_THROW(TypeErr("You must provide a Highlighter or null!"));
+        return Unwrap<Highlighter>(Obj(value))->highlighter();
+    }
+protected:
+    sdhtml_highlighter* const h_;
+private:
+    //Add the lexer an object describes under the given names
+    static bool add(sdhtml_highlighter* h, const std::string& names, Local<Object> spec) {
+        std::string keywords = words(spec->Get(Symbol("keywords")));
+        std::string literals = words(spec->Get(Symbol("literals")));
+        std::string line = text(spec->Get(Symbol("lineComment")));
+        std::string quotes = text(spec->Get(Symbol("quotes")));
+        std::string chars = text(spec->Get(Symbol("wordChars")));
+        std::string open, close;
+        Local<Value> block = spec->Get(Symbol("blockComment"));
+        if (block->IsArray()) {
+            open = text(Handle<Array>::Cast(block)->Get(0));
+            close = text(Handle<Array>::Cast(block)->Get(1));
+        }
+
+        sdhtml_lexer lexer;
+        lexer.keywords = keywords.c_str();
+        lexer.literals = literals.c_str();
+        lexer.line_comment = line.c_str();
+        lexer.block_comment[0] = open.c_str();
+        lexer.block_comment[1] = close.c_str();
+        lexer.quotes = quotes.c_str();
+        lexer.word_chars = chars.c_str();
+        lexer.flags = 0;
+        if (spec->Get(Symbol("preprocessor"))->BooleanValue()) lexer.flags |= SDHTML_LEX_PREPROCESSOR;
+        if (spec->Get(Symbol("variables"))->BooleanValue()) lexer.flags |= SDHTML_LEX_VARIABLES;
+        if (spec->Get(Symbol("keys"))->BooleanValue()) lexer.flags |= SDHTML_LEX_KEYS;
+        if (spec->Get(Symbol("tripleQuotes"))->BooleanValue()) lexer.flags |= SDHTML_LEX_TRIPLE_QUOTES;
+        if (spec->Get(Symbol("spacedComments"))->BooleanValue()) lexer.flags |= SDHTML_LEX_SPACED_COMMENTS;
+        if (spec->Get(Symbol("diff"))->BooleanValue()) lexer.flags |= SDHTML_LEX_DIFF;
+        return sdhtml_highlighter_add(h, names.c_str(), &lexer) == 0;
+    }
+    //A string, empty for none
+    static std::string text(Local<Value> value) {
+        if (value->IsUndefined() || value->IsNull()) return std::string();
+        return *String::Utf8Value(value);
+    }
+    //A string of space-separated words or an array of them
+    static std::string words(Local<Value> value) {
+        if (!value->IsArray()) return text(value);
+        Handle<Array> array = Handle<Array>::Cast(value);
+        std::string ret;
+        for (uint32_t i=0; i<array->Length(); i++) {
+            if (i) ret += ' ';
+            ret += *String::Utf8Value(array->Get(i));
+        }
+        return ret;
+    }
+};
+
+
+
 ////////////////////////////////////////////////////////////////////////////////
 // SUNDOWN BUNDLED RENDERERS ([X]HTML)
 ////////////////////////////////////////////////////////////////////////////////
@@ -713,10 +1171,13 @@ RENDFUNC_DEF(doc_footer, BUF1, void)
 class HtmlRendererWrap: public RendererWrap {
 public:
     V8_CL_WRAPPER("robotskirt::HtmlRendererWrap")
-    HtmlRendererWrap(unsigned int flags): data(new HtmlRendFuncData) {
+    HtmlRendererWrap(unsigned int flags, sdhtml_templates* templates = NULL):
+            data(new HtmlRendFuncData(templates)) {
+        reportMemory(sizeof(*this));
         //FIXME:expose options (Read-only)
         sd_callbacks cb;
         sdhtml_renderer(&cb, (html_renderopt*)data->ptr(), flags);
+        if (templates) sdhtml_templates_renderer(&cb, (html_renderopt*)data->ptr(), templates);
         wrapRenderer(&cb, data);
     }
     ~HtmlRendererWrap() {
@@ -735,11 +1196,51 @@ public:
     V8_CL_GETTER(HtmlRendererWrap, Flags) {
         return scope.Close(Uint(((html_renderopt*)inst->data->ptr())->flags));
     } V8_GETTER_END()
+
+    //Give the links the attributes of the given LinkRules (null for none)
+    V8_CL_CALLBACK(HtmlRendererWrap, SetLinkRules) {
+        CheckArguments(1, args);
+        sdhtml_set_link_rules((html_renderopt*)inst->data->ptr(), LinkRules::Check(args[0]));
+        return scope.Close(Undefined());
+    } V8_CALLBACK_END()
+
+    //Rewrite the URLs of links and images with the given UrlRewrites (null for none)
+    V8_CL_CALLBACK(HtmlRendererWrap, SetUrlRewrites) {
+        CheckArguments(1, args);
+        sdhtml_set_url_rewrites((html_renderopt*)inst->data->ptr(), UrlRewrites::Check(args[0]));
+        return scope.Close(Undefined());
+    } V8_CALLBACK_END()
+
+    //Resolve the relative URLs of links and images against the given one (null to stop)
+    V8_CL_CALLBACK(HtmlRendererWrap, SetBaseUrl) {
+        CheckArguments(1, args);
+        UrlRewrites::SetBase((html_renderopt*)inst->data->ptr(), args[0]);
+        return scope.Close(Undefined());
+    } V8_CALLBACK_END()
+
+    //Sanitize the raw HTML with the given Sanitizer (null to stop)
+    V8_CL_CALLBACK(HtmlRendererWrap, SetSanitizer) {
+        CheckArguments(1, args);
+        sdhtml_set_sanitizer((html_renderopt*)inst->data->ptr(), Sanitizer::Check(args[0]));
+        return scope.Close(Undefined());
+    } V8_CALLBACK_END()
+
+    //Highlight the fenced code blocks with the given Highlighter (null to stop)
+    V8_CL_CALLBACK(HtmlRendererWrap, SetHighlighter) {
+        CheckArguments(1, args);
+        sdhtml_set_highlighter((html_renderopt*)inst->data->ptr(), Highlighter::Check(args[0]));
+        return scope.Close(Undefined());
+    } V8_CALLBACK_END()
     
     NODE_DEF_TYPE("HtmlRenderer") {
         V8_INHERIT("robotskirt::RendererWrap");
 
         V8_DEF_RPROP(Flags, "flags");
+        V8_DEF_METHOD(SetLinkRules, "setLinkRules");
+        V8_DEF_METHOD(SetUrlRewrites, "setUrlRewrites");
+        V8_DEF_METHOD(SetBaseUrl, "setBaseUrl");
+        V8_DEF_METHOD(SetSanitizer, "setSanitizer");
+        V8_DEF_METHOD(SetHighlighter, "setHighlighter");
 
         StoreTemplate("robotskirt::HtmlRendererWrap", prot);
     } NODE_DEF_TYPE_END()
@@ -747,6 +1248,155 @@ protected:
     HtmlRendFuncData* const data;
 };
 
+// An HTML renderer writing some elements from templates given in JS, like
+// {link: '<a href="{href}" rel="nofollow">{text}</a>'}: they're compiled
+// once, and the elements are rendered from them natively.
+class TemplateRendererWrap: public HtmlRendererWrap {
+public:
+    V8_CL_WRAPPER("robotskirt::TemplateRendererWrap")
+    TemplateRendererWrap(unsigned int flags, sdhtml_templates* templates):
+            HtmlRendererWrap(flags, templates) {}
+    V8_CL_CTOR(TemplateRendererWrap) {
+        CheckArguments(1, args);
+        if (!args[0]->IsObject()) V8_THROW(TypeErr("You must give the templates in an object!"));
+        unsigned int flags = 0;
+        if (args.Length() >= 2) flags = CheckUFlags(args[1]);
+
+        sdhtml_templates* templates = compile(Obj(args[0]));
+        inst = new TemplateRendererWrap(flags, templates);
+    } V8_CL_CTOR_END()
+
+    NODE_DEF_TYPE("TemplateRenderer") {
+        V8_INHERIT("robotskirt::HtmlRendererWrap");
+
+        StoreTemplate("robotskirt::TemplateRendererWrap", prot);
+    } NODE_DEF_TYPE_END()
+private:
+    static sdhtml_templates* compile(Local<Object> obj) {
+        HandleScope scope;
+        sdhtml_templates* templates = sdhtml_templates_new();
+        if (!templates) V8_THROW(Err("Couldn't allocate the templates"));
+
+        Local<Array> names = obj->GetOwnPropertyNames();
+        for (uint32_t i=0; i<names->Length(); i++) {
+            String::Utf8Value name (names->Get(i));
+            String::Utf8Value source (obj->Get(names->Get(i)));
+            const char* error;
+            if (sdhtml_templates_set(templates, *name,
+                    reinterpret_cast<const uint8_t*>(*source), source.length(), &error) < 0) {
+                std::string message = std::string("Template for ") + *name + ": " + error;
+                sdhtml_templates_free(templates);
+                V8_THROW(Err(message.c_str()));
+            }
+        }
+        return templates;
+    }
+};
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// SHARED REFERENCE DICTIONARIES
+////////////////////////////////////////////////////////////////////////////////
+
+// Reference definitions parsed once and shared by any number of parsers.
+// They can't be modified: to update them, build new References and hand them
+// to the parsers, the renders in progress keep using the old ones.
+class References: public ObjectWrap {
+public:
+    V8_CL_WRAPPER("robotskirt::References")
+    References(sd_refdict* dict): dict_(dict) {}
+    ~References() {
+        sd_refdict_release(dict_);
+    }
+    V8_CL_CTOR(References) {
+        CheckArguments(1, args);
+        sd_refdict* dict;
+
+        if (Buffer::HasInstance(args[0])) {
+            Local<Object> obj = Obj(args[0]);
+            dict = sd_refdict_new(reinterpret_cast<const uint8_t*>(Buffer::Data(obj)),
+                                  Buffer::Length(obj));
+        } else {
+            String::Utf8Value text (args[0]);
+            dict = sd_refdict_new(reinterpret_cast<const uint8_t*>(*text), text.length());
+        }
+
+        if (!dict) V8_THROW(Err("Could not allocate the references"));
+        inst = new References(dict);
+    } V8_CL_CTOR_END()
+
+    V8_CL_GETTER(References, Size) {
+        return scope.Close(Uint(sd_refdict_size(inst->dict_)));
+    } V8_GETTER_END()
+
+    NODE_DEF_TYPE("References") {
+        V8_DEF_RPROP(Size, "size");
+
+        StoreTemplate("robotskirt::References", prot);
+    } NODE_DEF_TYPE_END()
+
+    sd_refdict* dict() const {return dict_;}
+protected:
+    sd_refdict* const dict_;
+};
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// PARALLEL RENDERING
+////////////////////////////////////////////////////////////////////////////////
+
+//Spreads the parts of a parallel render over a few threads of our own,
+//the calling one included, and waits for all of them
+class ParallelRun {
+public:
+    static void run(void (*job)(void*), void** args, size_t count, void* opaque) {
+        ParallelRun run (job, args, count);
+        size_t threads = *static_cast<size_t*>(opaque);
+        vector<uv_thread_t> tids;
+
+        for (size_t i=1; i<threads && i<count; i++) {
+            uv_thread_t tid;
+            if (uv_thread_create(&tid, work, &run) != 0) break;
+            tids.push_back(tid);
+        }
+        work(&run);
+        for (size_t i=0; i<tids.size(); i++) uv_thread_join(&tids[i]);
+    }
+    static size_t cpuCount() {
+        uv_cpu_info_t* cpus = NULL;
+        int count = 0;
+        uv_cpu_info(&cpus, &count);
+        if (cpus) uv_free_cpu_info(cpus, count);
+        return count > 0 ? count : 1;
+    }
+private:
+    ParallelRun(void (*job)(void*), void** args, size_t count):
+            job_(job), args_(args), count_(count), next_(0) {
+        uv_mutex_init(&lock_);
+    }
+    ~ParallelRun() {
+        uv_mutex_destroy(&lock_);
+    }
+    static void work(void* arg) {
+        ParallelRun* run = static_cast<ParallelRun*>(arg);
+        for (;;) {
+            uv_mutex_lock(&run->lock_);
+            size_t i = run->next_++;
+            uv_mutex_unlock(&run->lock_);
+            if (i >= run->count_) return;
+            run->job_(run->args_[i]);
+        }
+    }
+
+    void (* const job_)(void*);
+    void** const args_;
+    const size_t count_;
+    size_t next_;
+    uv_mutex_t lock_;
+};
+
 
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -759,12 +1409,20 @@ inline Markdown* newStdMarkdown(unsigned int extensions, unsigned int htmlflags,
 
 //Base Markdown class, doesn't contain logic to store renderer data;
 //this is specific to subclasses
-class Markdown: public ObjectWrap {
+class Markdown: public ObjectWrap, public ExternalMemory {
 public:
     V8_CL_WRAPPER("robotskirt::Markdown")
+    Markdown(): retain_limit_(DEFAULT_RETAIN_LIMIT), out_(bufnew(OUTPUT_UNIT)), rendering_(false) {
+        memset(&parallel_, 0, sizeof(parallel_));
+    }
+    //Report the parser, its work buffers and the retained output
+    void updateMemory() {
+        reportMemory(sizeof(*this) + sd_markdown_retained(markdown) + out_->asize);
+    }
     //Here, it's important that the destructor gets declared virtual
     virtual ~Markdown() {
         sd_markdown_free(markdown);
+        bufrelease(out_);
     }
     V8_CL_CTOR(Markdown) {
         //Check & extract arguments
@@ -810,6 +1468,105 @@ public:
     V8_CL_GETTER(Markdown, Extensions) {
         return scope.Close(Uint(inst->extensions_));
     } V8_GETTER_END()
+    V8_CL_GETTER(Markdown, RetainLimit) {
+        return scope.Close(Num(inst->retain_limit_));
+    } V8_GETTER_END()
+    V8_CL_SETTER(Markdown, RetainLimit) {
+        inst->retain_limit_ = Uint(value);
+        sd_markdown_set_retain_limit(inst->markdown, inst->retain_limit_);
+    } V8_SETTER_END()
+    V8_CL_GETTER(Markdown, ArenaHighWater) {
+        return scope.Close(Num(sd_markdown_arena_high_water(inst->markdown)));
+    } V8_GETTER_END()
+
+    //Free the memory kept for the next renders
+    V8_CL_CALLBACK(Markdown, Trim) {
+        sd_markdown_trim(inst->markdown);
+        if (!inst->rendering_) bufreset(inst->out_);
+        inst->updateMemory();
+        return scope.Close(Undefined());
+    } V8_CALLBACK_END()
+    V8_CL_CALLBACK(Markdown, Stats) {
+        size_t work = sd_markdown_retained(inst->markdown);
+        Local<Object> stats = Obj();
+        stats->Set(Symbol("retainedBytes"), Num(work + inst->out_->asize));
+        stats->Set(Symbol("workBytes"), Num(work));
+        stats->Set(Symbol("outputBytes"), Num(inst->out_->asize));
+        stats->Set(Symbol("arenaHighWater"), Num(sd_markdown_arena_high_water(inst->markdown)));
+        return scope.Close(stats);
+    } V8_CALLBACK_END()
+
+    //Look up the references the documents don't define in the given ones
+    V8_CL_CALLBACK(Markdown, SetReferences) {
+        CheckArguments(1, args);
+        sd_refdict* dict = NULL;
+
+        if (!(args[0]->IsUndefined() || args[0]->IsNull())) {
+            if (!args[0]->IsObject() ||
+                !GetTemplate("robotskirt::References")->HasInstance(Obj(args[0])))
+                V8_THROW(TypeErr("You must provide References or null!"));
+            dict = Unwrap<References>(Obj(args[0]))->dict();
+        }
+
+        sd_markdown_set_refdict(inst->markdown, dict);
+        return scope.Close(Undefined());
+    } V8_CALLBACK_END()
+
+    //Give the links the attributes of the given LinkRules (null for none)
+    V8_CL_CALLBACK(Markdown, SetLinkRules) {
+        CheckArguments(1, args);
+        html_renderopt* options = inst->htmlOptions();
+        if (!options) V8_THROW(Err("Only a Markdown.std() parser takes link rules, give them to its renderer"));
+        sdhtml_set_link_rules(options, LinkRules::Check(args[0]));
+        return scope.Close(Undefined());
+    } V8_CALLBACK_END()
+
+    //Rewrite the URLs of links and images with the given UrlRewrites (null for none)
+    V8_CL_CALLBACK(Markdown, SetUrlRewrites) {
+        CheckArguments(1, args);
+        html_renderopt* options = inst->htmlOptions();
+        if (!options) V8_THROW(Err("Only a Markdown.std() parser takes URL rewrites, give them to its renderer"));
+        sdhtml_set_url_rewrites(options, UrlRewrites::Check(args[0]));
+        return scope.Close(Undefined());
+    } V8_CALLBACK_END()
+
+    //Resolve the relative URLs of links and images against the given one (null to stop)
+    V8_CL_CALLBACK(Markdown, SetBaseUrl) {
+        CheckArguments(1, args);
+        html_renderopt* options = inst->htmlOptions();
+        if (!options) V8_THROW(Err("Only a Markdown.std() parser takes a base URL, give it to its renderer"));
+        UrlRewrites::SetBase(options, args[0]);
+        return scope.Close(Undefined());
+    } V8_CALLBACK_END()
+
+    //Sanitize the raw HTML with the given Sanitizer (null to stop)
+    V8_CL_CALLBACK(Markdown, SetSanitizer) {
+        CheckArguments(1, args);
+        html_renderopt* options = inst->htmlOptions();
+        if (!options) V8_THROW(Err("Only a Markdown.std() parser takes a sanitizer, give it to its renderer"));
+        sdhtml_set_sanitizer(options, Sanitizer::Check(args[0]));
+        return scope.Close(Undefined());
+    } V8_CALLBACK_END()
+
+    //Highlight the fenced code blocks with the given Highlighter (null to stop)
+    V8_CL_CALLBACK(Markdown, SetHighlighter) {
+        CheckArguments(1, args);
+        html_renderopt* options = inst->htmlOptions();
+        if (!options) V8_THROW(Err("Only a Markdown.std() parser takes a highlighter, give it to its renderer"));
+        sdhtml_set_highlighter(options, Highlighter::Check(args[0]));
+        return scope.Close(Undefined());
+    } V8_CALLBACK_END()
+
+    //Take per-render memory from an arena with chunks of the given size (0 to stop)
+    V8_CL_CALLBACK(Markdown, UseArena) {
+        size_t chunk_size = DEFAULT_ARENA_CHUNK;
+        if (args.Length() >= 1) chunk_size = Uint(args[0]);
+
+        if (sd_markdown_use_arena(inst->markdown, chunk_size) < 0)
+            V8_THROW(Err("Could not allocate the arena"));
+        inst->updateMemory();
+        return scope.Close(Undefined());
+    } V8_CALLBACK_END()
 
     static V8_S_CALLBACK(RenderSync) {
         fprintf(stderr, "renderSync() is DEPRECATED, please use render() instead.\n");
@@ -822,7 +1579,7 @@ public:
         String::Utf8Value input (args[0]);
 
         //Prepare
-        BufWrap out (bufnew(OUTPUT_UNIT));
+        OutputBuf out (inst);
 
         //GO!!
         sd_markdown_render(*out,
@@ -833,23 +1590,130 @@ public:
         //Finish
         return scope.Close(toString(*out));
     } V8_CALLBACK_END()
+    //The HTML and its table of contents, from a single parse: {html, toc}.
+    //Headers deeper than the nesting level (0 for all) are left out of
+    //the table; the level offset is taken from the first header unless given
+    V8_CL_CALLBACK(Markdown, RenderWithToc) {
+        CheckArguments(1, args);
+        html_renderopt* options = inst->htmlOptions();
+        if (!options) V8_THROW(Err("Only a Markdown.std() parser renders a table of contents"));
+        String::Utf8Value input (args[0]);
+
+        inst->resetRenderer();
+        if (args.Length()>=2) {
+            options->toc_data.nesting_level = Uint(args[1]);
+            if (args.Length()>=3) {
+                options->toc_data.level_offset = Uint(args[2]);
+                options->toc_data.fixed_offset = 1;
+            }
+        }
+
+        BufWrap toc (bufnew(OUTPUT_UNIT));
+        Local<Object> ret = Obj();
+        {
+            OutputBuf out (inst);
+            options->toc = *toc;
+            sd_markdown_render(*out,
+                               reinterpret_cast<const unsigned char*>(*input),
+                               input.length(),
+                               inst->markdown);
+            options->toc = NULL;
+            ret->Set(Symbol("html"), toString(*out));
+        }
+        inst->resetRenderer();
+
+        ret->Set(Symbol("toc"), toString(*toc));
+        return scope.Close(ret);
+    } V8_CALLBACK_END()
+    //Same output as render(), made on several threads when the renderer is native
+    V8_CL_CALLBACK(Markdown, RenderParallel) {
+        CheckArguments(1, args);
+        String::Utf8Value input (args[0]);
+        size_t threads = ParallelRun::cpuCount();
+        if (args.Length()>=2) threads = Uint(args[1]);
+
+        OutputBuf out (inst);
+        const unsigned char* data = reinterpret_cast<const unsigned char*>(*input);
+
+        if (inst->parallel_.run && threads > 1) {
+            sd_parallel parallel = inst->parallel_;
+            parallel.run_opaque = &threads;
+            sd_markdown_render_parallel(*out, data, input.length(), inst->markdown,
+                                        threads * PARTS_PER_THREAD, &parallel);
+        } else {
+            sd_markdown_render(*out, data, input.length(), inst->markdown);
+        }
+
+        return scope.Close(toString(*out));
+    } V8_CALLBACK_END()
 
     NODE_DEF_TYPE("Markdown") {
         V8_DEF_RPROP(Extensions, "extensions");
         V8_DEF_RPROP(MaxNesting, "maxNesting");
+        V8_DEF_RPROP(ArenaHighWater, "arenaHighWater");
+        V8_DEF_PROP(RetainLimit, "retainLimit");
 
         V8_DEF_METHOD(Render, "render");
         V8_DEF_METHOD(RenderSync, "renderSync");
+        V8_DEF_METHOD(RenderParallel, "renderParallel");
+        V8_DEF_METHOD(RenderWithToc, "renderWithToc");
+        V8_DEF_METHOD(UseArena, "useArena");
+        V8_DEF_METHOD(SetReferences, "setReferences");
+        V8_DEF_METHOD(SetLinkRules, "setLinkRules");
+        V8_DEF_METHOD(SetUrlRewrites, "setUrlRewrites");
+        V8_DEF_METHOD(SetBaseUrl, "setBaseUrl");
+        V8_DEF_METHOD(SetSanitizer, "setSanitizer");
+        V8_DEF_METHOD(SetHighlighter, "setHighlighter");
+        V8_DEF_METHOD(Trim, "trim");
+        V8_DEF_METHOD(Stats, "stats");
         
         prot->GetFunction()->Set(Symbol("std"), Func(MakeStandard)->GetFunction());
 
         StoreTemplate("robotskirt::Markdown", prot);
     } NODE_DEF_TYPE_END()
+
+    sd_markdown* parser() const {return markdown;}
+    //NULL unless the renderer can render parts of a document on their own
+    const sd_parallel* parallel() const {return parallel_.join ? &parallel_ : NULL;}
+    //Forget what the renderer carried over from the last render
+    virtual void resetRenderer() {}
+    //NULL unless the renderer is the native HTML one
+    virtual html_renderopt* htmlOptions() {return NULL;}
 protected:
     sd_markdown* markdown;
     sd_callbacks cb;
     size_t max_nesting_;
     int extensions_;
+    size_t retain_limit_;
+    sd_parallel parallel_; //unset unless the renderer can render parts at once
+private:
+    //Lends the retained output buffer to a render; a render started
+    //from one of the callbacks gets a fresh buffer instead
+    class OutputBuf {
+    public:
+        explicit OutputBuf(Markdown* md): md_(md),
+                buf_(md->rendering_ ? bufnew(OUTPUT_UNIT) : md->out_) {
+            if (buf_ == md_->out_) md_->rendering_ = true;
+            buf_->size = 0;
+        }
+        ~OutputBuf() {
+            if (buf_ != md_->out_) {
+                bufrelease(buf_);
+                return;
+            }
+            md_->rendering_ = false;
+            //Don't let a single huge document pin its memory forever
+            if (md_->retain_limit_ && buf_->asize > md_->retain_limit_) bufreset(buf_);
+            md_->updateMemory();
+        }
+        buf* operator*() {return buf_;}
+    private:
+        Markdown* const md_;
+        buf* const buf_;
+    };
+
+    buf* const out_;
+    bool rendering_;
 };
 
 // A markdown parser holding JS-wrapped Renderer data.
@@ -859,6 +1723,8 @@ public:
         max_nesting_ = max_nesting;
         extensions_ = extensions;
         markdown = makeMarkdown(renderer, &cb, &opaque, extensions, max_nesting);
+        sd_markdown_set_retain_limit(markdown, retain_limit_);
+        updateMemory();
     }
     //FIXME: is deallocation correct?
 protected:
@@ -882,7 +1748,22 @@ public:
         sdhtml_renderer(&cb, &options, htmlflags);
         //Create the Markdown parser
         markdown = sd_markdown_new(extensions, max_nesting, &cb, &options);
+        sdhtml_parallel(&parallel_, &cb);
+        parallel_.run = ParallelRun::run;
+        sd_markdown_set_retain_limit(markdown, retain_limit_);
+        updateMemory();
+    }
+    ~StdMarkdown() {
+        sdhtml_set_link_rules(&options, NULL);
+        sdhtml_set_url_rewrites(&options, NULL);
+        sdhtml_set_base_url(&options, NULL, 0);
+        sdhtml_set_sanitizer(&options, NULL);
+        sdhtml_set_highlighter(&options, NULL);
     }
+    void resetRenderer() {
+        memset(&options.toc_data, 0, sizeof(options.toc_data));
+    }
+    html_renderopt* htmlOptions() {return &options;}
 protected:
     html_renderopt options;
 };
@@ -897,6 +1778,377 @@ inline Markdown* newStdMarkdown(unsigned int extensions, unsigned int htmlflags,
 
 
 
+////////////////////////////////////////////////////////////////////////////////
+// INCREMENTAL DOCUMENTS
+////////////////////////////////////////////////////////////////////////////////
+
+// A document kept rendered between edits, for live previews: an edit only
+// renders the top-level blocks it touches again. Offsets are given in
+// characters, like everything else in JS.
+class Document: public ObjectWrap, public ExternalMemory {
+public:
+    V8_CL_WRAPPER("robotskirt::Document")
+    Document(Markdown* md, sd_document* doc, Handle<Object> parser):
+            md_(md), doc_(doc), parser_(Persistent<Object>::New(parser)), tagged_(false) {
+        updateMemory();
+    }
+    ~Document() {
+        sd_document_free(doc_);
+        parser_.Dispose();
+    }
+    void updateMemory() {
+        reportMemory(sizeof(*this) + sd_document_retained(doc_));
+    }
+    V8_CL_CTOR(Document) {
+        CheckArguments(1, args);
+        if (!args[0]->IsObject() ||
+            !GetTemplate("robotskirt::Markdown")->HasInstance(Obj(args[0])))
+            V8_THROW(TypeErr("You must provide a Markdown parser!"));
+        Local<Object> obj = Obj(args[0]);
+        Markdown* md = Unwrap<Markdown>(obj);
+
+        if (!md->parallel())
+            V8_THROW(TypeErr("Documents need a parser made by Markdown.std()"));
+
+        sd_document* doc = sd_document_new(md->parser(), md->parallel());
+        if (!doc) V8_THROW(Err("Could not allocate the document"));
+        inst = new Document(md, doc, obj);
+    } V8_CL_CTOR_END()
+
+    V8_CL_GETTER(Document, Blocks) {
+        return scope.Close(Uint(sd_document_blocks(inst->doc_)));
+    } V8_GETTER_END()
+    //Wrap every block in a <div data-block="id">, and list the ids
+    V8_CL_GETTER(Document, Tagged) {
+        return scope.Close(Bool(inst->tagged_));
+    } V8_GETTER_END()
+    V8_CL_SETTER(Document, Tagged) {
+        inst->tagged_ = Bool(value);
+    } V8_SETTER_END()
+
+    //Replace the whole document
+    V8_CL_CALLBACK(Document, Render) {
+        CheckArguments(1, args);
+        String::Utf8Value input (args[0]);
+
+        inst->md_->resetRenderer();
+        if (sd_document_render(inst->doc_, reinterpret_cast<const uint8_t*>(*input),
+                               input.length()) < 0)
+            V8_THROW(Err("Could not render the document"));
+        return scope.Close(inst->result());
+    } V8_CALLBACK_END()
+    //Replace `removed` characters at `offset` with the given text
+    V8_CL_CALLBACK(Document, Edit) {
+        CheckArguments(3, args);
+        const buf* src = sd_document_source(inst->doc_);
+        size_t offset = byteOffset(src, 0, Uint(args[0]));
+        size_t end = byteOffset(src, offset, Uint(args[1]));
+        String::Utf8Value inserted (args[2]);
+
+        inst->md_->resetRenderer();
+        if (sd_document_edit(inst->doc_, offset, end - offset,
+                             reinterpret_cast<const uint8_t*>(*inserted),
+                             inserted.length()) < 0)
+            V8_THROW(Err("Could not render the document"));
+        return scope.Close(inst->result());
+    } V8_CALLBACK_END()
+    //Operations turning the blocks with the given ids (from an earlier
+    //tagged render) into the current ones
+    V8_CL_CALLBACK(Document, Diff) {
+        CheckArguments(1, args);
+        if (!args[0]->IsArray()) V8_THROW(TypeErr("You must provide an array of ids!"));
+        Local<Array> array = Local<Array>::Cast(args[0]);
+
+        vector<unsigned int> from (array->Length());
+        for (uint32_t i=0; i<from.size(); i++) {
+            String::Utf8Value id (array->Get(i));
+            from[i] = strtoul(*id, NULL, 16);
+        }
+
+        const unsigned int* to;
+        size_t to_count = sd_document_ids(inst->doc_, &to);
+        vector<sd_block_op> ops (from.size() + to_count + 1);
+        size_t count = sd_block_diff(&ops[0], from.empty() ? NULL : &from[0], from.size(),
+                                     to, to_count);
+
+        Local<Array> ret = Array::New(count);
+        for (size_t i=0; i<count; i++) {
+            Local<Object> op = Obj();
+            const sd_block_op& it = ops[i];
+            if (it.type == SD_BLOCK_DELETE) {
+                op->Set(Symbol("op"), Symbol("delete"));
+                op->Set(Symbol("id"), array->Get(it.from));
+            } else {
+                BufWrap html (bufnew(OUTPUT_UNIT));
+                sdhtml_tagged_block(*html, inst->doc_, it.to);
+                if (it.type == SD_BLOCK_REPLACE) {
+                    op->Set(Symbol("op"), Symbol("replace"));
+                    op->Set(Symbol("id"), array->Get(it.from));
+                } else {
+                    op->Set(Symbol("op"), Symbol("insert"));
+                    op->Set(Symbol("after"), it.to ? blockId(to[it.to - 1]) : Null());
+                }
+                op->Set(Symbol("html"), toString(*html));
+            }
+            ret->Set(i, op);
+        }
+        return scope.Close(ret);
+    } V8_CALLBACK_END()
+
+    NODE_DEF_TYPE("Document") {
+        V8_DEF_RPROP(Blocks, "blocks");
+        V8_DEF_PROP(Tagged, "tagged");
+
+        V8_DEF_METHOD(Render, "render");
+        V8_DEF_METHOD(Edit, "edit");
+        V8_DEF_METHOD(Diff, "diff");
+
+        StoreTemplate("robotskirt::Document", prot);
+    } NODE_DEF_TYPE_END()
+private:
+    //{html, changed, blocks} after a render or an edit
+    Local<Object> result() {
+        HandleScope scope;
+        const size_t* indices;
+        size_t count = sd_document_changed(doc_, &indices);
+        Local<Array> changed = Array::New(count);
+        for (size_t i=0; i<count; i++) changed->Set(i, Uint(indices[i]));
+
+        Local<Object> ret = Obj();
+        if (tagged_) {
+            const unsigned int* ids;
+            size_t n = sd_document_ids(doc_, &ids);
+            Local<Array> list = Array::New(n);
+            for (size_t i=0; i<n; i++) list->Set(i, blockId(ids[i]));
+
+            BufWrap html (bufnew(OUTPUT_UNIT));
+            sdhtml_tagged(*html, doc_);
+            ret->Set(Symbol("html"), toString(*html));
+            ret->Set(Symbol("ids"), list);
+        } else {
+            ret->Set(Symbol("html"), toString(sd_document_output(doc_)));
+        }
+        ret->Set(Symbol("changed"), changed);
+        ret->Set(Symbol("blocks"), Uint(sd_document_blocks(doc_)));
+        updateMemory();
+        return scope.Close(ret);
+    }
+    //Same form as in the tagged output
+    static Local<String> blockId(unsigned int id) {
+        char hex [9];
+        sprintf(hex, "%08x", id);
+        return String::New(hex, 8);
+    }
+    //Byte offset `chars` UTF-16 units after `from`, in UTF-8 text
+    static size_t byteOffset(const buf* text, size_t from, size_t chars) {
+        size_t i = from;
+        while (chars && i < text->size) {
+            uint8_t c = text->data[i];
+            if (c < 0x80) i += 1;
+            else if (c < 0xE0) i += 2;
+            else if (c < 0xF0) i += 3;
+            else {
+                //Outside the BMP: a surrogate pair in JS
+                i += 4;
+                if (chars > 1) chars--;
+            }
+            chars--;
+        }
+        return i < text->size ? i : text->size;
+    }
+
+    Markdown* const md_;
+    sd_document* const doc_;
+    Persistent<Object> parser_; //keeps md_ alive
+    bool tagged_;
+};
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// DOCUMENT TREES
+////////////////////////////////////////////////////////////////////////////////
+
+// A document parsed once into flat arrays, which renders to HTML (with
+// any flags), a table of contents or plain text without parsing again.
+// The arrays can also be walked from JS: `nodes` holds NODE_SIZE numbers
+// per node (see the NODE_* constants), `children` the child indices.
+class Tree: public ObjectWrap, public ExternalMemory {
+public:
+    V8_CL_WRAPPER("robotskirt::Tree")
+    Tree(sd_tree* tree, unsigned int extensions, size_t max_nesting): tree_(tree) {
+        sd_callbacks cb;
+        sdtree_recorder(&cb);
+        markdown_ = sd_markdown_new(extensions, max_nesting, &cb, tree_);
+        sdtree_data(&data_, tree_);
+    }
+    //A saved tree, read where it is
+    Tree(): tree_(NULL), markdown_(NULL) {
+        memset(&data_, 0, sizeof(data_));
+    }
+    ~Tree() {
+        if (markdown_) sd_markdown_free(markdown_);
+        if (tree_) sdtree_free(tree_);
+        ClearPersistent(saved_);
+    }
+    void updateMemory() {
+        size_t retained = sizeof(*this) + copy_.size() * sizeof(uint32_t);
+        if (tree_) retained += sdtree_retained(tree_) + sd_markdown_retained(markdown_);
+        reportMemory(retained);
+    }
+    V8_CL_CTOR(Tree) {
+        CheckArguments(1, args);
+        unsigned int extensions = 0;
+        size_t max_nesting = DEFAULT_MAX_NESTING;
+        if (args.Length()>=2) {
+            extensions = CheckUFlags(args[1]);
+            if (args.Length()>=3) {
+                max_nesting = Uint(args[2]);
+            }
+        }
+
+        sd_tree* tree = sdtree_new();
+        if (!tree) V8_THROW(Err("Could not allocate the tree"));
+        inst = new Tree(tree, extensions, max_nesting);
+        if (!inst->parse(args[0])) {
+            delete inst;
+            V8_THROW(Err("Could not parse the document"));
+        }
+    } V8_CL_CTOR_END()
+
+    //Read a tree from the bytes save() gave, without copying them
+    //unless they aren't aligned on 4 bytes
+    static V8_CALLBACK(Load) {
+        CheckArguments(1, args);
+        if (!Buffer::HasInstance(args[0])) V8_THROW(TypeErr("You must provide a Buffer!"));
+        Local<Object> saved = args[0]->ToObject();
+
+        Tree* tree = new Tree();
+        if (!tree->load(saved)) {
+            delete tree;
+            V8_THROW(Err("Not a tree saved by this version"));
+        }
+        tree->updateMemory();
+        return tree->Wrapped();
+    } V8_CALLBACK_END()
+
+    V8_CL_GETTER(Tree, Nodes) {
+        const sd_tree_data& data = inst->data_;
+        return scope.Close(newUint32Array(reinterpret_cast<const uint32_t*>(data.nodes),
+                                          data.node_count * NODE_SIZE));
+    } V8_GETTER_END()
+    V8_CL_GETTER(Tree, Children) {
+        const sd_tree_data& data = inst->data_;
+        return scope.Close(newUint32Array(data.children, data.child_count));
+    } V8_GETTER_END()
+    //The pool the text and extra fields point into
+    V8_CL_GETTER(Tree, Strings) {
+        const sd_tree_data& data = inst->data_;
+        Buffer* slow = Buffer::New(reinterpret_cast<const char*>(data.strings), data.strings_size);
+        Local<Object> ret;
+        MAKE_FAST_BUFFER(slow->handle_, ret);
+        return scope.Close(ret);
+    } V8_GETTER_END()
+
+    //Replace the document
+    V8_CL_CALLBACK(Tree, Parse) {
+        CheckArguments(1, args);
+        if (!inst->tree_) V8_THROW(Err("A loaded tree can't be parsed"));
+        if (!inst->parse(args[0])) V8_THROW(Err("Could not parse the document"));
+        return scope.Close(Undefined());
+    } V8_CALLBACK_END()
+    V8_CL_CALLBACK(Tree, Html) {
+        unsigned int htmlflags = 0;
+        if (args.Length()>=1) htmlflags = CheckUFlags(args[0]);
+
+        sd_callbacks cb;
+        html_renderopt options;
+        sdhtml_renderer(&cb, &options, htmlflags);
+        BufWrap out (bufnew(OUTPUT_UNIT));
+        sdtree_render_data(*out, &inst->data_, &cb, &options);
+        return scope.Close(toString(*out));
+    } V8_CALLBACK_END()
+    //The table of contents; with HTML_HEADER_IDS among the flags, its
+    //entries link to the ids html() gives with the same flags
+    V8_CL_CALLBACK(Tree, Toc) {
+        sd_callbacks cb;
+        html_renderopt options;
+        sdhtml_toc_renderer(&cb, &options);
+        if (args.Length()>=1) options.flags |= CheckUFlags(args[0]);
+        BufWrap out (bufnew(OUTPUT_UNIT));
+        sdtree_render_data(*out, &inst->data_, &cb, &options);
+        return scope.Close(toString(*out));
+    } V8_CALLBACK_END()
+    V8_CL_CALLBACK(Tree, Text) {
+        BufWrap out (bufnew(OUTPUT_UNIT));
+        sdtree_text_data(*out, &inst->data_);
+        return scope.Close(toString(*out));
+    } V8_CALLBACK_END()
+    //The tree as bytes Tree.load() reads back, on a machine
+    //with the same byte order
+    V8_CL_CALLBACK(Tree, Save) {
+        BufWrap out (bufnew(OUTPUT_UNIT));
+        if (sdtree_save(*out, &inst->data_) < 0) V8_THROW(Err("Could not save the tree"));
+        return scope.Close(moveToBuffer(*out));
+    } V8_CALLBACK_END()
+
+    NODE_DEF_TYPE("Tree") {
+        V8_DEF_RPROP(Nodes, "nodes");
+        V8_DEF_RPROP(Children, "children");
+        V8_DEF_RPROP(Strings, "strings");
+
+        V8_DEF_METHOD(Parse, "parse");
+        V8_DEF_METHOD(Html, "html");
+        V8_DEF_METHOD(Toc, "toc");
+        V8_DEF_METHOD(Text, "text");
+        V8_DEF_METHOD(Save, "save");
+
+        StoreTemplate("robotskirt::Tree", prot);
+        prot->GetFunction()->Set(Symbol("load"), Func(Load)->GetFunction());
+    } NODE_DEF_TYPE_END()
+private:
+    static const size_t NODE_SIZE = sizeof(sd_node) / sizeof(uint32_t);
+
+    bool parse(Handle<Value> text) {
+        String::Utf8Value input (text);
+        int ret = sdtree_parse(tree_, reinterpret_cast<const uint8_t*>(*input),
+                               input.length(), markdown_);
+        sdtree_data(&data_, tree_);
+        updateMemory();
+        return ret == 0;
+    }
+    bool load(Handle<Object> saved) {
+        const char* data = Buffer::Data(saved);
+        size_t size = Buffer::Length(saved);
+        if (reinterpret_cast<size_t>(data) & 3) {
+            copy_.resize(size / sizeof(uint32_t) + 1);
+            memcpy(&copy_[0], data, size);
+            data = reinterpret_cast<const char*>(&copy_[0]);
+        } else {
+            saved_ = Persistent<Object>::New(saved);
+        }
+        return sdtree_load(&data_, data, size) == 0;
+    }
+    //A copy of the array, for JS to walk
+    static Local<Object> newUint32Array(const uint32_t* data, size_t length) {
+        HandleScope scope;
+        Local<Function> ctor = Local<Function>::Cast(
+            Context::GetCurrent()->Global()->Get(Symbol("Uint32Array")));
+        Handle<Value> argv[1] = {Uint(length)};
+        Local<Object> ret = ctor->NewInstance(1, argv);
+        if (length) memcpy(ret->GetIndexedPropertiesExternalArrayData(), data,
+                           length * sizeof(uint32_t));
+        return scope.Close(ret);
+    }
+
+    sd_tree* const tree_;  //NULL for a loaded tree
+    sd_markdown* markdown_;
+    sd_tree_data data_;
+    Persistent<Object> saved_;  //keeps the loaded bytes alive
+    vector<uint32_t> copy_;
+};
+
+
 ////////////////////////////////////////////////////////////////////////////////
 // HTML Renderer options
 ////////////////////////////////////////////////////////////////////////////////
@@ -997,86 +2249,358 @@ namespace houdini {
   #define HOUDINI_OUTPUT_UNIT OUTPUT_UNIT
   #define HOUDINI_DEFAULT_TO_SECURE true
 
-  #define HOUDINI_STANDARD_WRAPPER(IDENTIFIER, FUNCTION)                       \
-    V8_S_CALLBACK(IDENTIFIER) {                                                \
-      HandleScope scope;                                                       \
-      if (args.Length()<1) return ThrowException(RangeErr("One argument needed."));\
-      String::Utf8Value input (args[0]);                                       \
+  // One of the Houdini functions in its lazy form: it writes nothing and
+  // returns 0 when the input would come out the same, and returns -1 when
+  // it runs out of memory
+  typedef int (*HoudiniFunction)(buf*, const uint8_t*, size_t);
+  typedef bool (*HoudiniSplit)(const uint8_t*, size_t);
+
+  // Everything needed to run one of the Houdini functions. SPLIT tells
+  // whether the input can be cut right before the given index and the
+  // two halves processed separately, with the same result; without it,
+  // the input is never cut.
+  struct HoudiniOp {
+    HoudiniFunction function;
+    HoudiniSplit split;
+  };
+
+  bool splitAnywhere(const uint8_t* src, size_t at) {
+    return true;
+  }
+  bool splitEscapeJs(const uint8_t* src, size_t at) {
+    return src[at-1] != '<' && src[at-1] != '\r';
+  }
+  bool splitEscapeXml(const uint8_t* src, size_t at) {
+    return at >= 3 && src[at-1] < 0x80 && src[at-2] < 0x80 && src[at-3] < 0x80;
+  }
+  bool splitUnescapeUri(const uint8_t* src, size_t at) {
+    return at >= 2 && src[at-1] != '%' && src[at-2] != '%';
+  }
+  bool splitUnescapeJs(const uint8_t* src, size_t at) {
+    return src[at-1] != '\\';
+  }
+  bool splitUnescapeHtml(const uint8_t* src, size_t at) {
+    return src[at-1] == '\n' || src[at-1] == ' ';
+  }
+
+  // Runs OP over a String or a Buffer, and returns the same kind of value.
+  // If there's nothing to [un]escape, the input itself is returned, without
+  // copying it. Arrays are processed item by item.
+  Handle<Value> Run(Handle<Value> input, const HoudiniOp& op) {
+    HandleScope scope;
+    if (input->IsArray()) {
+      Handle<Array> items = Handle<Array>::Cast(input);
+      Local<Array> ret = Array::New(items->Length());
+      for (uint32_t i=0; i<items->Length(); i++)
+        ret->Set(i, Run(items->Get(i), op));
+      return scope.Close(ret);
+    }
+
+    if (Buffer::HasInstance(input)) {
+      Local<Object> obj = input->ToObject();
+      const uint8_t* data = reinterpret_cast<const uint8_t*>(Buffer::Data(obj));
+      size_t length = Buffer::Length(obj);
+
+      BufWrap out (bufnew(HOUDINI_OUTPUT_UNIT));
+      int ret = op.function(*out, data, length);
+      if (ret < 0) V8_THROW(Err("Could not allocate the output"));
+      if (!ret) return scope.Close(input);
+      return scope.Close(moveToBuffer(*out));
+    }
+
+    String::Utf8Value str (input);
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(*str);
+
+    BufWrap out (bufnew(HOUDINI_OUTPUT_UNIT));
+    int ret = op.function(*out, data, str.length());
+    if (ret < 0) V8_THROW(Err("Could not allocate the output"));
+    if (!ret) {
+      if (input->IsString()) return scope.Close(input);
+      bufput(*out, data, str.length());
+    }
+    return scope.Close(toString(*out));
+  }
+
+  // ASYNC: inputs are cut into chunks of about this size, which are
+  // processed in parallel on the thread pool and then stitched together
+  #define HOUDINI_CHUNK_SIZE (1 << 20)
+
+  class Job;
+
+  // A slice of one of the inputs, processed on its own
+  struct Piece {
+    uv_work_t req;
+    Job* job;
+    const uint8_t* src;
+    size_t size;
+    buf* out; //NULL if the slice needed no work
+    bool failed; //ran out of memory
+  };
+
+  // One of the inputs, and the slices it was cut into
+  struct Item {
+    Persistent<Value> value;
+    String::Utf8Value* str;
+    size_t first, count;
+  };
+
+  class Job {
+  public:
+    Job(const HoudiniOp& op, Handle<Value> input, Handle<Function> callback):
+        op_(op), array_(input->IsArray()), pending_(0) {
+      HandleScope scope;
+      callback_ = Persistent<Function>::New(callback);
+
+      if (array_) {
+        Handle<Array> items = Handle<Array>::Cast(input);
+        items_.resize(items->Length());
+        for (uint32_t i=0; i<items->Length(); i++) add(items_[i], items->Get(i));
+      } else {
+        items_.resize(1);
+        add(items_[0], input);
+      }
+    }
+    ~Job() {
+      for (size_t i=0; i<items_.size(); i++) {
+        items_[i].value.Dispose();
+        delete items_[i].str;
+      }
+      for (size_t i=0; i<pieces_.size(); i++) bufrelease(pieces_[i].out);
+      callback_.Dispose();
+    }
+
+    void queue() {
+      pending_ = pieces_.size();
+      if (!pending_) {
+        finish();
+        return;
+      }
+      for (size_t i=0; i<pieces_.size(); i++) {
+        pieces_[i].job = this;
+        pieces_[i].req.data = &pieces_[i];
+        uv_queue_work(uv_default_loop(), &pieces_[i].req, Work, After);
+      }
+    }
+
+  private:
+    // Keeps the input alive, and cuts it at chunk boundaries where OP allows
+    void add(Item& item, Handle<Value> value) {
+      const uint8_t* data;
+      size_t length;
+
+      item.value = Persistent<Value>::New(value);
+      item.str = NULL;
+      if (Buffer::HasInstance(value)) {
+        data = reinterpret_cast<const uint8_t*>(Buffer::Data(value->ToObject()));
+        length = Buffer::Length(value->ToObject());
+      } else {
+        item.str = new String::Utf8Value(value);
+        data = reinterpret_cast<const uint8_t*>(**item.str);
+        length = item.str->length();
+      }
+
+      item.first = pieces_.size();
+      size_t start = 0;
+      do {
+        size_t end = length;
+        if (op_.split && length - start > HOUDINI_CHUNK_SIZE) {
+          end = start + HOUDINI_CHUNK_SIZE;
+          while (end < length && !op_.split(data, end)) end++;
+        }
+
+        Piece piece;
+        piece.src = data + start;
+        piece.size = end - start;
+        piece.out = NULL;
+        piece.failed = false;
+        pieces_.push_back(piece);
+        start = end;
+      } while (start < length);
+      item.count = pieces_.size() - item.first;
+    }
+
+    static void Work(uv_work_t* req) {
+      Piece* piece = static_cast<Piece*>(req->data);
+      const HoudiniOp& op = piece->job->op_;
+      piece->out = bufnew(HOUDINI_OUTPUT_UNIT);
+      int ret = op.function(piece->out, piece->src, piece->size);
+      if (ret <= 0) {
+        bufrelease(piece->out);
+        piece->out = NULL;
+      }
+      piece->failed = ret < 0;
+    }
+
+    static void After(uv_work_t* req) {
+      Job* job = static_cast<Piece*>(req->data)->job;
+      if (--job->pending_ == 0) job->finish();
+    }
+
+    // Stitches the slices of an item back together
+    Handle<Value> result(Item& item) {
+      HandleScope scope;
+      bool changed = false;
+      size_t size = 0;
+      for (size_t i=item.first; i<item.first+item.count; i++) {
+        Piece& piece = pieces_[i];
+        if (piece.out) changed = true;
+        size += piece.out ? piece.out->size : piece.size;
+      }
+
+      bool buffer = !item.str;
+      if (!changed && (buffer || item.value->IsString())) return scope.Close(item.value);
+
+      BufWrap out (bufnew(HOUDINI_OUTPUT_UNIT));
+      bufgrow(*out, size);
+      for (size_t i=item.first; i<item.first+item.count; i++) {
+        Piece& piece = pieces_[i];
+        if (piece.out) bufput(*out, piece.out->data, piece.out->size);
+        else bufput(*out, piece.src, piece.size);
+      }
+      if (buffer) return scope.Close(moveToBuffer(*out));
+      return scope.Close(toString(*out));
+    }
+
+    bool failed() const {
+      for (size_t i=0; i<pieces_.size(); i++)
+        if (pieces_[i].failed) return true;
+      return false;
+    }
+
+    void finish() {
+      HandleScope scope;
+      Handle<Value> args [2] = {Null(), Undefined()};
+      if (failed()) {
+        args[0] = Err("Could not allocate the output");
+      } else if (array_) {
+        Local<Array> results = Array::New(items_.size());
+        for (size_t i=0; i<items_.size(); i++) results->Set(i, result(items_[i]));
+        args[1] = results;
+      } else {
+        args[1] = result(items_[0]);
+      }
+
+      TryCatch trycatch;
+      callback_->Call(Context::GetCurrent()->Global(), 2, args);
+      delete this;
+      if (trycatch.HasCaught()) FatalException(trycatch);
+    }
+
+    const HoudiniOp op_;
+    const bool array_;
+    Persistent<Function> callback_;
+    std::vector<Item> items_;
+    std::vector<Piece> pieces_;
+    size_t pending_;
+  };
+
+  // Runs OP on the thread pool; the callback is always the last argument
+  Handle<Value> RunAsync(const Arguments& args, const HoudiniOp& op) {
+    HandleScope scope;
+    if (args.Length()<2) return ThrowException(RangeErr("Two arguments needed."));
+    Local<Value> callback = args[args.Length()-1];
+    if (!callback->IsFunction()) return ThrowException(TypeErr("You must give a callback function."));
+
+    (new Job(op, args[0], Local<Function>::Cast(callback)))->queue();
+    return scope.Close(Undefined());
+  }
+
+  #define HOUDINI_STANDARD_WRAPPER(IDENTIFIER, FUNCTION, SPLIT)                \
+    const HoudiniOp IDENTIFIER##Op = {houdini_lazy_##FUNCTION, SPLIT};         \
                                                                                \
-      BufWrap out (bufnew(HOUDINI_OUTPUT_UNIT));                               \
-      houdini_##FUNCTION(*out, (const unsigned char*)(*input), input.length());\
-      return scope.Close(toString(*out));                                      \
+    V8_CALLBACK(IDENTIFIER) {                                                  \
+      if (args.Length()<1) return ThrowException(RangeErr("One argument needed."));\
+      return scope.Close(Run(args[0], IDENTIFIER##Op));                        \
+    } V8_CALLBACK_END()                                                        \
+    V8_S_CALLBACK(IDENTIFIER##Async) {                                         \
+      return RunAsync(args, IDENTIFIER##Op);                                   \
     }
 
   //JS [un]escaping
-  HOUDINI_STANDARD_WRAPPER(EscapeJs, escape_js)
-  HOUDINI_STANDARD_WRAPPER(UnescapeJs, unescape_js)
+  HOUDINI_STANDARD_WRAPPER(EscapeJs, escape_js, splitEscapeJs)
+  HOUDINI_STANDARD_WRAPPER(UnescapeJs, unescape_js, splitUnescapeJs)
   
   //URL [un]escaping
-  HOUDINI_STANDARD_WRAPPER(EscapeUrl, escape_url)
-  HOUDINI_STANDARD_WRAPPER(UnescapeUrl, unescape_url)
+  HOUDINI_STANDARD_WRAPPER(EscapeUrl, escape_url, splitAnywhere)
+  HOUDINI_STANDARD_WRAPPER(UnescapeUrl, unescape_url, splitUnescapeUri)
 
   //URI [un]escaping
-  HOUDINI_STANDARD_WRAPPER(EscapeUri, escape_uri)
-  HOUDINI_STANDARD_WRAPPER(UnescapeUri, unescape_uri)
+  HOUDINI_STANDARD_WRAPPER(EscapeUri, escape_uri, splitAnywhere)
+  HOUDINI_STANDARD_WRAPPER(UnescapeUri, unescape_uri, splitUnescapeUri)
 
   //HTML [un]escaping
-  V8_S_CALLBACK(EscapeHtml) {
-    HandleScope scope;
+  int escape_html(buf* ob, const uint8_t* src, size_t size) {
+    return houdini_lazy_escape_html(ob, src, size, 1);
+  }
+  int escape_html_insecure(buf* ob, const uint8_t* src, size_t size) {
+    return houdini_lazy_escape_html(ob, src, size, 0);
+  }
+  const HoudiniOp EscapeHtmlOp = {escape_html, splitAnywhere};
+  const HoudiniOp EscapeHtmlInsecureOp = {escape_html_insecure, splitAnywhere};
+
+  V8_CALLBACK(EscapeHtml) {
     if (args.Length()<1) return ThrowException(RangeErr("One argument needed."));
-    String::Utf8Value input (args[0]);
     bool secure = HOUDINI_DEFAULT_TO_SECURE;
     if (args.Length()>=2) secure = Bool(args[1]);
 
-    BufWrap out (bufnew(HOUDINI_OUTPUT_UNIT));
-    houdini_escape_html0(*out, (const unsigned char*)(*input), input.length(), secure);
-    return scope.Close(toString(*out));
+    return scope.Close(Run(args[0], secure ? EscapeHtmlOp : EscapeHtmlInsecureOp));
+  } V8_CALLBACK_END()
+  V8_S_CALLBACK(EscapeHtmlAsync) {
+    bool secure = HOUDINI_DEFAULT_TO_SECURE;
+    if (args.Length()>=3) secure = Bool(args[1]);
+
+    return RunAsync(args, secure ? EscapeHtmlOp : EscapeHtmlInsecureOp);
   }
-  HOUDINI_STANDARD_WRAPPER(UnescapeHtml, unescape_html)
+  HOUDINI_STANDARD_WRAPPER(UnescapeHtml, unescape_html, splitUnescapeHtml)
   
   //Additional HREF escaping
-  HOUDINI_STANDARD_WRAPPER(EscapeHref, escape_href)
+  HOUDINI_STANDARD_WRAPPER(EscapeHref, escape_href, splitAnywhere)
   
   //Additional XML escaping
-  HOUDINI_STANDARD_WRAPPER(EscapeXml, escape_xml)
+  HOUDINI_STANDARD_WRAPPER(EscapeXml, escape_xml, splitEscapeXml)
 
   //The initializer
   NODE_DEF(init) {
     target->Set(Symbol("escapeJS"), Func(EscapeJs)->GetFunction());
     target->Set(Symbol("unescapeJS"), Func(UnescapeJs)->GetFunction());
+    target->Set(Symbol("escapeJSAsync"), Func(EscapeJsAsync)->GetFunction());
+    target->Set(Symbol("unescapeJSAsync"), Func(UnescapeJsAsync)->GetFunction());
 
     target->Set(Symbol("escapeURL"), Func(EscapeUrl)->GetFunction());
     target->Set(Symbol("unescapeURL"), Func(UnescapeUrl)->GetFunction());
+    target->Set(Symbol("escapeURLAsync"), Func(EscapeUrlAsync)->GetFunction());
+    target->Set(Symbol("unescapeURLAsync"), Func(UnescapeUrlAsync)->GetFunction());
 
     target->Set(Symbol("escapeURI"), Func(EscapeUri)->GetFunction());
     target->Set(Symbol("unescapeURI"), Func(UnescapeUri)->GetFunction());
+    target->Set(Symbol("escapeURIAsync"), Func(EscapeUriAsync)->GetFunction());
+    target->Set(Symbol("unescapeURIAsync"), Func(UnescapeUriAsync)->GetFunction());
 
     target->Set(Symbol("escapeHTML"), Func(EscapeHtml)->GetFunction());
     target->Set(Symbol("unescapeHTML"), Func(UnescapeHtml)->GetFunction());
+    target->Set(Symbol("escapeHTMLAsync"), Func(EscapeHtmlAsync)->GetFunction());
+    target->Set(Symbol("unescapeHTMLAsync"), Func(UnescapeHtmlAsync)->GetFunction());
 
     target->Set(Symbol("escapeHREF"), Func(EscapeHref)->GetFunction());
+    target->Set(Symbol("escapeHREFAsync"), Func(EscapeHrefAsync)->GetFunction());
 
     target->Set(Symbol("escapeXML"), Func(EscapeXml)->GetFunction());
+    target->Set(Symbol("escapeXMLAsync"), Func(EscapeXmlAsync)->GetFunction());
   }
 };
 
 //SMARTYPANTS (Sundown implementation)
-#define SMARTYPANTS_OUTPUT_UNIT OUTPUT_UNIT
+//Runs like the Houdini functions: Strings or Buffers, arrays of them, and on
+//the thread pool. Quotes pair up across the whole text, so it's never cut.
+const houdini::HoudiniOp SmartypantsOp = {sdhtml_lazy_smartypants, NULL};
+
 V8_CALLBACK(SmartypantsHtml) {
-  //Extract input
   CheckArguments(1, args);
-  String::Utf8Value input (args[0]);
-  
-  //Prepare
-  BufWrap out (bufnew(SMARTYPANTS_OUTPUT_UNIT));
-  
-  //GO!!
-  sdhtml_smartypants(*out,
-                     reinterpret_cast<const unsigned char*>(*input),
-                     input.length());
-  
-  //Finish
-  return scope.Close(toString(*out));
+  return scope.Close(houdini::Run(args[0], SmartypantsOp));
+} V8_CALLBACK_END()
+
+V8_CALLBACK(SmartypantsHtmlAsync) {
+  return scope.Close(houdini::RunAsync(args, SmartypantsOp));
 } V8_CALLBACK_END()
 
 
@@ -1089,7 +2613,15 @@ NODE_DEF_MAIN() {
     //Initialize classes
     RendererWrap::init(target);
     HtmlRendererWrap::init(target);
+    TemplateRendererWrap::init(target);
+    References::init(target);
+    LinkRules::init(target);
+    UrlRewrites::init(target);
+    Sanitizer::init(target);
+    Highlighter::init(target);
     Markdown::init(target);
+    Document::init(target);
+    Tree::init(target);
     FunctionData::init(target);
 
     //Version class & hash
@@ -1120,6 +2652,37 @@ NODE_DEF_MAIN() {
     target->Set(Symbol("HTML_HARD_WRAP"), Int(HTML_HARD_WRAP));
     target->Set(Symbol("HTML_USE_XHTML"), Int(HTML_USE_XHTML));
     target->Set(Symbol("HTML_ESCAPE"), Int(HTML_ESCAPE));
+    target->Set(Symbol("HTML_SMARTYPANTS"), Int(HTML_SMARTYPANTS));
+    target->Set(Symbol("HTML_HEADER_IDS"), Int(HTML_HEADER_IDS));
+
+    //Tree node types and layout
+    target->Set(Symbol("NODE_DOCUMENT"), Int(SD_NODE_DOCUMENT));
+    target->Set(Symbol("NODE_BLOCKCODE"), Int(SD_NODE_BLOCKCODE));
+    target->Set(Symbol("NODE_BLOCKQUOTE"), Int(SD_NODE_BLOCKQUOTE));
+    target->Set(Symbol("NODE_BLOCKHTML"), Int(SD_NODE_BLOCKHTML));
+    target->Set(Symbol("NODE_HEADER"), Int(SD_NODE_HEADER));
+    target->Set(Symbol("NODE_HRULE"), Int(SD_NODE_HRULE));
+    target->Set(Symbol("NODE_LIST"), Int(SD_NODE_LIST));
+    target->Set(Symbol("NODE_LISTITEM"), Int(SD_NODE_LISTITEM));
+    target->Set(Symbol("NODE_PARAGRAPH"), Int(SD_NODE_PARAGRAPH));
+    target->Set(Symbol("NODE_TABLE"), Int(SD_NODE_TABLE));
+    target->Set(Symbol("NODE_TABLE_ROW"), Int(SD_NODE_TABLE_ROW));
+    target->Set(Symbol("NODE_TABLE_CELL"), Int(SD_NODE_TABLE_CELL));
+    target->Set(Symbol("NODE_AUTOLINK"), Int(SD_NODE_AUTOLINK));
+    target->Set(Symbol("NODE_CODESPAN"), Int(SD_NODE_CODESPAN));
+    target->Set(Symbol("NODE_DOUBLE_EMPHASIS"), Int(SD_NODE_DOUBLE_EMPHASIS));
+    target->Set(Symbol("NODE_EMPHASIS"), Int(SD_NODE_EMPHASIS));
+    target->Set(Symbol("NODE_IMAGE"), Int(SD_NODE_IMAGE));
+    target->Set(Symbol("NODE_LINEBREAK"), Int(SD_NODE_LINEBREAK));
+    target->Set(Symbol("NODE_LINK"), Int(SD_NODE_LINK));
+    target->Set(Symbol("NODE_RAW_HTML"), Int(SD_NODE_RAW_HTML));
+    target->Set(Symbol("NODE_TRIPLE_EMPHASIS"), Int(SD_NODE_TRIPLE_EMPHASIS));
+    target->Set(Symbol("NODE_STRIKETHROUGH"), Int(SD_NODE_STRIKETHROUGH));
+    target->Set(Symbol("NODE_SUPERSCRIPT"), Int(SD_NODE_SUPERSCRIPT));
+    target->Set(Symbol("NODE_ENTITY"), Int(SD_NODE_ENTITY));
+    target->Set(Symbol("NODE_TEXT"), Int(SD_NODE_TEXT));
+    target->Set(Symbol("NODE_SIZE"), Int(sizeof(sd_node) / sizeof(uint32_t)));
+    target->Set(Symbol("NODE_NONE"), Uint(SD_TREE_NONE));
 
     //SUBMODULE: Houdini, the escapist
     Local<Object> houdiniL = Obj();
@@ -1128,6 +2691,7 @@ NODE_DEF_MAIN() {
     
     //SMARTYPANTS
     target->Set(Symbol("smartypantsHtml"), Func(SmartypantsHtml)->GetFunction());
+    target->Set(Symbol("smartypantsHtmlAsync"), Func(SmartypantsHtmlAsync)->GetFunction());
 } NODE_DEF_MAIN_END(robotskirt)
 
 }
@@ -0,0 +1,1231 @@
+/* tree.c - parsed documents kept in flat arrays */
+
+/*
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "tree.h"
+#include "stack.h"
+#include "houdini.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#define TREE_CHUNK 4096
+#define TREE_UNIT 256
+
+/* While parsing, a callback writes a token naming its node where its
+ * output would go: a NUL, then the index seven bits a byte with the top
+ * bit set. The parser only ever trims spaces, '!' and letters off the
+ * end of an output, so tokens survive; text NULs are written twice */
+#define TOKEN_SIZE 5
+#define TOKEN_MAX_NODES (1u << 28)
+
+/***********
+ * PARSING *
+ ***********/
+
+/* grow_array • room for `need` items of `unit` bytes, or NULL */
+static void *
+grow_array(struct sd_tree *tree, void *array, size_t *asize, size_t need, size_t unit)
+{
+	size_t neo = *asize ? *asize : 64;
+
+	if (need <= *asize)
+		return array;
+
+	while (neo < need)
+		neo *= 2;
+
+	array = arena_realloc(&tree->arena, array, neo * unit);
+	if (array == NULL) {
+		tree->failed = 1;
+		return NULL;
+	}
+
+	*asize = neo;
+	return array;
+}
+
+static uint32_t
+new_node(struct sd_tree *tree, enum sd_node_type type, int flags)
+{
+	struct sd_node *nodes, *node;
+
+	if (tree->node_count >= TOKEN_MAX_NODES) {
+		tree->failed = 1;
+		return SD_TREE_NONE;
+	}
+
+	nodes = grow_array(tree, tree->nodes, &tree->node_asize,
+		tree->node_count + 1, sizeof(struct sd_node));
+	if (nodes == NULL)
+		return SD_TREE_NONE;
+
+	tree->nodes = nodes;
+	node = nodes + tree->node_count;
+	memset(node, 0x0, sizeof(struct sd_node));
+	node->type = type;
+	node->flags = flags;
+	node->child = tree->child_count;
+	node->text = node->extra = SD_TREE_NONE;
+
+	return (uint32_t)tree->node_count++;
+}
+
+static void
+add_child(struct sd_tree *tree, uint32_t index)
+{
+	uint32_t *children = grow_array(tree, tree->children, &tree->child_asize,
+		tree->child_count + 1, sizeof(uint32_t));
+
+	if (children == NULL)
+		return;
+
+	tree->children = children;
+	children[tree->child_count++] = index;
+}
+
+/* add_string • copies `text` to the pool, NULL meaning none */
+static void
+add_string(struct sd_tree *tree, uint32_t *offset, uint32_t *size, const uint8_t *data, size_t len)
+{
+	struct buf *pool = tree->strings;
+	size_t org = pool->size;
+
+	if (data == NULL)
+		return;
+
+	bufput(pool, data, len);
+	if (pool->size != org + len || pool->size > SD_TREE_NONE) {
+		pool->size = org;
+		tree->failed = 1;
+		return;
+	}
+
+	*offset = (uint32_t)org;
+	*size = (uint32_t)len;
+}
+
+static void
+set_text(struct sd_tree *tree, uint32_t index, const struct buf *text)
+{
+	struct sd_node *node = tree->nodes + index;
+
+	if (text)
+		add_string(tree, &node->text, &node->text_size, text->data, text->size);
+}
+
+static void
+set_extra(struct sd_tree *tree, uint32_t index, const struct buf *extra)
+{
+	struct sd_node *node = tree->nodes + index;
+
+	if (extra)
+		add_string(tree, &node->extra, &node->extra_size, extra->data, extra->size);
+}
+
+/* flush_text • turns what the pool got since `*start` into a TEXT child */
+static void
+flush_text(struct sd_tree *tree, size_t *start)
+{
+	size_t size = tree->strings->size;
+	uint32_t index;
+
+	if (size == *start)
+		return;
+
+	index = new_node(tree, SD_NODE_TEXT, 0);
+	if (index != SD_TREE_NONE) {
+		tree->nodes[index].text = (uint32_t)*start;
+		tree->nodes[index].text_size = (uint32_t)(size - *start);
+		add_child(tree, index);
+	}
+
+	*start = size;
+}
+
+/* add_children • appends the nodes `content` is made of to the children
+ * array, returning how many there are */
+static uint32_t
+add_children(struct sd_tree *tree, const struct buf *content)
+{
+	struct buf *pool = tree->strings;
+	size_t first = tree->child_count, start = pool->size, i = 0, end;
+	const uint8_t *data, *mark;
+	uint32_t index;
+
+	if (content == NULL)
+		return 0;
+
+	data = content->data;
+
+	while (i < content->size) {
+		mark = memchr(data + i, 0, content->size - i);
+		end = mark ? (size_t)(mark - data) : content->size;
+
+		bufput(pool, data + i, end - i);
+		i = end;
+
+		if (i + 1 >= content->size)
+			break;
+
+		if (data[i + 1] == 0) {
+			bufputc(pool, 0);
+			i += 2;
+			continue;
+		}
+
+		if (i + TOKEN_SIZE > content->size)
+			break;
+
+		index = (uint32_t)(data[i + 1] & 0x7f) << 21 | (uint32_t)(data[i + 2] & 0x7f) << 14 |
+			(uint32_t)(data[i + 3] & 0x7f) << 7 | (uint32_t)(data[i + 4] & 0x7f);
+
+		flush_text(tree, &start);
+		add_child(tree, index);
+		i += TOKEN_SIZE;
+	}
+
+	if (pool->size > SD_TREE_NONE) {
+		pool->size = start;
+		tree->failed = 1;
+	}
+
+	flush_text(tree, &start);
+	return (uint32_t)(tree->child_count - first);
+}
+
+static void
+put_token(struct buf *ob, uint32_t index)
+{
+	uint8_t token[TOKEN_SIZE];
+
+	if (index == SD_TREE_NONE)
+		return;
+
+	token[0] = 0;
+	token[1] = 0x80 | (index >> 21 & 0x7f);
+	token[2] = 0x80 | (index >> 14 & 0x7f);
+	token[3] = 0x80 | (index >> 7 & 0x7f);
+	token[4] = 0x80 | (index & 0x7f);
+	bufput(ob, token, TOKEN_SIZE);
+}
+
+/* add_parent • a node holding what `content` is made of */
+static uint32_t
+add_parent(struct sd_tree *tree, enum sd_node_type type, int flags, const struct buf *content)
+{
+	uint32_t index = new_node(tree, type, flags), count;
+
+	/* the nodes may move while the children are added */
+	if (index != SD_TREE_NONE) {
+		count = add_children(tree, content);
+		tree->nodes[index].child_count = count;
+	}
+
+	return index;
+}
+
+/* record_span • same refusals as the HTML renderer, which doesn't take
+ * empty spans */
+static int
+record_span(struct buf *ob, const struct buf *text, enum sd_node_type type, void *opaque)
+{
+	if (!text || !text->size)
+		return 0;
+
+	put_token(ob, add_parent(opaque, type, 0, text));
+	return 1;
+}
+
+static void
+rec_blockcode(struct buf *ob, const struct buf *text, const struct buf *lang, void *opaque)
+{
+	uint32_t index = new_node(opaque, SD_NODE_BLOCKCODE, 0);
+
+	if (index != SD_TREE_NONE) {
+		set_text(opaque, index, text);
+		set_extra(opaque, index, lang);
+	}
+
+	put_token(ob, index);
+}
+
+static void
+rec_blockquote(struct buf *ob, const struct buf *text, void *opaque)
+{
+	put_token(ob, add_parent(opaque, SD_NODE_BLOCKQUOTE, 0, text));
+}
+
+static void
+rec_blockhtml(struct buf *ob, const struct buf *text, void *opaque)
+{
+	uint32_t index = new_node(opaque, SD_NODE_BLOCKHTML, 0);
+
+	if (index != SD_TREE_NONE)
+		set_text(opaque, index, text);
+
+	put_token(ob, index);
+}
+
+static void
+rec_header(struct buf *ob, const struct buf *text, int level, void *opaque)
+{
+	put_token(ob, add_parent(opaque, SD_NODE_HEADER, level, text));
+}
+
+static void
+rec_hrule(struct buf *ob, void *opaque)
+{
+	put_token(ob, new_node(opaque, SD_NODE_HRULE, 0));
+}
+
+static void
+rec_list(struct buf *ob, const struct buf *text, int flags, void *opaque)
+{
+	put_token(ob, add_parent(opaque, SD_NODE_LIST, flags, text));
+}
+
+static void
+rec_listitem(struct buf *ob, const struct buf *text, int flags, void *opaque)
+{
+	put_token(ob, add_parent(opaque, SD_NODE_LISTITEM, flags, text));
+}
+
+static void
+rec_paragraph(struct buf *ob, const struct buf *text, void *opaque)
+{
+	put_token(ob, add_parent(opaque, SD_NODE_PARAGRAPH, 0, text));
+}
+
+static void
+rec_table(struct buf *ob, const struct buf *header, const struct buf *body, void *opaque)
+{
+	struct sd_tree *tree = opaque;
+	uint32_t index = new_node(tree, SD_NODE_TABLE, 0);
+
+	if (index != SD_TREE_NONE) {
+		uint32_t rows = add_children(tree, header);
+		uint32_t count = rows + add_children(tree, body);
+
+		tree->nodes[index].flags = rows;
+		tree->nodes[index].child_count = count;
+	}
+
+	put_token(ob, index);
+}
+
+static void
+rec_table_row(struct buf *ob, const struct buf *text, void *opaque)
+{
+	put_token(ob, add_parent(opaque, SD_NODE_TABLE_ROW, 0, text));
+}
+
+static void
+rec_table_cell(struct buf *ob, const struct buf *text, int flags, void *opaque)
+{
+	put_token(ob, add_parent(opaque, SD_NODE_TABLE_CELL, flags, text));
+}
+
+static int
+rec_autolink(struct buf *ob, const struct buf *link, enum mkd_autolink type, void *opaque)
+{
+	uint32_t index;
+
+	if (!link || !link->size)
+		return 0;
+
+	index = new_node(opaque, SD_NODE_AUTOLINK, type);
+	if (index != SD_TREE_NONE)
+		set_text(opaque, index, link);
+
+	put_token(ob, index);
+	return 1;
+}
+
+static int
+rec_codespan(struct buf *ob, const struct buf *text, void *opaque)
+{
+	uint32_t index = new_node(opaque, SD_NODE_CODESPAN, 0);
+
+	if (index != SD_TREE_NONE)
+		set_text(opaque, index, text);
+
+	put_token(ob, index);
+	return 1;
+}
+
+static int
+rec_double_emphasis(struct buf *ob, const struct buf *text, void *opaque)
+{
+	return record_span(ob, text, SD_NODE_DOUBLE_EMPHASIS, opaque);
+}
+
+static int
+rec_emphasis(struct buf *ob, const struct buf *text, void *opaque)
+{
+	return record_span(ob, text, SD_NODE_EMPHASIS, opaque);
+}
+
+static int
+rec_image(struct buf *ob, const struct buf *link, const struct buf *title, const struct buf *alt, void *opaque)
+{
+	struct sd_tree *tree = opaque;
+	uint32_t index, text;
+
+	if (!link || !link->size)
+		return 0;
+
+	index = new_node(tree, SD_NODE_IMAGE, 0);
+	if (index != SD_TREE_NONE) {
+		set_text(tree, index, link);
+		set_extra(tree, index, title);
+
+		/* the alt text is raw, it can't hold tokens */
+		if (alt && (text = new_node(tree, SD_NODE_TEXT, 0)) != SD_TREE_NONE) {
+			set_text(tree, text, alt);
+			tree->nodes[index].child = tree->child_count;
+			tree->nodes[index].child_count = 1;
+			add_child(tree, text);
+		}
+	}
+
+	put_token(ob, index);
+	return 1;
+}
+
+static int
+rec_linebreak(struct buf *ob, void *opaque)
+{
+	put_token(ob, new_node(opaque, SD_NODE_LINEBREAK, 0));
+	return 1;
+}
+
+static int
+rec_link(struct buf *ob, const struct buf *link, const struct buf *title, const struct buf *content, void *opaque)
+{
+	uint32_t index = add_parent(opaque, SD_NODE_LINK, 0, content);
+
+	if (index != SD_TREE_NONE) {
+		set_text(opaque, index, link);
+		set_extra(opaque, index, title);
+	}
+
+	put_token(ob, index);
+	return 1;
+}
+
+static int
+rec_raw_html(struct buf *ob, const struct buf *tag, void *opaque)
+{
+	uint32_t index = new_node(opaque, SD_NODE_RAW_HTML, 0);
+
+	if (index != SD_TREE_NONE)
+		set_text(opaque, index, tag);
+
+	put_token(ob, index);
+	return 1;
+}
+
+static int
+rec_triple_emphasis(struct buf *ob, const struct buf *text, void *opaque)
+{
+	return record_span(ob, text, SD_NODE_TRIPLE_EMPHASIS, opaque);
+}
+
+static int
+rec_strikethrough(struct buf *ob, const struct buf *text, void *opaque)
+{
+	return record_span(ob, text, SD_NODE_STRIKETHROUGH, opaque);
+}
+
+static int
+rec_superscript(struct buf *ob, const struct buf *text, void *opaque)
+{
+	return record_span(ob, text, SD_NODE_SUPERSCRIPT, opaque);
+}
+
+static void
+rec_entity(struct buf *ob, const struct buf *entity, void *opaque)
+{
+	uint32_t index = new_node(opaque, SD_NODE_ENTITY, 0);
+
+	if (index != SD_TREE_NONE)
+		set_text(opaque, index, entity);
+
+	put_token(ob, index);
+}
+
+/* rec_normal_text • text goes to the output as is, for the parser to
+ * trim; add_children makes nodes of it */
+static void
+rec_normal_text(struct buf *ob, const struct buf *text, void *opaque)
+{
+	size_t i = 0, end;
+	const uint8_t *mark;
+
+	if (!text)
+		return;
+
+	while (i < text->size) {
+		mark = memchr(text->data + i, 0, text->size - i);
+		end = mark ? (size_t)(mark - text->data) : text->size;
+
+		bufput(ob, text->data + i, end - i);
+		if (end >= text->size)
+			break;
+
+		bufput(ob, "\0\0", 2);
+		i = end + 1;
+	}
+}
+
+void
+sdtree_recorder(struct sd_callbacks *callbacks)
+{
+	static const struct sd_callbacks cb_default = {
+		rec_blockcode,
+		rec_blockquote,
+		rec_blockhtml,
+		rec_header,
+		rec_hrule,
+		rec_list,
+		rec_listitem,
+		rec_paragraph,
+		rec_table,
+		rec_table_row,
+		rec_table_cell,
+
+		rec_autolink,
+		rec_codespan,
+		rec_double_emphasis,
+		rec_emphasis,
+		rec_image,
+		rec_linebreak,
+		rec_link,
+		rec_raw_html,
+		rec_triple_emphasis,
+		rec_strikethrough,
+		rec_superscript,
+
+		rec_entity,
+		rec_normal_text,
+
+		NULL,
+		NULL,
+	};
+
+	memcpy(callbacks, &cb_default, sizeof(struct sd_callbacks));
+}
+
+/* clear_tree • back to a lone, empty root */
+static int
+clear_tree(struct sd_tree *tree)
+{
+	arena_reset(&tree->arena);
+
+	tree->nodes = NULL;
+	tree->node_count = tree->node_asize = 0;
+	tree->children = NULL;
+	tree->child_count = tree->child_asize = 0;
+	tree->failed = 0;
+
+	tree->strings = bufnewalloc(TREE_UNIT, &tree->arena.allocator);
+	if (tree->strings == NULL)
+		return -1;
+
+	return new_node(tree, SD_NODE_DOCUMENT, 0) == SD_TREE_NONE ? -1 : 0;
+}
+
+struct sd_tree *
+sdtree_new(void)
+{
+	struct sd_tree *tree = malloc(sizeof(struct sd_tree));
+
+	if (!tree)
+		return NULL;
+
+	if (arena_init(&tree->arena, TREE_CHUNK) < 0 || clear_tree(tree) < 0) {
+		arena_free(&tree->arena);
+		free(tree);
+		return NULL;
+	}
+
+	return tree;
+}
+
+int
+sdtree_parse(struct sd_tree *tree, const uint8_t *document, size_t doc_size, struct sd_markdown *md)
+{
+	struct buf *ob;
+	uint32_t count;
+
+	if (clear_tree(tree) < 0)
+		return -1;
+
+	/* sized up front for the usual markdown, since arrays that move
+	 * in the arena leave their old space behind */
+	tree->nodes = grow_array(tree, tree->nodes, &tree->node_asize,
+		doc_size / 24 + 1, sizeof(struct sd_node));
+	tree->children = grow_array(tree, NULL, &tree->child_asize,
+		doc_size / 24, sizeof(uint32_t));
+	bufgrow(tree->strings, doc_size);
+	if (tree->failed)
+		return -1;
+
+	ob = bufnew(TREE_UNIT);
+	if (!ob)
+		return -1;
+
+	sd_markdown_render(ob, document, doc_size, md);
+	tree->nodes[0].child = tree->child_count;
+	count = add_children(tree, ob);
+	tree->nodes[0].child_count = count;
+	bufrelease(ob);
+
+	if (tree->failed) {
+		clear_tree(tree);
+		return -1;
+	}
+
+	return 0;
+}
+
+/***************
+ * SAVED TREES *
+ ***************/
+
+/* tree_header • what a saved tree starts with; the nodes, the children
+ * and the strings follow */
+struct tree_header {
+	uint8_t magic[4];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t node_size;
+	uint32_t node_count;
+	uint32_t child_count;
+	uint32_t strings_size;
+	uint32_t reserved;
+};
+
+#define TREE_MAGIC "SDTR"
+#define TREE_BYTE_ORDER 0x01020304
+
+void
+sdtree_data(struct sd_tree_data *data, const struct sd_tree *tree)
+{
+	data->nodes = tree->nodes;
+	data->node_count = tree->node_count;
+	data->children = tree->children;
+	data->child_count = tree->child_count;
+	data->strings = tree->strings ? tree->strings->data : NULL;
+	data->strings_size = tree->strings ? tree->strings->size : 0;
+}
+
+int
+sdtree_save(struct buf *ob, const struct sd_tree_data *tree)
+{
+	struct tree_header header;
+	size_t nodes_size = tree->node_count * sizeof(struct sd_node);
+	size_t children_size = tree->child_count * sizeof(uint32_t);
+
+	memset(&header, 0x0, sizeof(header));
+	memcpy(header.magic, TREE_MAGIC, sizeof(header.magic));
+	header.version = SD_TREE_VERSION;
+	header.byte_order = TREE_BYTE_ORDER;
+	header.node_size = sizeof(struct sd_node);
+	header.node_count = (uint32_t)tree->node_count;
+	header.child_count = (uint32_t)tree->child_count;
+	header.strings_size = (uint32_t)tree->strings_size;
+
+	if (bufgrow(ob, ob->size + sizeof(header) + nodes_size + children_size + tree->strings_size) < 0)
+		return -1;
+
+	bufput(ob, &header, sizeof(header));
+	bufput(ob, tree->nodes, nodes_size);
+	bufput(ob, tree->children, children_size);
+	bufput(ob, tree->strings, tree->strings_size);
+	return 0;
+}
+
+static int
+check_string(const struct sd_tree_data *tree, uint32_t offset, uint32_t size)
+{
+	return offset == SD_TREE_NONE ||
+		(offset <= tree->strings_size && size <= tree->strings_size - offset);
+}
+
+/* the flags lists get, MKD_LI_END included: the parser leaves it in */
+#define TREE_LIST_FLAGS (MKD_LIST_ORDERED | MKD_LI_BLOCK | 8)
+
+/* check_flags • whether a node has flags its callback can be called with;
+ * renderers trust them, e.g. to open as many TOC levels as a header's */
+static int
+check_flags(const struct sd_node *node)
+{
+	switch (node->type) {
+	case SD_NODE_HEADER:
+		return node->flags >= 1 && node->flags <= 6;
+
+	case SD_NODE_LIST:
+	case SD_NODE_LISTITEM:
+		return (node->flags & ~TREE_LIST_FLAGS) == 0;
+
+	case SD_NODE_TABLE:
+		return node->flags <= node->child_count;
+
+	case SD_NODE_TABLE_CELL:
+		return (node->flags & ~(MKD_TABLE_ALIGNMASK | MKD_TABLE_HEADER)) == 0;
+
+	case SD_NODE_AUTOLINK:
+		return node->flags == MKDA_NORMAL || node->flags == MKDA_EMAIL;
+
+	default:
+		return node->flags == 0;
+	}
+}
+
+/* check_tree • walks down from the root, making sure every node it meets
+ * is a sound one that no other node has as a child, and isn't too deep */
+static int
+check_tree(const struct sd_tree_data *tree)
+{
+	const struct sd_node *node;
+	uint32_t *stack, index, child, i;
+	uint8_t *seen;
+	size_t top = 0;
+	int ret = 0;
+
+	if (tree->node_count == 0 || tree->nodes[0].type != SD_NODE_DOCUMENT)
+		return -1;
+
+	stack = malloc(tree->node_count * 2 * sizeof(uint32_t) + tree->node_count);
+	if (!stack)
+		return -1;
+
+	seen = (uint8_t *)(stack + tree->node_count * 2);
+	memset(seen, 0x0, tree->node_count);
+	seen[0] = 1;
+	stack[top++] = 0;
+	stack[top++] = 0;
+
+	while (top > 0 && ret == 0) {
+		uint32_t depth = stack[--top];
+		index = stack[--top];
+		node = tree->nodes + index;
+
+		if (node->type > SD_NODE_TEXT || depth > SD_TREE_MAX_DEPTH ||
+			node->child > tree->child_count || node->child_count > tree->child_count - node->child ||
+			!check_flags(node) ||
+			(node->text == SD_TREE_NONE && (node->type == SD_NODE_AUTOLINK ||
+				node->type == SD_NODE_RAW_HTML || node->type == SD_NODE_ENTITY)) ||
+			!check_string(tree, node->text, node->text_size) ||
+			!check_string(tree, node->extra, node->extra_size)) {
+			ret = -1;
+			break;
+		}
+
+		for (i = 0; i < node->child_count; ++i) {
+			child = tree->children[node->child + i];
+			if (child >= tree->node_count || seen[child]) {
+				ret = -1;
+				break;
+			}
+
+			seen[child] = 1;
+			stack[top++] = child;
+			stack[top++] = depth + 1;
+		}
+	}
+
+	free(stack);
+	return ret;
+}
+
+int
+sdtree_load(struct sd_tree_data *tree, const void *data, size_t size)
+{
+	const uint8_t *bytes = data;
+	struct tree_header header;
+
+	if (size < sizeof(header) || ((size_t)bytes & 3) != 0)
+		return -1;
+
+	memcpy(&header, bytes, sizeof(header));
+	bytes += sizeof(header);
+	size -= sizeof(header);
+
+	if (memcmp(header.magic, TREE_MAGIC, sizeof(header.magic)) != 0 ||
+		header.version != SD_TREE_VERSION ||
+		header.byte_order != TREE_BYTE_ORDER ||
+		header.node_size != sizeof(struct sd_node))
+		return -1;
+
+	if (header.node_count > size / sizeof(struct sd_node))
+		return -1;
+
+	tree->nodes = (const struct sd_node *)bytes;
+	tree->node_count = header.node_count;
+	bytes += tree->node_count * sizeof(struct sd_node);
+	size -= tree->node_count * sizeof(struct sd_node);
+
+	if (header.child_count > size / sizeof(uint32_t))
+		return -1;
+
+	tree->children = (const uint32_t *)bytes;
+	tree->child_count = header.child_count;
+	bytes += tree->child_count * sizeof(uint32_t);
+	size -= tree->child_count * sizeof(uint32_t);
+
+	if (header.strings_size != size)
+		return -1;
+
+	tree->strings = bytes;
+	tree->strings_size = size;
+
+	return check_tree(tree);
+}
+
+/*************
+ * RENDERING *
+ *************/
+
+struct replay {
+	const struct sd_tree_data *tree;
+	const struct sd_callbacks *cb;
+	void *opaque;
+	struct stack work;
+};
+
+static struct buf *
+replay_newbuf(struct replay *r)
+{
+	struct stack *pool = &r->work;
+	struct buf *work;
+
+	if (pool->size < pool->asize && pool->item[pool->size] != NULL) {
+		work = pool->item[pool->size++];
+		work->size = 0;
+	} else {
+		work = bufnew(TREE_UNIT);
+		stack_push(pool, work);
+	}
+
+	return work;
+}
+
+static inline void
+replay_popbuf(struct replay *r)
+{
+	r->work.size--;
+}
+
+/* node_string • a view of a string of the pool, NULL if there is none */
+static const struct buf *
+node_string(struct buf *view, const struct sd_tree_data *tree, uint32_t offset, uint32_t size)
+{
+	if (offset == SD_TREE_NONE)
+		return NULL;
+
+	memset(view, 0x0, sizeof(struct buf));
+	view->data = (uint8_t *)tree->strings + offset;
+	view->size = size;
+	return view;
+}
+
+/* render_text • text as the parser gives it out when it isn't markup */
+static void
+render_text(struct buf *ob, struct replay *r, const uint8_t *data, size_t size)
+{
+	struct buf text;
+
+	if (r->cb->normal_text) {
+		memset(&text, 0x0, sizeof(struct buf));
+		text.data = (uint8_t *)data;
+		text.size = size;
+		r->cb->normal_text(ob, &text, r->opaque);
+	}
+	else
+		bufput(ob, data, size);
+}
+
+static void render_node(struct buf *ob, struct replay *r, uint32_t index);
+
+static void
+render_children(struct buf *ob, struct replay *r, uint32_t first, uint32_t count)
+{
+	uint32_t i;
+
+	for (i = 0; i < count; ++i)
+		render_node(ob, r, r->tree->children[first + i]);
+}
+
+/* render_html_block • what the parser makes of an HTML block when the
+ * renderer takes none: a paragraph, with its tags as raw HTML */
+static void
+render_html_block(struct buf *ob, struct replay *r, const struct buf *html)
+{
+	const struct sd_callbacks *cb = r->cb;
+	struct buf *work = replay_newbuf(r);
+	struct buf tag;
+	size_t i = 0, org, end, size = html ? html->size : 0;
+
+	while (size && html->data[size - 1] == '\n')
+		size--;
+
+	while (i < size) {
+		org = i;
+		while (i < size && html->data[i] != '<')
+			i++;
+
+		render_text(work, r, html->data + org, i - org);
+
+		end = i;
+		while (end < size && html->data[end] != '>')
+			end++;
+
+		if (end >= size) {
+			render_text(work, r, html->data + i, size - i);
+			break;
+		}
+
+		memset(&tag, 0x0, sizeof(struct buf));
+		tag.data = html->data + i;
+		tag.size = end + 1 - i;
+
+		if (!cb->raw_html_tag || !cb->raw_html_tag(work, &tag, r->opaque))
+			render_text(work, r, tag.data, tag.size);
+
+		i = end + 1;
+	}
+
+	if (cb->paragraph)
+		cb->paragraph(ob, work, r->opaque);
+
+	replay_popbuf(r);
+}
+
+static void
+render_node(struct buf *ob, struct replay *r, uint32_t index)
+{
+	const struct sd_tree_data *tree = r->tree;
+	const struct sd_callbacks *cb = r->cb;
+	const struct sd_node *node = tree->nodes + index;
+	const struct buf *text, *extra, *alt;
+	struct buf text_view, extra_view, alt_view, *work, *body;
+	int (*span)(struct buf *, const struct buf *, void *) = NULL;
+
+	text = node_string(&text_view, tree, node->text, node->text_size);
+	extra = node_string(&extra_view, tree, node->extra, node->extra_size);
+
+	switch (node->type) {
+	case SD_NODE_DOCUMENT:
+		render_children(ob, r, node->child, node->child_count);
+		break;
+
+	case SD_NODE_TEXT:
+		if (text)
+			render_text(ob, r, text->data, text->size);
+		break;
+
+	case SD_NODE_ENTITY:
+		if (cb->entity)
+			cb->entity(ob, text, r->opaque);
+		else if (text)
+			bufput(ob, text->data, text->size);
+		break;
+
+	case SD_NODE_BLOCKCODE:
+		if (cb->blockcode)
+			cb->blockcode(ob, text, extra, r->opaque);
+		break;
+
+	case SD_NODE_BLOCKHTML:
+		if (cb->blockhtml)
+			cb->blockhtml(ob, text, r->opaque);
+		else
+			render_html_block(ob, r, text);
+		break;
+
+	case SD_NODE_HRULE:
+		if (cb->hrule)
+			cb->hrule(ob, r->opaque);
+		break;
+
+	/* the parser renders the content of a block even when the block
+	 * is skipped: callbacks may count what they see */
+	case SD_NODE_BLOCKQUOTE:
+	case SD_NODE_HEADER:
+	case SD_NODE_LIST:
+	case SD_NODE_LISTITEM:
+	case SD_NODE_PARAGRAPH:
+	case SD_NODE_TABLE_ROW:
+	case SD_NODE_TABLE_CELL:
+		work = replay_newbuf(r);
+		render_children(work, r, node->child, node->child_count);
+
+		if (node->type == SD_NODE_BLOCKQUOTE && cb->blockquote)
+			cb->blockquote(ob, work, r->opaque);
+		else if (node->type == SD_NODE_HEADER && cb->header)
+			cb->header(ob, work, (int)node->flags, r->opaque);
+		else if (node->type == SD_NODE_LIST && cb->list)
+			cb->list(ob, work, (int)node->flags, r->opaque);
+		else if (node->type == SD_NODE_LISTITEM && cb->listitem)
+			cb->listitem(ob, work, (int)node->flags, r->opaque);
+		else if (node->type == SD_NODE_PARAGRAPH && cb->paragraph)
+			cb->paragraph(ob, work, r->opaque);
+		else if (node->type == SD_NODE_TABLE_ROW && cb->table_row)
+			cb->table_row(ob, work, r->opaque);
+		else if (node->type == SD_NODE_TABLE_CELL && cb->table_cell)
+			cb->table_cell(ob, work, (int)node->flags, r->opaque);
+
+		replay_popbuf(r);
+		break;
+
+	case SD_NODE_TABLE:
+		work = replay_newbuf(r);
+		body = replay_newbuf(r);
+		render_children(work, r, node->child, node->flags);
+		render_children(body, r, node->child + node->flags, node->child_count - node->flags);
+
+		if (cb->table)
+			cb->table(ob, work, body, r->opaque);
+
+		replay_popbuf(r);
+		replay_popbuf(r);
+		break;
+
+	/* spans turned down print what they hold */
+	case SD_NODE_AUTOLINK:
+		if ((!cb->autolink || !cb->autolink(ob, text, (enum mkd_autolink)node->flags, r->opaque)) && text)
+			render_text(ob, r, text->data, text->size);
+		break;
+
+	case SD_NODE_CODESPAN:
+		if ((!cb->codespan || !cb->codespan(ob, text, r->opaque)) && text)
+			render_text(ob, r, text->data, text->size);
+		break;
+
+	case SD_NODE_IMAGE:
+		alt = NULL;
+		if (node->child_count) {
+			const struct sd_node *child = tree->nodes + tree->children[node->child];
+			alt = node_string(&alt_view, tree, child->text, child->text_size);
+		}
+
+		if ((!cb->image || !cb->image(ob, text, extra, alt, r->opaque)) && alt)
+			render_text(ob, r, alt->data, alt->size);
+		break;
+
+	case SD_NODE_LINEBREAK:
+		if (!cb->linebreak || !cb->linebreak(ob, r->opaque))
+			render_text(ob, r, (const uint8_t *)"\n", 1);
+		break;
+
+	case SD_NODE_LINK:
+		work = replay_newbuf(r);
+		render_children(work, r, node->child, node->child_count);
+
+		if (!cb->link || !cb->link(ob, text, extra, node->child_count ? work : NULL, r->opaque))
+			bufput(ob, work->data, work->size);
+
+		replay_popbuf(r);
+		break;
+
+	case SD_NODE_RAW_HTML:
+		if ((!cb->raw_html_tag || !cb->raw_html_tag(ob, text, r->opaque)) && text)
+			render_text(ob, r, text->data, text->size);
+		break;
+
+	case SD_NODE_DOUBLE_EMPHASIS:
+		span = cb->double_emphasis;
+		goto render_span;
+	case SD_NODE_EMPHASIS:
+		span = cb->emphasis;
+		goto render_span;
+	case SD_NODE_TRIPLE_EMPHASIS:
+		span = cb->triple_emphasis;
+		goto render_span;
+	case SD_NODE_STRIKETHROUGH:
+		span = cb->strikethrough;
+		goto render_span;
+	case SD_NODE_SUPERSCRIPT:
+		span = cb->superscript;
+
+	render_span:
+		work = replay_newbuf(r);
+		render_children(work, r, node->child, node->child_count);
+
+		if (!span || !span(ob, work, r->opaque))
+			bufput(ob, work->data, work->size);
+
+		replay_popbuf(r);
+		break;
+	}
+}
+
+void
+sdtree_render_data(struct buf *ob, const struct sd_tree_data *tree, const struct sd_callbacks *callbacks, void *opaque)
+{
+	struct replay r;
+	size_t i;
+
+	r.tree = tree;
+	r.cb = callbacks;
+	r.opaque = opaque;
+	if (tree->node_count == 0 || stack_init(&r.work, 8) < 0)
+		return;
+
+	if (callbacks->doc_header)
+		callbacks->doc_header(ob, opaque);
+
+	render_node(ob, &r, 0);
+
+	if (callbacks->doc_footer)
+		callbacks->doc_footer(ob, opaque);
+
+	for (i = 0; i < r.work.asize; ++i)
+		bufrelease(r.work.item[i]);
+
+	stack_free(&r.work);
+}
+
+void
+sdtree_render(struct buf *ob, const struct sd_tree *tree, const struct sd_callbacks *callbacks, void *opaque)
+{
+	struct sd_tree_data data;
+
+	sdtree_data(&data, tree);
+	sdtree_render_data(ob, &data, callbacks, opaque);
+}
+
+/*************
+ * PLAINTEXT *
+ *************/
+
+/* text_break • ends what's in `ob` with `lines` line breaks */
+static void
+text_break(struct buf *ob, size_t org, size_t lines)
+{
+	size_t n = 0;
+
+	if (ob->size == org)
+		return;
+
+	while (n < ob->size - org && ob->data[ob->size - 1 - n] == '\n')
+		n++;
+
+	for (; n < lines; ++n)
+		bufputc(ob, '\n');
+}
+
+static void
+text_node(struct buf *ob, size_t org, const struct sd_tree_data *tree, uint32_t index)
+{
+	const struct sd_node *node = tree->nodes + index;
+	const uint8_t *text = node->text != SD_TREE_NONE ? tree->strings + node->text : NULL;
+	uint32_t i;
+
+	switch (node->type) {
+	case SD_NODE_BLOCKCODE:
+	case SD_NODE_BLOCKQUOTE:
+	case SD_NODE_HEADER:
+	case SD_NODE_HRULE:
+	case SD_NODE_LIST:
+	case SD_NODE_PARAGRAPH:
+	case SD_NODE_TABLE:
+		text_break(ob, org, 2);
+		break;
+
+	case SD_NODE_LISTITEM:
+	case SD_NODE_TABLE_ROW:
+		text_break(ob, org, 1);
+		break;
+
+	case SD_NODE_BLOCKHTML:
+	case SD_NODE_RAW_HTML:
+		return;
+
+	case SD_NODE_ENTITY:
+		if (text)
+			houdini_unescape_html(ob, text, node->text_size);
+		return;
+
+	case SD_NODE_AUTOLINK:
+		if (!text)
+			return;
+
+		if (node->text_size > 7 && memcmp(text, "mailto:", 7) == 0)
+			bufput(ob, text + 7, node->text_size - 7);
+		else
+			bufput(ob, text, node->text_size);
+		return;
+
+	case SD_NODE_LINEBREAK:
+		bufputc(ob, '\n');
+		return;
+	}
+
+	if (text && node->type != SD_NODE_LINK && node->type != SD_NODE_IMAGE)
+		bufput(ob, text, node->text_size);
+
+	for (i = 0; i < node->child_count; ++i) {
+		if (node->type == SD_NODE_TABLE_ROW && i > 0)
+			bufputc(ob, '\t');
+
+		text_node(ob, org, tree, tree->children[node->child + i]);
+	}
+}
+
+void
+sdtree_text_data(struct buf *ob, const struct sd_tree_data *tree)
+{
+	size_t org = ob->size;
+
+	if (tree->node_count == 0)
+		return;
+
+	text_node(ob, org, tree, 0);
+
+	while (ob->size > org && ob->data[ob->size - 1] == '\n')
+		ob->size--;
+
+	if (ob->size > org)
+		bufputc(ob, '\n');
+}
+
+void
+sdtree_text(struct buf *ob, const struct sd_tree *tree)
+{
+	struct sd_tree_data data;
+
+	sdtree_data(&data, tree);
+	sdtree_text_data(ob, &data);
+}
+
+size_t
+sdtree_retained(const struct sd_tree *tree)
+{
+	return sizeof(struct sd_tree) + arena_allocated(&tree->arena);
+}
+
+void
+sdtree_free(struct sd_tree *tree)
+{
+	if (!tree)
+		return;
+
+	arena_free(&tree->arena);
+	free(tree);
+}
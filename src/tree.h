@@ -0,0 +1,159 @@
+/*
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef UPSKIRT_TREE_H
+#define UPSKIRT_TREE_H
+
+#include "markdown.h"
+#include "buffer.h"
+#include "arena.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* one node type per callback, named after it */
+enum sd_node_type {
+	SD_NODE_DOCUMENT,
+	SD_NODE_BLOCKCODE,
+	SD_NODE_BLOCKQUOTE,
+	SD_NODE_BLOCKHTML,
+	SD_NODE_HEADER,
+	SD_NODE_HRULE,
+	SD_NODE_LIST,
+	SD_NODE_LISTITEM,
+	SD_NODE_PARAGRAPH,
+	SD_NODE_TABLE,
+	SD_NODE_TABLE_ROW,
+	SD_NODE_TABLE_CELL,
+	SD_NODE_AUTOLINK,
+	SD_NODE_CODESPAN,
+	SD_NODE_DOUBLE_EMPHASIS,
+	SD_NODE_EMPHASIS,
+	SD_NODE_IMAGE,
+	SD_NODE_LINEBREAK,
+	SD_NODE_LINK,
+	SD_NODE_RAW_HTML,
+	SD_NODE_TRIPLE_EMPHASIS,
+	SD_NODE_STRIKETHROUGH,
+	SD_NODE_SUPERSCRIPT,
+	SD_NODE_ENTITY,
+	SD_NODE_TEXT
+};
+
+/* a string that was a NULL buffer */
+#define SD_TREE_NONE 0xFFFFFFFFu
+
+/* sd_node • what a callback was called with. `flags` holds the flags,
+ * header level or autolink type of the call, and the number of header
+ * rows of a table. `text` is the code, HTML, link or text; `extra` the
+ * language or title; both are offsets into the string pool. An image's
+ * alt text is its only child, a TEXT node; a table's children are its
+ * header rows, then its body rows */
+struct sd_node {
+	uint32_t type;
+	uint32_t flags;
+	uint32_t child, child_count;	/* range in `children` */
+	uint32_t text, text_size;
+	uint32_t extra, extra_size;
+};
+
+/* sd_tree • a parsed document, in a few flat arrays: the root is the
+ * first node, and everything lives in an arena freed at once */
+struct sd_tree {
+	struct sd_node *nodes;
+	size_t node_count, node_asize;
+	uint32_t *children;
+	size_t child_count, child_asize;
+	struct buf *strings;
+	struct arena arena;
+	int failed;	/* an allocation failed while parsing */
+};
+
+/* sd_tree_data • the arrays of a tree, in memory or saved */
+struct sd_tree_data {
+	const struct sd_node *nodes;
+	size_t node_count;
+	const uint32_t *children;
+	size_t child_count;
+	const uint8_t *strings;
+	size_t strings_size;
+};
+
+/* version of the format sdtree_save writes */
+#define SD_TREE_VERSION 1
+
+/* deepest tree sdtree_load takes */
+#define SD_TREE_MAX_DEPTH 1024
+
+extern struct sd_tree *
+sdtree_new(void);
+
+/* sdtree_recorder • callbacks building the tree given as their opaque
+ * data, for sdtree_parse */
+extern void
+sdtree_recorder(struct sd_callbacks *callbacks);
+
+/* sdtree_parse • replaces the tree with the document parsed by `md`,
+ * a parser made with sdtree_recorder callbacks and the tree */
+extern int
+sdtree_parse(struct sd_tree *tree, const uint8_t *document, size_t doc_size, struct sd_markdown *md);
+
+/* sdtree_render • calls the callbacks the parser would have called,
+ * in the same order; spans the callbacks turn down print their
+ * content or their text */
+extern void
+sdtree_render(struct buf *ob, const struct sd_tree *tree, const struct sd_callbacks *callbacks, void *opaque);
+
+/* sdtree_render_data • sdtree_render, for a tree in any form */
+extern void
+sdtree_render_data(struct buf *ob, const struct sd_tree_data *tree, const struct sd_callbacks *callbacks, void *opaque);
+
+/* sdtree_text • the text of the document, without any markup */
+extern void
+sdtree_text(struct buf *ob, const struct sd_tree *tree);
+
+extern void
+sdtree_text_data(struct buf *ob, const struct sd_tree_data *tree);
+
+/* sdtree_data • the arrays of a tree in memory, valid until it changes */
+extern void
+sdtree_data(struct sd_tree_data *data, const struct sd_tree *tree);
+
+/* sdtree_save • appends the tree to `ob` in a form sdtree_load reads in
+ * place: a header, then the arrays as they are in memory */
+extern int
+sdtree_save(struct buf *ob, const struct sd_tree_data *tree);
+
+/* sdtree_load • checks that `size` bytes at `data` (aligned on 4 bytes,
+ * for instance mapped from a file) hold a tree saved by this version on a
+ * machine with the same byte order, and points `tree` at its arrays
+ * there; -1 if they don't. Whatever the bytes, rendering the tree then
+ * stays within them, and only passes callbacks flags, header levels and
+ * autolink types the parser could have given them */
+extern int
+sdtree_load(struct sd_tree_data *tree, const void *data, size_t size);
+
+/* sdtree_retained • bytes the tree takes */
+extern size_t
+sdtree_retained(const struct sd_tree *tree);
+
+extern void
+sdtree_free(struct sd_tree *tree);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif